@@ -1081,6 +1081,28 @@ int drm_gem_mmap_obj(struct drm_gem_object *obj, unsigned long obj_size,
 }
 EXPORT_SYMBOL(drm_gem_mmap_obj);
 
+/**
+ * drm_gem_vma_node_get - reference the GEM object of a VMA offset node
+ * @node: VMA offset node embedded in a GEM object
+ *
+ * Lookup callback for drm_vma_offset_lookup_get(). When the object is being
+ * freed, after it hits 0-refcnt it proceeds to tear down the object, which
+ * removes the VMA offset. Therefore if we find an object with a 0-refcnt that
+ * matches our range, we know it is in the process of being destroyed and
+ * must treat it as invalid.
+ *
+ * Returns:
+ * True if a reference to the object was taken, false otherwise.
+ */
+bool drm_gem_vma_node_get(struct drm_vma_offset_node *node)
+{
+	struct drm_gem_object *obj = container_of(node, struct drm_gem_object,
+						  vma_node);
+
+	return kref_get_unless_zero(&obj->refcount);
+}
+EXPORT_SYMBOL(drm_gem_vma_node_get);
+
 /**
  * drm_gem_mmap - memory map routine for GEM objects
  * @filp: DRM file pointer
@@ -1107,26 +1129,11 @@ int drm_gem_mmap(struct file *filp, struct vm_area_struct *vma)
 	if (drm_dev_is_unplugged(dev))
 		return -ENODEV;
 
-	drm_vma_offset_lock_lookup(dev->vma_offset_manager);
-	node = drm_vma_offset_exact_lookup_locked(dev->vma_offset_manager,
-						  vma->vm_pgoff,
-						  vma_pages(vma));
-	if (likely(node)) {
+	node = drm_vma_offset_lookup_get(dev->vma_offset_manager,
+					 vma->vm_pgoff, vma_pages(vma),
+					 drm_gem_vma_node_get);
+	if (likely(node))
 		obj = container_of(node, struct drm_gem_object, vma_node);
-		/*
-		 * When the object is being freed, after it hits 0-refcnt it
-		 * proceeds to tear down the object. In the process it will
-		 * attempt to remove the VMA offset and so acquire this
-		 * mgr->vm_lock.  Therefore if we find an object with a 0-refcnt
-		 * that matches our range, we know it is in the process of being
-		 * destroyed and will be freed as soon as we release the lock -
-		 * so we have to check for the 0-refcnted object and treat it as
-		 * invalid.
-		 */
-		if (!kref_get_unless_zero(&obj->refcount))
-			obj = NULL;
-	}
-	drm_vma_offset_unlock_lookup(dev->vma_offset_manager);
 
 	if (!obj)
 		return -EINVAL;
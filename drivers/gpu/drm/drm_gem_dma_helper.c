@@ -352,27 +352,10 @@ unsigned long drm_gem_dma_get_unmapped_area(struct file *filp,
 	if (drm_dev_is_unplugged(dev))
 		return -ENODEV;
 
-	drm_vma_offset_lock_lookup(dev->vma_offset_manager);
-	node = drm_vma_offset_exact_lookup_locked(dev->vma_offset_manager,
-						  pgoff,
-						  len >> PAGE_SHIFT);
-	if (likely(node)) {
+	node = drm_vma_offset_lookup_get(dev->vma_offset_manager, pgoff,
+					 len >> PAGE_SHIFT, drm_gem_vma_node_get);
+	if (likely(node))
 		obj = container_of(node, struct drm_gem_object, vma_node);
-		/*
-		 * When the object is being freed, after it hits 0-refcnt it
-		 * proceeds to tear down the object. In the process it will
-		 * attempt to remove the VMA offset and so acquire this
-		 * mgr->vm_lock.  Therefore if we find an object with a 0-refcnt
-		 * that matches our range, we know it is in the process of being
-		 * destroyed and will be freed as soon as we release the lock -
-		 * so we have to check for the 0-refcnted object and treat it as
-		 * invalid.
-		 */
-		if (!kref_get_unless_zero(&obj->refcount))
-			obj = NULL;
-	}
-
-	drm_vma_offset_unlock_lookup(dev->vma_offset_manager);
 
 	if (!obj)
 		return -EINVAL;
@@ -23,9 +23,12 @@
  * OTHER DEALINGS IN THE SOFTWARE.
  */
 
+#include <linux/delay.h>
 #include <linux/mm.h>
 #include <linux/module.h>
 #include <linux/rbtree.h>
+#include <linux/rcupdate.h>
+#include <linux/rhashtable.h>
 #include <linux/slab.h>
 #include <linux/spinlock.h>
 #include <linux/types.h>
@@ -48,6 +51,11 @@
  * optimized for alloc/free calls, not lookups. Hence, we use an rb-tree to
  * speed up offset lookups.
  *
+ * The mmap() path only ever looks up nodes by their exact start address, so
+ * every allocated node is also published in a hash table keyed by that
+ * address. drm_vma_offset_lookup_get() walks it under RCU and does not touch
+ * the manager lock, which is only taken to add and remove nodes.
+ *
  * You must not use multiple offset managers on a single address_space.
  * Otherwise, mm-core will be unable to tear down memory mappings as the VM will
  * no longer be linear.
@@ -82,11 +90,34 @@
  * for the caller. While calling into the vma-manager, a given node must
  * always be guaranteed to be referenced.
  */
+/*
+ * Hash table entry of an allocated node. Entries are freed after an RCU grace
+ * period, but the node they point to is owned by the driver and may be freed
+ * as soon as drm_vma_offset_remove() returns: @vm_node is cleared under
+ * @vm_lock on removal, and lookups only dereference it under @vm_lock.
+ */
+struct drm_vma_offset_entry {
+	struct rhash_head vm_hash;
+	unsigned long vm_start;
+	spinlock_t vm_lock;
+	struct drm_vma_offset_node *vm_node;
+	struct rcu_head vm_rcu;
+};
+
+static const struct rhashtable_params drm_vma_offset_hash_params = {
+	.key_len = sizeof_field(struct drm_vma_offset_entry, vm_start),
+	.key_offset = offsetof(struct drm_vma_offset_entry, vm_start),
+	.head_offset = offsetof(struct drm_vma_offset_entry, vm_hash),
+	.automatic_shrinking = true,
+};
+
 void drm_vma_offset_manager_init(struct drm_vma_offset_manager *mgr,
 				 unsigned long page_offset, unsigned long size)
 {
 	rwlock_init(&mgr->vm_lock);
 	drm_mm_init(&mgr->vm_addr_space_mm, page_offset, size);
+	/* falls back to a minimal __GFP_NOFAIL table, cannot fail */
+	WARN_ON(rhashtable_init(&mgr->vm_hash, &drm_vma_offset_hash_params));
 }
 EXPORT_SYMBOL(drm_vma_offset_manager_init);
 
@@ -103,6 +134,7 @@ EXPORT_SYMBOL(drm_vma_offset_manager_init);
  */
 void drm_vma_offset_manager_destroy(struct drm_vma_offset_manager *mgr)
 {
+	rhashtable_destroy(&mgr->vm_hash);
 	drm_mm_takedown(&mgr->vm_addr_space_mm);
 }
 EXPORT_SYMBOL(drm_vma_offset_manager_destroy);
@@ -175,6 +207,106 @@ struct drm_vma_offset_node *drm_vma_offset_lookup_locked(struct drm_vma_offset_m
 }
 EXPORT_SYMBOL(drm_vma_offset_lookup_locked);
 
+/**
+ * drm_vma_offset_lookup_get() - Look up node by exact address and reference it
+ * @mgr: Manager object
+ * @start: Start address (page-based, not byte-based)
+ * @pages: Size of object (page-based)
+ * @get: Callback taking a reference to the object embedding the node
+ *
+ * Same as drm_vma_offset_exact_lookup_locked(), but without taking the manager
+ * lock. The lookup runs under RCU and @get is called on the node found, which
+ * cannot be removed from the manager until @get returns. @get must not sleep,
+ * and returns false if the object is already being destroyed. This usually
+ * boils down to kref_get_unless_zero():
+ *
+ * ::
+ *
+ *     static bool sth_get(struct drm_vma_offset_node *node)
+ *     {
+ *         return kref_get_unless_zero(&container_of(node, sth, entr)->ref);
+ *     }
+ *
+ *     node = drm_vma_offset_lookup_get(mgr, start, pages, sth_get);
+ *
+ * RETURNS:
+ * Node at exact start address @start that spans at least @pages, for which
+ * @get returned true. NULL otherwise.
+ */
+struct drm_vma_offset_node *
+drm_vma_offset_lookup_get(struct drm_vma_offset_manager *mgr,
+			  unsigned long start, unsigned long pages,
+			  bool (*get)(struct drm_vma_offset_node *node))
+{
+	struct drm_vma_offset_node *node = NULL;
+	struct drm_vma_offset_entry *entry;
+
+	rcu_read_lock();
+	entry = rhashtable_lookup(&mgr->vm_hash, &start,
+				  drm_vma_offset_hash_params);
+	if (entry) {
+		spin_lock(&entry->vm_lock);
+		node = entry->vm_node;
+		if (node && (drm_vma_node_size(node) < pages || !get(node)))
+			node = NULL;
+		spin_unlock(&entry->vm_lock);
+	}
+	rcu_read_unlock();
+
+	return node;
+}
+EXPORT_SYMBOL(drm_vma_offset_lookup_get);
+
+/* Attempts to hash a node once the table has to resize, see below */
+#define DRM_VMA_HASH_INSERT_TRIES	10
+
+/*
+ * rhashtable_insert_fast() fails with -EBUSY or -ENOMEM when the table has to
+ * be resized first, which its deferred worker does and GFP_ATOMIC may not.
+ * Retry without holding the manager's write lock meanwhile; until then, only
+ * drm_vma_offset_lookup_get() misses the node. The entry is owned by the node
+ * as soon as @node->vm_entry points to it, so a concurrent
+ * drm_vma_offset_remove() frees it and ends the retries.
+ */
+static int drm_vma_offset_insert_retry(struct drm_vma_offset_manager *mgr,
+				       struct drm_vma_offset_node *node,
+				       struct drm_vma_offset_entry *entry)
+{
+	int ret = -EBUSY, tries;
+
+	for (tries = 0; tries < DRM_VMA_HASH_INSERT_TRIES; tries++) {
+		msleep(1);
+
+		read_lock(&mgr->vm_lock);
+		if (node->vm_entry != entry) {
+			read_unlock(&mgr->vm_lock);
+			return 0;
+		}
+		ret = rhashtable_insert_fast(&mgr->vm_hash, &entry->vm_hash,
+					     drm_vma_offset_hash_params);
+		read_unlock(&mgr->vm_lock);
+
+		if (ret != -EBUSY && ret != -ENOMEM)
+			break;
+	}
+	if (!ret)
+		return 0;
+
+	write_lock(&mgr->vm_lock);
+	if (node->vm_entry == entry) {
+		drm_mm_remove_node(&node->vm_node);
+		memset(&node->vm_node, 0, sizeof(node->vm_node));
+		node->vm_entry = NULL;
+	} else {
+		entry = NULL;
+	}
+	write_unlock(&mgr->vm_lock);
+
+	kfree(entry);
+
+	return ret;
+}
+
 /**
  * drm_vma_offset_add() - Add offset node to manager
  * @mgr: Manager object
@@ -191,6 +323,9 @@ EXPORT_SYMBOL(drm_vma_offset_lookup_locked);
  * drm_vma_offset_remove(), anyway. However, no cleanup is required in that
  * case.
  *
+ * This call may sleep. A concurrent call for the same node can return before
+ * drm_vma_offset_lookup_get() finds the node.
+ *
  * @pages is not required to be the same size as the underlying memory object
  * that you want to map. It only limits the size that user-space can map into
  * their address space.
@@ -201,16 +336,49 @@ EXPORT_SYMBOL(drm_vma_offset_lookup_locked);
 int drm_vma_offset_add(struct drm_vma_offset_manager *mgr,
 		       struct drm_vma_offset_node *node, unsigned long pages)
 {
+	struct drm_vma_offset_entry *entry;
 	int ret = 0;
 
+	/* Preallocate the hash entry to avoid atomic allocations below. It is
+	 * freed again if the node turns out to be allocated already. */
+	entry = kmalloc(sizeof(*entry), GFP_KERNEL);
+	if (!entry)
+		return -ENOMEM;
+
 	write_lock(&mgr->vm_lock);
 
-	if (!drm_mm_node_allocated(&node->vm_node))
-		ret = drm_mm_insert_node(&mgr->vm_addr_space_mm,
-					 &node->vm_node, pages);
+	if (drm_mm_node_allocated(&node->vm_node))
+		goto unlock;
+
+	ret = drm_mm_insert_node(&mgr->vm_addr_space_mm, &node->vm_node, pages);
+	if (ret)
+		goto unlock;
+
+	entry->vm_start = node->vm_node.start;
+	spin_lock_init(&entry->vm_lock);
+	entry->vm_node = node;
+
+	ret = rhashtable_insert_fast(&mgr->vm_hash, &entry->vm_hash,
+				     drm_vma_offset_hash_params);
+	if (ret == -EBUSY || ret == -ENOMEM) {
+		node->vm_entry = entry;
+		write_unlock(&mgr->vm_lock);
+		return drm_vma_offset_insert_retry(mgr, node, entry);
+	}
+	if (ret) {
+		drm_mm_remove_node(&node->vm_node);
+		memset(&node->vm_node, 0, sizeof(node->vm_node));
+		goto unlock;
+	}
 
+	node->vm_entry = entry;
+	entry = NULL;
+
+unlock:
 	write_unlock(&mgr->vm_lock);
 
+	kfree(entry);
+
 	return ret;
 }
 EXPORT_SYMBOL(drm_vma_offset_add);
@@ -225,13 +393,30 @@ EXPORT_SYMBOL(drm_vma_offset_add);
  * new offset is allocated via drm_vma_offset_add() again. Helper functions like
  * drm_vma_node_start() and drm_vma_node_offset_addr() will return 0 if no
  * offset is allocated.
+ *
+ * Concurrent drm_vma_offset_lookup_get() calls that found the node are done
+ * with it when this returns, so the node can be freed without waiting for an
+ * RCU grace period.
  */
 void drm_vma_offset_remove(struct drm_vma_offset_manager *mgr,
 			   struct drm_vma_offset_node *node)
 {
+	struct drm_vma_offset_entry *entry;
+
 	write_lock(&mgr->vm_lock);
 
 	if (drm_mm_node_allocated(&node->vm_node)) {
+		entry = node->vm_entry;
+		rhashtable_remove_fast(&mgr->vm_hash, &entry->vm_hash,
+				       drm_vma_offset_hash_params);
+
+		/* wait for lookups still referencing the node */
+		spin_lock(&entry->vm_lock);
+		entry->vm_node = NULL;
+		spin_unlock(&entry->vm_lock);
+		kfree_rcu(entry, vm_rcu);
+		node->vm_entry = NULL;
+
 		drm_mm_remove_node(&node->vm_node);
 		memset(&node->vm_node, 0, sizeof(node->vm_node));
 	}
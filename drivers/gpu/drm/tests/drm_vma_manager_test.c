@@ -0,0 +1,220 @@
+// SPDX-License-Identifier: GPL-2.0 OR MIT
+/*
+ * KUnit tests for the lockless lookups of the VMA offset manager: exact
+ * lookups through drm_vma_offset_lookup_get(), and lookups racing with nodes
+ * being added and removed, with objects freed as soon as their node is gone.
+ */
+
+#include <kunit/test.h>
+
+#include <linux/cpumask.h>
+#include <linux/kref.h>
+#include <linux/kthread.h>
+#include <linux/module.h>
+#include <linux/random.h>
+#include <linux/slab.h>
+
+#include <drm/drm_vma_manager.h>
+
+#define VMA_TEST_START		0x1000
+#define VMA_TEST_SIZE		0x100000
+#define VMA_TEST_SLOTS		64
+#define VMA_TEST_ITERATIONS	100000
+#define VMA_TEST_MAX_THREADS	4
+
+struct vma_test_obj {
+	struct kref ref;
+	struct drm_vma_offset_manager *mgr;
+	struct drm_vma_offset_node node;
+};
+
+static void vma_test_obj_release(struct kref *ref)
+{
+	struct vma_test_obj *obj = container_of(ref, struct vma_test_obj, ref);
+
+	drm_vma_offset_remove(obj->mgr, &obj->node);
+	kfree(obj);
+}
+
+static void vma_test_obj_put(struct vma_test_obj *obj)
+{
+	kref_put(&obj->ref, vma_test_obj_release);
+}
+
+static bool vma_test_obj_get(struct drm_vma_offset_node *node)
+{
+	struct vma_test_obj *obj = container_of(node, struct vma_test_obj, node);
+
+	return kref_get_unless_zero(&obj->ref);
+}
+
+static struct vma_test_obj *vma_test_obj_create(struct drm_vma_offset_manager *mgr,
+						unsigned long pages)
+{
+	struct vma_test_obj *obj;
+
+	obj = kzalloc(sizeof(*obj), GFP_KERNEL);
+	if (!obj)
+		return NULL;
+
+	kref_init(&obj->ref);
+	obj->mgr = mgr;
+	drm_vma_node_reset(&obj->node);
+
+	if (drm_vma_offset_add(mgr, &obj->node, pages)) {
+		kfree(obj);
+		return NULL;
+	}
+
+	return obj;
+}
+
+static void drm_test_vma_lookup_get(struct kunit *test)
+{
+	struct drm_vma_offset_manager *mgr;
+	struct drm_vma_offset_node *node;
+	struct vma_test_obj *obj;
+	unsigned long start;
+
+	mgr = kunit_kzalloc(test, sizeof(*mgr), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, mgr);
+	drm_vma_offset_manager_init(mgr, VMA_TEST_START, VMA_TEST_SIZE);
+
+	obj = vma_test_obj_create(mgr, 4);
+	KUNIT_ASSERT_NOT_NULL(test, obj);
+	start = drm_vma_node_start(&obj->node);
+
+	node = drm_vma_offset_lookup_get(mgr, start, 4, vma_test_obj_get);
+	KUNIT_EXPECT_PTR_EQ(test, node, &obj->node);
+	KUNIT_EXPECT_EQ(test, kref_read(&obj->ref), 2);
+	if (node)
+		vma_test_obj_put(obj);
+
+	/* too large, or not at the start of the node */
+	KUNIT_EXPECT_NULL(test, drm_vma_offset_lookup_get(mgr, start, 5,
+							  vma_test_obj_get));
+	KUNIT_EXPECT_NULL(test, drm_vma_offset_lookup_get(mgr, start + 1, 1,
+							  vma_test_obj_get));
+	KUNIT_EXPECT_EQ(test, kref_read(&obj->ref), 1);
+
+	/* a dead object is not returned, even while its node is allocated */
+	refcount_set(&obj->ref.refcount, 0);
+	KUNIT_EXPECT_NULL(test, drm_vma_offset_lookup_get(mgr, start, 1,
+							  vma_test_obj_get));
+	kref_init(&obj->ref);
+
+	vma_test_obj_put(obj);
+	KUNIT_EXPECT_NULL(test, drm_vma_offset_lookup_get(mgr, start, 1,
+							  vma_test_obj_get));
+
+	KUNIT_EXPECT_TRUE(test, drm_mm_clean(&mgr->vm_addr_space_mm));
+	drm_vma_offset_manager_destroy(mgr);
+}
+
+struct vma_test_stress {
+	struct drm_vma_offset_manager mgr;
+	unsigned long starts[VMA_TEST_SLOTS];
+	atomic_long_t hits;
+	atomic_t errors;
+};
+
+static int vma_test_lookup_thread(void *data)
+{
+	struct vma_test_stress *st = data;
+	struct drm_vma_offset_node *node;
+	unsigned long start;
+
+	while (!kthread_should_stop()) {
+		start = READ_ONCE(st->starts[get_random_u32_below(VMA_TEST_SLOTS)]);
+
+		node = drm_vma_offset_lookup_get(&st->mgr, start, 1,
+						 vma_test_obj_get);
+		if (node) {
+			if (drm_vma_node_start(node) != start)
+				atomic_inc(&st->errors);
+			atomic_long_inc(&st->hits);
+
+			/* may drop the last reference and free the object */
+			vma_test_obj_put(container_of(node, struct vma_test_obj,
+						      node));
+		}
+
+		cond_resched();
+	}
+
+	return 0;
+}
+
+static void drm_test_vma_lookup_stress(struct kunit *test)
+{
+	struct task_struct *threads[VMA_TEST_MAX_THREADS];
+	struct vma_test_obj *objs[VMA_TEST_SLOTS] = {};
+	unsigned int nr_threads, i, slot;
+	struct vma_test_stress *st;
+	struct vma_test_obj *obj;
+
+	st = kunit_kzalloc(test, sizeof(*st), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, st);
+	drm_vma_offset_manager_init(&st->mgr, VMA_TEST_START, VMA_TEST_SIZE);
+
+	nr_threads = clamp(num_online_cpus(), 2U, VMA_TEST_MAX_THREADS);
+	for (i = 0; i < nr_threads; i++) {
+		threads[i] = kthread_run(vma_test_lookup_thread, st,
+					 "drm_vma_test/%u", i);
+		if (IS_ERR(threads[i])) {
+			KUNIT_FAIL(test, "kthread_run() failed: %pe", threads[i]);
+			nr_threads = i;
+			break;
+		}
+	}
+
+	/* replace the objects of the slots while the threads look them up */
+	for (i = 0; i < VMA_TEST_ITERATIONS; i++) {
+		slot = i % VMA_TEST_SLOTS;
+
+		obj = vma_test_obj_create(&st->mgr,
+					  1 + get_random_u32_below(4));
+		if (!obj) {
+			KUNIT_FAIL(test, "failed to add node %u", i);
+			break;
+		}
+
+		WRITE_ONCE(st->starts[slot], drm_vma_node_start(&obj->node));
+		if (objs[slot])
+			vma_test_obj_put(objs[slot]);
+		objs[slot] = obj;
+
+		cond_resched();
+	}
+
+	for (i = 0; i < nr_threads; i++)
+		kthread_stop(threads[i]);
+
+	for (slot = 0; slot < VMA_TEST_SLOTS; slot++) {
+		if (objs[slot])
+			vma_test_obj_put(objs[slot]);
+	}
+
+	KUNIT_EXPECT_EQ(test, atomic_read(&st->errors), 0);
+	KUNIT_EXPECT_GT(test, atomic_long_read(&st->hits), 0);
+	KUNIT_EXPECT_TRUE(test, drm_mm_clean(&st->mgr.vm_addr_space_mm));
+	drm_vma_offset_manager_destroy(&st->mgr);
+
+	kunit_info(test, "%u threads, %ld successful lookups\n", nr_threads,
+		   atomic_long_read(&st->hits));
+}
+
+static struct kunit_case drm_vma_manager_tests[] = {
+	KUNIT_CASE(drm_test_vma_lookup_get),
+	KUNIT_CASE_SLOW(drm_test_vma_lookup_stress),
+	{}
+};
+
+static struct kunit_suite drm_vma_manager_test_suite = {
+	.name = "drm_vma_manager",
+	.test_cases = drm_vma_manager_tests,
+};
+
+kunit_test_suite(drm_vma_manager_test_suite);
+
+MODULE_LICENSE("GPL");
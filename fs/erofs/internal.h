@@ -18,6 +18,7 @@
 #include <linux/slab.h>
 #include <linux/vmalloc.h>
 #include <linux/iomap.h>
+#include <linux/maple_tree.h>
 #include "erofs_fs.h"
 
 /* redefine pr_fmt "erofs: " */
@@ -257,6 +258,7 @@ EROFS_FEATURE_FUNCS(xattr_filter, compat, COMPAT_XATTR_FILTER)
 /* atomic flag definitions */
 #define EROFS_I_EA_INITED_BIT	0
 #define EROFS_I_Z_INITED_BIT	1
+#define EROFS_I_Z_EXTENT_REF_BIT	2
 
 /* bitlock definitions (arranged in reverse order) */
 #define EROFS_I_BL_XATTR_BIT	(BITS_PER_LONG - 1)
@@ -298,6 +300,13 @@ struct erofs_inode {
 		};
 #endif	/* CONFIG_EROFS_FS_ZIP */
 	};
+#ifdef CONFIG_EROFS_FS_ZIP
+	/* decoded extents of compressed inodes, indexed by logical offset */
+	struct maple_tree z_extents;
+	/* on the extent cache LRU, protected by its lock */
+	struct list_head z_extents_lru;
+	unsigned int z_nr_extents;
+#endif
 	/* the corresponding vfs inode */
 	struct inode vfs_inode;
 };
@@ -470,6 +479,10 @@ int erofs_try_to_free_all_cached_folios(struct erofs_sb_info *sbi,
 					struct erofs_workgroup *egrp);
 int z_erofs_map_blocks_iter(struct inode *inode, struct erofs_map_blocks *map,
 			    int flags);
+void z_erofs_init_extent_cache(struct erofs_inode *vi);
+void z_erofs_drop_extent_cache(struct erofs_inode *vi);
+int __init z_erofs_init_extent_shrinker(void);
+void z_erofs_exit_extent_shrinker(void);
 void *erofs_get_pcpubuf(unsigned int requiredpages);
 void erofs_put_pcpubuf(void *ptr);
 int erofs_pcpubuf_growsize(unsigned int nrpages);
@@ -486,6 +499,8 @@ static inline int z_erofs_init_zip_subsystem(void) { return 0; }
 static inline void z_erofs_exit_zip_subsystem(void) {}
 static inline void erofs_pcpubuf_init(void) {}
 static inline void erofs_pcpubuf_exit(void) {}
+static inline void z_erofs_init_extent_cache(struct erofs_inode *vi) {}
+static inline void z_erofs_drop_extent_cache(struct erofs_inode *vi) {}
 static inline int erofs_init_managed_cache(struct super_block *sb) { return 0; }
 #endif	/* !CONFIG_EROFS_FS_ZIP */
 
@@ -451,6 +451,7 @@ static inline void erofs_cpu_hotplug_destroy(void) {}
 
 void z_erofs_exit_zip_subsystem(void)
 {
+	z_erofs_exit_extent_shrinker();
 	erofs_cpu_hotplug_destroy();
 	erofs_destroy_percpu_workers();
 	destroy_workqueue(z_erofs_workqueue);
@@ -478,8 +479,14 @@ int __init z_erofs_init_zip_subsystem(void)
 	err = erofs_cpu_hotplug_init();
 	if (err < 0)
 		goto out_error_cpuhp_init;
+
+	err = z_erofs_init_extent_shrinker();
+	if (err)
+		goto out_error_extent_shrinker;
 	return err;
 
+out_error_extent_shrinker:
+	erofs_cpu_hotplug_destroy();
 out_error_cpuhp_init:
 	erofs_destroy_percpu_workers();
 out_error_pcpu_worker:
@@ -692,6 +692,255 @@ static int z_erofs_fill_inode_lazy(struct inode *inode)
 	return err;
 }
 
+/*
+ * Decoded extents of compressed inodes, so that random reads do not decode the
+ * same lcluster indexes again on every map.  A record starts at the head of an
+ * extent and holds what z_erofs_do_map_blocks() reported for it, except for
+ * EROFS_MAP_FULL_MAPPED, which depends on the map request.  Unless the decode
+ * found where the extent ends, the record only covers it up to the end of the
+ * lcluster that was decoded, and later decodes further in the extent extend
+ * it.  Inodes with cached extents are on a global LRU, emptied inode by inode
+ * under memory pressure.
+ */
+struct z_erofs_extent {
+	erofs_off_t la, pa;
+	u64 llen, plen;
+	unsigned int flags;
+	char algorithmformat;
+	/* @llen is the length of the whole extent */
+	bool end_known;
+	struct rcu_head rcu;
+};
+
+static DEFINE_SPINLOCK(z_erofs_extent_lru_lock);
+static LIST_HEAD(z_erofs_extent_lru);
+static atomic_long_t z_erofs_nr_extents;
+
+void z_erofs_init_extent_cache(struct erofs_inode *vi)
+{
+	mt_init_flags(&vi->z_extents, MT_FLAGS_USE_RCU);
+	INIT_LIST_HEAD(&vi->z_extents_lru);
+}
+
+/*
+ * Report the cached extent of @map->m_la as if it was decoded with @flags:
+ * mapped up to the end of the lcluster of @map->m_la, unless the next head is
+ * in that lcluster or the whole extent is asked for.  The latter two need a
+ * record whose end is known.
+ */
+static bool z_erofs_extent_cache_lookup(struct inode *inode,
+					struct erofs_map_blocks *map, int flags)
+{
+	struct erofs_inode *const vi = EROFS_I(inode);
+	unsigned int lclusterbits = vi->z_logical_clusterbits;
+	erofs_off_t ofs = map->m_la, end, extent_end;
+	struct z_erofs_extent *ext, rec;
+	bool full;
+
+	if (ofs > ULONG_MAX)
+		return false;
+
+	rcu_read_lock();
+	ext = mtree_load(&vi->z_extents, ofs);
+	if (ext)
+		rec = *ext;
+	rcu_read_unlock();
+	if (!ext)
+		return false;
+
+	if (!test_bit(EROFS_I_Z_EXTENT_REF_BIT, &vi->flags))
+		set_bit(EROFS_I_Z_EXTENT_REF_BIT, &vi->flags);
+
+	full = (flags & EROFS_GET_BLOCKS_FIEMAP) ||
+		((flags & EROFS_GET_BLOCKS_READMORE) &&
+		 (rec.algorithmformat == Z_EROFS_COMPRESSION_LZMA ||
+		  rec.algorithmformat == Z_EROFS_COMPRESSION_DEFLATE) &&
+		 rec.llen >= i_blocksize(inode));
+	if (full && !rec.end_known)
+		return false;
+
+	map->m_la = rec.la;
+	map->m_llen = rec.llen;
+	map->m_pa = rec.pa;
+	map->m_plen = rec.plen;
+	map->m_flags = rec.flags;
+	map->m_algorithmformat = rec.algorithmformat;
+
+	extent_end = rec.la + rec.llen;
+	end = ((ofs >> lclusterbits) + 1) << lclusterbits;
+	if (rec.end_known && extent_end < end && extent_end < inode->i_size) {
+		/* the next head lcluster is the one of @ofs, see lookback */
+		map->m_flags |= EROFS_MAP_FULL_MAPPED;
+		return true;
+	}
+
+	if ((vi->z_advise & Z_EROFS_ADVISE_INLINE_PCLUSTER) &&
+	    (ofs >> lclusterbits) == (rec.la >> lclusterbits) &&
+	    end > inode->i_size)
+		end = inode->i_size;
+	map->m_llen = end - rec.la;
+
+	if (full) {
+		map->m_llen = extent_end - rec.la;
+		map->m_flags |= EROFS_MAP_FULL_MAPPED;
+	}
+	return true;
+}
+
+/*
+ * Cache what z_erofs_do_map_blocks() decoded of the extent: all of it if it
+ * found where the extent ends, or else up to the end of the map.  A record
+ * covering less of the extent is replaced.  Whether the caller gets
+ * EROFS_MAP_FULL_MAPPED is decided again on every lookup.
+ */
+static void z_erofs_extent_cache_insert(struct inode *inode,
+					const struct erofs_map_blocks *map)
+{
+	struct erofs_inode *const vi = EROFS_I(inode);
+	erofs_off_t last = map->m_la + map->m_llen - 1;
+	struct z_erofs_extent *ext, *old;
+	MA_STATE(mas, &vi->z_extents, map->m_la, last);
+
+	/* offsets the tree can index only */
+	if (!map->m_llen || last > ULONG_MAX)
+		return;
+
+	ext = kmalloc(sizeof(*ext), GFP_NOFS | __GFP_NOWARN);
+	if (!ext)
+		return;
+
+	ext->la = map->m_la;
+	ext->llen = map->m_llen;
+	ext->pa = map->m_pa;
+	ext->plen = map->m_plen;
+	ext->flags = map->m_flags & ~EROFS_MAP_FULL_MAPPED;
+	ext->algorithmformat = map->m_algorithmformat;
+	ext->end_known = map->m_flags & EROFS_MAP_FULL_MAPPED;
+
+	/*
+	 * Under the LRU lock, so that the shrinker cannot free the inode's
+	 * records between the store and its accounting.
+	 */
+	spin_lock(&z_erofs_extent_lru_lock);
+	mas_lock(&mas);
+	old = mas_find(&mas, last);
+	if (old) {
+		/*
+		 * Keep a record that covers as much, or was stored by a
+		 * concurrent map of the same extent, and never overwrite
+		 * records of other extents.
+		 */
+		if (old->la != ext->la || old->end_known ||
+		    old->llen > ext->llen ||
+		    (old->llen == ext->llen && !ext->end_known) ||
+		    mas_find(&mas, last))
+			goto out_unlock;
+	}
+	mas_set_range(&mas, ext->la, last);
+	if (mas_store_gfp(&mas, ext, GFP_NOWAIT | __GFP_NOWARN))
+		goto out_unlock;
+	mas_unlock(&mas);
+
+	if (old) {
+		kfree_rcu(old, rcu);
+	} else {
+		if (list_empty(&vi->z_extents_lru))
+			list_add_tail(&vi->z_extents_lru, &z_erofs_extent_lru);
+		vi->z_nr_extents++;
+		atomic_long_inc(&z_erofs_nr_extents);
+	}
+	spin_unlock(&z_erofs_extent_lru_lock);
+	return;
+
+out_unlock:
+	mas_unlock(&mas);
+	spin_unlock(&z_erofs_extent_lru_lock);
+	kfree(ext);
+}
+
+/* Free all cached extents of an inode, returns how many were accounted */
+static unsigned long z_erofs_extent_cache_free(struct erofs_inode *vi)
+{
+	MA_STATE(mas, &vi->z_extents, 0, 0);
+	unsigned long nr = vi->z_nr_extents;
+	struct z_erofs_extent *ext;
+
+	lockdep_assert_held(&z_erofs_extent_lru_lock);
+
+	list_del_init(&vi->z_extents_lru);
+	vi->z_nr_extents = 0;
+	atomic_long_sub(nr, &z_erofs_nr_extents);
+
+	/* lockless lookups may still be using the records */
+	mtree_lock(&vi->z_extents);
+	mas_for_each(&mas, ext, ULONG_MAX)
+		kfree_rcu(ext, rcu);
+	__mt_destroy(&vi->z_extents);
+	mtree_unlock(&vi->z_extents);
+	return nr;
+}
+
+void z_erofs_drop_extent_cache(struct erofs_inode *vi)
+{
+	if (!erofs_inode_is_data_compressed(vi->datalayout))
+		return;
+
+	spin_lock(&z_erofs_extent_lru_lock);
+	z_erofs_extent_cache_free(vi);
+	spin_unlock(&z_erofs_extent_lru_lock);
+}
+
+static unsigned long z_erofs_extent_shrink_count(struct shrinker *shrink,
+						 struct shrink_control *sc)
+{
+	return atomic_long_read(&z_erofs_nr_extents);
+}
+
+static unsigned long z_erofs_extent_shrink_scan(struct shrinker *shrink,
+						struct shrink_control *sc)
+{
+	unsigned long nr = sc->nr_to_scan, freed = 0;
+	struct erofs_inode *vi;
+	unsigned int scanned;
+
+	spin_lock(&z_erofs_extent_lru_lock);
+	for (scanned = 0; freed < nr && scanned < nr &&
+	     !list_empty(&z_erofs_extent_lru); scanned++) {
+		vi = list_first_entry(&z_erofs_extent_lru, struct erofs_inode,
+				      z_extents_lru);
+
+		/* give inodes looked up since the last scan another round */
+		if (test_and_clear_bit(EROFS_I_Z_EXTENT_REF_BIT, &vi->flags)) {
+			list_move_tail(&vi->z_extents_lru,
+				       &z_erofs_extent_lru);
+			continue;
+		}
+		freed += z_erofs_extent_cache_free(vi);
+	}
+	spin_unlock(&z_erofs_extent_lru_lock);
+	return freed;
+}
+
+static struct shrinker *z_erofs_extent_shrinker;
+
+int __init z_erofs_init_extent_shrinker(void)
+{
+	z_erofs_extent_shrinker = shrinker_alloc(0, "erofs-extent-cache");
+	if (!z_erofs_extent_shrinker)
+		return -ENOMEM;
+
+	z_erofs_extent_shrinker->count_objects = z_erofs_extent_shrink_count;
+	z_erofs_extent_shrinker->scan_objects = z_erofs_extent_shrink_scan;
+
+	shrinker_register(z_erofs_extent_shrinker);
+	return 0;
+}
+
+void z_erofs_exit_extent_shrinker(void)
+{
+	shrinker_free(z_erofs_extent_shrinker);
+}
+
 int z_erofs_map_blocks_iter(struct inode *inode, struct erofs_map_blocks *map,
 			    int flags)
 {
@@ -721,7 +970,12 @@ int z_erofs_map_blocks_iter(struct inode *inode, struct erofs_map_blocks *map,
 		goto out;
 	}
 
+	if (z_erofs_extent_cache_lookup(inode, map, flags))
+		goto out;
+
 	err = z_erofs_do_map_blocks(inode, map, flags);
+	if (!err)
+		z_erofs_extent_cache_insert(inode, map);
 out:
 	trace_z_erofs_map_blocks_iter_exit(inode, map, flags, err);
 	return err;
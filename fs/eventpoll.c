@@ -38,6 +38,8 @@
 #include <linux/compat.h>
 #include <linux/rculist.h>
 #include <linux/capability.h>
+#include <linux/log2.h>
+#include <linux/vmalloc.h>
 #include <net/busy_poll.h>
 
 /*
@@ -155,6 +157,9 @@ struct epitem {
 	 */
 	bool dying;
 
+	/* Entry of the event ring last posted for this item, see ep_ring_post() */
+	u16 ring_idx;
+
 	/* List containing poll wait queues */
 	struct eppoll_entry *pwqlist;
 
@@ -171,6 +176,33 @@ struct epitem {
 	struct epoll_event event;
 };
 
+/* Upper bound of the number of entries of an event ring */
+#define EP_RING_MAX_ENTRIES (1U << 16)
+
+/*
+ * Items whose events are published on the event ring: only EPOLLET among
+ * these bits, as the ring is not rescanned like the ready list is.
+ */
+#define EP_RING_BITS (EPOLLET | EPOLLONESHOT | EPOLLWAKEUP)
+
+/* Event ring shared with userspace, see EPIOCSRING */
+struct ep_ring {
+	/* Serializes ep_poll_callback() instances publishing on the ring */
+	spinlock_t lock;
+
+	/* Next entry to fill; the copy in the shared header is not read back */
+	u32 tail;
+	u32 mask;
+
+	/* Shared area, vmalloc_user() memory mapped by userspace */
+	struct epoll_ring *hdr;
+	struct epoll_ring_event *events;
+	size_t size;
+
+	/* Item that posted each entry, NULL once it is removed */
+	struct epitem **owners;
+};
+
 /*
  * This structure is stored inside the "private_data" member of the file
  * structure and represents the main data structure for the eventpoll
@@ -225,6 +257,9 @@ struct eventpoll {
 	 */
 	refcount_t refcount;
 
+	/* event ring, set once by EPIOCSRING and freed with the eventpoll */
+	struct ep_ring *ring;
+
 #ifdef CONFIG_NET_RX_BUSY_POLL
 	/* used to track busy poll napi_id */
 	unsigned int napi_id;
@@ -378,6 +413,171 @@ static inline struct epitem *ep_item_from_wait(wait_queue_entry_t *p)
 	return container_of(p, struct eppoll_entry, wait)->base;
 }
 
+/*
+ * Events published on the ring and not consumed yet.  The head is written by
+ * userspace, any value other than our tail wakes up the waiters, which then
+ * leave it to userspace to make sense of the ring.
+ */
+static inline bool ep_ring_events_available(struct eventpoll *ep)
+{
+	struct ep_ring *ring = READ_ONCE(ep->ring);
+
+	return ring && READ_ONCE(ring->hdr->head) != READ_ONCE(ring->tail);
+}
+
+/*
+ * Whether the last entry posted for @epi is still waiting for userspace, with
+ * ep->lock held or ring->lock held and ep->lock read-locked.
+ */
+static bool ep_ring_pending(struct ep_ring *ring, struct epitem *epi, u32 head)
+{
+	return ring->owners[epi->ring_idx] == epi &&
+	       ((epi->ring_idx - head) & ring->mask) < ring->tail - head;
+}
+
+/*
+ * Called by ep_poll_callback() with ep->lock read-locked: publish the event
+ * on the ring, instead of queueing @epi on the ready list for epoll_wait() to
+ * poll it again.  Returns false if the event must go through the ready list,
+ * which is also where it goes when the ring is full.
+ *
+ * No entry is added while the last one of @epi, not consumed yet, already
+ * reports all the events: userspace reads the entry before advancing head,
+ * and only handles it after, so it can't miss them.  Entries are never
+ * changed once published, except by ep_ring_forget().
+ */
+static bool ep_ring_post(struct eventpoll *ep, struct epitem *epi,
+			 __poll_t pollflags)
+{
+	struct ep_ring *ring = READ_ONCE(ep->ring);
+	struct epoll_ring_event *event;
+	bool posted = false;
+	__poll_t events;
+	u32 head;
+
+	if (!ring || !pollflags || (pollflags & POLLFREE) ||
+	    (epi->event.events & EP_RING_BITS) != EPOLLET)
+		return false;
+
+	events = pollflags & epi->event.events & ~EP_PRIVATE_BITS;
+
+	spin_lock(&ring->lock);
+	/* Pairs with the store-release of head once userspace read entries */
+	head = smp_load_acquire(&ring->hdr->head);
+	if (ep_ring_pending(ring, epi, head) &&
+	    !(events & ~READ_ONCE(ring->events[epi->ring_idx].events))) {
+		posted = true;
+	} else if (ring->tail - head <= ring->mask) {
+		epi->ring_idx = ring->tail & ring->mask;
+		ring->owners[epi->ring_idx] = epi;
+		event = &ring->events[epi->ring_idx];
+		event->events = events;
+		event->data = epi->event.data;
+		WRITE_ONCE(ring->tail, ring->tail + 1);
+		/* Pairs with the load-acquire of tail by userspace */
+		smp_store_release(&ring->hdr->tail, ring->tail);
+		posted = true;
+	} else {
+		ring->hdr->overflow++;
+	}
+	spin_unlock(&ring->lock);
+
+	return posted;
+}
+
+/*
+ * Called with ep->lock write-locked when @epi is removed or its data changes:
+ * turn its entry, if not consumed yet, into a tombstone with no events, so
+ * that userspace doesn't get stale data.
+ */
+static void ep_ring_forget(struct eventpoll *ep, struct epitem *epi)
+{
+	struct ep_ring *ring = ep->ring;
+
+	if (!ring || ring->owners[epi->ring_idx] != epi)
+		return;
+
+	if (ep_ring_pending(ring, epi, smp_load_acquire(&ring->hdr->head)))
+		WRITE_ONCE(ring->events[epi->ring_idx].events, 0);
+	ring->owners[epi->ring_idx] = NULL;
+}
+
+static void ep_ring_free(struct ep_ring *ring)
+{
+	if (!ring)
+		return;
+
+	kvfree(ring->owners);
+	vfree(ring->hdr);
+	kfree(ring);
+}
+
+static long ep_ring_setup(struct eventpoll *ep,
+			  struct epoll_ring_params __user *uparams)
+{
+	struct epoll_ring_params params;
+	struct ep_ring *ring;
+	unsigned int entries;
+	void *mem;
+	long err;
+
+	if (copy_from_user(&params, uparams, sizeof(params)))
+		return -EFAULT;
+
+	if (params.flags || !params.entries ||
+	    params.entries > EP_RING_MAX_ENTRIES)
+		return -EINVAL;
+
+	entries = roundup_pow_of_two(params.entries);
+
+	ring = kzalloc(sizeof(*ring), GFP_KERNEL_ACCOUNT);
+	if (!ring)
+		return -ENOMEM;
+
+	spin_lock_init(&ring->lock);
+	ring->mask = entries - 1;
+	ring->size = PAGE_ALIGN(EPOLL_RING_EVENTS_OFFSET +
+				entries * sizeof(struct epoll_ring_event));
+	ring->owners = kvcalloc(entries, sizeof(*ring->owners),
+				GFP_KERNEL_ACCOUNT);
+	if (!ring->owners) {
+		kfree(ring);
+		return -ENOMEM;
+	}
+	mem = vmalloc_user(ring->size);
+	if (!mem) {
+		kvfree(ring->owners);
+		kfree(ring);
+		return -ENOMEM;
+	}
+	ring->hdr = mem;
+	ring->hdr->mask = ring->mask;
+	ring->events = mem + EPOLL_RING_EVENTS_OFFSET;
+
+	params.entries = entries;
+	params.size = ring->size;
+	if (copy_to_user(uparams, &params, sizeof(params))) {
+		err = -EFAULT;
+		goto out_free;
+	}
+
+	mutex_lock(&ep->mtx);
+	if (ep->ring) {
+		mutex_unlock(&ep->mtx);
+		err = -EBUSY;
+		goto out_free;
+	}
+	/* Pairs with READ_ONCE() of ep->ring by the callback and waiters */
+	smp_store_release(&ep->ring, ring);
+	mutex_unlock(&ep->mtx);
+
+	return 0;
+
+out_free:
+	ep_ring_free(ring);
+	return err;
+}
+
 /**
  * ep_events_available - Checks if ready events might be available.
  *
@@ -389,7 +589,8 @@ static inline struct epitem *ep_item_from_wait(wait_queue_entry_t *p)
 static inline int ep_events_available(struct eventpoll *ep)
 {
 	return !list_empty_careful(&ep->rdllist) ||
-		READ_ONCE(ep->ovflist) != EP_UNACTIVE_PTR;
+		READ_ONCE(ep->ovflist) != EP_UNACTIVE_PTR ||
+		ep_ring_events_available(ep);
 }
 
 #ifdef CONFIG_NET_RX_BUSY_POLL
@@ -786,6 +987,7 @@ static bool ep_refcount_dec_and_test(struct eventpoll *ep)
 
 static void ep_free(struct eventpoll *ep)
 {
+	ep_ring_free(ep->ring);
 	mutex_destroy(&ep->mtx);
 	free_uid(ep->user);
 	wakeup_source_unregister(ep->ws);
@@ -840,6 +1042,7 @@ static bool __ep_remove(struct eventpoll *ep, struct epitem *epi, bool force)
 	write_lock_irq(&ep->lock);
 	if (ep_is_linked(epi))
 		list_del_init(&epi->rdllink);
+	ep_ring_forget(ep, epi);
 	write_unlock_irq(&ep->lock);
 
 	wakeup_source_unregister(ep_wakeup_source(epi));
@@ -908,6 +1111,9 @@ static void ep_clear_and_put(struct eventpoll *ep)
 		ep_free(ep);
 }
 
+static long ep_ctl_batch(struct file *file,
+			 struct epoll_ctl_batch __user *ubatch);
+
 static long ep_eventpoll_ioctl(struct file *file, unsigned int cmd,
 			       unsigned long arg)
 {
@@ -921,6 +1127,13 @@ static long ep_eventpoll_ioctl(struct file *file, unsigned int cmd,
 	case EPIOCGPARAMS:
 		ret = ep_eventpoll_bp_ioctl(file, cmd, arg);
 		break;
+	case EPIOCSRING:
+		ret = ep_ring_setup(file->private_data,
+				   (struct epoll_ring_params __user *)arg);
+		break;
+	case EPIOCCTLBATCH:
+		ret = ep_ctl_batch(file, (struct epoll_ctl_batch __user *)arg);
+		break;
 	default:
 		ret = -EINVAL;
 		break;
@@ -954,6 +1167,9 @@ static __poll_t __ep_eventpoll_poll(struct file *file, poll_table *wait, int dep
 	/* Insert inside our poll wait queue */
 	poll_wait(file, &ep->poll_wait, wait);
 
+	if (ep_ring_events_available(ep))
+		return EPOLLIN | EPOLLRDNORM;
+
 	/*
 	 * Proceed to find out if wanted events are really available inside
 	 * the ready list.
@@ -1003,6 +1219,17 @@ static __poll_t ep_eventpoll_poll(struct file *file, poll_table *wait)
 	return __ep_eventpoll_poll(file, wait, 0);
 }
 
+static int ep_eventpoll_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct eventpoll *ep = file->private_data;
+	struct ep_ring *ring = READ_ONCE(ep->ring);
+
+	if (!ring)
+		return -ENODEV;
+
+	return remap_vmalloc_range(vma, ring->hdr, vma->vm_pgoff);
+}
+
 #ifdef CONFIG_PROC_FS
 static void ep_show_fdinfo(struct seq_file *m, struct file *f)
 {
@@ -1034,6 +1261,7 @@ static const struct file_operations eventpoll_fops = {
 #endif
 	.release	= ep_eventpoll_release,
 	.poll		= ep_eventpoll_poll,
+	.mmap		= ep_eventpoll_mmap,
 	.llseek		= noop_llseek,
 	.unlocked_ioctl	= ep_eventpoll_ioctl,
 	.compat_ioctl   = compat_ptr_ioctl,
@@ -1300,6 +1528,9 @@ static int ep_poll_callback(wait_queue_entry_t *wait, unsigned mode, int sync, v
 	if (pollflags && !(pollflags & epi->event.events))
 		goto out_unlock;
 
+	if (ep_ring_post(ep, epi, pollflags))
+		goto wake;
+
 	/*
 	 * If we are transferring events to userspace, we can hold no locks
 	 * (because we're accessing user memory, and because of linux f_op->poll()
@@ -1315,6 +1546,7 @@ static int ep_poll_callback(wait_queue_entry_t *wait, unsigned mode, int sync, v
 			ep_pm_stay_awake_rcu(epi);
 	}
 
+wake:
 	/*
 	 * Wake up ( if active ) both the eventpoll wait list and the ->poll()
 	 * wait list.
@@ -1716,6 +1948,13 @@ static int ep_modify(struct eventpoll *ep, struct epitem *epi,
 
 	init_poll_funcptr(&pt, NULL);
 
+	/* Entries with the old data must not reach userspace */
+	if (READ_ONCE(ep->ring) && epi->event.data != event->data) {
+		write_lock_irq(&ep->lock);
+		ep_ring_forget(ep, epi);
+		write_unlock_irq(&ep->lock);
+	}
+
 	/*
 	 * Set the new event interest mask before calling f_op->poll();
 	 * otherwise we might miss an event that happens between the
@@ -1969,6 +2208,10 @@ static int ep_poll(struct eventpoll *ep, struct epoll_event __user *events,
 			res = ep_send_events(ep, events, maxevents);
 			if (res)
 				return res;
+
+			/* Events on the ring are for userspace to collect */
+			if (ep_ring_events_available(ep))
+				return 0;
 		}
 
 		if (timed_out)
@@ -2218,25 +2461,20 @@ static inline int epoll_mutex_lock(struct mutex *mutex, int depth,
 	return -EAGAIN;
 }
 
-int do_epoll_ctl(int epfd, int op, int fd, struct epoll_event *epds,
-		 bool nonblock)
+static int ep_ctl_file(struct file *file, int op, int fd,
+		       struct epoll_event *epds, bool nonblock)
 {
 	int error;
 	int full_check = 0;
-	struct fd f, tf;
+	struct fd tf;
 	struct eventpoll *ep;
 	struct epitem *epi;
 	struct eventpoll *tep = NULL;
 
-	error = -EBADF;
-	f = fdget(epfd);
-	if (!f.file)
-		goto error_return;
-
 	/* Get the "struct file *" for the target file */
 	tf = fdget(fd);
 	if (!tf.file)
-		goto error_fput;
+		return -EBADF;
 
 	/* The target file descriptor must support poll */
 	error = -EPERM;
@@ -2253,7 +2491,7 @@ int do_epoll_ctl(int epfd, int op, int fd, struct epoll_event *epds,
 	 * adding an epoll file descriptor inside itself.
 	 */
 	error = -EINVAL;
-	if (f.file == tf.file || !is_file_epoll(f.file))
+	if (file == tf.file || !is_file_epoll(file))
 		goto error_tgt_fput;
 
 	/*
@@ -2273,7 +2511,7 @@ int do_epoll_ctl(int epfd, int op, int fd, struct epoll_event *epds,
 	 * At this point it is safe to assume that the "private_data" contains
 	 * our own data structure.
 	 */
-	ep = f.file->private_data;
+	ep = file->private_data;
 
 	/*
 	 * When we insert an epoll file descriptor inside another epoll file
@@ -2294,7 +2532,7 @@ int do_epoll_ctl(int epfd, int op, int fd, struct epoll_event *epds,
 	if (error)
 		goto error_tgt_fput;
 	if (op == EPOLL_CTL_ADD) {
-		if (READ_ONCE(f.file->f_ep) || ep->gen == loop_check_gen ||
+		if (READ_ONCE(file->f_ep) || ep->gen == loop_check_gen ||
 		    is_file_epoll(tf.file)) {
 			mutex_unlock(&ep->mtx);
 			error = epoll_mutex_lock(&epnested_mutex, 0, nonblock);
@@ -2362,13 +2600,67 @@ int do_epoll_ctl(int epfd, int op, int fd, struct epoll_event *epds,
 	}
 
 	fdput(tf);
-error_fput:
+
+	return error;
+}
+
+int do_epoll_ctl(int epfd, int op, int fd, struct epoll_event *epds,
+		 bool nonblock)
+{
+	struct fd f;
+	int error;
+
+	f = fdget(epfd);
+	if (!f.file)
+		return -EBADF;
+
+	error = ep_ctl_file(f.file, op, fd, epds, nonblock);
 	fdput(f);
-error_return:
 
 	return error;
 }
 
+/*
+ * Apply the epoll_ctl() operations of the batch in order, stopping at the
+ * first one that fails or whose result cannot be written back.  Returns the
+ * number of operations that succeeded and were reported, or the error of the
+ * first one.
+ */
+static long ep_ctl_batch(struct file *file,
+			 struct epoll_ctl_batch __user *ubatch)
+{
+	struct epoll_ctl_batch batch;
+	struct epoll_ctl_op __user *uops;
+	struct epoll_ctl_op op;
+	struct epoll_event epds;
+	unsigned int i;
+	int error;
+
+	if (copy_from_user(&batch, ubatch, sizeof(batch)))
+		return -EFAULT;
+
+	if (batch.flags || batch.nr > INT_MAX)
+		return -EINVAL;
+
+	uops = u64_to_user_ptr(batch.ops);
+	for (i = 0; i < batch.nr; i++) {
+		if (copy_from_user(&op, &uops[i], sizeof(op)))
+			return i ? i : -EFAULT;
+
+		epds.events = op.events;
+		epds.data = op.data;
+		error = ep_ctl_file(file, op.op, op.fd, &epds, false);
+		if (put_user(error, &uops[i].result))
+			error = error ? : -EFAULT;
+		if (error)
+			return i ? i : error;
+
+		cond_resched();
+	}
+
+	return i;
+}
+
 /*
  * The following function implements the controller interface for
  * the eventpoll file that enables the insertion/removal/change of
@@ -133,6 +133,8 @@ static int ext4_readdir(struct file *file, struct dir_context *ctx)
 	struct super_block *sb = inode->i_sb;
 	struct buffer_head *bh = NULL;
 	struct fscrypt_str fstr = FSTR_INIT(NULL, 0);
+	char *copy = NULL, *data;
+	int nofs;
 
 	err = fscrypt_prepare_readdir(inode);
 	if (err)
@@ -167,6 +169,19 @@ static int ext4_readdir(struct file *file, struct dir_context *ctx)
 			return err;
 	}
 
+	/*
+	 * With parallel directory operations, blocks may change under us
+	 * while dir_emit() faults on the user buffer, which can't be done
+	 * with the block locked: work on a copy of each block instead.
+	 */
+	if (ext4_pdirops(inode)) {
+		copy = kmalloc(sb->s_blocksize, GFP_KERNEL);
+		if (!copy) {
+			err = -ENOMEM;
+			goto errout;
+		}
+	}
+
 	while (ctx->pos < inode->i_size) {
 		struct ext4_map_blocks map;
 
@@ -196,12 +211,20 @@ static int ext4_readdir(struct file *file, struct dir_context *ctx)
 					&file->f_ra, file,
 					index, 1);
 			file->f_ra.prev_pos = (loff_t)index << PAGE_SHIFT;
+			nofs = ext4_dirop_lock(inode, false);
+			ext4_dirblock_lock(inode, map.m_lblk, false);
 			bh = ext4_bread(NULL, inode, map.m_lblk, 0);
 			if (IS_ERR(bh)) {
+				ext4_dirblock_unlock(inode, map.m_lblk, false);
+				ext4_dirop_unlock(inode, false, nofs);
 				err = PTR_ERR(bh);
 				bh = NULL;
 				goto errout;
 			}
+			if (!bh) {
+				ext4_dirblock_unlock(inode, map.m_lblk, false);
+				ext4_dirop_unlock(inode, false, nofs);
+			}
 		}
 
 		if (!bh) {
@@ -215,6 +238,10 @@ static int ext4_readdir(struct file *file, struct dir_context *ctx)
 		/* Check the checksum */
 		if (!buffer_verified(bh) &&
 		    !ext4_dirblock_csum_verify(inode, bh)) {
+			if (copy) {
+				ext4_dirblock_unlock(inode, map.m_lblk, false);
+				ext4_dirop_unlock(inode, false, nofs);
+			}
 			EXT4_ERROR_FILE(file, 0, "directory fails checksum "
 					"at offset %llu",
 					(unsigned long long)ctx->pos);
@@ -225,6 +252,14 @@ static int ext4_readdir(struct file *file, struct dir_context *ctx)
 		}
 		set_buffer_verified(bh);
 
+		data = bh->b_data;
+		if (copy) {
+			memcpy(copy, bh->b_data, sb->s_blocksize);
+			ext4_dirblock_unlock(inode, map.m_lblk, false);
+			ext4_dirop_unlock(inode, false, nofs);
+			data = copy;
+		}
+
 		/* If the dir block has changed since the last call to
 		 * readdir(2), then we might be pointing to an invalid
 		 * dirent right now.  Scan from the start of the block
@@ -232,7 +267,7 @@ static int ext4_readdir(struct file *file, struct dir_context *ctx)
 		if (!inode_eq_iversion(inode, file->f_version)) {
 			for (i = 0; i < sb->s_blocksize && i < offset; ) {
 				de = (struct ext4_dir_entry_2 *)
-					(bh->b_data + i);
+					(data + i);
 				/* It's too expensive to do a full
 				 * dirent test each time round this
 				 * loop, but we do have to test at
@@ -254,9 +289,9 @@ static int ext4_readdir(struct file *file, struct dir_context *ctx)
 
 		while (ctx->pos < inode->i_size
 		       && offset < sb->s_blocksize) {
-			de = (struct ext4_dir_entry_2 *) (bh->b_data + offset);
+			de = (struct ext4_dir_entry_2 *) (data + offset);
 			if (ext4_check_dir_entry(inode, file, de, bh,
-						 bh->b_data, bh->b_size,
+						 data, bh->b_size,
 						 offset)) {
 				/*
 				 * On error, skip to the next block
@@ -307,6 +342,7 @@ static int ext4_readdir(struct file *file, struct dir_context *ctx)
 done:
 	err = 0;
 errout:
+	kfree(copy);
 	fscrypt_fname_free_buffer(&fstr);
 	brelse(bh);
 	return err;
@@ -550,7 +586,7 @@ static int ext4_dx_readdir(struct file *file, struct dir_context *ctx)
 	struct dir_private_info *info = file->private_data;
 	struct inode *inode = file_inode(file);
 	struct fname *fname;
-	int ret = 0;
+	int ret = 0, nofs;
 
 	if (!info) {
 		info = ext4_htree_create_dir_info(file, ctx->pos);
@@ -594,9 +630,11 @@ static int ext4_dx_readdir(struct file *file, struct dir_context *ctx)
 			info->curr_node = NULL;
 			free_rb_tree_fname(&info->root);
 			file->f_version = inode_query_iversion(inode);
+			nofs = ext4_dirop_lock(inode, false);
 			ret = ext4_htree_fill_tree(file, info->curr_hash,
 						   info->curr_minor_hash,
 						   &info->next_hash);
+			ext4_dirop_unlock(inode, false, nofs);
 			if (ret < 0)
 				goto finished;
 			if (ret == 0) {
@@ -1090,6 +1090,20 @@ struct ext4_inode_info {
 	 * by other means, so we have i_data_sem.
 	 */
 	struct rw_semaphore i_data_sem;
+
+	/*
+	 * With SB_I_PAR_DIROPS, creates and unlinks run with the directory's
+	 * i_rwsem held shared.  They hold i_dirop_sem shared to change
+	 * entries in place within one block, under that block's lock (see
+	 * ext4_dirblock_lock()), and exclusive to move entries between blocks
+	 * or change the directory format.  i_dirop_gen counts the exclusive
+	 * sections, so that a found entry can be checked to be still in place.
+	 * Exclusive holders may have a transaction running, so allocations
+	 * are GFP_NOFS while it is held either way.
+	 */
+	struct rw_semaphore i_dirop_sem;
+	unsigned int i_dirop_gen;
+
 	struct inode vfs_inode;
 	struct jbd2_inode *jinode;
 
@@ -1251,6 +1265,9 @@ struct ext4_inode_info {
 						    * scanning in mballoc
 						    */
 #define EXT4_MOUNT2_ABORT		0x00000100 /* Abort filesystem */
+#define EXT4_MOUNT2_PDIROPS		0x00000200 /* Parallel creates and
+						    * unlinks in a directory
+						    */
 
 #define clear_opt(sb, opt)		EXT4_SB(sb)->s_mount_opt &= \
 						~EXT4_MOUNT_##opt
@@ -3617,6 +3634,40 @@ extern int __ext4_unlink(struct inode *dir, const struct qstr *d_name,
 			 struct inode *inode, struct dentry *dentry);
 extern int __ext4_link(struct inode *dir, struct inode *inode,
 		       struct dentry *dentry);
+extern void __init ext4_init_dirblock_locks(void);
+extern void ext4_dirblock_lock(struct inode *dir, ext4_lblk_t block,
+			       bool write);
+extern void ext4_dirblock_unlock(struct inode *dir, ext4_lblk_t block,
+				 bool write);
+
+static inline bool ext4_pdirops(struct inode *dir)
+{
+	return dir->i_sb->s_iflags & SB_I_PAR_DIROPS;
+}
+
+static inline int ext4_dirop_lock(struct inode *dir, bool excl)
+{
+	if (!ext4_pdirops(dir))
+		return 0;
+	if (excl)
+		down_write(&EXT4_I(dir)->i_dirop_sem);
+	else
+		down_read(&EXT4_I(dir)->i_dirop_sem);
+	return memalloc_nofs_save();
+}
+
+static inline void ext4_dirop_unlock(struct inode *dir, bool excl, int ctx)
+{
+	if (!ext4_pdirops(dir))
+		return;
+	memalloc_nofs_restore(ctx);
+	if (excl) {
+		EXT4_I(dir)->i_dirop_gen++;
+		up_write(&EXT4_I(dir)->i_dirop_sem);
+	} else {
+		up_read(&EXT4_I(dir)->i_dirop_sem);
+	}
+}
 
 #define S_SHIFT 12
 static const unsigned char ext4_type_by_mode[(S_IFMT >> S_SHIFT) + 1] = {
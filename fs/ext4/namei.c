@@ -36,6 +36,7 @@
 #include <linux/bio.h>
 #include <linux/iversion.h>
 #include <linux/unicode.h>
+#include <linux/hash.h>
 #include "ext4.h"
 #include "ext4_jbd2.h"
 
@@ -50,6 +51,51 @@
 #define NAMEI_RA_BLOCKS  4
 #define NAMEI_RA_SIZE	     (NAMEI_RA_CHUNKS * NAMEI_RA_BLOCKS)
 
+/*
+ * Locks of the directory blocks changed in place with i_dirop_sem held
+ * shared, hashed by directory and logical block.  Readers of those blocks
+ * take them for read; holders of i_dirop_sem exclusive need none.
+ */
+#define EXT4_DIRBLOCK_LOCK_BITS	8
+
+static struct rw_semaphore ext4_dirblock_locks[1 << EXT4_DIRBLOCK_LOCK_BITS];
+
+void __init ext4_init_dirblock_locks(void)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(ext4_dirblock_locks); i++)
+		init_rwsem(&ext4_dirblock_locks[i]);
+}
+
+static struct rw_semaphore *ext4_dirblock_sem(struct inode *dir,
+					      ext4_lblk_t block)
+{
+	u64 key = ((u64)dir->i_ino << 32) ^ block;
+
+	return &ext4_dirblock_locks[hash_64(key, EXT4_DIRBLOCK_LOCK_BITS)];
+}
+
+void ext4_dirblock_lock(struct inode *dir, ext4_lblk_t block, bool write)
+{
+	if (!ext4_pdirops(dir))
+		return;
+	if (write)
+		down_write(ext4_dirblock_sem(dir, block));
+	else
+		down_read(ext4_dirblock_sem(dir, block));
+}
+
+void ext4_dirblock_unlock(struct inode *dir, ext4_lblk_t block, bool write)
+{
+	if (!ext4_pdirops(dir))
+		return;
+	if (write)
+		up_write(ext4_dirblock_sem(dir, block));
+	else
+		up_read(ext4_dirblock_sem(dir, block));
+}
+
 static struct buffer_head *ext4_append(handle_t *handle,
 					struct inode *inode,
 					ext4_lblk_t *block)
@@ -322,9 +368,13 @@ static int ext4_htree_next_block(struct inode *dir, __u32 hash,
 				 __u32 *start_hash);
 static struct buffer_head * ext4_dx_find_entry(struct inode *dir,
 		struct ext4_filename *fname,
-		struct ext4_dir_entry_2 **res_dir);
+		struct ext4_dir_entry_2 **res_dir,
+		ext4_lblk_t *lblk);
 static int ext4_dx_add_entry(handle_t *handle, struct ext4_filename *fname,
 			     struct inode *dir, struct inode *inode);
+static int ext4_dx_add_entry_shared(handle_t *handle,
+				    struct ext4_filename *fname,
+				    struct inode *dir, struct inode *inode);
 
 /* checksumming functions */
 void ext4_initialize_dirent_tail(struct buffer_head *bh,
@@ -1079,9 +1129,12 @@ static int htree_dirblock_to_tree(struct file *dir_file,
 
 	dxtrace(printk(KERN_INFO "In htree dirblock_to_tree: block %lu\n",
 							(unsigned long)block));
+	ext4_dirblock_lock(dir, block, false);
 	bh = ext4_read_dirblock(dir, block, DIRENT_HTREE);
-	if (IS_ERR(bh))
+	if (IS_ERR(bh)) {
+		ext4_dirblock_unlock(dir, block, false);
 		return PTR_ERR(bh);
+	}
 
 	de = (struct ext4_dir_entry_2 *) bh->b_data;
 	/* csum entries are not larger in the casefolded encrypted case */
@@ -1093,14 +1146,14 @@ static int htree_dirblock_to_tree(struct file *dir_file,
 	if (IS_ENCRYPTED(dir)) {
 		err = fscrypt_prepare_readdir(dir);
 		if (err < 0) {
-			brelse(bh);
-			return err;
+			count = err;
+			goto errout;
 		}
 		err = fscrypt_fname_alloc_buffer(EXT4_NAME_LEN,
 						 &fname_crypto_str);
 		if (err < 0) {
-			brelse(bh);
-			return err;
+			count = err;
+			goto errout;
 		}
 	}
 
@@ -1166,6 +1219,7 @@ static int htree_dirblock_to_tree(struct file *dir_file,
 	}
 errout:
 	brelse(bh);
+	ext4_dirblock_unlock(dir, block, false);
 	fscrypt_fname_free_buffer(&fname_crypto_str);
 	return count;
 }
@@ -1591,7 +1645,7 @@ static int is_dx_internal_node(struct inode *dir, ext4_lblk_t block,
 static struct buffer_head *__ext4_find_entry(struct inode *dir,
 					     struct ext4_filename *fname,
 					     struct ext4_dir_entry_2 **res_dir,
-					     int *inlined)
+					     int *inlined, ext4_lblk_t *lblk)
 {
 	struct super_block *sb;
 	struct buffer_head *bh_use[NAMEI_RA_SIZE];
@@ -1632,7 +1686,7 @@ static struct buffer_head *__ext4_find_entry(struct inode *dir,
 		goto restart;
 	}
 	if (is_dx(dir)) {
-		ret = ext4_dx_find_entry(dir, fname, res_dir);
+		ret = ext4_dx_find_entry(dir, fname, res_dir, lblk);
 		/*
 		 * On success, or if the error was file not found,
 		 * return.  Otherwise, fall back to doing a search the
@@ -1686,10 +1740,12 @@ static struct buffer_head *__ext4_find_entry(struct inode *dir,
 			ret = ERR_PTR(-EIO);
 			goto cleanup_and_exit;
 		}
+		ext4_dirblock_lock(dir, block, false);
 		if (!buffer_verified(bh) &&
 		    !is_dx_internal_node(dir, block,
 					 (struct ext4_dir_entry *)bh->b_data) &&
 		    !ext4_dirblock_csum_verify(dir, bh)) {
+			ext4_dirblock_unlock(dir, block, false);
 			EXT4_ERROR_INODE_ERR(dir, EFSBADCRC,
 					     "checksumming directory "
 					     "block %lu", (unsigned long)block);
@@ -1700,8 +1756,11 @@ static struct buffer_head *__ext4_find_entry(struct inode *dir,
 		set_buffer_verified(bh);
 		i = search_dirblock(bh, dir, fname,
 			    block << EXT4_BLOCK_SIZE_BITS(sb), res_dir);
+		ext4_dirblock_unlock(dir, block, false);
 		if (i == 1) {
 			EXT4_I(dir)->i_dir_start_lookup = block;
+			if (lblk)
+				*lblk = block;
 			ret = bh;
 			goto cleanup_and_exit;
 		} else {
@@ -1740,6 +1799,7 @@ static struct buffer_head *ext4_find_entry(struct inode *dir,
 	int err;
 	struct ext4_filename fname;
 	struct buffer_head *bh;
+	int nofs;
 
 	err = ext4_fname_setup_filename(dir, d_name, 1, &fname);
 	if (err == -ENOENT)
@@ -1747,7 +1807,9 @@ static struct buffer_head *ext4_find_entry(struct inode *dir,
 	if (err)
 		return ERR_PTR(err);
 
-	bh = __ext4_find_entry(dir, &fname, res_dir, inlined);
+	nofs = ext4_dirop_lock(dir, false);
+	bh = __ext4_find_entry(dir, &fname, res_dir, inlined, NULL);
+	ext4_dirop_unlock(dir, false, nofs);
 
 	ext4_fname_free_filename(&fname);
 	return bh;
@@ -1760,6 +1822,7 @@ static struct buffer_head *ext4_lookup_entry(struct inode *dir,
 	int err;
 	struct ext4_filename fname;
 	struct buffer_head *bh;
+	int nofs;
 
 	err = ext4_fname_prepare_lookup(dir, dentry, &fname);
 	if (err == -ENOENT)
@@ -1767,7 +1830,9 @@ static struct buffer_head *ext4_lookup_entry(struct inode *dir,
 	if (err)
 		return ERR_PTR(err);
 
-	bh = __ext4_find_entry(dir, &fname, res_dir, NULL);
+	nofs = ext4_dirop_lock(dir, false);
+	bh = __ext4_find_entry(dir, &fname, res_dir, NULL, NULL);
+	ext4_dirop_unlock(dir, false, nofs);
 
 	ext4_fname_free_filename(&fname);
 	return bh;
@@ -1775,7 +1840,8 @@ static struct buffer_head *ext4_lookup_entry(struct inode *dir,
 
 static struct buffer_head * ext4_dx_find_entry(struct inode *dir,
 			struct ext4_filename *fname,
-			struct ext4_dir_entry_2 **res_dir)
+			struct ext4_dir_entry_2 **res_dir,
+			ext4_lblk_t *lblk)
 {
 	struct super_block * sb = dir->i_sb;
 	struct dx_frame frames[EXT4_HTREE_LEVEL], *frame;
@@ -1791,15 +1857,22 @@ static struct buffer_head * ext4_dx_find_entry(struct inode *dir,
 		return (struct buffer_head *) frame;
 	do {
 		block = dx_get_block(frame->at);
+		ext4_dirblock_lock(dir, block, false);
 		bh = ext4_read_dirblock(dir, block, DIRENT_HTREE);
-		if (IS_ERR(bh))
+		if (IS_ERR(bh)) {
+			ext4_dirblock_unlock(dir, block, false);
 			goto errout;
+		}
 
 		retval = search_dirblock(bh, dir, fname,
 					 block << EXT4_BLOCK_SIZE_BITS(sb),
 					 res_dir);
-		if (retval == 1)
+		ext4_dirblock_unlock(dir, block, false);
+		if (retval == 1) {
+			if (lblk)
+				*lblk = block;
 			goto success;
+		}
 		brelse(bh);
 		if (retval == -1) {
 			bh = ERR_PTR(ERR_BAD_DX_DIR);
@@ -2381,6 +2454,7 @@ static int ext4_add_entry(handle_t *handle, struct dentry *dentry,
 	unsigned blocksize;
 	ext4_lblk_t block, blocks;
 	int	csum_size = 0;
+	int	nofs;
 
 	if (ext4_has_metadata_csum(inode->i_sb))
 		csum_size = sizeof(struct ext4_dir_entry_tail);
@@ -2401,6 +2475,19 @@ static int ext4_add_entry(handle_t *handle, struct dentry *dentry,
 	if (retval)
 		return retval;
 
+	if (ext4_pdirops(dir)) {
+		nofs = ext4_dirop_lock(dir, false);
+		if (is_dx(dir))
+			retval = ext4_dx_add_entry_shared(handle, &fname, dir,
+							  inode);
+		else
+			retval = -EAGAIN;
+		ext4_dirop_unlock(dir, false, nofs);
+		if (retval != -EAGAIN)
+			goto out_unlocked;
+	}
+	nofs = ext4_dirop_lock(dir, true);
+
 	if (ext4_has_inline_data(dir)) {
 		retval = ext4_try_add_inline_entry(handle, &fname, dir, inode);
 		if (retval < 0)
@@ -2471,6 +2558,8 @@ static int ext4_add_entry(handle_t *handle, struct dentry *dentry,
 
 	retval = add_dirent_to_buf(handle, &fname, dir, inode, de, bh);
 out:
+	ext4_dirop_unlock(dir, true, nofs);
+out_unlocked:
 	ext4_fname_free_filename(&fname);
 	brelse(bh);
 	if (retval == 0)
@@ -2478,6 +2567,42 @@ static int ext4_add_entry(handle_t *handle, struct dentry *dentry,
 	return retval;
 }
 
+/*
+ * Add an entry to its htree leaf with i_dirop_sem held shared, so that
+ * creates landing in different leaves run in parallel.  Returns -EAGAIN when
+ * the leaf is full or the index is bad, for the caller to retry with
+ * i_dirop_sem held exclusive.
+ */
+static int ext4_dx_add_entry_shared(handle_t *handle,
+				    struct ext4_filename *fname,
+				    struct inode *dir, struct inode *inode)
+{
+	struct dx_frame frames[EXT4_HTREE_LEVEL], *frame;
+	struct buffer_head *bh;
+	ext4_lblk_t block;
+	int err;
+
+	frame = dx_probe(fname, dir, NULL, frames);
+	if (IS_ERR(frame)) {
+		err = PTR_ERR(frame);
+		return err == ERR_BAD_DX_DIR ? -EAGAIN : err;
+	}
+	block = dx_get_block(frame->at);
+
+	ext4_dirblock_lock(dir, block, true);
+	bh = ext4_read_dirblock(dir, block, DIRENT_HTREE);
+	if (IS_ERR(bh)) {
+		err = PTR_ERR(bh);
+	} else {
+		err = add_dirent_to_buf(handle, fname, dir, inode, NULL, bh);
+		brelse(bh);
+	}
+	ext4_dirblock_unlock(dir, block, true);
+
+	dx_release(frames);
+	return err == -ENOSPC ? -EAGAIN : err;
+}
+
 /*
  * Returns 0 for success, or a negative error value
  */
@@ -3230,22 +3355,38 @@ int __ext4_unlink(struct inode *dir, const struct qstr *d_name,
 		  struct inode *inode,
 		  struct dentry *dentry /* NULL during fast_commit recovery */)
 {
-	int retval = -ENOENT;
+	int retval;
 	struct buffer_head *bh;
 	struct ext4_dir_entry_2 *de;
+	struct ext4_filename fname;
 	handle_t *handle;
 	int skip_remove_dentry = 0;
+	int inlined = 0;
+	ext4_lblk_t lblk = 0;
+	unsigned int gen;
+	int nofs;
 
 	/*
 	 * Keep this outside the transaction; it may have to set up the
 	 * directory's encryption key, which isn't GFP_NOFS-safe.
 	 */
-	bh = ext4_find_entry(dir, d_name, &de, NULL);
-	if (IS_ERR(bh))
-		return PTR_ERR(bh);
+	retval = ext4_fname_setup_filename(dir, d_name, 1, &fname);
+	if (retval)
+		return retval;
 
+	nofs = ext4_dirop_lock(dir, false);
+	gen = EXT4_I(dir)->i_dirop_gen;
+	bh = __ext4_find_entry(dir, &fname, &de, &inlined, &lblk);
+	ext4_dirop_unlock(dir, false, nofs);
+	if (IS_ERR(bh)) {
+		retval = PTR_ERR(bh);
+		bh = NULL;
+		goto out_bh;
+	}
+
+	retval = -ENOENT;
 	if (!bh)
-		return -ENOENT;
+		goto out_bh;
 
 	if (le32_to_cpu(de->inode) != inode->i_ino) {
 		/*
@@ -3270,7 +3411,29 @@ int __ext4_unlink(struct inode *dir, const struct qstr *d_name,
 		ext4_handle_sync(handle);
 
 	if (!skip_remove_dentry) {
+		/*
+		 * A create that had to split the block may have moved the entry
+		 * since we looked it up; the name itself is held by the VFS.
+		 */
+		nofs = ext4_dirop_lock(dir, false);
+		if (gen != EXT4_I(dir)->i_dirop_gen) {
+			brelse(bh);
+			inlined = 0;
+			bh = __ext4_find_entry(dir, &fname, &de, &inlined,
+					       &lblk);
+			if (IS_ERR_OR_NULL(bh)) {
+				ext4_dirop_unlock(dir, false, nofs);
+				retval = bh ? PTR_ERR(bh) : -ENOENT;
+				bh = NULL;
+				goto out_handle;
+			}
+		}
+		if (!inlined)
+			ext4_dirblock_lock(dir, lblk, true);
 		retval = ext4_delete_entry(handle, dir, de, bh);
+		if (!inlined)
+			ext4_dirblock_unlock(dir, lblk, true);
+		ext4_dirop_unlock(dir, false, nofs);
 		if (retval)
 			goto out_handle;
 		inode_set_mtime_to_ts(dir, inode_set_ctime_current(dir));
@@ -3296,6 +3459,7 @@ int __ext4_unlink(struct inode *dir, const struct qstr *d_name,
 	ext4_journal_stop(handle);
 out_bh:
 	brelse(bh);
+	ext4_fname_free_filename(&fname);
 	return retval;
 }
 
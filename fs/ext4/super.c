@@ -120,6 +120,10 @@ static const struct fs_parameter_spec ext4_param_specs[];
  *
  * writepages:
  * transaction start -> page lock(s) -> i_data_sem (rw)
+ *
+ * create and unlink with pdirops:
+ * i_rwsem (r) -> transaction start -> i_dirop_sem (rw) ->
+ *   directory block lock (rw) -> i_data_sem (rw)
  */
 
 static const struct fs_context_operations ext4_context_ops = {
@@ -1492,6 +1496,7 @@ static void init_once(void *foo)
 	INIT_LIST_HEAD(&ei->i_orphan);
 	init_rwsem(&ei->xattr_sem);
 	init_rwsem(&ei->i_data_sem);
+	init_rwsem(&ei->i_dirop_sem);
 	inode_init_once(&ei->vfs_inode);
 	ext4_fc_init_inode(&ei->vfs_inode);
 }
@@ -1682,7 +1687,7 @@ enum {
 	Opt_dioread_nolock, Opt_dioread_lock,
 	Opt_discard, Opt_nodiscard, Opt_init_itable, Opt_noinit_itable,
 	Opt_max_dir_size_kb, Opt_nojournal_checksum, Opt_nombcache,
-	Opt_no_prefetch_block_bitmaps, Opt_mb_optimize_scan,
+	Opt_no_prefetch_block_bitmaps, Opt_mb_optimize_scan, Opt_pdirops,
 	Opt_errors, Opt_data, Opt_data_err, Opt_jqfmt, Opt_dax_type,
 #ifdef CONFIG_EXT4_DEBUG
 	Opt_fc_debug_max_replay, Opt_fc_debug_force
@@ -1825,6 +1830,7 @@ static const struct fs_parameter_spec ext4_param_specs[] = {
 	fsparam_flag	("no_prefetch_block_bitmaps",
 						Opt_no_prefetch_block_bitmaps),
 	fsparam_s32	("mb_optimize_scan",	Opt_mb_optimize_scan),
+	fsparam_flag	("pdirops",		Opt_pdirops),
 	fsparam_string	("check",		Opt_removed),	/* mount option from ext2/3 */
 	fsparam_flag	("nocheck",		Opt_removed),	/* mount option from ext2/3 */
 	fsparam_flag	("reservation",		Opt_removed),	/* mount option from ext2/3 */
@@ -1924,6 +1930,7 @@ static const struct mount_opts {
 	 MOPT_SET | MOPT_2 | MOPT_EXT4_ONLY},
 #endif
 	{Opt_abort, EXT4_MOUNT2_ABORT, MOPT_SET | MOPT_2},
+	{Opt_pdirops, EXT4_MOUNT2_PDIROPS, MOPT_SET | MOPT_2},
 	{Opt_err, 0, 0}
 };
 
@@ -5275,6 +5282,9 @@ static int __ext4_fill_super(struct fs_context *fc, struct super_block *sb)
 	/* i_version is always enabled now */
 	sb->s_flags |= SB_I_VERSION;
 
+	if (test_opt2(sb, PDIROPS))
+		sb->s_iflags |= SB_I_PAR_DIROPS;
+
 	err = ext4_check_feature_compatibility(sb, es, silent);
 	if (err)
 		goto failed_mount;
@@ -6497,6 +6507,13 @@ static int __ext4_remount(struct fs_context *fc, struct super_block *sb)
 		sbi->s_mount_opt ^= EXT4_MOUNT_JOURNAL_CHECKSUM;
 	}
 
+	if ((old_opts.s_mount_opt2 & EXT4_MOUNT2_PDIROPS) ^
+	    test_opt2(sb, PDIROPS)) {
+		ext4_msg(sb, KERN_ERR, "changing pdirops "
+			 "during remount not supported; ignoring");
+		sbi->s_mount_opt2 ^= EXT4_MOUNT2_PDIROPS;
+	}
+
 	if (test_opt(sb, DATA_FLAGS) == EXT4_MOUNT_JOURNAL_DATA) {
 		if (test_opt2(sb, EXPLICIT_DELALLOC)) {
 			ext4_msg(sb, KERN_ERR, "can't mount with "
@@ -7356,6 +7373,8 @@ static int __init ext4_init_fs(void)
 	for (i = 0; i < EXT4_WQ_HASH_SZ; i++)
 		init_waitqueue_head(&ext4__ioend_wq[i]);
 
+	ext4_init_dirblock_locks();
+
 	err = ext4_init_es();
 	if (err)
 		return err;
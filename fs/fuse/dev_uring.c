@@ -0,0 +1,781 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * FUSE: Filesystem in Userspace
+ *
+ * io_uring transport for FUSE requests.
+ *
+ * Instead of read() and write() on /dev/fuse, the daemon issues
+ * IORING_OP_URING_CMD commands on it.  Each ring entry is a buffer registered
+ * once with FUSE_IO_URING_CMD_REGISTER, into which the kernel copies the next
+ * request, in the format read() would return it.  The command completes once
+ * a request was copied; the daemon writes its reply to the same buffer, in the
+ * format write() takes, and sends FUSE_IO_URING_CMD_COMMIT_AND_FETCH, which
+ * both ends the request and hands the entry back for the next one.
+ *
+ * Entries are registered on a queue per CPU, and a request is served by the
+ * queue of the CPU it is submitted on: a daemon running a thread per CPU then
+ * answers requests locally, without any shared lock on the way.  Requests
+ * submitted on a CPU without entries, requests which do not expect a reply,
+ * FORGETs and INTERRUPTs still go through /dev/fuse.
+ */
+
+#include "fuse_i.h"
+#include "fuse_dev_i.h"
+#include "dev_uring_i.h"
+
+#include <linux/io_uring/cmd.h>
+#include <linux/module.h>
+#include <linux/uio.h>
+
+static bool __read_mostly enable_uring;
+module_param(enable_uring, bool, 0644);
+MODULE_PARM_DESC(enable_uring,
+		 "Enable userspace communication through io_uring");
+
+struct fuse_uring_pdu {
+	struct fuse_ring_ent *ent;
+};
+
+static struct fuse_ring_ent *uring_cmd_to_ring_ent(struct io_uring_cmd *cmd)
+{
+	struct fuse_uring_pdu *pdu = (struct fuse_uring_pdu *)cmd->pdu;
+
+	return pdu->ent;
+}
+
+static void uring_cmd_set_ring_ent(struct io_uring_cmd *cmd,
+				   struct fuse_ring_ent *ent)
+{
+	struct fuse_uring_pdu *pdu = (struct fuse_uring_pdu *)cmd->pdu;
+
+	pdu->ent = ent;
+}
+
+struct fuse_ring_queue *fuse_uring_req_queue(struct fuse_req *req)
+{
+	struct fuse_ring *ring = smp_load_acquire(&req->fm->fc->ring);
+	struct fuse_ring_queue *queue;
+
+	if (!ring || !test_bit(FR_ISREPLY, &req->flags))
+		return NULL;
+
+	queue = READ_ONCE(ring->queues[raw_smp_processor_id()]);
+	if (!queue || !READ_ONCE(queue->nr_ents))
+		return NULL;
+
+	return queue;
+}
+
+/* Called with queue->lock held */
+static void fuse_uring_assign_req(struct fuse_ring_ent *ent,
+				  struct fuse_req *req)
+{
+	ent->state = FRRS_FUSE_REQ;
+	ent->req = req;
+	req->ring_entry = ent;
+}
+
+/*
+ * Give the entry the next queued request, or make it available if there is
+ * none.  Called with queue->lock held.
+ */
+static bool fuse_uring_next_req(struct fuse_ring_ent *ent)
+{
+	struct fuse_ring_queue *queue = ent->queue;
+	struct fuse_req *req;
+
+	req = list_first_entry_or_null(&queue->fuse_req_queue, struct fuse_req,
+				       list);
+	if (!req) {
+		ent->state = FRRS_AVAILABLE;
+		list_add(&ent->list, &queue->ent_avail);
+		return false;
+	}
+
+	list_del_init(&req->list);
+	clear_bit(FR_URING, &req->flags);
+	fuse_uring_assign_req(ent, req);
+	return true;
+}
+
+/*
+ * The entry will not be used again: its command is completed with an error by
+ * the caller.  Called with queue->lock held.
+ */
+static struct io_uring_cmd *fuse_uring_release_ent(struct fuse_ring_ent *ent)
+{
+	struct io_uring_cmd *cmd = ent->cmd;
+
+	ent->state = FRRS_RELEASED;
+	ent->cmd = NULL;
+	ent->req = NULL;
+	WRITE_ONCE(ent->queue->nr_ents, ent->queue->nr_ents - 1);
+
+	return cmd;
+}
+
+/*
+ * Copy the request assigned to the entry to its buffer.  This runs in the
+ * context of the daemon task that issued the command.
+ *
+ * If the request could not be copied, it is ended, and an error is returned.
+ */
+static int fuse_uring_copy_to_ring(struct fuse_ring_ent *ent)
+{
+	struct fuse_pqueue *fpq = &ent->queue->fpq;
+	struct fuse_req *req = ent->req;
+	struct fuse_conn *fc = req->fm->fc;
+	struct fuse_args *args = req->args;
+	struct fuse_copy_state cs;
+	struct iov_iter iter;
+	unsigned int hash;
+	int err;
+
+	/* If request is too large, reply with an error */
+	if (ent->buf_len < req->in.h.len) {
+		req->out.h.error = -EIO;
+		/* SETXATTR is special, since it may contain too large data */
+		if (args->opcode == FUSE_SETXATTR)
+			req->out.h.error = -E2BIG;
+		fuse_request_end(req);
+		return -E2BIG;
+	}
+
+	spin_lock(&fpq->lock);
+	if (!fpq->connected) {
+		spin_unlock(&fpq->lock);
+		req->out.h.error = -ECONNABORTED;
+		fuse_request_end(req);
+		return -ECONNABORTED;
+	}
+	list_add(&req->list, &fpq->io);
+	spin_unlock(&fpq->lock);
+
+	err = import_ubuf(ITER_DEST, ent->buf, req->in.h.len, &iter);
+	if (!err) {
+		fuse_copy_init(&cs, 1, &iter);
+		cs.req = req;
+		err = fuse_copy_one(&cs, &req->in.h, sizeof(req->in.h));
+		if (!err)
+			err = fuse_copy_args(&cs, args->in_numargs,
+					     args->in_pages,
+					     (struct fuse_arg *) args->in_args,
+					     0);
+		fuse_copy_finish(&cs);
+	}
+
+	spin_lock(&fpq->lock);
+	clear_bit(FR_LOCKED, &req->flags);
+	if (!fpq->connected) {
+		err = fc->aborted ? -ECONNABORTED : -ENODEV;
+		goto out_end;
+	}
+	if (err) {
+		req->out.h.error = -EIO;
+		goto out_end;
+	}
+	hash = fuse_req_hash(req->in.h.unique);
+	list_move_tail(&req->list, &fpq->processing[hash]);
+	__fuse_get_request(req);
+	set_bit(FR_SENT, &req->flags);
+	spin_unlock(&fpq->lock);
+	/* matches barrier in request_wait_answer() */
+	smp_mb__after_atomic();
+	if (test_bit(FR_INTERRUPTED, &req->flags))
+		fuse_dev_queue_interrupt(req);
+	fuse_put_request(req);
+
+	return 0;
+
+out_end:
+	if (!test_bit(FR_PRIVATE, &req->flags))
+		list_del_init(&req->list);
+	spin_unlock(&fpq->lock);
+	fuse_request_end(req);
+	return err;
+}
+
+/*
+ * Hand the request assigned to the entry to the daemon, completing the command
+ * of the entry.  If the request does not fit in the entry buffer, the entry
+ * moves on to the next queued request, or waits for one.
+ */
+static void fuse_uring_send(struct fuse_ring_ent *ent, unsigned int issue_flags)
+{
+	struct fuse_ring_queue *queue = ent->queue;
+	struct io_uring_cmd *cmd;
+	int err;
+
+	for (;;) {
+		err = fuse_uring_copy_to_ring(ent);
+
+		spin_lock(&queue->lock);
+		if (!err) {
+			ent->state = FRRS_USERSPACE;
+			ent->req = NULL;
+			cmd = ent->cmd;
+			ent->cmd = NULL;
+			break;
+		}
+
+		ent->req = NULL;
+		if (err != -E2BIG || queue->stopped) {
+			cmd = fuse_uring_release_ent(ent);
+			if (queue->stopped)
+				err = -ENOTCONN;
+			break;
+		}
+		if (!fuse_uring_next_req(ent)) {
+			spin_unlock(&queue->lock);
+			return;
+		}
+		spin_unlock(&queue->lock);
+	}
+	spin_unlock(&queue->lock);
+
+	io_uring_cmd_done(cmd, err, 0, issue_flags);
+}
+
+static void fuse_uring_send_in_task(struct io_uring_cmd *cmd,
+				    unsigned int issue_flags)
+{
+	fuse_uring_send(uring_cmd_to_ring_ent(cmd), issue_flags);
+}
+
+/*
+ * Queue a request on the ring queue of the submitting CPU.  If an entry is
+ * waiting, the request is copied to it from the daemon's context.
+ */
+void fuse_uring_queue_req(struct fuse_ring_queue *queue, struct fuse_req *req)
+{
+	struct io_uring_cmd *cmd = NULL;
+	struct fuse_ring_ent *ent;
+
+	spin_lock(&queue->lock);
+	/*
+	 * All entries were released by io_uring.  Once the connection is
+	 * aborted, the input queue ends the request.
+	 */
+	if (unlikely(queue->stopped || !queue->nr_ents)) {
+		spin_unlock(&queue->lock);
+		fuse_dev_queue_req(&req->fm->fc->iq, req);
+		return;
+	}
+
+	ent = list_first_entry_or_null(&queue->ent_avail, struct fuse_ring_ent,
+				       list);
+	if (ent) {
+		list_del_init(&ent->list);
+		fuse_uring_assign_req(ent, req);
+		cmd = ent->cmd;
+	} else {
+		req->ring_queue = queue;
+		set_bit(FR_URING, &req->flags);
+		list_add_tail(&req->list, &queue->fuse_req_queue);
+	}
+	spin_unlock(&queue->lock);
+
+	if (cmd)
+		io_uring_cmd_complete_in_task(cmd, fuse_uring_send_in_task);
+}
+
+/*
+ * Take a request that no entry picked up yet off its queue, when the task
+ * waiting for it got a fatal signal.  Returns false if the request is, or
+ * is about to be, handed to the daemon.
+ */
+bool fuse_uring_remove_pending_req(struct fuse_req *req)
+{
+	struct fuse_ring_queue *queue = req->ring_queue;
+	bool removed = false;
+
+	if (!queue)
+		return false;
+
+	spin_lock(&queue->lock);
+	if (test_bit(FR_URING, &req->flags)) {
+		list_del_init(&req->list);
+		clear_bit(FR_URING, &req->flags);
+		removed = true;
+	}
+	spin_unlock(&queue->lock);
+
+	return removed;
+}
+
+/*
+ * Find a request handed out through io_uring, for a reply to its INTERRUPT
+ * written to /dev/fuse.  Returns the request with a reference held.
+ */
+struct fuse_req *fuse_uring_find_req(struct fuse_conn *fc, u64 unique)
+{
+	struct fuse_ring *ring = smp_load_acquire(&fc->ring);
+	struct fuse_ring_queue *queue;
+	struct fuse_pqueue *fpq;
+	struct fuse_req *req;
+	unsigned int qid;
+
+	if (!ring)
+		return NULL;
+
+	for (qid = 0; qid < ring->nr_queues; qid++) {
+		queue = READ_ONCE(ring->queues[qid]);
+		if (!queue)
+			continue;
+
+		fpq = &queue->fpq;
+		spin_lock(&fpq->lock);
+		req = fpq->connected ? fuse_request_find(fpq, unique) : NULL;
+		if (req) {
+			__fuse_get_request(req);
+			spin_unlock(&fpq->lock);
+			return req;
+		}
+		spin_unlock(&fpq->lock);
+	}
+
+	return NULL;
+}
+
+/*
+ * Called by fuse_resend(), with fc->lock held: move the requests the daemon
+ * holds through io_uring to @to_queue, to be sent again through /dev/fuse.
+ * The entries they were handed out in are lost with them and are released.
+ * Requests whose entry did not complete its command yet are left alone, the
+ * daemon is about to get them anyway.
+ */
+void fuse_uring_resend(struct fuse_conn *fc, struct list_head *to_queue)
+{
+	struct fuse_ring *ring = smp_load_acquire(&fc->ring);
+	struct fuse_ring_queue *queue;
+	struct fuse_req *req, *next;
+	struct fuse_pqueue *fpq;
+	unsigned int qid, i;
+
+	if (!ring)
+		return;
+
+	for (qid = 0; qid < ring->nr_queues; qid++) {
+		queue = READ_ONCE(ring->queues[qid]);
+		if (!queue)
+			continue;
+
+		fpq = &queue->fpq;
+		spin_lock(&fpq->lock);
+		spin_lock(&queue->lock);
+		for (i = 0; i < FUSE_PQ_HASH_SIZE; i++) {
+			list_for_each_entry_safe(req, next, &fpq->processing[i],
+						 list) {
+				if (req->ring_entry->state != FRRS_USERSPACE)
+					continue;
+				fuse_uring_release_ent(req->ring_entry);
+				req->ring_entry = NULL;
+				list_move_tail(&req->list, to_queue);
+			}
+		}
+		spin_unlock(&queue->lock);
+		spin_unlock(&fpq->lock);
+	}
+}
+
+/*
+ * The entry holds a new command: pick up the next request, or wait for one.
+ * Called with queue->lock held.
+ */
+static int fuse_uring_fetch_and_unlock(struct fuse_ring_ent *ent,
+				       unsigned int issue_flags)
+	__releases(ent->queue->lock)
+{
+	struct fuse_ring_queue *queue = ent->queue;
+	struct io_uring_cmd *cmd;
+
+	if (queue->stopped) {
+		cmd = fuse_uring_release_ent(ent);
+		spin_unlock(&queue->lock);
+		io_uring_cmd_done(cmd, -ENOTCONN, 0, issue_flags);
+		return -EIOCBQUEUED;
+	}
+
+	if (fuse_uring_next_req(ent)) {
+		spin_unlock(&queue->lock);
+		/* Already in the daemon's context, no need for task work */
+		fuse_uring_send(ent, issue_flags);
+		return -EIOCBQUEUED;
+	}
+	spin_unlock(&queue->lock);
+
+	return -EIOCBQUEUED;
+}
+
+static struct fuse_ring *fuse_uring_create(struct fuse_conn *fc)
+{
+	struct fuse_ring *ring;
+
+	ring = kzalloc(struct_size(ring, queues, nr_cpu_ids),
+		       GFP_KERNEL_ACCOUNT);
+	if (!ring)
+		return NULL;
+
+	ring->fc = fc;
+	ring->nr_queues = nr_cpu_ids;
+
+	spin_lock(&fc->lock);
+	if (fc->ring) {
+		kfree(ring);
+		ring = fc->ring;
+	} else {
+		/* Pairs with smp_load_acquire() in fuse_uring_req_queue() */
+		smp_store_release(&fc->ring, ring);
+	}
+	spin_unlock(&fc->lock);
+
+	return ring;
+}
+
+static struct fuse_ring_queue *fuse_uring_create_queue(struct fuse_ring *ring,
+						       unsigned int qid)
+{
+	struct fuse_conn *fc = ring->fc;
+	struct fuse_ring_queue *queue;
+	struct list_head *pq;
+
+	queue = kzalloc(sizeof(*queue), GFP_KERNEL_ACCOUNT);
+	pq = kcalloc(FUSE_PQ_HASH_SIZE, sizeof(struct list_head), GFP_KERNEL);
+	if (!queue || !pq) {
+		kfree(queue);
+		kfree(pq);
+		return NULL;
+	}
+
+	queue->ring = ring;
+	queue->qid = qid;
+	spin_lock_init(&queue->lock);
+	INIT_LIST_HEAD(&queue->ent_avail);
+	INIT_LIST_HEAD(&queue->ents);
+	INIT_LIST_HEAD(&queue->fuse_req_queue);
+	queue->fpq.processing = pq;
+	fuse_pqueue_init(&queue->fpq);
+
+	spin_lock(&fc->lock);
+	if (ring->queues[qid]) {
+		spin_unlock(&fc->lock);
+		kfree(queue->fpq.processing);
+		kfree(queue);
+		return ring->queues[qid];
+	}
+	/* fuse_uring_abort() only sees queues set up before the abort */
+	if (!fc->connected) {
+		queue->stopped = true;
+		queue->fpq.connected = 0;
+	}
+	WRITE_ONCE(ring->queues[qid], queue);
+	spin_unlock(&fc->lock);
+
+	return queue;
+}
+
+static int fuse_uring_register(struct io_uring_cmd *cmd,
+			       unsigned int issue_flags, struct fuse_conn *fc)
+{
+	const struct fuse_uring_cmd_req *cmd_req = io_uring_sqe_cmd(cmd->sqe);
+	void __user *buf = u64_to_user_ptr(READ_ONCE(cmd_req->buf));
+	unsigned int buf_len = READ_ONCE(cmd_req->buf_len);
+	unsigned int qid = READ_ONCE(cmd_req->qid);
+	struct fuse_ring *ring = smp_load_acquire(&fc->ring);
+	struct fuse_ring_queue *queue;
+	struct fuse_ring_ent *ent;
+
+	/* Same requirement as fuse_dev_do_read() for the read buffer */
+	if (buf_len < max_t(size_t, FUSE_MIN_READ_BUFFER,
+			    sizeof(struct fuse_in_header) +
+			    sizeof(struct fuse_write_in) +
+			    fc->max_write))
+		return -EINVAL;
+
+	if (!access_ok(buf, buf_len))
+		return -EFAULT;
+
+	if (!ring) {
+		ring = fuse_uring_create(fc);
+		if (!ring)
+			return -ENOMEM;
+	}
+
+	if (qid >= ring->nr_queues)
+		return -EINVAL;
+
+	queue = READ_ONCE(ring->queues[qid]);
+	if (!queue) {
+		queue = fuse_uring_create_queue(ring, qid);
+		if (!queue)
+			return -ENOMEM;
+	}
+
+	ent = kzalloc(sizeof(*ent), GFP_KERNEL_ACCOUNT);
+	if (!ent)
+		return -ENOMEM;
+
+	INIT_LIST_HEAD(&ent->list);
+	ent->queue = queue;
+	ent->buf = buf;
+	ent->buf_len = buf_len;
+	ent->cmd = cmd;
+	uring_cmd_set_ring_ent(cmd, ent);
+	io_uring_cmd_mark_cancelable(cmd, issue_flags);
+
+	spin_lock(&queue->lock);
+	list_add(&ent->entry, &queue->ents);
+	WRITE_ONCE(queue->nr_ents, queue->nr_ents + 1);
+
+	return fuse_uring_fetch_and_unlock(ent, issue_flags);
+}
+
+/*
+ * End the request the daemon answered through the entry, with the reply it
+ * wrote to the entry buffer.  Like fuse_dev_do_write(), the request is ended
+ * even if the reply is bogus.
+ */
+static void fuse_uring_commit(struct fuse_ring_ent *ent, struct fuse_req *req)
+{
+	struct fuse_pqueue *fpq = &ent->queue->fpq;
+	struct fuse_copy_state cs;
+	struct fuse_out_header oh;
+	struct iov_iter iter;
+	int err;
+
+	err = import_ubuf(ITER_SOURCE, ent->buf, ent->buf_len, &iter);
+	if (err)
+		goto out;
+
+	fuse_copy_init(&cs, 0, &iter);
+	cs.req = req;
+	err = fuse_copy_one(&cs, &oh, sizeof(oh));
+	if (err)
+		goto copy_finish;
+
+	err = -EINVAL;
+	if (oh.unique != req->in.h.unique || oh.len < sizeof(oh) ||
+	    oh.len > ent->buf_len || oh.error <= -512 || oh.error > 0)
+		goto copy_finish;
+
+	req->out.h = oh;
+	if (oh.error)
+		err = oh.len != sizeof(oh) ? -EINVAL : 0;
+	else
+		err = fuse_copy_out_args(&cs, req->args, oh.len);
+
+copy_finish:
+	fuse_copy_finish(&cs);
+out:
+	spin_lock(&fpq->lock);
+	clear_bit(FR_LOCKED, &req->flags);
+	if (fpq->connected && err)
+		req->out.h.error = -EIO;
+	if (!test_bit(FR_PRIVATE, &req->flags))
+		list_del_init(&req->list);
+	spin_unlock(&fpq->lock);
+
+	fuse_request_end(req);
+}
+
+static int fuse_uring_commit_fetch(struct io_uring_cmd *cmd,
+				   unsigned int issue_flags,
+				   struct fuse_conn *fc)
+{
+	const struct fuse_uring_cmd_req *cmd_req = io_uring_sqe_cmd(cmd->sqe);
+	u64 commit_id = READ_ONCE(cmd_req->commit_id);
+	unsigned int qid = READ_ONCE(cmd_req->qid);
+	struct fuse_ring *ring = smp_load_acquire(&fc->ring);
+	struct fuse_ring_queue *queue;
+	struct fuse_ring_ent *ent;
+	struct fuse_pqueue *fpq;
+	struct fuse_req *req;
+
+	if (!ring || qid >= ring->nr_queues)
+		return -EINVAL;
+
+	queue = READ_ONCE(ring->queues[qid]);
+	if (!queue)
+		return -EINVAL;
+
+	fpq = &queue->fpq;
+	spin_lock(&fpq->lock);
+	req = NULL;
+	if (fpq->connected && !(commit_id & FUSE_INT_REQ_BIT))
+		req = fuse_request_find(fpq, commit_id);
+	if (!req) {
+		spin_unlock(&fpq->lock);
+		return -ENOENT;
+	}
+
+	/*
+	 * Only requests handed out by entries of the queue are found here, but
+	 * the entry might not have completed its command yet.
+	 */
+	ent = req->ring_entry;
+	spin_lock(&queue->lock);
+	if (ent->state != FRRS_USERSPACE) {
+		spin_unlock(&queue->lock);
+		spin_unlock(&fpq->lock);
+		return -EBUSY;
+	}
+	spin_unlock(&queue->lock);
+	clear_bit(FR_SENT, &req->flags);
+	list_move(&req->list, &fpq->io);
+	set_bit(FR_LOCKED, &req->flags);
+	spin_unlock(&fpq->lock);
+
+	fuse_uring_commit(ent, req);
+
+	ent->cmd = cmd;
+	uring_cmd_set_ring_ent(cmd, ent);
+	io_uring_cmd_mark_cancelable(cmd, issue_flags);
+
+	spin_lock(&queue->lock);
+	return fuse_uring_fetch_and_unlock(ent, issue_flags);
+}
+
+/* io_uring is going away: release the entry if it is waiting for a request */
+static void fuse_uring_cancel(struct io_uring_cmd *cmd,
+			      unsigned int issue_flags)
+{
+	struct fuse_ring_ent *ent = uring_cmd_to_ring_ent(cmd);
+	struct fuse_ring_queue *queue = ent->queue;
+	bool release = false;
+
+	spin_lock(&queue->lock);
+	if (ent->state == FRRS_AVAILABLE) {
+		list_del_init(&ent->list);
+		fuse_uring_release_ent(ent);
+		release = true;
+	}
+	spin_unlock(&queue->lock);
+
+	if (release)
+		io_uring_cmd_done(cmd, -ENOTCONN, 0, issue_flags);
+}
+
+int fuse_uring_cmd(struct io_uring_cmd *cmd, unsigned int issue_flags)
+{
+	struct fuse_dev *fud;
+	struct fuse_conn *fc;
+
+	BUILD_BUG_ON(sizeof(struct fuse_uring_pdu) >
+		     sizeof_field(struct io_uring_cmd, pdu));
+
+	if (unlikely(issue_flags & IO_URING_F_CANCEL)) {
+		fuse_uring_cancel(cmd, issue_flags);
+		return 0;
+	}
+
+	if (!enable_uring)
+		return -EOPNOTSUPP;
+
+	/* struct fuse_uring_cmd_req does not fit in a 64 byte SQE */
+	if (!(issue_flags & IO_URING_F_SQE128))
+		return -EINVAL;
+
+	fud = fuse_get_dev(cmd->file);
+	if (!fud)
+		return -EPERM;
+	fc = fud->fc;
+
+	if (!READ_ONCE(fc->connected))
+		return fc->aborted ? -ECONNABORTED : -ENOTCONN;
+
+	switch (cmd->cmd_op) {
+	case FUSE_IO_URING_CMD_REGISTER:
+		return fuse_uring_register(cmd, issue_flags, fc);
+	case FUSE_IO_URING_CMD_COMMIT_AND_FETCH:
+		return fuse_uring_commit_fetch(cmd, issue_flags, fc);
+	default:
+		return -EINVAL;
+	}
+}
+
+static void fuse_uring_abort_queue(struct fuse_ring_queue *queue)
+{
+	struct fuse_ring_ent *ent, *next;
+	struct fuse_req *req;
+	LIST_HEAD(to_release);
+	LIST_HEAD(to_end);
+
+	spin_lock(&queue->lock);
+	queue->stopped = true;
+	list_for_each_entry(req, &queue->fuse_req_queue, list)
+		clear_bit(FR_URING, &req->flags);
+	list_splice_init(&queue->fuse_req_queue, &to_end);
+	/*
+	 * Commands of the daemon fail from now on, so entries it holds are
+	 * released here; they have no command to complete.  Entries with a
+	 * request assigned are released by fuse_uring_send(), which finds the
+	 * processing queue disconnected.  Released entries are left alone by
+	 * cancellation.
+	 */
+	list_for_each_entry(ent, &queue->ents, entry) {
+		if (ent->state == FRRS_USERSPACE)
+			fuse_uring_release_ent(ent);
+	}
+	list_for_each_entry(ent, &queue->ent_avail, list) {
+		ent->state = FRRS_RELEASED;
+		WRITE_ONCE(queue->nr_ents, queue->nr_ents - 1);
+	}
+	list_splice_init(&queue->ent_avail, &to_release);
+	spin_unlock(&queue->lock);
+
+	fuse_pqueue_abort(&queue->fpq, &to_end);
+	fuse_dev_end_requests(&to_end);
+
+	list_for_each_entry_safe(ent, next, &to_release, list) {
+		list_del_init(&ent->list);
+		io_uring_cmd_done(ent->cmd, -ENOTCONN, 0, IO_URING_F_UNLOCKED);
+		ent->cmd = NULL;
+	}
+}
+
+/* Called by fuse_abort_conn(), once the connection is marked disconnected */
+void fuse_uring_abort(struct fuse_conn *fc)
+{
+	struct fuse_ring *ring = smp_load_acquire(&fc->ring);
+	struct fuse_ring_queue *queue;
+	unsigned int qid;
+
+	if (!ring)
+		return;
+
+	for (qid = 0; qid < ring->nr_queues; qid++) {
+		queue = READ_ONCE(ring->queues[qid]);
+		if (queue)
+			fuse_uring_abort_queue(queue);
+	}
+}
+
+/*
+ * Free the ring with the connection.  Commands hold a reference to the
+ * /dev/fuse file, so none can be in flight by then.
+ */
+void fuse_uring_destruct(struct fuse_conn *fc)
+{
+	struct fuse_ring *ring = fc->ring;
+	struct fuse_ring_ent *ent, *next;
+	struct fuse_ring_queue *queue;
+	unsigned int qid;
+
+	if (!ring)
+		return;
+
+	for (qid = 0; qid < ring->nr_queues; qid++) {
+		queue = ring->queues[qid];
+		if (!queue)
+			continue;
+
+		WARN_ON(!list_empty(&queue->ent_avail));
+		WARN_ON(!list_empty(&queue->fuse_req_queue));
+		list_for_each_entry_safe(ent, next, &queue->ents, entry)
+			kfree(ent);
+		kfree(queue->fpq.processing);
+		kfree(queue);
+	}
+	kfree(ring);
+	fc->ring = NULL;
+}
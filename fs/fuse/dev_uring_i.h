@@ -0,0 +1,172 @@
+/* SPDX-License-Identifier: GPL-2.0
+ *
+ * FUSE: Filesystem in Userspace
+ *
+ * io_uring transport for FUSE requests.
+ */
+#ifndef _FS_FUSE_DEV_URING_I_H
+#define _FS_FUSE_DEV_URING_I_H
+
+#include "fuse_i.h"
+
+struct io_uring_cmd;
+
+/* IORING_OP_URING_CMD commands on /dev/fuse, in sqe->cmd_op */
+enum fuse_uring_cmd {
+	FUSE_IO_URING_CMD_INVALID = 0,
+
+	/* Register a ring entry buffer and wait for the first request */
+	FUSE_IO_URING_CMD_REGISTER = 1,
+
+	/* Commit the reply in the entry buffer and wait for the next request */
+	FUSE_IO_URING_CMD_COMMIT_AND_FETCH = 2,
+};
+
+/*
+ * Payload of the commands, in the command area of a 128 byte SQE.
+ *
+ * A request is copied to the entry buffer as read() on /dev/fuse would return
+ * it, and the reply is expected there as write() would take it, so @buf_len
+ * has the same minimum as a /dev/fuse read buffer.
+ */
+struct fuse_uring_cmd_req {
+	__u64	flags;
+
+	/* REGISTER: entry buffer, used for all requests of the entry */
+	__u64	buf;
+	__u32	buf_len;
+
+	/* queue of the entry: the CPU whose requests it serves */
+	__u16	qid;
+	__u16	padding;
+
+	/* COMMIT_AND_FETCH: unique id of the request being answered */
+	__u64	commit_id;
+};
+
+enum fuse_ring_ent_state {
+	FRRS_INVALID = 0,
+
+	/* holding a command, waiting for a request */
+	FRRS_AVAILABLE,
+
+	/* request assigned, to be copied in the daemon's context */
+	FRRS_FUSE_REQ,
+
+	/* request handed to the daemon, waiting for its reply */
+	FRRS_USERSPACE,
+
+	/* command completed with an error, entry no longer used */
+	FRRS_RELEASED,
+};
+
+/** A daemon buffer, and the command that hands it to the kernel */
+struct fuse_ring_ent {
+	struct fuse_ring_queue *queue;
+
+	/* entry on queue->ent_avail */
+	struct list_head list;
+
+	/* entry on queue->ents */
+	struct list_head entry;
+
+	/* command of the entry, NULL while the daemon has the entry */
+	struct io_uring_cmd *cmd;
+
+	enum fuse_ring_ent_state state;
+
+	/* request being copied to the buffer */
+	struct fuse_req *req;
+
+	void __user *buf;
+	unsigned int buf_len;
+};
+
+/** Ring entries and requests of one CPU */
+struct fuse_ring_queue {
+	struct fuse_ring *ring;
+
+	unsigned int qid;
+
+	/* Lock protecting the entry lists and request queue */
+	spinlock_t lock;
+
+	/* entries waiting for a request */
+	struct list_head ent_avail;
+
+	/* all entries ever registered, freed with the ring */
+	struct list_head ents;
+
+	/* requests waiting for an entry */
+	struct list_head fuse_req_queue;
+
+	/* requests handed to the daemon */
+	struct fuse_pqueue fpq;
+
+	/* entries that were not released */
+	unsigned int nr_ents;
+
+	/* set when the connection is aborted */
+	bool stopped;
+};
+
+/** io_uring transport of a connection */
+struct fuse_ring {
+	struct fuse_conn *fc;
+
+	unsigned int nr_queues;
+
+	/* queues are set up by their first entry, under fc->lock */
+	struct fuse_ring_queue *queues[];
+};
+
+#ifdef CONFIG_FUSE_IO_URING
+
+int fuse_uring_cmd(struct io_uring_cmd *cmd, unsigned int issue_flags);
+struct fuse_ring_queue *fuse_uring_req_queue(struct fuse_req *req);
+void fuse_uring_queue_req(struct fuse_ring_queue *queue, struct fuse_req *req);
+bool fuse_uring_remove_pending_req(struct fuse_req *req);
+struct fuse_req *fuse_uring_find_req(struct fuse_conn *fc, u64 unique);
+void fuse_uring_resend(struct fuse_conn *fc, struct list_head *to_queue);
+void fuse_uring_abort(struct fuse_conn *fc);
+void fuse_uring_destruct(struct fuse_conn *fc);
+
+#else /* CONFIG_FUSE_IO_URING */
+
+static inline struct fuse_ring_queue *fuse_uring_req_queue(struct fuse_req *req)
+{
+	return NULL;
+}
+
+static inline void fuse_uring_queue_req(struct fuse_ring_queue *queue,
+					struct fuse_req *req)
+{
+}
+
+static inline bool fuse_uring_remove_pending_req(struct fuse_req *req)
+{
+	return false;
+}
+
+static inline struct fuse_req *fuse_uring_find_req(struct fuse_conn *fc,
+						   u64 unique)
+{
+	return NULL;
+}
+
+static inline void fuse_uring_resend(struct fuse_conn *fc,
+				     struct list_head *to_queue)
+{
+}
+
+static inline void fuse_uring_abort(struct fuse_conn *fc)
+{
+}
+
+static inline void fuse_uring_destruct(struct fuse_conn *fc)
+{
+}
+
+#endif /* CONFIG_FUSE_IO_URING */
+
+#endif /* _FS_FUSE_DEV_URING_I_H */
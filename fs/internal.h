@@ -63,6 +63,28 @@ int do_symlinkat(struct filename *from, int newdfd, struct filename *to);
 int do_linkat(int olddfd, struct filename *old, int newdfd,
 			struct filename *new, int flags);
 
+#define LOOKUP_BATCH_DEPTH	4
+
+/* Lookups of many names relative to one dirfd, see lookup_batch_path() */
+struct lookup_batch {
+	int dfd;
+	unsigned int flags;
+	char *dir_name;		/* name of the deepest directory kept */
+	unsigned int nr_dirs;
+	unsigned int m_seq;	/* mount_lock when the first one was walked */
+	/* directories of the last names, each an ancestor of the next one */
+	struct lookup_batch_dir {
+		struct path path;
+		unsigned int len; /* of its name in dir_name, with the slash */
+		unsigned int seq; /* its d_seq after the walk */
+	} dirs[LOOKUP_BATCH_DEPTH];
+};
+
+void lookup_batch_init(struct lookup_batch *lb, int dfd, unsigned int flags);
+int lookup_batch_path(struct lookup_batch *lb, struct filename *name,
+		      struct path *path);
+void lookup_batch_end(struct lookup_batch *lb);
+
 /*
  * namespace.c
  */
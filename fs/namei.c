@@ -584,6 +584,8 @@ struct nameidata {
 	struct nameidata *saved;
 	unsigned	root_seq;
 	int		dfd;
+	const struct path *start;	/* instead of dfd, see lookup_batch_path() */
+	unsigned	start_skip;
 	vfsuid_t	dir_vfsuid;
 	umode_t		dir_mode;
 } __randomize_layout;
@@ -598,6 +600,8 @@ static void __set_nameidata(struct nameidata *p, int dfd, struct filename *name)
 	p->stack = p->internal;
 	p->depth = 0;
 	p->dfd = dfd;
+	p->start = NULL;
+	p->start_skip = 0;
 	p->name = name;
 	p->path.mnt = NULL;
 	p->path.dentry = NULL;
@@ -1699,6 +1703,73 @@ static struct dentry *__lookup_slow(const struct qstr *name,
 	return dentry;
 }
 
+/*
+ * Filesystems with SB_I_PAR_DIROPS create (through open) and unlink with the
+ * parent locked shared.  The name itself is then held against other creates
+ * and unlinks by DCACHE_PAR_UPDATE, everything else still takes the parent
+ * exclusive.  Casefolded directories don't keep negative dentries hashed, so
+ * two spellings of a name can't be told to be the same one there.
+ */
+static inline bool may_par_dirops(struct inode *dir)
+{
+	return (dir->i_sb->s_iflags & SB_I_PAR_DIROPS) && !IS_CASEFOLDED(dir);
+}
+
+/*
+ * Returns false if the dentry was unhashed or moved while we waited for it;
+ * the caller has to look the name up again.
+ */
+static bool d_lock_update(struct dentry *dentry, struct dentry *parent)
+{
+	bool waited = false;
+
+	spin_lock(&dentry->d_lock);
+	while (dentry->d_flags & DCACHE_PAR_UPDATE) {
+		spin_unlock(&dentry->d_lock);
+		wait_var_event(&dentry->d_flags,
+			       !(READ_ONCE(dentry->d_flags) & DCACHE_PAR_UPDATE));
+		waited = true;
+		spin_lock(&dentry->d_lock);
+	}
+	if (waited && (d_unhashed(dentry) || dentry->d_parent != parent)) {
+		spin_unlock(&dentry->d_lock);
+		return false;
+	}
+	dentry->d_flags |= DCACHE_PAR_UPDATE;
+	spin_unlock(&dentry->d_lock);
+	return true;
+}
+
+static void d_unlock_update(struct dentry *dentry)
+{
+	spin_lock(&dentry->d_lock);
+	dentry->d_flags &= ~DCACHE_PAR_UPDATE;
+	spin_unlock(&dentry->d_lock);
+	/* pairs with the barrier in prepare_to_wait_event() */
+	smp_mb();
+	wake_up_var(&dentry->d_flags);
+}
+
+/*
+ * lookup_one_qstr_excl() for a parent locked shared: the name is returned
+ * held with d_lock_update().
+ */
+static struct dentry *lookup_one_qstr_update(const struct qstr *name,
+					     struct dentry *base,
+					     unsigned int flags)
+{
+	struct dentry *dentry;
+
+	for (;;) {
+		dentry = lookup_dcache(name, base, flags);
+		if (!dentry)
+			dentry = __lookup_slow(name, base, flags);
+		if (IS_ERR(dentry) || d_lock_update(dentry, base))
+			return dentry;
+		dput(dentry);
+	}
+}
+
 static struct dentry *lookup_slow(const struct qstr *name,
 				  struct dentry *dir,
 				  unsigned int flags)
@@ -2352,7 +2423,7 @@ static int link_path_walk(const char *name, struct nameidata *nd)
 static const char *path_init(struct nameidata *nd, unsigned flags)
 {
 	int error;
-	const char *s = nd->name->name;
+	const char *s = nd->name->name + nd->start_skip;
 
 	/* LOOKUP_CACHED requires RCU, ask caller to retry */
 	if ((flags & (LOOKUP_RCU | LOOKUP_CACHED)) == LOOKUP_CACHED)
@@ -2399,7 +2470,18 @@ static const char *path_init(struct nameidata *nd, unsigned flags)
 	}
 
 	/* Relative pathname -- get the starting-point it is relative to. */
-	if (nd->dfd == AT_FDCWD) {
+	if (nd->start) {
+		/* Pinned by the caller, permissions checked as for a dirfd */
+		if (*s && unlikely(!d_can_lookup(nd->start->dentry)))
+			return ERR_PTR(-ENOTDIR);
+
+		nd->path = *nd->start;
+		nd->inode = nd->path.dentry->d_inode;
+		if (flags & LOOKUP_RCU)
+			nd->seq = read_seqcount_begin(&nd->path.dentry->d_seq);
+		else
+			path_get(&nd->path);
+	} else if (nd->dfd == AT_FDCWD) {
 		if (flags & LOOKUP_RCU) {
 			struct fs_struct *fs = current->fs;
 			unsigned seq;
@@ -2503,27 +2585,192 @@ static int path_lookupat(struct nameidata *nd, unsigned flags, struct path *path
 	return err;
 }
 
-int filename_lookup(int dfd, struct filename *name, unsigned flags,
-		    struct path *path, struct path *root)
+static int __filename_lookup(struct nameidata *nd, unsigned flags,
+			     struct path *path)
 {
 	int retval;
-	struct nameidata nd;
-	if (IS_ERR(name))
-		return PTR_ERR(name);
-	set_nameidata(&nd, dfd, name, root);
-	retval = path_lookupat(&nd, flags | LOOKUP_RCU, path);
+
+	retval = path_lookupat(nd, flags | LOOKUP_RCU, path);
 	if (unlikely(retval == -ECHILD))
-		retval = path_lookupat(&nd, flags, path);
+		retval = path_lookupat(nd, flags, path);
 	if (unlikely(retval == -ESTALE))
-		retval = path_lookupat(&nd, flags | LOOKUP_REVAL, path);
+		retval = path_lookupat(nd, flags | LOOKUP_REVAL, path);
 
 	if (likely(!retval))
-		audit_inode(name, path->dentry,
+		audit_inode(nd->name, path->dentry,
 			    flags & LOOKUP_MOUNTPOINT ? AUDIT_INODE_NOEVAL : 0);
 	restore_nameidata();
 	return retval;
 }
 
+int filename_lookup(int dfd, struct filename *name, unsigned flags,
+		    struct path *path, struct path *root)
+{
+	struct nameidata nd;
+	if (IS_ERR(name))
+		return PTR_ERR(name);
+	set_nameidata(&nd, dfd, name, root);
+	return __filename_lookup(&nd, flags, path);
+}
+
+void lookup_batch_init(struct lookup_batch *lb, int dfd, unsigned int flags)
+{
+	lb->dfd = dfd;
+	lb->flags = flags;
+	lb->dir_name = NULL;
+	lb->nr_dirs = 0;
+}
+
+/* Forget the kept directories from the @nr-th on */
+static void lookup_batch_put_dirs(struct lookup_batch *lb, unsigned int nr)
+{
+	while (lb->nr_dirs > nr)
+		path_put(&lb->dirs[--lb->nr_dirs].path);
+}
+
+void lookup_batch_end(struct lookup_batch *lb)
+{
+	lookup_batch_put_dirs(lb, 0);
+	if (lb->dir_name)
+		__putname(lb->dir_name);
+	lookup_batch_init(lb, lb->dfd, lb->flags);
+}
+
+/* Is the kept directory still where its name led when it was walked? */
+static bool lookup_batch_dir_valid(const struct lookup_batch_dir *d)
+{
+	struct dentry *dentry = d->path.dentry;
+
+	return !d_unhashed(dentry) &&
+	       !read_seqcount_retry(&dentry->d_seq, d->seq);
+}
+
+/*
+ * Make the directory named by the first @len bytes of @s, trailing slash
+ * included, the deepest one kept in @lb, walking it from the deepest kept
+ * directory whose name is a prefix of it.
+ */
+static int lookup_batch_dir(struct lookup_batch *lb, const char *s,
+			    unsigned int len)
+{
+	struct lookup_batch_dir *d;
+	struct filename *name;
+	struct nameidata nd;
+	struct path dir;
+	unsigned int i, prev;
+	int error;
+
+	if (lb->nr_dirs && read_seqretry(&mount_lock, lb->m_seq))
+		lookup_batch_put_dirs(lb, 0);
+
+	for (i = 0, prev = 0; i < lb->nr_dirs; prev = d->len, i++) {
+		d = &lb->dirs[i];
+		if (d->len > len ||
+		    memcmp(lb->dir_name + prev, s + prev, d->len - prev) ||
+		    !lookup_batch_dir_valid(d))
+			break;
+	}
+	lookup_batch_put_dirs(lb, i);
+	if (i && lb->dirs[i - 1].len == len)
+		return 0;
+
+	if (!lb->dir_name) {
+		lb->dir_name = __getname();
+		if (!lb->dir_name)
+			return -ENOMEM;
+	}
+	memcpy(lb->dir_name, s, len);
+	lb->dir_name[len] = '\0';
+
+retry:
+	if (!i)
+		lb->m_seq = read_seqbegin(&mount_lock);
+	name = getname_kernel(lb->dir_name);
+	if (IS_ERR(name))
+		return PTR_ERR(name);
+	if (i) {
+		set_nameidata(&nd, AT_FDCWD, name, NULL);
+		nd.start = &lb->dirs[i - 1].path;
+		nd.start_skip = lb->dirs[i - 1].len;
+	} else {
+		set_nameidata(&nd, lb->dfd, name, NULL);
+	}
+	/* the trailing slash makes it a directory lookup, automounts included */
+	error = __filename_lookup(&nd, LOOKUP_FOLLOW, &dir);
+	putname(name);
+	if (unlikely(error == -ESTALE) && i) {
+		/* a kept directory may be what went stale */
+		lookup_batch_put_dirs(lb, 0);
+		i = 0;
+		goto retry;
+	}
+	if (error)
+		return error;
+
+	if (i == LOOKUP_BATCH_DEPTH) {
+		path_put(&lb->dirs[0].path);
+		memmove(&lb->dirs[0], &lb->dirs[1],
+			--i * sizeof(lb->dirs[0]));
+	}
+	d = &lb->dirs[i];
+	d->path = dir;
+	d->len = len;
+	d->seq = raw_seqcount_begin(&dir.dentry->d_seq);
+	lb->nr_dirs = i + 1;
+	return 0;
+}
+
+/**
+ * lookup_batch_path - look up one of many names relative to the same dirfd
+ * @lb:		batch state, from lookup_batch_init()
+ * @name:	pathname to look up
+ * @path:	pointer to container for result
+ *
+ * Does what filename_lookup() with @lb's dirfd and flags would, but names
+ * share the walk of their directories with the previous names: a directory
+ * is walked from the deepest directory kept in @lb whose name is a prefix of
+ * its own, and kept in turn, up to LOOKUP_BATCH_DEPTH of them.  Only the last
+ * component is walked from it, in RCU mode first and falling back to
+ * refcounted walk per name.
+ * A kept directory is walked again once it is renamed or unhashed, and all
+ * of them after any mount change.  Renames of directories in between are not
+ * noticed: names below them resolve as if looked up before the rename, like
+ * a lookup racing with it could.
+ * The batch must not use scoped lookups; release it with lookup_batch_end().
+ */
+int lookup_batch_path(struct lookup_batch *lb, struct filename *name,
+		      struct path *path)
+{
+	const char *s = name->name;
+	const char *slash = strrchr(s, '/');
+	struct lookup_batch_dir *d;
+	struct nameidata nd;
+	unsigned int len;
+	int error;
+
+	/* Nothing to share, or a trailing slash on the last component */
+	if (!slash || !slash[1])
+		return filename_lookup(lb->dfd, name, lb->flags, path, NULL);
+
+	len = slash - s + 1;
+	error = lookup_batch_dir(lb, s, len);
+	if (error)
+		return error;
+
+	d = &lb->dirs[lb->nr_dirs - 1];
+	set_nameidata(&nd, AT_FDCWD, name, NULL);
+	nd.start = &d->path;
+	nd.start_skip = len;
+	error = __filename_lookup(&nd, lb->flags, path);
+	if (unlikely(error == -ESTALE)) {
+		/* the directory itself may be what went stale */
+		lookup_batch_end(lb);
+		error = filename_lookup(lb->dfd, name,
+					lb->flags | LOOKUP_REVAL, path, NULL);
+	}
+	return error;
+}
+
 /* Returns 0 and nd will be valid on success; Returns error, otherwise. */
 static int path_parentat(struct nameidata *nd, unsigned flags,
 				struct path *parent)
@@ -3387,7 +3634,8 @@ static struct dentry *atomic_open(struct nameidata *nd, struct dentry *dentry,
 /*
  * Look up and maybe create and open the last component.
  *
- * Must be called with parent locked (exclusive in O_CREAT case).
+ * Must be called with parent locked (exclusive in O_CREAT case, unless the
+ * filesystem has SB_I_PAR_DIROPS).
  *
  * Returns 0 on success, that is, if
  *  the file was successfully atomically created (if necessary) and opened, or
@@ -3407,7 +3655,7 @@ static struct dentry *lookup_open(struct nameidata *nd, struct file *file,
 	struct dentry *dir = nd->path.dentry;
 	struct inode *dir_inode = dir->d_inode;
 	int open_flag = op->open_flag;
-	struct dentry *dentry;
+	struct dentry *dentry, *update = NULL;
 	int error, create_error = 0;
 	umode_t mode = op->mode;
 	DECLARE_WAIT_QUEUE_HEAD_ONSTACK(wq);
@@ -3416,6 +3664,7 @@ static struct dentry *lookup_open(struct nameidata *nd, struct file *file,
 		return ERR_PTR(-ENOENT);
 
 	file->f_mode &= ~FMODE_CREATED;
+again:
 	dentry = d_lookup(dir, &nd->last);
 	for (;;) {
 		if (!dentry) {
@@ -3440,6 +3689,20 @@ static struct dentry *lookup_open(struct nameidata *nd, struct file *file,
 		return dentry;
 	}
 
+	if ((open_flag & O_CREAT) && may_par_dirops(dir_inode)) {
+		if (!d_lock_update(dentry, dir)) {
+			dput(dentry);
+			goto again;
+		}
+		update = dget(dentry);
+		if (dentry->d_inode) {
+			/* created while we waited */
+			d_unlock_update(update);
+			dput(update);
+			return dentry;
+		}
+	}
+
 	/*
 	 * Checking write permission is tricky, bacuse we don't know if we are
 	 * going to actually need it: O_CREAT opens should work as long as the
@@ -3468,7 +3731,7 @@ static struct dentry *lookup_open(struct nameidata *nd, struct file *file,
 		dentry = atomic_open(nd, dentry, file, open_flag, mode);
 		if (unlikely(create_error) && dentry == ERR_PTR(-ENOENT))
 			dentry = ERR_PTR(create_error);
-		return dentry;
+		goto out_update;
 	}
 
 	if (d_in_lookup(dentry)) {
@@ -3503,11 +3766,17 @@ static struct dentry *lookup_open(struct nameidata *nd, struct file *file,
 		error = create_error;
 		goto out_dput;
 	}
+out_update:
+	if (update) {
+		d_unlock_update(update);
+		dput(update);
+	}
 	return dentry;
 
 out_dput:
 	dput(dentry);
-	return ERR_PTR(error);
+	dentry = ERR_PTR(error);
+	goto out_update;
 }
 
 static const char *open_last_lookups(struct nameidata *nd,
@@ -3515,7 +3784,7 @@ static const char *open_last_lookups(struct nameidata *nd,
 {
 	struct dentry *dir = nd->path.dentry;
 	int open_flag = op->open_flag;
-	bool got_write = false;
+	bool got_write = false, excl;
 	struct dentry *dentry;
 	const char *res;
 
@@ -3559,14 +3828,15 @@ static const char *open_last_lookups(struct nameidata *nd,
 		 * dropping this one anyway.
 		 */
 	}
-	if (open_flag & O_CREAT)
+	excl = (open_flag & O_CREAT) && !may_par_dirops(dir->d_inode);
+	if (excl)
 		inode_lock(dir->d_inode);
 	else
 		inode_lock_shared(dir->d_inode);
 	dentry = lookup_open(nd, file, op, got_write);
 	if (!IS_ERR(dentry) && (file->f_mode & FMODE_CREATED))
 		fsnotify_create(dir->d_inode, dentry);
-	if (open_flag & O_CREAT)
+	if (excl)
 		inode_unlock(dir->d_inode);
 	else
 		inode_unlock_shared(dir->d_inode);
@@ -4373,6 +4643,7 @@ int do_unlinkat(int dfd, struct filename *name)
 	struct inode *inode = NULL;
 	struct inode *delegated_inode = NULL;
 	unsigned int lookup_flags = 0;
+	bool par;
 retry:
 	error = filename_parentat(dfd, name, lookup_flags, &path, &last, &type);
 	if (error)
@@ -4386,8 +4657,17 @@ int do_unlinkat(int dfd, struct filename *name)
 	if (error)
 		goto exit2;
 retry_deleg:
-	inode_lock_nested(path.dentry->d_inode, I_MUTEX_PARENT);
-	dentry = lookup_one_qstr_excl(&last, path.dentry, lookup_flags);
+	/* directories still need the parent exclusive, see do_rmdir() */
+	par = may_par_dirops(path.dentry->d_inode);
+	if (par) {
+		inode_lock_shared_nested(path.dentry->d_inode, I_MUTEX_PARENT);
+		dentry = lookup_one_qstr_update(&last, path.dentry,
+						lookup_flags);
+	} else {
+		inode_lock_nested(path.dentry->d_inode, I_MUTEX_PARENT);
+		dentry = lookup_one_qstr_excl(&last, path.dentry,
+					      lookup_flags);
+	}
 	error = PTR_ERR(dentry);
 	if (!IS_ERR(dentry)) {
 
@@ -4402,9 +4682,14 @@ int do_unlinkat(int dfd, struct filename *name)
 		error = vfs_unlink(mnt_idmap(path.mnt), path.dentry->d_inode,
 				   dentry, &delegated_inode);
 exit3:
+		if (par)
+			d_unlock_update(dentry);
 		dput(dentry);
 	}
-	inode_unlock(path.dentry->d_inode);
+	if (par)
+		inode_unlock_shared(path.dentry->d_inode);
+	else
+		inode_unlock(path.dentry->d_inode);
 	if (inode)
 		iput(inode);	/* truncate the inode here */
 	inode = NULL;
@@ -53,6 +53,14 @@
  */
 static unsigned int pipe_max_size = 1048576;
 
+/*
+ * Largest order of the pages backing anonymous buffers of grown pipes, see
+ * pipe_buf_order(). Can be lowered by root in /proc/sys/fs/pipe-max-buf-order,
+ * zero keeping single page buffers.
+ */
+static unsigned int pipe_max_buf_order = PAGE_ALLOC_COSTLY_ORDER;
+static unsigned int pipe_buf_order_limit = PAGE_ALLOC_COSTLY_ORDER;
+
 /* Maximum allocatable pages per user. Hard limit is unset by default, soft
  * matches default values.
  */
@@ -112,11 +120,57 @@ void pipe_double_lock(struct pipe_inode_info *pipe1,
 	pipe_lock(pipe2);
 }
 
+/* Let the pipe use as many slots as it has pages left */
+static void pipe_update_max_usage(struct pipe_inode_info *pipe)
+{
+	unsigned int max_usage = 0;
+
+	if (pipe->large_pages < pipe->ring_size)
+		max_usage = pipe->ring_size - pipe->large_pages;
+	WRITE_ONCE(pipe->max_usage, max_usage);
+}
+
+/**
+ * pipe_buf_charge - account a large buffer entering a pipe
+ * @pipe:	the pipe the buffer is added to
+ * @buf:	the buffer
+ *
+ * The pages beyond the first of a buffer flagged %PIPE_BUF_FLAG_LARGE take
+ * slots off the pipe, so that the pipe holds no more pages than it has slots.
+ * Copies of such a buffer that share its page must drop the flag.
+ */
+void pipe_buf_charge(struct pipe_inode_info *pipe,
+		     const struct pipe_buffer *buf)
+{
+	if (!(buf->flags & PIPE_BUF_FLAG_LARGE))
+		return;
+
+	pipe->large_pages += compound_nr(buf->page) - 1;
+	pipe_update_max_usage(pipe);
+}
+
+/**
+ * pipe_buf_uncharge - account a large buffer leaving a pipe
+ * @pipe:	the pipe the buffer was charged to
+ * @buf:	the buffer
+ */
+void pipe_buf_uncharge(struct pipe_inode_info *pipe,
+		       const struct pipe_buffer *buf)
+{
+	if (!(buf->flags & PIPE_BUF_FLAG_LARGE))
+		return;
+
+	pipe->large_pages -= compound_nr(buf->page) - 1;
+	pipe_update_max_usage(pipe);
+}
+
 static void anon_pipe_buf_release(struct pipe_inode_info *pipe,
 				  struct pipe_buffer *buf)
 {
 	struct page *page = buf->page;
 
+	pipe_buf_uncharge(pipe, buf);
+
 	/*
 	 * If nobody else uses this page, and we don't already have a
 	 * temporary page, let's keep track of it as a one-deep
@@ -133,7 +187,8 @@ static bool anon_pipe_buf_try_steal(struct pipe_inode_info *pipe,
 {
 	struct page *page = buf->page;
 
-	if (page_count(page) != 1)
+	/* Large buffers are not handed out as page cache pages */
+	if (page_count(page) != 1 || PageCompound(page))
 		return false;
 	memcg_kmem_uncharge_page(page, 0);
 	__SetPageLocked(page);
@@ -424,6 +479,35 @@ static inline bool pipe_writable(const struct pipe_inode_info *pipe)
 		!READ_ONCE(pipe->readers);
 }
 
+/*
+ * Get a page for a new anonymous buffer: one of order pipe->buf_order if
+ * @large and that is cheap to find, or a single page. The cached page is used
+ * if it is of the right order.
+ */
+static struct page *anon_pipe_get_page(struct pipe_inode_info *pipe, bool large)
+{
+	unsigned int order = large ? pipe->buf_order : 0;
+	struct page *page = pipe->tmp_page;
+
+	if (page && compound_order(page) == order) {
+		pipe->tmp_page = NULL;
+		return page;
+	}
+
+	/*
+	 * Not from highmem: buffer consumers such as fuse map the first page
+	 * only and expect the rest of the buffer to follow.
+	 */
+	if (order) {
+		page = alloc_pages(GFP_USER | __GFP_ACCOUNT | __GFP_COMP |
+				   __GFP_NORETRY | __GFP_NOWARN, order);
+		if (page)
+			return page;
+	}
+
+	return alloc_page(GFP_HIGHUSER | __GFP_ACCOUNT);
+}
+
 static ssize_t
 pipe_write(struct kiocb *iocb, struct iov_iter *from)
 {
@@ -465,19 +549,19 @@ pipe_write(struct kiocb *iocb, struct iov_iter *from)
 	 * the last buffer.
 	 *
 	 * That naturally merges small writes, but it also
-	 * page-aligns the rest of the writes for large writes
-	 * spanning multiple pages.
+	 * buffer-aligns the rest of the writes for large writes
+	 * spanning multiple buffers.
 	 */
 	head = pipe->head;
 	was_empty = pipe_empty(head, pipe->tail);
-	chars = total_len & (PAGE_SIZE-1);
+	chars = total_len & ((PAGE_SIZE << pipe->buf_order) - 1);
 	if (chars && !was_empty) {
 		unsigned int mask = pipe->ring_size - 1;
 		struct pipe_buffer *buf = &pipe->bufs[(head - 1) & mask];
 		int offset = buf->offset + buf->len;
 
 		if ((buf->flags & PIPE_BUF_FLAG_CAN_MERGE) &&
-		    offset + chars <= PAGE_SIZE) {
+		    offset + chars <= page_size(buf->page)) {
 			ret = pipe_buf_confirm(pipe, buf);
 			if (ret)
 				goto out;
@@ -506,17 +590,27 @@ pipe_write(struct kiocb *iocb, struct iov_iter *from)
 		if (!pipe_full(head, pipe->tail, pipe->max_usage)) {
 			unsigned int mask = pipe->ring_size - 1;
 			struct pipe_buffer *buf;
-			struct page *page = pipe->tmp_page;
+			struct page *page;
+			bool large;
+			size_t size;
 			int copied;
 
-			if (!page) {
-				page = alloc_page(GFP_HIGHUSER | __GFP_ACCOUNT);
-				if (unlikely(!page)) {
-					ret = ret ? : -ENOMEM;
-					break;
-				}
-				pipe->tmp_page = page;
+			/*
+			 * Large buffers only for bulk data, and only if the
+			 * pipe has room left for all of their pages. Packets
+			 * keep a page each, like spliced pages.
+			 */
+			large = pipe->buf_order && !is_packetized(filp) &&
+				iov_iter_count(from) > PAGE_SIZE &&
+				pipe_occupancy(head, pipe->tail) +
+				(1U << pipe->buf_order) <= pipe->max_usage;
+
+			page = anon_pipe_get_page(pipe, large);
+			if (unlikely(!page)) {
+				ret = ret ? : -ENOMEM;
+				break;
 			}
+			size = page_size(page);
 
 			/* Allocate a slot in the ring in advance and attach an
 			 * empty buffer.  If we fault or otherwise fail to use
@@ -535,10 +629,13 @@ pipe_write(struct kiocb *iocb, struct iov_iter *from)
 				buf->flags = PIPE_BUF_FLAG_PACKET;
 			else
 				buf->flags = PIPE_BUF_FLAG_CAN_MERGE;
-			pipe->tmp_page = NULL;
+			if (PageCompound(page)) {
+				buf->flags |= PIPE_BUF_FLAG_LARGE;
+				pipe_buf_charge(pipe, buf);
+			}
 
-			copied = copy_page_from_iter(page, 0, PAGE_SIZE, from);
-			if (unlikely(copied < PAGE_SIZE && iov_iter_count(from))) {
+			copied = copy_page_from_iter(page, 0, size, from);
+			if (unlikely(copied < size && iov_iter_count(from))) {
 				if (!ret)
 					ret = -EFAULT;
 				break;
@@ -857,7 +954,7 @@ void free_pipe_info(struct pipe_inode_info *pipe)
 		put_watch_queue(pipe->watch_queue);
 #endif
 	if (pipe->tmp_page)
-		__free_page(pipe->tmp_page);
+		put_page(pipe->tmp_page);
 	kfree(pipe->bufs);
 	kfree(pipe);
 }
@@ -1277,8 +1374,9 @@ int pipe_resize_ring(struct pipe_inode_info *pipe, unsigned int nr_slots)
 	head = pipe->head;
 	tail = pipe->tail;
 
+	/* Pages beyond the first of large buffers count as slots */
 	n = pipe_occupancy(head, tail);
-	if (nr_slots < n) {
+	if (nr_slots < n + pipe->large_pages) {
 		spin_unlock_irq(&pipe->rd_wait.lock);
 		kfree(bufs);
 		return -EBUSY;
@@ -1316,7 +1414,7 @@ int pipe_resize_ring(struct pipe_inode_info *pipe, unsigned int nr_slots)
 	pipe->head = head;
 
 	if (!pipe_has_watch_queue(pipe)) {
-		pipe->max_usage = nr_slots;
+		pipe_update_max_usage(pipe);
 		pipe->nr_accounted = nr_slots;
 	}
 
@@ -1327,6 +1425,29 @@ int pipe_resize_ring(struct pipe_inode_info *pipe, unsigned int nr_slots)
 	return 0;
 }
 
+/* Capacity of the pipe, in pages */
+static unsigned int pipe_nr_pages(const struct pipe_inode_info *pipe)
+{
+	return pipe->max_usage + pipe->large_pages;
+}
+
+/*
+ * Order of the pages backing large anonymous buffers of a pipe of @nr_pages:
+ * pipes grown past the default size get larger buffers for bulk writes, up to
+ * pipe_max_buf_order and to a PIPE_DEF_BUFFERS-th of the pipe, so that bulk
+ * transfers move fewer and larger units. The pipe keeps a slot per page, and
+ * large buffers take as many slots as they hold pages, so the memory the pipe
+ * may hold is unchanged.
+ */
+static unsigned int pipe_buf_order(unsigned int nr_pages)
+{
+	if (nr_pages <= PIPE_DEF_BUFFERS)
+		return 0;
+
+	return min_t(unsigned int, ilog2(nr_pages / PIPE_DEF_BUFFERS),
+		     READ_ONCE(pipe_max_buf_order));
+}
+
 /*
  * Allocate a new array of pipe buffers and copy the info over. Returns the
  * pipe size if successful, or return -ERROR on error.
@@ -1334,16 +1455,16 @@ int pipe_resize_ring(struct pipe_inode_info *pipe, unsigned int nr_slots)
 static long pipe_set_size(struct pipe_inode_info *pipe, unsigned int arg)
 {
 	unsigned long user_bufs;
-	unsigned int nr_slots, size;
+	unsigned int nr_pages, order, size;
 	long ret = 0;
 
 	if (pipe_has_watch_queue(pipe))
 		return -EBUSY;
 
 	size = round_pipe_size(arg);
-	nr_slots = size >> PAGE_SHIFT;
+	nr_pages = size >> PAGE_SHIFT;
 
-	if (!nr_slots)
+	if (!nr_pages)
 		return -EINVAL;
 
 	/*
@@ -1353,13 +1474,13 @@ static long pipe_set_size(struct pipe_inode_info *pipe, unsigned int arg)
 	 * Decreasing the pipe capacity is always permitted, even
 	 * if the user is currently over a limit.
 	 */
-	if (nr_slots > pipe->max_usage &&
+	if (nr_pages > pipe_nr_pages(pipe) &&
 			size > pipe_max_size && !capable(CAP_SYS_RESOURCE))
 		return -EPERM;
 
-	user_bufs = account_pipe_buffers(pipe->user, pipe->nr_accounted, nr_slots);
+	user_bufs = account_pipe_buffers(pipe->user, pipe->nr_accounted, nr_pages);
 
-	if (nr_slots > pipe->max_usage &&
+	if (nr_pages > pipe_nr_pages(pipe) &&
 			(too_many_pipe_buffers_hard(user_bufs) ||
 			 too_many_pipe_buffers_soft(user_bufs)) &&
 			pipe_is_unprivileged_user()) {
@@ -1367,14 +1488,16 @@ static long pipe_set_size(struct pipe_inode_info *pipe, unsigned int arg)
 		goto out_revert_acct;
 	}
 
-	ret = pipe_resize_ring(pipe, nr_slots);
+	ret = pipe_resize_ring(pipe, nr_pages);
 	if (ret < 0)
 		goto out_revert_acct;
 
-	return pipe->max_usage * PAGE_SIZE;
+	pipe->buf_order = pipe_buf_order(nr_pages);
+
+	return pipe_nr_pages(pipe) * PAGE_SIZE;
 
 out_revert_acct:
-	(void) account_pipe_buffers(pipe->user, nr_slots, pipe->nr_accounted);
+	(void) account_pipe_buffers(pipe->user, nr_pages, pipe->nr_accounted);
 	return ret;
 }
 
@@ -1409,7 +1532,7 @@ long pipe_fcntl(struct file *file, unsigned int cmd, unsigned int arg)
 		ret = pipe_set_size(pipe, arg);
 		break;
 	case F_GETPIPE_SZ:
-		ret = pipe->max_usage * PAGE_SIZE;
+		ret = pipe_nr_pages(pipe) * PAGE_SIZE;
 		break;
 	default:
 		ret = -EINVAL;
@@ -1498,6 +1621,15 @@ static struct ctl_table fs_pipe_sysctls[] = {
 		.mode		= 0644,
 		.proc_handler	= proc_doulongvec_minmax,
 	},
+	{
+		.procname	= "pipe-max-buf-order",
+		.data		= &pipe_max_buf_order,
+		.maxlen		= sizeof(pipe_max_buf_order),
+		.mode		= 0644,
+		.proc_handler	= proc_douintvec_minmax,
+		.extra1		= SYSCTL_ZERO,
+		.extra2		= &pipe_buf_order_limit,
+	},
 };
 #endif
 
@@ -1819,6 +1819,8 @@ static int splice_pipe_to_pipe(struct pipe_inode_info *ipipe,
 			 */
 			*obuf = *ibuf;
 			ibuf->ops = NULL;
+			pipe_buf_uncharge(ipipe, obuf);
+			pipe_buf_charge(opipe, obuf);
 			i_tail++;
 			ipipe->tail = i_tail;
 			input_wakeup = true;
@@ -1839,10 +1841,12 @@ static int splice_pipe_to_pipe(struct pipe_inode_info *ipipe,
 
 			/*
 			 * Don't inherit the gift and merge flags, we need to
-			 * prevent multiple steals of this page.
+			 * prevent multiple steals of this page. The page stays
+			 * charged to ipipe.
 			 */
 			obuf->flags &= ~PIPE_BUF_FLAG_GIFT;
 			obuf->flags &= ~PIPE_BUF_FLAG_CAN_MERGE;
+			obuf->flags &= ~PIPE_BUF_FLAG_LARGE;
 
 			obuf->len = len;
 			ibuf->offset += len;
@@ -1931,10 +1935,12 @@ static ssize_t link_pipe(struct pipe_inode_info *ipipe,
 
 		/*
 		 * Don't inherit the gift and merge flag, we need to prevent
-		 * multiple steals of this page.
+		 * multiple steals of this page. The page stays charged to
+		 * ipipe.
 		 */
 		obuf->flags &= ~PIPE_BUF_FLAG_GIFT;
 		obuf->flags &= ~PIPE_BUF_FLAG_CAN_MERGE;
+		obuf->flags &= ~PIPE_BUF_FLAG_LARGE;
 
 		if (obuf->len > len)
 			obuf->len = len;
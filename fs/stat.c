@@ -229,44 +229,51 @@ int getname_statx_lookup_flags(int flags)
  *
  * 0 will be returned on success, and a -ve error code if unsuccessful.
  */
-static int vfs_statx(int dfd, struct filename *filename, int flags,
-	      struct kstat *stat, u32 request_mask)
+static int vfs_statx_path(const struct path *path, int flags,
+			  struct kstat *stat, u32 request_mask)
 {
-	struct path path;
-	unsigned int lookup_flags = getname_statx_lookup_flags(flags);
-	int error;
-
-	if (flags & ~(AT_SYMLINK_NOFOLLOW | AT_NO_AUTOMOUNT | AT_EMPTY_PATH |
-		      AT_STATX_SYNC_TYPE))
-		return -EINVAL;
-
-retry:
-	error = filename_lookup(dfd, filename, lookup_flags, &path, NULL);
-	if (error)
-		goto out;
-
-	error = vfs_getattr(&path, stat, request_mask, flags);
+	int error = vfs_getattr(path, stat, request_mask, flags);
 
 	if (request_mask & STATX_MNT_ID_UNIQUE) {
-		stat->mnt_id = real_mount(path.mnt)->mnt_id_unique;
+		stat->mnt_id = real_mount(path->mnt)->mnt_id_unique;
 		stat->result_mask |= STATX_MNT_ID_UNIQUE;
 	} else {
-		stat->mnt_id = real_mount(path.mnt)->mnt_id;
+		stat->mnt_id = real_mount(path->mnt)->mnt_id;
 		stat->result_mask |= STATX_MNT_ID;
 	}
 
-	if (path.mnt->mnt_root == path.dentry)
+	if (path->mnt->mnt_root == path->dentry)
 		stat->attributes |= STATX_ATTR_MOUNT_ROOT;
 	stat->attributes_mask |= STATX_ATTR_MOUNT_ROOT;
 
 	/* Handle STATX_DIOALIGN for block devices. */
 	if (request_mask & STATX_DIOALIGN) {
-		struct inode *inode = d_backing_inode(path.dentry);
+		struct inode *inode = d_backing_inode(path->dentry);
 
 		if (S_ISBLK(inode->i_mode))
 			bdev_statx_dioalign(inode, stat);
 	}
 
+	return error;
+}
+
+static int vfs_statx(int dfd, struct filename *filename, int flags,
+	      struct kstat *stat, u32 request_mask)
+{
+	struct path path;
+	unsigned int lookup_flags = getname_statx_lookup_flags(flags);
+	int error;
+
+	if (flags & ~(AT_SYMLINK_NOFOLLOW | AT_NO_AUTOMOUNT | AT_EMPTY_PATH |
+		      AT_STATX_SYNC_TYPE))
+		return -EINVAL;
+
+retry:
+	error = filename_lookup(dfd, filename, lookup_flags, &path, NULL);
+	if (error)
+		goto out;
+
+	error = vfs_statx_path(&path, flags, stat, request_mask);
 	path_put(&path);
 	if (retry_estale(error, lookup_flags)) {
 		lookup_flags |= LOOKUP_REVAL;
@@ -711,6 +718,93 @@ SYSCALL_DEFINE5(statx,
 	return ret;
 }
 
+static int statx_batch_one(struct lookup_batch *lb,
+			   const struct statx_batch_entry *e,
+			   unsigned int flags, unsigned int mask)
+{
+	struct filename *name;
+	struct kstat stat;
+	struct path path;
+	int error;
+
+	if (e->__reserved)
+		return -EINVAL;
+
+	name = getname_flags(u64_to_user_ptr(e->path), lb->flags, NULL);
+	if (IS_ERR(name))
+		return PTR_ERR(name);
+
+	error = lookup_batch_path(lb, name, &path);
+	if (!error) {
+		error = vfs_statx_path(&path, flags, &stat, mask);
+		path_put(&path);
+		/* retry the whole walk, with LOOKUP_REVAL */
+		if (unlikely(error == -ESTALE))
+			error = vfs_statx(lb->dfd, name, flags, &stat, mask);
+	}
+	putname(name);
+	if (error)
+		return error;
+
+	return cp_statx(&stat, u64_to_user_ptr(e->buf));
+}
+
+/**
+ * sys_statx_batch - System call to get enhanced stats of many files
+ * @dfd: Base directory to pathwalk from.
+ * @entries: Paths, result buffers and per-path results.
+ * @nr: Number of entries.
+ * @flags: AT_* flags to control pathwalk, for all entries.
+ * @mask: Parts of statx struct actually required.
+ *
+ * Each entry is handled as statx() would, with its error in ->result.
+ * Entries with ->__reserved set fail with -EINVAL.
+ * Paths share the walk of the directories they have in common with the
+ * previous ones.
+ *
+ * Returns the number of entries done, which is less than @nr if a signal
+ * is pending or an entry can't be accessed.
+ */
+SYSCALL_DEFINE5(statx_batch,
+		int, dfd, struct statx_batch_entry __user *, entries,
+		unsigned int, nr, unsigned int, flags, unsigned int, mask)
+{
+	struct lookup_batch lb;
+	struct statx_batch_entry e;
+	unsigned int done;
+	int error = 0;
+
+	if (mask & STATX__RESERVED)
+		return -EINVAL;
+	if ((flags & AT_STATX_SYNC_TYPE) == AT_STATX_SYNC_TYPE)
+		return -EINVAL;
+	if (flags & ~(AT_SYMLINK_NOFOLLOW | AT_NO_AUTOMOUNT | AT_EMPTY_PATH |
+		      AT_STATX_SYNC_TYPE))
+		return -EINVAL;
+
+	/* As for statx(), STATX_CHANGE_COOKIE is kernel-only */
+	mask &= ~STATX_CHANGE_COOKIE;
+
+	lookup_batch_init(&lb, dfd, getname_statx_lookup_flags(flags));
+	for (done = 0; done < nr; done++) {
+		if (done && signal_pending(current))
+			break;
+		if (copy_from_user(&e, &entries[done], sizeof(e))) {
+			error = -EFAULT;
+			break;
+		}
+		e.result = statx_batch_one(&lb, &e, flags, mask);
+		if (put_user(e.result, &entries[done].result)) {
+			error = -EFAULT;
+			break;
+		}
+		cond_resched();
+	}
+	lookup_batch_end(&lb);
+
+	return done ? done : error;
+}
+
 #if defined(CONFIG_COMPAT) && defined(__ARCH_WANT_COMPAT_STAT)
 static int cp_compat_stat(struct kstat *stat, struct compat_stat __user *ubuf)
 {
@@ -479,6 +479,7 @@ void drm_gem_vm_open(struct vm_area_struct *vma);
 void drm_gem_vm_close(struct vm_area_struct *vma);
 int drm_gem_mmap_obj(struct drm_gem_object *obj, unsigned long obj_size,
 		     struct vm_area_struct *vma);
+bool drm_gem_vma_node_get(struct drm_vma_offset_node *node);
 int drm_gem_mmap(struct file *filp, struct vm_area_struct *vma);
 
 /**
@@ -26,6 +26,7 @@
 #include <drm/drm_mm.h>
 #include <linux/mm.h>
 #include <linux/rbtree.h>
+#include <linux/rhashtable-types.h>
 #include <linux/spinlock.h>
 #include <linux/types.h>
 
@@ -42,6 +43,7 @@
 #endif
 
 struct drm_file;
+struct drm_vma_offset_entry;
 
 struct drm_vma_offset_file {
 	struct rb_node vm_rb;
@@ -53,12 +55,14 @@ struct drm_vma_offset_node {
 	rwlock_t vm_lock;
 	struct drm_mm_node vm_node;
 	struct rb_root vm_files;
+	struct drm_vma_offset_entry *vm_entry;
 	void *driver_private;
 };
 
 struct drm_vma_offset_manager {
 	rwlock_t vm_lock;
 	struct drm_mm vm_addr_space_mm;
+	struct rhashtable vm_hash;
 };
 
 void drm_vma_offset_manager_init(struct drm_vma_offset_manager *mgr,
@@ -68,6 +72,10 @@ void drm_vma_offset_manager_destroy(struct drm_vma_offset_manager *mgr);
 struct drm_vma_offset_node *drm_vma_offset_lookup_locked(struct drm_vma_offset_manager *mgr,
 							   unsigned long start,
 							   unsigned long pages);
+struct drm_vma_offset_node *
+drm_vma_offset_lookup_get(struct drm_vma_offset_manager *mgr,
+			  unsigned long start, unsigned long pages,
+			  bool (*get)(struct drm_vma_offset_node *node));
 int drm_vma_offset_add(struct drm_vma_offset_manager *mgr,
 		       struct drm_vma_offset_node *node, unsigned long pages);
 void drm_vma_offset_remove(struct drm_vma_offset_manager *mgr,
@@ -11,6 +11,62 @@
 #include <uapi/linux/eventpoll.h>
 #include <uapi/linux/kcmp.h>
 
+/*
+ * Event ring of an epoll instance, set up with EPIOCSRING and mapped with
+ * mmap() of the epoll file descriptor: a struct epoll_ring header followed, at
+ * EPOLL_RING_EVENTS_OFFSET, by an array of struct epoll_ring_event.
+ *
+ * Events of edge-triggered items are published there from the wakeup
+ * callback, without being polled again.  Events that cannot go through the
+ * ring are still reported by epoll_wait(), which also returns as soon as the
+ * ring is not empty.
+ *
+ * Userspace reads the entry at head, then advances head, and only then acts
+ * on the events.  No entry is added for an item whose last entry is still
+ * before head and already reports the new events.  When an item is removed,
+ * or its data changes with EPOLL_CTL_MOD, its entry still before head is
+ * turned into a tombstone with no events, to be skipped.  An entry read
+ * before the epoll_ctl() call returned may still carry the old data.
+ */
+struct epoll_ring_params {
+	__u32	entries;	/* in: minimum number of entries, out: actual */
+	__u32	flags;		/* must be zero */
+	__u64	size;		/* out: size of the mapping */
+};
+
+struct epoll_ring {
+	__u32	head;		/* next entry to consume, set by userspace */
+	__u32	tail;		/* next entry to fill, set by the kernel */
+	__u32	mask;		/* number of entries - 1 */
+	__u32	overflow;	/* events left to epoll_wait(), ring was full */
+};
+
+#define EPOLL_RING_EVENTS_OFFSET	64
+
+struct epoll_ring_event {
+	__u32	events;
+	__u32	__pad;
+	__u64	data;
+};
+
+/* One epoll_ctl() operation of an EPIOCCTLBATCH batch */
+struct epoll_ctl_op {
+	__s32	op;
+	__s32	fd;
+	__u32	events;
+	__s32	result;		/* out: epoll_ctl() return value */
+	__u64	data;
+};
+
+struct epoll_ctl_batch {
+	__u64	ops;		/* array of struct epoll_ctl_op */
+	__u32	nr;
+	__u32	flags;		/* must be zero */
+};
+
+#define EPIOCSRING	_IOWR(EPOLL_IOC_TYPE, 0x03, struct epoll_ring_params)
+#define EPIOCCTLBATCH	_IOW(EPOLL_IOC_TYPE, 0x04, struct epoll_ctl_batch)
+
 
 /* Forward declarations to avoid compiler errors */
 struct file;
@@ -1182,6 +1182,7 @@ extern int send_sigurg(struct fown_struct *fown);
 #define SB_I_TS_EXPIRY_WARNED 0x00000400 /* warned about timestamp range expiry */
 #define SB_I_RETIRED	0x00000800	/* superblock shouldn't be reused */
 #define SB_I_NOUMASK	0x00001000	/* VFS does not apply umask */
+#define SB_I_PAR_DIROPS	0x00002000	/* create/unlink with dir locked shared */
 
 /* Possible states of 'frozen' field */
 enum {
@@ -13,6 +13,7 @@
 #ifdef CONFIG_WATCH_QUEUE
 #define PIPE_BUF_FLAG_LOSS	0x40	/* Message loss happened after this buffer */
 #endif
+#define PIPE_BUF_FLAG_LARGE	0x80	/* large anon buffer, charged to its pipe */
 
 /**
  *	struct pipe_buffer - a linux kernel pipe buffer
@@ -40,8 +41,10 @@ struct pipe_buffer {
  *	@tail: The point of buffer consumption
  *	@note_loss: The next read() should insert a data-lost message
  *	@max_usage: The maximum number of slots that may be used in the ring
+ *	@large_pages: pages beyond the first of large buffers, off @max_usage
  *	@ring_size: total number of buffers (should be a power of 2)
  *	@nr_accounted: The amount this pipe accounts for in user->pipe_bufs
+ *	@buf_order: order of the pages allocated for anonymous buffers
  *	@tmp_page: cached released page
  *	@readers: number of current readers of this pipe
  *	@writers: number of current writers of this pipe
@@ -61,8 +64,10 @@ struct pipe_inode_info {
 	unsigned int head;
 	unsigned int tail;
 	unsigned int max_usage;
+	unsigned int large_pages;
 	unsigned int ring_size;
 	unsigned int nr_accounted;
+	unsigned int buf_order;
 	unsigned int readers;
 	unsigned int writers;
 	unsigned int files;
@@ -270,6 +275,10 @@ void pipe_wait_writable(struct pipe_inode_info *);
 struct pipe_inode_info *alloc_pipe_info(void);
 void free_pipe_info(struct pipe_inode_info *);
 
+/* Account large buffers moved between pipes, see PIPE_BUF_FLAG_LARGE */
+void pipe_buf_charge(struct pipe_inode_info *, const struct pipe_buffer *);
+void pipe_buf_uncharge(struct pipe_inode_info *, const struct pipe_buffer *);
+
 /* Generic pipe buffer ops functions */
 bool generic_pipe_buf_get(struct pipe_inode_info *, struct pipe_buffer *);
 bool generic_pipe_buf_try_steal(struct pipe_inode_info *, struct pipe_buffer *);
@@ -63,4 +63,12 @@ struct kstat {
 /* file attribute values */
 #define STATX_ATTR_CHANGE_MONOTONIC	0x8000000000000000ULL /* version monotonically increases */
 
+/* One path of statx_batch(2) */
+struct statx_batch_entry {
+	__u64	path;		/* const char __user *, relative to the dirfd */
+	__u64	buf;		/* struct statx __user * */
+	__s32	result;		/* out: 0 or -errno, as statx() would return */
+	__u32	__reserved;
+};
+
 #endif
@@ -228,6 +228,8 @@ inet_bind_bucket_create(struct kmem_cache *cachep, struct net *net,
 			const unsigned short snum, int l3mdev);
 void inet_bind_bucket_destroy(struct kmem_cache *cachep,
 			      struct inet_bind_bucket *tb);
+void inet_bind_bucket_hint(const struct sock *sk,
+			   const struct inet_bind_bucket *tb);
 
 bool inet_bind_bucket_match(const struct inet_bind_bucket *tb,
 			    const struct net *net, unsigned short port,
@@ -0,0 +1,49 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+#ifndef _NET_NF_TABLES_JIT_H
+#define _NET_NF_TABLES_JIT_H
+
+#include <net/netfilter/nf_tables.h>
+
+struct bpf_prog;
+
+/* Shortest run of rules worth compiling into a program. */
+#define NFT_JIT_MIN_RULES	4
+
+/**
+ *	struct nft_jit_expr - compiled rule segment
+ *
+ *	@prog: program matching the rules of the segment, NULL if the
+ *	       segment could not be compiled
+ *	@len: blob offset from the segment rule to the first rule after
+ *	      the segment
+ *
+ *	The segment rule carries this as its only expression and is
+ *	placed in front of the rules it was compiled from, which are
+ *	kept in the blob for the interpreter.
+ */
+struct nft_jit_expr {
+	struct bpf_prog		*prog;
+	u32			len;
+};
+
+#define NFT_JIT_RULE_SIZE	\
+	(sizeof(struct nft_rule_dp) + NFT_EXPR_SIZE(sizeof(struct nft_jit_expr)))
+
+#ifdef CONFIG_NF_TABLES_JIT
+bool nft_jit_rule_supported(const struct nft_rule *rule);
+void nft_jit_rule_init(struct nft_rule_dp *jrule);
+void nft_jit_compile(struct nft_rule_dp *jrule, const void *end);
+void nft_jit_release(const struct nft_rule_blob *blob);
+#else
+static inline bool nft_jit_rule_supported(const struct nft_rule *rule)
+{
+	return false;
+}
+
+static inline void nft_jit_rule_init(struct nft_rule_dp *jrule) { }
+static inline void nft_jit_compile(struct nft_rule_dp *jrule,
+				   const void *end) { }
+static inline void nft_jit_release(const struct nft_rule_blob *blob) { }
+#endif
+
+#endif /* _NET_NF_TABLES_JIT_H */
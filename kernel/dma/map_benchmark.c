@@ -17,6 +17,7 @@
 #include <linux/pci.h>
 #include <linux/platform_device.h>
 #include <linux/slab.h>
+#include <linux/swiotlb.h>
 #include <linux/timekeeping.h>
 
 struct map_benchmark_data {
@@ -167,6 +168,17 @@ static int do_map_benchmark(struct map_benchmark_data *map)
 				map->bparam.avg_unmap_100ns;
 		map->bparam.map_stddev = int_sqrt64(map_variance);
 		map->bparam.unmap_stddev = int_sqrt64(unmap_variance);
+
+		/*
+		 * Throughput of all threads together, which is what the
+		 * bounce buffer allocator scales with. Boot with
+		 * swiotlb=force to measure it for swiotlb.
+		 */
+		pr_info("%s: %llu map/unmap per second with %d threads%s\n",
+			dev_name(map->dev),
+			div_u64(loops, map->bparam.seconds), threads,
+			is_swiotlb_force_bounce(map->dev) ?
+			" (swiotlb forced)" : "");
 	}
 
 out:
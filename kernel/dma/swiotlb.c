@@ -518,6 +518,8 @@ int swiotlb_init_late(size_t size, gfp_t gfp_mask,
 	return -ENOMEM;
 }
 
+static bool swiotlb_pcp_drain(void);
+
 void __init swiotlb_exit(void)
 {
 	struct io_tlb_pool *mem = &io_tlb_default_mem.defpool;
@@ -531,6 +533,8 @@ void __init swiotlb_exit(void)
 	if (!mem->nslabs)
 		return;
 
+	swiotlb_pcp_drain();
+
 	pr_info("tearing down default memory pool\n");
 	tbl_vaddr = (unsigned long)phys_to_virt(mem->start);
 	tbl_size = PAGE_ALIGN(mem->end - mem->start);
@@ -1322,6 +1326,239 @@ static unsigned long mem_used(struct io_tlb_mem *mem)
 
 #endif /* CONFIG_DEBUG_FS */
 
+/**
+ * swiotlb_free_run() - return a run of slots to the free list
+ * @mem:	Memory pool of the slots.
+ * @index:	Index of the first slot.
+ * @nslots:	Number of slots in the run.
+ *
+ * Return the buffer to the free list by setting the corresponding
+ * entries to indicate the number of contiguous entries available.
+ * While returning the entries to the free list, we merge the entries
+ * with slots below and above the pool being returned.
+ */
+static void swiotlb_free_run(struct io_tlb_pool *mem, int index, int nslots)
+{
+	int aindex = index / mem->area_nslabs;
+	struct io_tlb_area *area = &mem->areas[aindex];
+	unsigned long flags;
+	int count, i;
+
+	BUG_ON(aindex >= mem->nareas);
+
+	spin_lock_irqsave(&area->lock, flags);
+	if (index + nslots < ALIGN(index + 1, IO_TLB_SEGSIZE))
+		count = mem->slots[index + nslots].list;
+	else
+		count = 0;
+
+	/*
+	 * Step 1: return the slots to the free list, merging the slots with
+	 * superceeding slots
+	 */
+	for (i = index + nslots - 1; i >= index; i--) {
+		mem->slots[i].list = ++count;
+		mem->slots[i].orig_addr = INVALID_PHYS_ADDR;
+		mem->slots[i].alloc_size = 0;
+	}
+
+	/*
+	 * Step 2: merge the returned slots with the preceding slots, if
+	 * available (non zero)
+	 */
+	for (i = index - 1;
+	     io_tlb_offset(i) != IO_TLB_SEGSIZE - 1 && mem->slots[i].list;
+	     i--)
+		mem->slots[i].list = ++count;
+	area->used -= nslots;
+	spin_unlock_irqrestore(&area->lock, flags);
+}
+
+/*
+ * Per-CPU caches of recently released bounce buffers of the default pool.
+ *
+ * Small streaming mappings are the common case for devices behind
+ * swiotlb, and each of them would otherwise search the slot list of an
+ * area under its lock, both to map and to unmap. Instead, runs of up to
+ * IO_TLB_PCP_CLASSES slots are kept allocated on release and parked in a
+ * per-CPU magazine for their exact size, from which the next mapping of
+ * that size is served without touching the area. The cached runs still
+ * count as used in their area, but not in the debugfs usage counters.
+ * When the pool runs out of free slots, all magazines are drained back
+ * to the free lists before giving up.
+ *
+ * Magazines are only ever trylocked. A mapping or unmapping that finds
+ * its magazine busy, because it interrupted the holder on the same CPU
+ * or because another CPU drains it, uses the area instead, so interrupts
+ * don't need to be disabled around them.
+ */
+#define IO_TLB_PCP_CLASSES	4
+#define IO_TLB_PCP_SIZE		8
+
+struct io_tlb_pcp {
+	spinlock_t lock;
+	unsigned int nr;
+	unsigned int count[IO_TLB_PCP_CLASSES];
+	unsigned int index[IO_TLB_PCP_CLASSES][IO_TLB_PCP_SIZE];
+};
+
+static DEFINE_PER_CPU(struct io_tlb_pcp, io_tlb_pcp) = {
+	.lock = __SPIN_LOCK_UNLOCKED(io_tlb_pcp.lock),
+};
+
+static bool swiotlb_pcp_eligible(struct device *dev, unsigned int nslots)
+{
+	return dev->dma_io_tlb_mem == &io_tlb_default_mem &&
+		nslots && nslots <= IO_TLB_PCP_CLASSES &&
+		!dma_get_min_align_mask(dev);
+}
+
+/**
+ * swiotlb_pcp_get() - allocate a bounce buffer from the per-CPU cache
+ * @dev:	Device which maps the buffer.
+ * @alloc_size: Total requested size of the bounce buffer.
+ * @alloc_align_mask:	Required alignment of the allocated buffer.
+ * @retpool:	Used memory pool, updated on return.
+ *
+ * Return: Index of the first allocated slot, or -1 if the cache can't
+ * serve the request.
+ */
+static int swiotlb_pcp_get(struct device *dev, size_t alloc_size,
+		unsigned int alloc_align_mask, struct io_tlb_pool **retpool)
+{
+	struct io_tlb_pool *pool = &io_tlb_default_mem.defpool;
+	unsigned long boundary_mask = dma_get_seg_boundary(dev);
+	unsigned long max_slots = get_max_slots(boundary_mask);
+	unsigned int nslots = nr_slots(alloc_size);
+	dma_addr_t tbl_dma_addr;
+	struct io_tlb_pcp *pcp;
+	int index = -1;
+	unsigned int c, i;
+
+	if (alloc_align_mask || !swiotlb_pcp_eligible(dev, nslots))
+		return -1;
+
+	/* Same default alignment as swiotlb_search_pool_area() */
+	if (alloc_size >= PAGE_SIZE)
+		alloc_align_mask = PAGE_SIZE - 1;
+	tbl_dma_addr = phys_to_dma_unencrypted(dev, pool->start);
+
+	c = nslots - 1;
+	pcp = raw_cpu_ptr(&io_tlb_pcp);
+	if (!spin_trylock(&pcp->lock))
+		return -1;
+	for (i = pcp->count[c]; i--; ) {
+		if (slot_addr(tbl_dma_addr, pcp->index[c][i]) & alloc_align_mask)
+			continue;
+		/* The run may have been released by a device with another
+		 * segment boundary.
+		 */
+		if (iommu_is_span_boundary(pcp->index[c][i], nslots,
+					   nr_slots(tbl_dma_addr & boundary_mask),
+					   max_slots))
+			continue;
+		index = pcp->index[c][i];
+		pcp->index[c][i] = pcp->index[c][--pcp->count[c]];
+		WRITE_ONCE(pcp->nr, pcp->nr - 1);
+		break;
+	}
+	spin_unlock(&pcp->lock);
+
+	if (index < 0)
+		return -1;
+
+	for (i = 0; i < nslots; i++)
+		pool->slots[index + i].alloc_size =
+			alloc_size - (i << IO_TLB_SHIFT);
+
+	inc_used_and_hiwater(dev->dma_io_tlb_mem, nslots);
+
+#ifdef CONFIG_SWIOTLB_DYNAMIC
+	WRITE_ONCE(dev->dma_uses_io_tlb, true);
+	/* See swiotlb_find_slots() */
+	smp_mb();
+#endif
+
+	*retpool = pool;
+	return index;
+}
+
+/**
+ * swiotlb_pcp_put() - park a released bounce buffer in the per-CPU cache
+ * @dev:	Device which mapped the buffer.
+ * @pool:	Memory pool of the buffer.
+ * @index:	Index of the first slot of the buffer.
+ * @nslots:	Number of slots of the buffer.
+ *
+ * Return: %true if the buffer was cached, %false if it must be returned
+ * to the free list.
+ */
+static bool swiotlb_pcp_put(struct device *dev, struct io_tlb_pool *pool,
+		int index, unsigned int nslots)
+{
+	struct io_tlb_pcp *pcp;
+	unsigned int c, i;
+	bool cached = false;
+
+	if (pool != &io_tlb_default_mem.defpool ||
+	    !swiotlb_pcp_eligible(dev, nslots))
+		return false;
+
+	c = nslots - 1;
+	pcp = raw_cpu_ptr(&io_tlb_pcp);
+	if (!spin_trylock(&pcp->lock))
+		return false;
+	if (pcp->count[c] < IO_TLB_PCP_SIZE) {
+		for (i = 0; i < nslots; i++) {
+			pool->slots[index + i].orig_addr = INVALID_PHYS_ADDR;
+			pool->slots[index + i].alloc_size = 0;
+		}
+		pcp->index[c][pcp->count[c]++] = index;
+		WRITE_ONCE(pcp->nr, pcp->nr + 1);
+		cached = true;
+	}
+	spin_unlock(&pcp->lock);
+
+	if (cached)
+		dec_used(dev->dma_io_tlb_mem, nslots);
+	return cached;
+}
+
+/**
+ * swiotlb_pcp_drain() - return cached bounce buffers to the free lists
+ *
+ * Magazines that are busy are skipped.
+ *
+ * Return: %true if any buffer was returned.
+ */
+static bool swiotlb_pcp_drain(void)
+{
+	struct io_tlb_pool *pool = &io_tlb_default_mem.defpool;
+	bool drained = false;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		struct io_tlb_pcp *pcp = per_cpu_ptr(&io_tlb_pcp, cpu);
+		unsigned int c;
+
+		if (!READ_ONCE(pcp->nr) || !spin_trylock(&pcp->lock))
+			continue;
+
+		for (c = 0; c < IO_TLB_PCP_CLASSES; c++) {
+			while (pcp->count[c]) {
+				swiotlb_free_run(pool,
+						 pcp->index[c][--pcp->count[c]],
+						 c + 1);
+				drained = true;
+			}
+		}
+		WRITE_ONCE(pcp->nr, 0);
+		spin_unlock(&pcp->lock);
+	}
+
+	return drained;
+}
+
 phys_addr_t swiotlb_tbl_map_single(struct device *dev, phys_addr_t orig_addr,
 		size_t mapping_size, size_t alloc_size,
 		unsigned int alloc_align_mask, enum dma_data_direction dir,
@@ -1349,8 +1586,14 @@ phys_addr_t swiotlb_tbl_map_single(struct device *dev, phys_addr_t orig_addr,
 		return (phys_addr_t)DMA_MAPPING_ERROR;
 	}
 
-	index = swiotlb_find_slots(dev, orig_addr,
-				   alloc_size + offset, alloc_align_mask, &pool);
+	index = swiotlb_pcp_get(dev, alloc_size + offset, alloc_align_mask,
+				&pool);
+	if (index == -1)
+		index = swiotlb_find_slots(dev, orig_addr, alloc_size + offset,
+					   alloc_align_mask, &pool);
+	if (index == -1 && swiotlb_pcp_drain())
+		index = swiotlb_find_slots(dev, orig_addr, alloc_size + offset,
+					   alloc_align_mask, &pool);
 	if (index == -1) {
 		if (!(attrs & DMA_ATTR_NO_WARN))
 			dev_warn_ratelimited(dev,
@@ -1383,49 +1626,14 @@ phys_addr_t swiotlb_tbl_map_single(struct device *dev, phys_addr_t orig_addr,
 static void swiotlb_release_slots(struct device *dev, phys_addr_t tlb_addr)
 {
 	struct io_tlb_pool *mem = swiotlb_find_pool(dev, tlb_addr);
-	unsigned long flags;
 	unsigned int offset = swiotlb_align_offset(dev, tlb_addr);
 	int index = (tlb_addr - offset - mem->start) >> IO_TLB_SHIFT;
 	int nslots = nr_slots(mem->slots[index].alloc_size + offset);
-	int aindex = index / mem->area_nslabs;
-	struct io_tlb_area *area = &mem->areas[aindex];
-	int count, i;
-
-	/*
-	 * Return the buffer to the free list by setting the corresponding
-	 * entries to indicate the number of contiguous entries available.
-	 * While returning the entries to the free list, we merge the entries
-	 * with slots below and above the pool being returned.
-	 */
-	BUG_ON(aindex >= mem->nareas);
-
-	spin_lock_irqsave(&area->lock, flags);
-	if (index + nslots < ALIGN(index + 1, IO_TLB_SEGSIZE))
-		count = mem->slots[index + nslots].list;
-	else
-		count = 0;
-
-	/*
-	 * Step 1: return the slots to the free list, merging the slots with
-	 * superceeding slots
-	 */
-	for (i = index + nslots - 1; i >= index; i--) {
-		mem->slots[i].list = ++count;
-		mem->slots[i].orig_addr = INVALID_PHYS_ADDR;
-		mem->slots[i].alloc_size = 0;
-	}
 
-	/*
-	 * Step 2: merge the returned slots with the preceding slots, if
-	 * available (non zero)
-	 */
-	for (i = index - 1;
-	     io_tlb_offset(i) != IO_TLB_SEGSIZE - 1 && mem->slots[i].list;
-	     i--)
-		mem->slots[i].list = ++count;
-	area->used -= nslots;
-	spin_unlock_irqrestore(&area->lock, flags);
+	if (swiotlb_pcp_put(dev, mem, index, nslots))
+		return;
 
+	swiotlb_free_run(mem, index, nslots);
 	dec_used(dev->dma_io_tlb_mem, nslots);
 }
 
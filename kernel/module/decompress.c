@@ -11,6 +11,7 @@
 #include <linux/slab.h>
 #include <linux/sysfs.h>
 #include <linux/vmalloc.h>
+#include <asm/unaligned.h>
 
 #include "internal.h"
 
@@ -54,6 +55,16 @@ static struct page *module_get_next_page(struct load_info *info)
 #include <linux/zlib.h>
 #define MODULE_COMPRESSION	gzip
 #define MODULE_DECOMPRESS_FN	module_gzip_decompress
+#define MODULE_DECOMPRESSED_SIZE_FN	module_gzip_decompressed_size
+
+/* The gzip trailer ends with the uncompressed size, modulo 2^32 */
+static size_t module_gzip_decompressed_size(const void *buf, size_t size)
+{
+	if (size < 18)
+		return 0;
+
+	return get_unaligned_le32(buf + size - 4);
+}
 
 /*
  * Calculate length of the header which consists of signature, header
@@ -145,6 +156,63 @@ static ssize_t module_gzip_decompress(struct load_info *info,
 #include <linux/xz.h>
 #define MODULE_COMPRESSION	xz
 #define MODULE_DECOMPRESS_FN	module_xz_decompress
+#define MODULE_DECOMPRESSED_SIZE_FN	module_xz_decompressed_size
+
+/* Read an xz multibyte integer: at most 9 bytes of 7 bits, low bits first */
+static bool module_xz_get_vli(const u8 *buf, size_t end, size_t *pos, u64 *vli)
+{
+	unsigned int shift;
+
+	*vli = 0;
+	for (shift = 0; shift < 63 && *pos < end; shift += 7) {
+		u8 byte = buf[(*pos)++];
+
+		*vli |= (u64)(byte & 0x7f) << shift;
+		if (!(byte & 0x80))
+			return true;
+	}
+
+	return false;
+}
+
+/*
+ * The uncompressed size is only recorded in the index, which the stream
+ * footer locates: add up the uncompressed size of its records.  Modules are
+ * a single stream, without padding after it.
+ */
+static size_t module_xz_decompressed_size(const void *buf, size_t size)
+{
+	static const u8 footer_magic[] = { 'Y', 'Z' };
+	const u8 *p = buf;
+	u64 nr_records, unpadded, uncompressed, total = 0;
+	size_t index_size, pos, end;
+
+	/* 12 byte stream header and footer */
+	if (size < 24 || memcmp(p + size - 2, footer_magic, sizeof(footer_magic)))
+		return 0;
+
+	/* Backward Size in the footer: the index size / 4, minus one */
+	index_size = ((size_t)get_unaligned_le32(p + size - 8) + 1) * 4;
+	if (index_size > size - 24)
+		return 0;
+
+	end = size - 12;
+	pos = end - index_size;
+	/* Index Indicator */
+	if (p[pos++] != 0x00)
+		return 0;
+
+	if (!module_xz_get_vli(p, end, &pos, &nr_records))
+		return 0;
+	while (nr_records--) {
+		if (!module_xz_get_vli(p, end, &pos, &unpadded) ||
+		    !module_xz_get_vli(p, end, &pos, &uncompressed))
+			return 0;
+		total += uncompressed;
+	}
+
+	return total > SIZE_MAX ? 0 : total;
+}
 
 static ssize_t module_xz_decompress(struct load_info *info,
 				    const void *buf, size_t size)
@@ -203,6 +271,18 @@ static ssize_t module_xz_decompress(struct load_info *info,
 #include <linux/zstd.h>
 #define MODULE_COMPRESSION	zstd
 #define MODULE_DECOMPRESS_FN	module_zstd_decompress
+#define MODULE_DECOMPRESSED_SIZE_FN	module_zstd_decompressed_size
+
+static size_t module_zstd_decompressed_size(const void *buf, size_t size)
+{
+	zstd_frame_header header;
+
+	if (zstd_get_frame_header(&header, buf, size) != 0 ||
+	    header.frameContentSize == ZSTD_CONTENTSIZE_UNKNOWN)
+		return 0;
+
+	return header.frameContentSize;
+}
 
 static ssize_t module_zstd_decompress(struct load_info *info,
 				    const void *buf, size_t size)
@@ -291,9 +371,16 @@ static ssize_t module_zstd_decompress(struct load_info *info,
 #error "Unexpected configuration for CONFIG_MODULE_DECOMPRESS"
 #endif
 
+/*
+ * Don't trust the size recorded in the compressed stream for more than a
+ * hint: it only sizes the page array up front.
+ */
+#define MODULE_DECOMPRESS_MAX_RATIO	32
+
 int module_decompress(struct load_info *info, const void *buf, size_t size)
 {
 	unsigned int n_pages;
+	size_t hint;
 	ssize_t data_size;
 	int error;
 
@@ -302,11 +389,19 @@ int module_decompress(struct load_info *info, const void *buf, size_t size)
 #endif
 
 	/*
-	 * Start with number of pages twice as big as needed for
-	 * compressed data.
+	 * Size the page array for the whole decompressed module when the
+	 * stream tells us how large it is, so that it is not grown and
+	 * copied while decompressing. Otherwise start with number of pages
+	 * twice as big as needed for compressed data.
 	 */
-	n_pages = DIV_ROUND_UP(size, PAGE_SIZE) * 2;
+	hint = MODULE_DECOMPRESSED_SIZE_FN(buf, size);
+	if (hint && hint / MODULE_DECOMPRESS_MAX_RATIO <= size)
+		n_pages = DIV_ROUND_UP(hint, PAGE_SIZE) + 1;
+	else
+		n_pages = DIV_ROUND_UP(size, PAGE_SIZE) * 2;
 	error = module_extend_max_pages(info, n_pages);
+	if (error)
+		goto err;
 
 	data_size = MODULE_DECOMPRESS_FN(info, buf, size);
 	if (data_size < 0) {
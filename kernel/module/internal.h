@@ -13,6 +13,7 @@
 #include <linux/rculist.h>
 #include <linux/rcupdate.h>
 #include <linux/mm.h>
+#include <linux/timekeeping.h>
 
 #ifndef ARCH_SHF_SMALL
 #define ARCH_SHF_SMALL 0
@@ -71,6 +72,13 @@ struct load_info {
 #ifdef CONFIG_KALLSYMS
 	unsigned long mod_kallsyms_init_off;
 #endif
+#ifdef CONFIG_MODULE_STATS
+	/* Time spent in each step of loading, in ns */
+	u64 start_ns;
+	u64 kread_ns;
+	u64 decompress_ns;
+	u64 sig_ns;
+#endif
 #ifdef CONFIG_MODULE_DECOMPRESS
 #ifdef CONFIG_MODULE_STATS
 	unsigned long compressed_len;
@@ -212,6 +220,16 @@ struct mod_fail_load {
 int try_add_failed_module(const char *name, enum fail_dup_mod_reason reason);
 void mod_stat_bump_invalid(struct load_info *info, int flags);
 void mod_stat_bump_becoming(struct load_info *info, int flags);
+void mod_stat_add_timing(const char *name, struct load_info *info);
+
+static inline u64 mod_stat_clock(void)
+{
+	return ktime_get_ns();
+}
+
+#define mod_stat_start(info) ((info)->start_ns = ktime_get_ns())
+#define mod_stat_time(info, step, since) \
+	((info)->step##_ns += ktime_get_ns() - (since))
 
 #else
 
@@ -232,6 +250,19 @@ static inline void mod_stat_bump_becoming(struct load_info *info, int flags)
 {
 }
 
+static inline void mod_stat_add_timing(const char *name,
+				       struct load_info *info)
+{
+}
+
+static inline u64 mod_stat_clock(void)
+{
+	return 0;
+}
+
+#define mod_stat_start(info)
+#define mod_stat_time(info, step, since) do { } while (0)
+
 #endif /* CONFIG_MODULE_STATS */
 
 #ifdef CONFIG_MODULE_DEBUG_AUTOLOAD_DUPS
@@ -2852,6 +2852,7 @@ static int load_module(struct load_info *info, const char __user *uargs,
 	bool module_allocated = false;
 	long err = 0;
 	char *after_dashes;
+	u64 t __maybe_unused = mod_stat_clock();
 
 	/*
 	 * Do the signature check (if any) first. All that
@@ -2866,6 +2867,7 @@ static int load_module(struct load_info *info, const char __user *uargs,
 	 * checks against info->len more correct.
 	 */
 	err = module_sig_check(info, flags);
+	mod_stat_time(info, sig, t);
 	if (err)
 		goto free_copy;
 
@@ -2998,6 +3000,8 @@ static int load_module(struct load_info *info, const char __user *uargs,
 	/* Done! */
 	trace_module_load(mod);
 
+	mod_stat_add_timing(mod->name, info);
+
 	return do_init_module(mod);
 
  sysfs_cleanup:
@@ -3068,12 +3072,14 @@ SYSCALL_DEFINE3(init_module, void __user *, umod,
 	pr_debug("init_module: umod=%p, len=%lu, uargs=%p\n",
 	       umod, len, uargs);
 
+	mod_stat_start(&info);
 	err = copy_module_from_user(umod, len, &info);
 	if (err) {
 		mod_stat_inc(&failed_kreads);
 		mod_stat_add_long(len, &invalid_kread_bytes);
 		return err;
 	}
+	mod_stat_time(&info, kread, info.start_ns);
 
 	return load_module(&info, uargs, 0);
 }
@@ -3146,14 +3152,19 @@ static int init_module_from_file(struct file *f, const char __user * uargs, int
 	void *buf = NULL;
 	int len;
 
+	mod_stat_start(&info);
 	len = kernel_read_file(f, 0, &buf, INT_MAX, NULL, READING_MODULE);
 	if (len < 0) {
 		mod_stat_inc(&failed_kreads);
 		return len;
 	}
+	mod_stat_time(&info, kread, info.start_ns);
 
 	if (flags & MODULE_INIT_COMPRESSED_FILE) {
+		u64 t __maybe_unused = mod_stat_clock();
 		int err = module_decompress(&info, buf, len);
+
+		mod_stat_time(&info, decompress, t);
 		vfree(buf); /* compressed data is no longer needed */
 		if (err) {
 			mod_stat_inc(&failed_decompress);
@@ -14,6 +14,9 @@
 #include <linux/debugfs.h>
 #include <linux/rculist.h>
 #include <linux/math.h>
+#include <linux/math64.h>
+#include <linux/spinlock.h>
+#include <linux/timekeeping.h>
 
 #include "internal.h"
 
@@ -99,6 +102,44 @@
  */
 static LIST_HEAD(dup_failed_modules);
 
+/**
+ * DOC: module load timings
+ *
+ * For each module loaded successfully the time spent in the steps of
+ * finit_module() and init_module() which process the whole module image is
+ * recorded, in microseconds:
+ *
+ *   * kread: reading the module with kernel_read_file() or copying it from
+ *     userspace
+ *   * decompress: module decompression, if used
+ *   * signature: module_sig_check()
+ *   * total: from the start of the read until the module is ready to run
+ *     its init routine, which includes the steps above
+ *
+ * Concurrent module loads run these steps in the context of their own
+ * loading task, and so in parallel on different CPUs. These timings help to
+ * find which steps dominate a burst of module loads on boot, and which
+ * modules are the most costly to load. Only the timings of the last
+ * MAX_MOD_LOAD_TIMINGS loaded modules are kept.
+ */
+#define MAX_MOD_LOAD_TIMINGS 512
+
+struct mod_load_timing {
+	struct list_head list;
+	char name[MODULE_NAME_LEN];
+	u64 kread_ns;
+	u64 decompress_ns;
+	u64 sig_ns;
+	u64 total_ns;
+};
+
+static LIST_HEAD(mod_load_timings);
+static DEFINE_SPINLOCK(mod_load_timings_lock);
+static unsigned int mod_load_timings_count;
+static atomic64_t total_kread_ns;
+static atomic64_t total_decompress_ns;
+static atomic64_t total_sig_ns;
+
 /**
  * DOC: module statistics debugfs counters
  *
@@ -261,6 +302,39 @@ int try_add_failed_module(const char *name, enum fail_dup_mod_reason reason)
 	return 0;
 }
 
+void mod_stat_add_timing(const char *name, struct load_info *info)
+{
+	struct mod_load_timing *timing;
+
+	atomic64_add(info->kread_ns, &total_kread_ns);
+	atomic64_add(info->decompress_ns, &total_decompress_ns);
+	atomic64_add(info->sig_ns, &total_sig_ns);
+
+	timing = kzalloc(sizeof(*timing), GFP_KERNEL);
+	if (!timing)
+		return;
+
+	strscpy(timing->name, name, sizeof(timing->name));
+	timing->kread_ns = info->kread_ns;
+	timing->decompress_ns = info->decompress_ns;
+	timing->sig_ns = info->sig_ns;
+	timing->total_ns = ktime_get_ns() - info->start_ns;
+
+	spin_lock(&mod_load_timings_lock);
+	list_add_tail(&timing->list, &mod_load_timings);
+	if (mod_load_timings_count == MAX_MOD_LOAD_TIMINGS) {
+		timing = list_first_entry(&mod_load_timings,
+					  struct mod_load_timing, list);
+		list_del(&timing->list);
+	} else {
+		mod_load_timings_count++;
+		timing = NULL;
+	}
+	spin_unlock(&mod_load_timings_lock);
+
+	kfree(timing);
+}
+
 /*
  * At 64 bytes per module and assuming a 1024 bytes preamble we can fit the
  * 112 module prints within 8k.
@@ -270,11 +344,14 @@ int try_add_failed_module(const char *name, enum fail_dup_mod_reason reason)
 #define MAX_PREAMBLE 1024
 #define MAX_FAILED_MOD_PRINT 112
 #define MAX_BYTES_PER_MOD 64
+#define MAX_BYTES_PER_TIMING 96
 static ssize_t read_file_mod_stats(struct file *file, char __user *user_buf,
 				   size_t count, loff_t *ppos)
 {
 	struct mod_fail_load *mod_fail;
-	unsigned int len, size, count_failed = 0;
+	struct mod_load_timing *timing;
+	unsigned int len, size, count_failed = 0, count_timed = 0;
+	unsigned int nr_timings;
 	char *buf;
 	int ret;
 	u32 live_mod_count, fkreads, fdecompress, fbecoming, floads;
@@ -296,8 +373,14 @@ static ssize_t read_file_mod_stats(struct file *file, char __user *user_buf,
 
 	total_virtual_lost = ikread_bytes + idecompress_bytes + ibecoming_bytes + imod_bytes;
 
+	spin_lock(&mod_load_timings_lock);
+	nr_timings = mod_load_timings_count;
+	spin_unlock(&mod_load_timings_lock);
+
 	size = MAX_PREAMBLE + min((unsigned int)(floads + fbecoming),
 				  (unsigned int)MAX_FAILED_MOD_PRINT) * MAX_BYTES_PER_MOD;
+	if (nr_timings)
+		size += (nr_timings + 2) * MAX_BYTES_PER_TIMING;
 	buf = kzalloc(size, GFP_KERNEL);
 	if (buf == NULL)
 		return -ENOMEM;
@@ -327,6 +410,13 @@ static ssize_t read_file_mod_stats(struct file *file, char __user *user_buf,
 
 	len += scnprintf(buf + len, size - len, "%25s\t%lu\n", "Virtual mem wasted bytes", total_virtual_lost);
 
+	len += scnprintf(buf + len, size - len, "%25s\t%llu\n", "Total kread usecs",
+			 div_u64(atomic64_read(&total_kread_ns), NSEC_PER_USEC));
+	len += scnprintf(buf + len, size - len, "%25s\t%llu\n", "Total decompress usecs",
+			 div_u64(atomic64_read(&total_decompress_ns), NSEC_PER_USEC));
+	len += scnprintf(buf + len, size - len, "%25s\t%llu\n", "Total sig check usecs",
+			 div_u64(atomic64_read(&total_sig_ns), NSEC_PER_USEC));
+
 	if (live_mod_count && total_size) {
 		len += scnprintf(buf + len, size - len, "%25s\t%lu\n", "Average mod size",
 				 DIV_ROUND_UP(total_size, live_mod_count));
@@ -373,6 +463,26 @@ static ssize_t read_file_mod_stats(struct file *file, char __user *user_buf,
 	/* Catch when we've gone beyond our expected preamble */
 	WARN_ON_ONCE(len >= MAX_PREAMBLE);
 
+	if (nr_timings) {
+		len += scnprintf(buf + len, size - len, "Module load timings (usecs):\n");
+		len += scnprintf(buf + len, size - len, "%25s\t%10s\t%10s\t%10s\t%10s\n",
+				 "Module-name", "kread", "decompress", "signature", "total");
+
+		spin_lock(&mod_load_timings_lock);
+		list_for_each_entry(timing, &mod_load_timings, list) {
+			if (++count_timed > nr_timings)
+				break;
+			len += scnprintf(buf + len, size - len,
+					 "%25s\t%10llu\t%10llu\t%10llu\t%10llu\n",
+					 timing->name,
+					 div_u64(timing->kread_ns, NSEC_PER_USEC),
+					 div_u64(timing->decompress_ns, NSEC_PER_USEC),
+					 div_u64(timing->sig_ns, NSEC_PER_USEC),
+					 div_u64(timing->total_ns, NSEC_PER_USEC));
+		}
+		spin_unlock(&mod_load_timings_lock);
+	}
+
 	if (list_empty(&dup_failed_modules))
 		goto out;
 
@@ -398,6 +508,7 @@ static ssize_t read_file_mod_stats(struct file *file, char __user *user_buf,
 #undef MAX_PREAMBLE
 #undef MAX_FAILED_MOD_PRINT
 #undef MAX_BYTES_PER_MOD
+#undef MAX_BYTES_PER_TIMING
 
 static const struct file_operations fops_mod_stats = {
 	.read = read_file_mod_stats,
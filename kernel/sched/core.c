@@ -5687,6 +5687,7 @@ void scheduler_tick(void)
 	calc_global_load_tick(rq);
 	sched_core_tick(rq);
 	task_tick_mm_cid(rq, curr);
+	psi_tick(rq);
 
 	rq_unlock(rq, &rf);
 
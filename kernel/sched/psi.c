@@ -135,6 +135,15 @@
  * This gives us an approximation of pressure that is practical
  * cost-wise, yet way more sensitive and accurate than periodic
  * sampling of the aggregate task states would be.
+ *
+ * Task state changes outside of a context switch (wakeups, requeues,
+ * memstall sections) are applied to the task's own cgroup right away,
+ * but their propagation to the ancestors is batched per CPU: each change
+ * is logged with its timestamp and replayed in order by the CPU itself at
+ * its next context switch or scheduler tick, so the ancestors account the
+ * same state times as if they had been updated directly. Until then,
+ * readers only count the live state of a CPU up to its oldest logged
+ * change. Pressure data thus lags by at most a tick.
  */
 
 static int psi_bug __read_mostly;
@@ -176,6 +185,42 @@ static void psi_avgs_work(struct work_struct *work);
 
 static void poll_timer_fn(struct timer_list *t);
 
+/*
+ * Ancestor updates deferred by psi_task_change(), in the order they
+ * happened and stamped with the time they happened at, so that replaying
+ * them accounts the exact time of every state the ancestors went through.
+ * Protected by the rq lock of the CPU, and only replayed on it.
+ *
+ * @since is the time of the oldest one, 0 if there are none. The groups'
+ * states on the CPU are current up to then, so readers don't count live
+ * state time beyond it, see get_recent_times().
+ */
+#define PSI_PENDING_CHANGES	8
+
+struct psi_pending_change {
+	struct psi_group *group;
+	u64 now;
+	u8 clear, set;
+	bool curr_memstall;
+};
+
+struct psi_pending {
+	seqcount_t seq;
+	u64 since;
+	unsigned int nr;
+	struct psi_pending_change changes[PSI_PENDING_CHANGES];
+};
+
+static DEFINE_PER_CPU(struct psi_pending, psi_pending);
+
+static void __init psi_pending_init(void)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		seqcount_init(&per_cpu_ptr(&psi_pending, cpu)->seq);
+}
+
 static void group_init(struct psi_group *group)
 {
 	int cpu;
@@ -216,6 +261,7 @@ void __init psi_init(void)
 
 	psi_period = jiffies_to_nsecs(PSI_FREQ);
 	group_init(&psi_system);
+	psi_pending_init();
 }
 
 static bool test_state(unsigned int *tasks, enum psi_states state, bool oncpu)
@@ -247,19 +293,32 @@ static void get_recent_times(struct psi_group *group, int cpu,
 			     u32 *pchanged_states)
 {
 	struct psi_group_cpu *groupc = per_cpu_ptr(group->pcpu, cpu);
+	struct psi_pending *pending = per_cpu_ptr(&psi_pending, cpu);
 	int current_cpu = raw_smp_processor_id();
 	unsigned int tasks[NR_PSI_TASK_COUNTS];
-	u64 now, state_start;
+	u64 now, since, state_start;
 	enum psi_states s;
 	unsigned int seq;
 	u32 state_mask;
 
 	*pchanged_states = 0;
 
+	/*
+	 * Changes logged since @since are yet to be replayed, and the state
+	 * is only known up to then, see psi_task_change().
+	 */
+	do {
+		seq = read_seqcount_begin(&pending->seq);
+		now = cpu_clock(cpu);
+		since = pending->since;
+	} while (read_seqcount_retry(&pending->seq, seq));
+
+	if (since && since < now)
+		now = since;
+
 	/* Snapshot a coherent view of the CPU state */
 	do {
 		seq = read_seqcount_begin(&groupc->seq);
-		now = cpu_clock(cpu);
 		memcpy(times, groupc->times, sizeof(groupc->times));
 		state_mask = groupc->state_mask;
 		state_start = groupc->state_start;
@@ -279,7 +338,7 @@ static void get_recent_times(struct psi_group *group, int cpu,
 		 * (u32) and our reported pressure close to what's
 		 * actually happening.
 		 */
-		if (state_mask & (1 << s))
+		if ((state_mask & (1 << s)) && now > state_start)
 			times[s] += now - state_start;
 
 		delta = times[s] - groupc->times_prev[aggregator][s];
@@ -764,9 +823,9 @@ static void record_times(struct psi_group_cpu *groupc, u64 now)
 		groupc->times[PSI_NONIDLE] += delta;
 }
 
-static void psi_group_change(struct psi_group *group, int cpu,
-			     unsigned int clear, unsigned int set, u64 now,
-			     bool wake_clock)
+static void __psi_group_change(struct psi_group *group, int cpu,
+			       unsigned int clear, unsigned int set, u64 now,
+			       bool wake_clock, bool curr_memstall)
 {
 	struct psi_group_cpu *groupc;
 	unsigned int t, m;
@@ -854,7 +913,7 @@ static void psi_group_change(struct psi_group *group, int cpu,
 	 * task in a cgroup is in_memstall, the corresponding groupc
 	 * on that cpu is in PSI_MEM_FULL state.
 	 */
-	if (unlikely((state_mask & PSI_ONCPU) && cpu_curr(cpu)->in_memstall))
+	if (unlikely((state_mask & PSI_ONCPU) && curr_memstall))
 		state_mask |= (1 << PSI_MEM_FULL);
 
 	record_times(groupc, now);
@@ -870,6 +929,14 @@ static void psi_group_change(struct psi_group *group, int cpu,
 		schedule_delayed_work(&group->avgs_work, PSI_FREQ);
 }
 
+static void psi_group_change(struct psi_group *group, int cpu,
+			     unsigned int clear, unsigned int set, u64 now,
+			     bool wake_clock)
+{
+	__psi_group_change(group, cpu, clear, set, now, wake_clock,
+			   cpu_curr(cpu)->in_memstall);
+}
+
 static inline struct psi_group *task_psi_group(struct task_struct *task)
 {
 #ifdef CONFIG_CGROUPS
@@ -894,9 +961,64 @@ static void psi_flags_change(struct task_struct *task, int clear, int set)
 	task->psi_flags |= set;
 }
 
+static void __psi_flush_pending(struct psi_pending *pending, int cpu)
+{
+	unsigned int i;
+
+	for (i = 0; i < pending->nr; i++) {
+		struct psi_pending_change *c = &pending->changes[i];
+		struct psi_group *group = c->group;
+
+		do {
+			__psi_group_change(group, cpu, c->clear, c->set, c->now,
+					   true, c->curr_memstall);
+		} while ((group = group->parent));
+	}
+
+	WRITE_ONCE(pending->nr, 0);
+
+	write_seqcount_begin(&pending->seq);
+	pending->since = 0;
+	write_seqcount_end(&pending->seq);
+}
+
+/**
+ * psi_flush_pending - replay the deferred ancestor updates of a CPU
+ * @cpu: the CPU, whose rq lock must be held
+ *
+ * Must be called before any group is updated directly on @cpu, so that
+ * each group sees its changes in time order.
+ */
+void psi_flush_pending(int cpu)
+{
+	struct psi_pending *pending = per_cpu_ptr(&psi_pending, cpu);
+
+	lockdep_assert_rq_held(cpu_rq(cpu));
+
+	if (pending->nr)
+		__psi_flush_pending(pending, cpu);
+}
+
+static bool psi_pending_cond(int cpu, void *info)
+{
+	return READ_ONCE(per_cpu_ptr(&psi_pending, cpu)->nr);
+}
+
+static void psi_flush_pending_ipi(void *info)
+{
+	struct rq *rq = this_rq();
+	struct rq_flags rf;
+
+	rq_lock_irqsave(rq, &rf);
+	psi_flush_pending(cpu_of(rq));
+	rq_unlock_irqrestore(rq, &rf);
+}
+
 void psi_task_change(struct task_struct *task, int clear, int set)
 {
 	int cpu = task_cpu(task);
+	struct psi_pending *pending = per_cpu_ptr(&psi_pending, cpu);
+	struct psi_pending_change *c;
 	struct psi_group *group;
 	u64 now;
 
@@ -905,12 +1027,43 @@ void psi_task_change(struct task_struct *task, int clear, int set)
 
 	psi_flags_change(task, clear, set);
 
-	now = cpu_clock(cpu);
+	if (pending->nr == PSI_PENDING_CHANGES)
+		__psi_flush_pending(pending, cpu);
 
 	group = task_psi_group(task);
-	do {
+
+	if (!pending->nr) {
+		if (!group->parent) {
+			psi_group_change(group, cpu, clear, set,
+					 cpu_clock(cpu), true);
+			return;
+		}
+
+		/*
+		 * Nothing is pending, so the task's own group can be updated
+		 * right away. Its ancestors are deferred from now on: sample
+		 * the clock inside the write section, so that a reader that
+		 * didn't see @since got an earlier time than any change it
+		 * could miss.
+		 */
+		write_seqcount_begin(&pending->seq);
+		now = cpu_clock(cpu);
+		pending->since = now;
+		write_seqcount_end(&pending->seq);
+
 		psi_group_change(group, cpu, clear, set, now, true);
-	} while ((group = group->parent));
+		group = group->parent;
+	} else {
+		now = cpu_clock(cpu);
+	}
+
+	c = &pending->changes[pending->nr];
+	c->group = group;
+	c->now = now;
+	c->clear = clear;
+	c->set = set;
+	c->curr_memstall = cpu_curr(cpu)->in_memstall;
+	WRITE_ONCE(pending->nr, pending->nr + 1);
 }
 
 void psi_task_switch(struct task_struct *prev, struct task_struct *next,
@@ -918,7 +1071,11 @@ void psi_task_switch(struct task_struct *prev, struct task_struct *next,
 {
 	struct psi_group *group, *common = NULL;
 	int cpu = task_cpu(prev);
-	u64 now = cpu_clock(cpu);
+	u64 now;
+
+	/* Replay the logged changes before updating the groups directly */
+	psi_flush_pending(cpu);
+	now = cpu_clock(cpu);
 
 	if (next->pid) {
 		psi_flags_change(next, 0, TSK_ONCPU);
@@ -1001,9 +1158,10 @@ void psi_account_irqtime(struct task_struct *task, u32 delta)
 	if (static_branch_likely(&psi_disabled))
 		return;
 
-	if (!task->pid)
+	if (!task->pid || !delta)
 		return;
 
+	psi_flush_pending(cpu);
 	now = cpu_clock(cpu);
 
 	group = task_psi_group(task);
@@ -1113,6 +1271,12 @@ void psi_cgroup_free(struct cgroup *cgroup)
 	if (!static_branch_likely(&psi_cgroups_enabled))
 		return;
 
+	/*
+	 * Logged changes of exited tasks may still refer to the group. Have
+	 * the CPUs replay them, which can queue avgs_work, so cancel it only
+	 * afterwards.
+	 */
+	on_each_cpu_cond(psi_pending_cond, psi_flush_pending_ipi, NULL, true);
 	cancel_delayed_work_sync(&cgroup->psi->avgs_work);
 	free_percpu(cgroup->psi->pcpu);
 	/* All triggers must be removed by now */
@@ -1215,6 +1379,7 @@ void psi_cgroup_restart(struct psi_group *group)
 		u64 now;
 
 		rq_lock_irq(rq, &rf);
+		psi_flush_pending(cpu);
 		now = cpu_clock(cpu);
 		psi_group_change(group, cpu, 0, 0, now, true);
 		rq_unlock_irq(rq, &rf);
@@ -111,6 +111,7 @@ void psi_task_change(struct task_struct *task, int clear, int set);
 void psi_task_switch(struct task_struct *prev, struct task_struct *next,
 		     bool sleep);
 void psi_account_irqtime(struct task_struct *task, u32 delta);
+void psi_flush_pending(int cpu);
 
 /*
  * PSI tracks state that persists across sleeps, such as iowaits and
@@ -185,6 +186,15 @@ static inline void psi_sched_switch(struct task_struct *prev,
 	psi_task_switch(prev, next, sleep);
 }
 
+/* Bound the lag of the ancestor updates batched by psi_task_change() */
+static inline void psi_tick(struct rq *rq)
+{
+	if (static_branch_likely(&psi_disabled))
+		return;
+
+	psi_flush_pending(cpu_of(rq));
+}
+
 #else /* CONFIG_PSI */
 static inline void psi_enqueue(struct task_struct *p, bool wakeup) {}
 static inline void psi_dequeue(struct task_struct *p, bool sleep) {}
@@ -193,6 +203,7 @@ static inline void psi_sched_switch(struct task_struct *prev,
 				    struct task_struct *next,
 				    bool sleep) {}
 static inline void psi_account_irqtime(struct task_struct *task, u32 delta) {}
+static inline void psi_tick(struct rq *rq) {}
 #endif /* CONFIG_PSI */
 
 #ifdef CONFIG_SCHED_INFO
@@ -33,6 +33,7 @@ static struct trace_buffer *buffer;
 static struct task_struct *producer;
 static struct task_struct *consumer;
 static unsigned long read;
+static unsigned long read_bytes;
 
 static unsigned int disable_reader;
 module_param(disable_reader, uint, 0644);
@@ -99,6 +100,7 @@ static enum event_status read_event(int cpu)
 	}
 
 	read++;
+	read_bytes += ring_buffer_event_length(event);
 	return EVENT_FOUND;
 }
 
@@ -124,6 +126,7 @@ static enum event_status read_page(int cpu)
 		rpage = ring_buffer_read_page_data(bpage);
 		/* The commit may have missed event flags set, clear them */
 		commit = local_read(&rpage->commit) & 0xfffff;
+		read_bytes += commit;
 		for (i = 0; i < commit && !test_error ; i += inc) {
 
 			if (i >= (page_size - offsetof(struct rb_page, data))) {
@@ -187,6 +190,7 @@ static void ring_buffer_consumer(void)
 	read_events ^= 1;
 
 	read = 0;
+	read_bytes = 0;
 	/*
 	 * Continue running until the producer specifically asks to stop
 	 * and is ready for the completion.
@@ -345,6 +349,17 @@ static void ring_buffer_producer(void)
 
 	trace_printk("Entries per millisec: %ld\n", hit);
 
+	/*
+	 * Consumer throughput, to compare the copying readers against
+	 * a zero-copy reader of the mapped buffer from user space.
+	 */
+	if (!disable_reader && time) {
+		trace_printk("Read per millisec: %ld  (by %s)\n",
+			     read / (long)time, read_events ? "events" : "pages");
+		trace_printk("Read bytes per millisec: %ld\n",
+			     read_bytes / (long)time);
+	}
+
 	if (hit) {
 		/* Calculate the average time in nanosecs */
 		avg = NSEC_PER_MSEC / hit;
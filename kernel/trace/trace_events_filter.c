@@ -141,16 +141,45 @@ static bool is_not(const char *str)
 	return true;
 }
 
+/*
+ * Compiled forms of the predicates. Integer comparisons on a field of the
+ * record are evaluated inline by filter_match_preds() instead of going
+ * through filter_pred_fn_call(). Everything else is FILTER_INSN_CALL.
+ */
+enum filter_insn {
+	FILTER_INSN_CALL,
+	FILTER_INSN_EQ,
+	FILTER_INSN_NE,
+	FILTER_INSN_LT,
+	FILTER_INSN_LE,
+	FILTER_INSN_GT,
+	FILTER_INSN_GE,
+	FILTER_INSN_SLT,
+	FILTER_INSN_SLE,
+	FILTER_INSN_SGT,
+	FILTER_INSN_SGE,
+	FILTER_INSN_BAND,
+};
+
 /**
  * struct prog_entry - a singe entry in the filter program
  * @target:	     Index to jump to on a branch (actually one minus the index)
  * @when_to_branch:  The value of the result of the predicate to do a branch
  * @pred:	     The predicate to execute.
+ * @val:	     Compiled: the constant to compare against (sign or zero
+ *		     extended to 64 bits, depending on @insn)
+ * @offset:	     Compiled: the offset of the field in the record
+ * @insn:	     Compiled: how to evaluate @pred (enum filter_insn)
+ * @size:	     Compiled: the size of the field in the record
  */
 struct prog_entry {
 	int			target;
 	int			when_to_branch;
 	struct filter_pred	*pred;
+	u64			val;
+	int			offset;
+	unsigned short		insn;
+	unsigned short		size;
 };
 
 /**
@@ -1167,6 +1196,73 @@ static int test_pred_visited_fn(struct filter_pred *pred, void *event)
 
 static int filter_pred_fn_call(struct filter_pred *pred, void *event);
 
+static __always_inline u64 filter_insn_load(void *rec, int offset, int size)
+{
+	void *addr = rec + offset;
+
+	switch (size) {
+	case 8:
+		return *(u64 *)addr;
+	case 4:
+		return *(u32 *)addr;
+	case 2:
+		return *(u16 *)addr;
+	default:
+		return *(u8 *)addr;
+	}
+}
+
+static __always_inline s64 filter_insn_load_signed(void *rec, int offset,
+						   int size)
+{
+	void *addr = rec + offset;
+
+	switch (size) {
+	case 8:
+		return *(s64 *)addr;
+	case 4:
+		return *(s32 *)addr;
+	case 2:
+		return *(s16 *)addr;
+	default:
+		return *(s8 *)addr;
+	}
+}
+
+static __always_inline int filter_prog_entry_eval(struct prog_entry *entry,
+						  void *rec)
+{
+	int offset = entry->offset;
+	int size = entry->size;
+
+	switch (entry->insn) {
+	case FILTER_INSN_EQ:
+		return filter_insn_load(rec, offset, size) == entry->val;
+	case FILTER_INSN_NE:
+		return filter_insn_load(rec, offset, size) != entry->val;
+	case FILTER_INSN_LT:
+		return filter_insn_load(rec, offset, size) < entry->val;
+	case FILTER_INSN_LE:
+		return filter_insn_load(rec, offset, size) <= entry->val;
+	case FILTER_INSN_GT:
+		return filter_insn_load(rec, offset, size) > entry->val;
+	case FILTER_INSN_GE:
+		return filter_insn_load(rec, offset, size) >= entry->val;
+	case FILTER_INSN_SLT:
+		return filter_insn_load_signed(rec, offset, size) < (s64)entry->val;
+	case FILTER_INSN_SLE:
+		return filter_insn_load_signed(rec, offset, size) <= (s64)entry->val;
+	case FILTER_INSN_SGT:
+		return filter_insn_load_signed(rec, offset, size) > (s64)entry->val;
+	case FILTER_INSN_SGE:
+		return filter_insn_load_signed(rec, offset, size) >= (s64)entry->val;
+	case FILTER_INSN_BAND:
+		return !!(filter_insn_load(rec, offset, size) & entry->val);
+	default:
+		return filter_pred_fn_call(entry->pred, rec);
+	}
+}
+
 /* return 1 if event matches, 0 otherwise (discard) */
 int filter_match_preds(struct event_filter *filter, void *rec)
 {
@@ -1183,8 +1279,7 @@ int filter_match_preds(struct event_filter *filter, void *rec)
 		return 1;
 
 	for (i = 0; prog[i].pred; i++) {
-		struct filter_pred *pred = prog[i].pred;
-		int match = filter_pred_fn_call(pred, rec);
+		int match = filter_prog_entry_eval(&prog[i], rec);
 		if (match == prog[i].when_to_branch)
 			i = prog[i].target;
 	}
@@ -1495,6 +1590,108 @@ static int filter_pred_fn_call(struct filter_pred *pred, void *event)
 	}
 }
 
+static void filter_compile_entry(struct prog_entry *entry)
+{
+	struct filter_pred *pred = entry->pred;
+	bool is_signed = false;
+	bool is_cmp = true;
+	int size;
+
+	entry->insn = FILTER_INSN_CALL;
+
+	switch (pred->fn_num) {
+	case FILTER_PRED_FN_64:
+		is_cmp = false;
+		fallthrough;
+	case FILTER_PRED_FN_U64:
+		size = 8;
+		break;
+	case FILTER_PRED_FN_32:
+		is_cmp = false;
+		fallthrough;
+	case FILTER_PRED_FN_U32:
+		size = 4;
+		break;
+	case FILTER_PRED_FN_16:
+		is_cmp = false;
+		fallthrough;
+	case FILTER_PRED_FN_U16:
+		size = 2;
+		break;
+	case FILTER_PRED_FN_8:
+		is_cmp = false;
+		fallthrough;
+	case FILTER_PRED_FN_U8:
+		size = 1;
+		break;
+	case FILTER_PRED_FN_S64:
+		is_signed = true;
+		size = 8;
+		break;
+	case FILTER_PRED_FN_S32:
+		is_signed = true;
+		size = 4;
+		break;
+	case FILTER_PRED_FN_S16:
+		is_signed = true;
+		size = 2;
+		break;
+	case FILTER_PRED_FN_S8:
+		is_signed = true;
+		size = 1;
+		break;
+	default:
+		return;
+	}
+
+	entry->offset = pred->offset;
+	entry->size = size;
+
+	/* Same truncation as the (type)pred->val casts in the pred functions */
+	if (is_signed)
+		entry->val = sign_extend64(pred->val, size * 8 - 1);
+	else if (size < 8)
+		entry->val = pred->val & GENMASK_ULL(size * 8 - 1, 0);
+	else
+		entry->val = pred->val;
+
+	if (!is_cmp) {
+		entry->insn = pred->not ? FILTER_INSN_NE : FILTER_INSN_EQ;
+		return;
+	}
+
+	switch (pred->op) {
+	case OP_LT:
+		entry->insn = is_signed ? FILTER_INSN_SLT : FILTER_INSN_LT;
+		break;
+	case OP_LE:
+		entry->insn = is_signed ? FILTER_INSN_SLE : FILTER_INSN_LE;
+		break;
+	case OP_GT:
+		entry->insn = is_signed ? FILTER_INSN_SGT : FILTER_INSN_GT;
+		break;
+	case OP_GE:
+		entry->insn = is_signed ? FILTER_INSN_SGE : FILTER_INSN_GE;
+		break;
+	case OP_BAND:
+		entry->insn = FILTER_INSN_BAND;
+		break;
+	}
+}
+
+/*
+ * Turn the predicates of a parsed program into their compiled form, so
+ * that filter_match_preds() can do the common integer comparisons inline.
+ * Must be called again if the fn_num of any predicate is changed.
+ */
+static void filter_compile_prog(struct prog_entry *prog)
+{
+	int i;
+
+	for (i = 0; prog[i].pred; i++)
+		filter_compile_entry(&prog[i]);
+}
+
 /* Called when a predicate is encountered by predicate_parse() */
 static int parse_pred(const char *str, void *data,
 		      int pos, struct filter_parse_error *pe,
@@ -2106,6 +2303,8 @@ static int process_preds(struct trace_event_call *call,
 	if (IS_ERR(prog))
 		return PTR_ERR(prog);
 
+	filter_compile_prog(prog);
+
 	rcu_assign_pointer(filter->prog, prog);
 	return 0;
 }
@@ -2649,6 +2848,7 @@ int ftrace_profile_set_filter(struct perf_event *event, int event_id,
 
 #include <linux/types.h>
 #include <linux/tracepoint.h>
+#include <linux/sched/clock.h>
 
 #define CREATE_TRACE_POINTS
 #include "trace_events_filter_test.h"
@@ -2760,6 +2960,40 @@ static void update_pred_fn(struct event_filter *filter, char *fields)
 
 		pred->fn_num = FILTER_PRED_TEST_VISITED;
 	}
+
+	filter_compile_prog(prog);
+}
+
+#define FILTER_BENCH_LOOPS	100000
+
+static __init void ftrace_test_event_filter_bench(void)
+{
+	struct test_filter_data_t *d = &test_filter_data[DATA_CNT - 1];
+	struct event_filter *filter = NULL;
+	u64 start, delta;
+	int err;
+	int i;
+
+	err = create_filter(NULL, &event_ftrace_test_filter,
+			    d->filter, false, &filter);
+	if (err) {
+		__free_filter(filter);
+		return;
+	}
+
+	mutex_lock(&event_mutex);
+	preempt_disable();
+	start = local_clock();
+	for (i = 0; i < FILTER_BENCH_LOOPS; i++)
+		filter_match_preds(filter, &d->rec);
+	delta = local_clock() - start;
+	preempt_enable();
+	mutex_unlock(&event_mutex);
+
+	__free_filter(filter);
+
+	printk(KERN_INFO "ftrace filter benchmark: %llu events/sec\n",
+	       div64_u64((u64)FILTER_BENCH_LOOPS * NSEC_PER_SEC, delta ?: 1));
 }
 
 static __init int ftrace_test_event_filter(void)
@@ -2816,8 +3050,10 @@ static __init int ftrace_test_event_filter(void)
 		}
 	}
 
-	if (i == DATA_CNT)
+	if (i == DATA_CNT) {
 		printk(KERN_CONT "OK\n");
+		ftrace_test_event_filter_bench();
+	}
 
 	return 0;
 }
@@ -525,6 +525,8 @@ struct hist_trigger_attrs {
 	bool		clear;
 	bool		ts_in_usecs;
 	bool		no_hitcount;
+	bool		percpu;
+	bool		grow;
 	unsigned int	map_bits;
 
 	char		*assignment_str[TRACING_MAP_VARS_MAX];
@@ -1553,6 +1555,10 @@ parse_hist_trigger_attrs(struct trace_array *tr, char *trigger_str)
 		} else if (strcmp(str, "nohitcount") == 0 ||
 			   strcmp(str, "NOHC") == 0)
 			attrs->no_hitcount = true;
+		else if (strcmp(str, "percpu") == 0)
+			attrs->percpu = true;
+		else if (strcmp(str, "grow") == 0)
+			attrs->grow = true;
 		else if (strcmp(str, "pause") == 0)
 			attrs->pause = true;
 		else if ((strcmp(str, "cont") == 0) ||
@@ -5129,6 +5135,11 @@ create_hist_data(unsigned int map_bits,
 	ret = create_tracing_map_fields(hist_data);
 	if (ret)
 		goto free;
+
+	if (attrs->percpu)
+		tracing_map_set_pcpu(hist_data->map);
+	if (attrs->grow)
+		tracing_map_set_max_bits(hist_data->map, TRACING_MAP_BITS_MAX);
  out:
 	return hist_data;
  free:
@@ -5589,7 +5600,7 @@ static void hist_trigger_show(struct seq_file *m,
 	track_data_snapshot_print(m, hist_data);
 
 	seq_printf(m, "\nTotals:\n    Hits: %llu\n    Entries: %u\n    Dropped: %llu\n",
-		   (u64)atomic64_read(&hist_data->map->hits),
+		   tracing_map_read_hits(hist_data->map),
 		   n_entries, (u64)atomic64_read(&hist_data->map->drops));
 }
 
@@ -6048,11 +6059,17 @@ static int event_hist_trigger_print(struct seq_file *m,
 		if (sort_key->descending)
 			seq_puts(m, ".descending");
 	}
-	seq_printf(m, ":size=%u", (1 << hist_data->map->map_bits));
+	/* the configured size, the map may have grown since */
+	seq_printf(m, ":size=%u", 1 << (hist_data->attrs->map_bits ?:
+					 TRACING_MAP_BITS_DEFAULT));
 	if (hist_data->enable_timestamps)
 		seq_printf(m, ":clock=%s", hist_data->attrs->clock);
 	if (hist_data->attrs->no_hitcount)
 		seq_puts(m, ":nohitcount");
+	if (hist_data->attrs->percpu)
+		seq_puts(m, ":percpu");
+	if (hist_data->attrs->grow)
+		seq_puts(m, ":grow");
 
 	print_actions_spec(m, hist_data);
 
@@ -16,6 +16,9 @@
 #include <linux/slab.h>
 #include <linux/sort.h>
 #include <linux/kmemleak.h>
+#include <linux/hash.h>
+#include <linux/cpu.h>
+#include <linux/tracepoint.h>
 
 #include "tracing_map.h"
 #include "trace.h"
@@ -26,6 +29,73 @@
  * of tracing_map data structures at the beginning of tracing_map.h.
  */
 
+static void tracing_map_pcpu_slot_flush(struct tracing_map *map,
+					struct tracing_map_pcpu_slot *slot)
+{
+	unsigned int i;
+
+	if (!slot->elt)
+		return;
+
+	for (i = 0; i < map->n_fields; i++) {
+		if (!slot->sums[i])
+			continue;
+		atomic64_add(slot->sums[i], &slot->elt->fields[i].sum);
+		slot->sums[i] = 0;
+	}
+	slot->count = 0;
+}
+
+static void tracing_map_pcpu_drain(struct tracing_map *map, int cpu,
+				   bool discard)
+{
+	struct tracing_map_pcpu *pcpu = per_cpu_ptr(map->pcpu, cpu);
+	unsigned int i;
+
+	for (i = 0; i < TRACING_MAP_PCPU_SLOTS; i++) {
+		struct tracing_map_pcpu_slot *slot = &pcpu->slots[i];
+
+		if (!discard)
+			tracing_map_pcpu_slot_flush(map, slot);
+		memset(slot, 0, sizeof(*slot));
+	}
+
+	if (discard)
+		local64_set(&pcpu->hits, 0);
+}
+
+static void tracing_map_pcpu_flush_ipi(void *data)
+{
+	tracing_map_pcpu_drain(data, smp_processor_id(), false);
+}
+
+static void tracing_map_pcpu_discard_ipi(void *data)
+{
+	tracing_map_pcpu_drain(data, smp_processor_id(), true);
+}
+
+/*
+ * Fold (or throw away, if @discard) what the per-cpu slots have
+ * accumulated.  The slots of online cpus can only be touched by their
+ * own cpu, so that's done from an IPI.
+ */
+static void tracing_map_pcpu_sync(struct tracing_map *map, bool discard)
+{
+	int cpu;
+
+	if (!map->pcpu)
+		return;
+
+	cpus_read_lock();
+	on_each_cpu(discard ? tracing_map_pcpu_discard_ipi :
+		    tracing_map_pcpu_flush_ipi, map, 1);
+	for_each_possible_cpu(cpu) {
+		if (!cpu_online(cpu))
+			tracing_map_pcpu_drain(map, cpu, discard);
+	}
+	cpus_read_unlock();
+}
+
 /**
  * tracing_map_update_sum - Add a value to a tracing_map_elt's sum field
  * @elt: The tracing_map_elt
@@ -38,7 +108,29 @@
  */
 void tracing_map_update_sum(struct tracing_map_elt *elt, unsigned int i, u64 n)
 {
-	atomic64_add(n, &elt->fields[i].sum);
+	struct tracing_map *map = elt->map;
+	struct tracing_map_pcpu_slot *slot;
+	unsigned long flags;
+
+	/* NMIs can't use the slots, which are only protected against irqs */
+	if (!map->pcpu || in_nmi()) {
+		atomic64_add(n, &elt->fields[i].sum);
+		return;
+	}
+
+	local_irq_save(flags);
+
+	slot = &this_cpu_ptr(map->pcpu)->slots[hash_ptr(elt, TRACING_MAP_PCPU_BITS)];
+	if (slot->elt != elt) {
+		tracing_map_pcpu_slot_flush(map, slot);
+		slot->elt = elt;
+	}
+
+	slot->sums[i] += n;
+	if (++slot->count >= TRACING_MAP_PCPU_FLUSH_THRESH)
+		tracing_map_pcpu_slot_flush(map, slot);
+
+	local_irq_restore(flags);
 }
 
 /**
@@ -49,7 +141,8 @@ void tracing_map_update_sum(struct tracing_map_elt *elt, unsigned int i, u64 n)
  * Retrieve the value of the sum i associated with the specified
  * tracing_map_elt instance.  The index i is the index returned by the
  * call to tracing_map_add_sum_field() when the tracing map was set
- * up.
+ * up.  If the map uses per-cpu aggregation, updates still sitting in
+ * the per-cpu slots are only included after tracing_map_sort_entries().
  *
  * Return: The sum associated with field i for elt.
  */
@@ -58,6 +151,27 @@ u64 tracing_map_read_sum(struct tracing_map_elt *elt, unsigned int i)
 	return (u64)atomic64_read(&elt->fields[i].sum);
 }
 
+/**
+ * tracing_map_read_hits - Return the number of hits of a tracing_map
+ * @map: The tracing_map
+ *
+ * Return: The number of successful insertions and lookups done via
+ * tracing_map_insert(), including those counted in per-cpu counters
+ * if tracing_map_set_pcpu() was used.
+ */
+u64 tracing_map_read_hits(struct tracing_map *map)
+{
+	u64 hits = atomic64_read(&map->hits);
+	int cpu;
+
+	if (map->pcpu) {
+		for_each_possible_cpu(cpu)
+			hits += local64_read(&per_cpu_ptr(map->pcpu, cpu)->hits);
+	}
+
+	return hits;
+}
+
 /**
  * tracing_map_set_var - Assign a tracing_map_elt's variable field
  * @elt: The tracing_map_elt
@@ -461,6 +575,11 @@ static struct tracing_map_elt *get_free_elt(struct tracing_map *map)
 			map->ops->elt_init(elt);
 	}
 
+	/* Start growing when 3/4 of the pool is used, or if it ran out */
+	if (map->map_bits < map->max_map_bits &&
+	    (idx == map->max_elts - map->max_elts / 4 || !elt))
+		irq_work_queue(&map->grow_irq_work);
+
 	return elt;
 }
 
@@ -512,22 +631,34 @@ static inline bool keys_match(void *key, void *test_key, unsigned key_size)
 	return match;
 }
 
+static inline void tracing_map_inc_hits(struct tracing_map *map)
+{
+	if (map->pcpu)
+		local64_inc(this_cpu_ptr(&map->pcpu->hits));
+	else
+		atomic64_inc(&map->hits);
+}
+
 static inline struct tracing_map_elt *
 __tracing_map_insert(struct tracing_map *map, void *key, bool lookup_only)
 {
+	const struct tracing_map_table *table;
 	u32 idx, key_hash, test_key;
 	int dup_try = 0;
 	struct tracing_map_entry *entry;
 	struct tracing_map_elt *val;
 
+	/* Pairs with the smp_store_release() in tracing_map_grow() */
+	table = smp_load_acquire(&map->table);
+
 	key_hash = jhash(key, map->key_size, 0);
 	if (key_hash == 0)
 		key_hash = 1;
-	idx = key_hash >> (32 - (map->map_bits + 1));
+	idx = key_hash >> (32 - (table->bits + 1));
 
 	while (1) {
-		idx &= (map->map_size - 1);
-		entry = TRACING_MAP_ENTRY(map->map, idx);
+		idx &= (table->size - 1);
+		entry = TRACING_MAP_ENTRY(table->entries, idx);
 		test_key = entry->key;
 
 		if (test_key && test_key == key_hash) {
@@ -535,7 +666,7 @@ __tracing_map_insert(struct tracing_map *map, void *key, bool lookup_only)
 			if (val &&
 			    keys_match(key, val->key, map->key_size)) {
 				if (!lookup_only)
-					atomic64_inc(&map->hits);
+					tracing_map_inc_hits(map);
 				return val;
 			} else if (unlikely(!val)) {
 				/*
@@ -551,7 +682,7 @@ __tracing_map_insert(struct tracing_map *map, void *key, bool lookup_only)
 				 */
 
 				dup_try++;
-				if (dup_try > map->map_size) {
+				if (dup_try > table->size) {
 					atomic64_inc(&map->drops);
 					break;
 				}
@@ -563,6 +694,16 @@ __tracing_map_insert(struct tracing_map *map, void *key, bool lookup_only)
 			if (lookup_only)
 				break;
 
+			/*
+			 * New keys are held back while the map is grown, see
+			 * tracing_map_grow().  Pairs with its
+			 * smp_store_release().
+			 */
+			if (unlikely(smp_load_acquire(&map->resizing))) {
+				atomic64_inc(&map->drops);
+				break;
+			}
+
 			if (!cmpxchg(&entry->key, 0, key_hash)) {
 				struct tracing_map_elt *elt;
 
@@ -580,7 +721,7 @@ __tracing_map_insert(struct tracing_map *map, void *key, bool lookup_only)
 				 */
 				smp_wmb();
 				WRITE_ONCE(entry->val, elt);
-				atomic64_inc(&map->hits);
+				tracing_map_inc_hits(map);
 
 				return entry->val;
 			} else {
@@ -678,9 +819,14 @@ void tracing_map_destroy(struct tracing_map *map)
 	if (!map)
 		return;
 
+	irq_work_sync(&map->grow_irq_work);
+	cancel_work_sync(&map->grow_work);
+
 	tracing_map_free_elts(map);
 
 	tracing_map_array_free(map->map);
+	kfree(map->table);
+	free_percpu(map->pcpu);
 	kfree(map);
 }
 
@@ -699,6 +845,10 @@ void tracing_map_clear(struct tracing_map *map)
 {
 	unsigned int i;
 
+	mutex_lock(&map->lock);
+
+	tracing_map_pcpu_sync(map, true);
+
 	atomic_set(&map->next_elt, -1);
 	atomic64_set(&map->hits, 0);
 	atomic64_set(&map->drops, 0);
@@ -707,6 +857,129 @@ void tracing_map_clear(struct tracing_map *map)
 
 	for (i = 0; i < map->max_elts; i++)
 		tracing_map_elt_clear(*(TRACING_MAP_ELT(map->elts, i)));
+
+	mutex_unlock(&map->lock);
+}
+
+/*
+ * Double the size of the element pool and of the tracing_map_entry
+ * array.  The new pool reuses the existing elts, and the new array is
+ * populated by rehashing the existing entries while insertions of new
+ * keys are held off via map->resizing.  Lookups keep using the old
+ * array until the new one is published.  Called with map->lock held.
+ */
+static int tracing_map_grow(struct tracing_map *map)
+{
+	unsigned int new_bits = map->map_bits + 1;
+	unsigned int new_max_elts = 1 << new_bits;
+	unsigned int new_map_size = 1 << (new_bits + 1);
+	struct tracing_map_table *new_table, *old_table;
+	struct tracing_map_array *elts, *table;
+	struct tracing_map_entry *entry, *new_entry;
+	unsigned int i;
+	u32 idx;
+
+	elts = tracing_map_array_alloc(new_max_elts,
+				       sizeof(struct tracing_map_elt *));
+	if (!elts)
+		return -ENOMEM;
+
+	table = tracing_map_array_alloc(new_map_size,
+					sizeof(struct tracing_map_entry));
+	if (!table) {
+		tracing_map_array_free(elts);
+		return -ENOMEM;
+	}
+
+	new_table = kmalloc(sizeof(*new_table), GFP_KERNEL);
+	if (!new_table) {
+		tracing_map_array_free(table);
+		tracing_map_array_free(elts);
+		return -ENOMEM;
+	}
+	new_table->entries = table;
+	new_table->bits = new_bits;
+	new_table->size = new_map_size;
+
+	for (i = map->max_elts; i < new_max_elts; i++) {
+		struct tracing_map_elt *elt = tracing_map_elt_alloc(map);
+
+		if (IS_ERR(elt)) {
+			while (i-- > map->max_elts)
+				tracing_map_elt_free(*(TRACING_MAP_ELT(elts, i)));
+			kfree(new_table);
+			tracing_map_array_free(elts);
+			tracing_map_array_free(table);
+			return -ENOMEM;
+		}
+		*(TRACING_MAP_ELT(elts, i)) = elt;
+	}
+
+	for (i = 0; i < map->max_elts; i++)
+		*(TRACING_MAP_ELT(elts, i)) = *(TRACING_MAP_ELT(map->elts, i));
+
+	/* Wait for the inserters of new keys that didn't see it yet */
+	WRITE_ONCE(map->resizing, true);
+	tracepoint_synchronize_unregister();
+
+	for (i = 0; i < map->map_size; i++) {
+		entry = TRACING_MAP_ENTRY(map->map, i);
+		if (!entry->key || !entry->val)
+			continue;
+
+		idx = entry->key >> (32 - (new_bits + 1));
+		while (1) {
+			idx &= (new_map_size - 1);
+			new_entry = TRACING_MAP_ENTRY(table, idx);
+			if (!new_entry->key)
+				break;
+			idx++;
+		}
+		new_entry->key = entry->key;
+		new_entry->val = entry->val;
+	}
+
+	/* Switch lookups over, and wait for those still on the old array */
+	old_table = map->table;
+	smp_store_release(&map->table, new_table);
+	tracepoint_synchronize_unregister();
+
+	if (atomic_read(&map->next_elt) >= (int)map->max_elts)
+		atomic_set(&map->next_elt, map->max_elts - 1);
+
+	/* The elts themselves now belong to the new pool */
+	tracing_map_array_free(map->elts);
+	tracing_map_array_free(map->map);
+	kfree(old_table);
+
+	map->elts = elts;
+	map->map = table;
+	map->map_bits = new_bits;
+	map->max_elts = new_max_elts;
+	map->map_size = new_map_size;
+
+	smp_store_release(&map->resizing, false);
+
+	return 0;
+}
+
+static void tracing_map_grow_work(struct work_struct *work)
+{
+	struct tracing_map *map = container_of(work, struct tracing_map,
+					       grow_work);
+
+	mutex_lock(&map->lock);
+	if (map->map_bits < map->max_map_bits)
+		tracing_map_grow(map);
+	mutex_unlock(&map->lock);
+}
+
+static void tracing_map_grow_irq_work(struct irq_work *work)
+{
+	struct tracing_map *map = container_of(work, struct tracing_map,
+					       grow_irq_work);
+
+	schedule_work(&map->grow_work);
 }
 
 static void set_sort_key(struct tracing_map *map,
@@ -787,14 +1060,26 @@ struct tracing_map *tracing_map_create(unsigned int map_bits,
 
 	map->map_size = (1 << (map_bits + 1));
 	map->ops = ops;
+	map->max_map_bits = map_bits;
 
 	map->private_data = private_data;
 
+	mutex_init(&map->lock);
+	init_irq_work(&map->grow_irq_work, tracing_map_grow_irq_work);
+	INIT_WORK(&map->grow_work, tracing_map_grow_work);
+
 	map->map = tracing_map_array_alloc(map->map_size,
 					   sizeof(struct tracing_map_entry));
 	if (!map->map)
 		goto free;
 
+	map->table = kmalloc(sizeof(*map->table), GFP_KERNEL);
+	if (!map->table)
+		goto free;
+	map->table->entries = map->map;
+	map->table->bits = map->map_bits;
+	map->table->size = map->map_size;
+
 	map->key_size = key_size;
 	for (i = 0; i < TRACING_MAP_KEYS_MAX; i++)
 		map->key_idx[i] = -1;
@@ -833,6 +1118,12 @@ int tracing_map_init(struct tracing_map *map)
 	if (map->n_fields < 2)
 		return -EINVAL; /* need at least 1 key and 1 val */
 
+	if (map->use_pcpu) {
+		map->pcpu = alloc_percpu(struct tracing_map_pcpu);
+		if (!map->pcpu)
+			return -ENOMEM;
+	}
+
 	err = tracing_map_alloc_elts(map);
 	if (err)
 		return err;
@@ -842,6 +1133,36 @@ int tracing_map_init(struct tracing_map *map)
 	return err;
 }
 
+/**
+ * tracing_map_set_pcpu - Aggregate sums and hits per-cpu
+ * @map: The tracing_map
+ *
+ * Make tracing_map_update_sum() accumulate into a small per-cpu cache
+ * which is folded into the tracing_map_elts when evicted or when the
+ * map is sorted, instead of doing an atomic add on the shared sum for
+ * every update.  Must be called before tracing_map_init().
+ */
+void tracing_map_set_pcpu(struct tracing_map *map)
+{
+	map->use_pcpu = true;
+}
+
+/**
+ * tracing_map_set_max_bits - Let a tracing_map grow when it fills up
+ * @map: The tracing_map
+ * @max_bits: The size the map is allowed to grow to (2 ** max_bits)
+ *
+ * Instead of dropping new keys once the pool of tracing_map_elts is
+ * exhausted, double the map from a work item whenever it gets 3/4
+ * full, until it reaches 2 ** @max_bits elements.  A @max_bits not
+ * larger than the current size disables growing.
+ */
+void tracing_map_set_max_bits(struct tracing_map *map, unsigned int max_bits)
+{
+	map->max_map_bits = min_t(unsigned int, max_bits,
+				  TRACING_MAP_BITS_MAX);
+}
+
 static int cmp_entries_dup(const void *A, const void *B)
 {
 	const struct tracing_map_sort_entry *a, *b;
@@ -1080,9 +1401,15 @@ int tracing_map_sort_entries(struct tracing_map *map,
 	struct tracing_map_sort_entry *sort_entry, **entries;
 	int i, n_entries, ret;
 
+	mutex_lock(&map->lock);
+
+	tracing_map_pcpu_sync(map, false);
+
 	entries = vmalloc(array_size(sizeof(sort_entry), map->max_elts));
-	if (!entries)
+	if (!entries) {
+		mutex_unlock(&map->lock);
 		return -ENOMEM;
+	}
 
 	for (i = 0, n_entries = 0; i < map->map_size; i++) {
 		struct tracing_map_entry *entry;
@@ -1107,7 +1434,8 @@ int tracing_map_sort_entries(struct tracing_map *map,
 
 	if (n_entries == 1) {
 		*sort_entries = entries;
-		return 1;
+		ret = 1;
+		goto out;
 	}
 
 	detect_dups(entries, n_entries, map->key_size);
@@ -1130,10 +1458,13 @@ int tracing_map_sort_entries(struct tracing_map *map,
 			       &sort_keys[1]);
 
 	*sort_entries = entries;
+	ret = n_entries;
+ out:
+	mutex_unlock(&map->lock);
 
-	return n_entries;
+	return ret;
  free:
 	tracing_map_destroy_sort_entries(entries, n_entries);
 
-	return ret;
+	goto out;
 }
@@ -2,6 +2,11 @@
 #ifndef __TRACING_MAP_H
 #define __TRACING_MAP_H
 
+#include <linux/irq_work.h>
+#include <linux/mutex.h>
+#include <linux/workqueue.h>
+#include <asm/local64.h>
+
 #define TRACING_MAP_BITS_DEFAULT	11
 #define TRACING_MAP_BITS_MAX		17
 #define TRACING_MAP_BITS_MIN		7
@@ -13,6 +18,10 @@
 #define TRACING_MAP_VARS_MAX		16
 #define TRACING_MAP_SORT_KEYS_MAX	2
 
+#define TRACING_MAP_PCPU_BITS		6
+#define TRACING_MAP_PCPU_SLOTS		(1 << TRACING_MAP_PCPU_BITS)
+#define TRACING_MAP_PCPU_FLUSH_THRESH	1024
+
 typedef int (*tracing_map_cmp_fn_t) (void *val_a, void *val_b);
 
 /*
@@ -125,6 +134,26 @@ typedef int (*tracing_map_cmp_fn_t) (void *val_a, void *val_b);
  * user, tracing_map_sort_entry objects contain a number of additional
  * fields which are used for caching and internal purposes and can
  * safely be ignored.
+ *
+ * Two optional features can be turned on before tracing_map_init()
+ * is called.
+ *
+ * tracing_map_set_pcpu() adds a small per-cpu cache of
+ * tracing_map_pcpu_slot in front of the atomic sums of the
+ * tracing_map_elts.  tracing_map_update_sum() then accumulates into
+ * the slot of the current cpu, and the slot is folded into the
+ * shared sums when it's evicted by another elt, after
+ * TRACING_MAP_PCPU_FLUSH_THRESH updates, or when the map is read via
+ * tracing_map_sort_entries().  The map's hit count is kept per-cpu as
+ * well, and must be read with tracing_map_read_hits().
+ *
+ * tracing_map_set_max_bits() allows the map to grow.  When the pool
+ * of tracing_map_elts runs low, a work item doubles both the pool and
+ * the tracing_map_entry array, up to the given number of bits.  The
+ * existing tracing_map_elts are moved over as-is, so pointers
+ * returned by earlier insertions stay valid.  Lookups and hits on
+ * existing keys are served from the old array while the new one is
+ * being populated; only insertions of new keys are dropped meanwhile.
 */
 
 struct tracing_map_field {
@@ -180,6 +209,27 @@ struct tracing_map_array {
 #define TRACING_MAP_ELT(array, idx)					\
 	((struct tracing_map_elt **)TRACING_MAP_ARRAY_ELT(array, idx))
 
+/*
+ * The tracing_map_entry array as seen by lockless insertions, replaced
+ * as a whole when the map grows.
+ */
+struct tracing_map_table {
+	struct tracing_map_array	*entries;
+	unsigned int			bits;
+	unsigned int			size;
+};
+
+struct tracing_map_pcpu_slot {
+	struct tracing_map_elt		*elt;
+	unsigned int			count;
+	u64				sums[TRACING_MAP_FIELDS_MAX];
+};
+
+struct tracing_map_pcpu {
+	local64_t			hits;
+	struct tracing_map_pcpu_slot	slots[TRACING_MAP_PCPU_SLOTS];
+};
+
 struct tracing_map {
 	unsigned int			key_size;
 	unsigned int			map_bits;
@@ -198,6 +248,14 @@ struct tracing_map {
 	unsigned int			n_vars;
 	atomic64_t			hits;
 	atomic64_t			drops;
+	bool				use_pcpu;
+	struct tracing_map_pcpu __percpu *pcpu;
+	unsigned int			max_map_bits;
+	struct tracing_map_table	*table;
+	bool				resizing;
+	struct mutex			lock;
+	struct irq_work			grow_irq_work;
+	struct work_struct		grow_work;
 };
 
 /**
@@ -243,6 +301,9 @@ tracing_map_create(unsigned int map_bits,
 		   const struct tracing_map_ops *ops,
 		   void *private_data);
 extern int tracing_map_init(struct tracing_map *map);
+extern void tracing_map_set_pcpu(struct tracing_map *map);
+extern void tracing_map_set_max_bits(struct tracing_map *map,
+				     unsigned int max_bits);
 
 extern int tracing_map_add_sum_field(struct tracing_map *map);
 extern int tracing_map_add_var(struct tracing_map *map);
@@ -271,6 +332,7 @@ extern bool tracing_map_var_set(struct tracing_map_elt *elt, unsigned int i);
 extern u64 tracing_map_read_sum(struct tracing_map_elt *elt, unsigned int i);
 extern u64 tracing_map_read_var(struct tracing_map_elt *elt, unsigned int i);
 extern u64 tracing_map_read_var_once(struct tracing_map_elt *elt, unsigned int i);
+extern u64 tracing_map_read_hits(struct tracing_map *map);
 
 extern int
 tracing_map_sort_entries(struct tracing_map *map,
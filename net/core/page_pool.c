@@ -30,6 +30,36 @@
 
 #define BIAS_MAX	(LONG_MAX >> 1)
 
+/* Pages returned outside of the pool's NAPI context are kept per CPU and
+ * moved into the ptr_ring in batches, instead of taking the producer lock
+ * for each of them. The allocator takes them back directly when the ring
+ * runs empty.
+ */
+#define PP_RETURN_CACHE_SIZE	32
+
+struct page_pool_return_cache {
+	spinlock_t lock;	/* taken remotely when the ring runs empty */
+	unsigned int count;
+	struct page *cache[PP_RETURN_CACHE_SIZE];
+};
+
+/* Pools are only allocated by page_pool_create_percpu(), so state private
+ * to this file can live next to struct page_pool.
+ */
+struct page_pool_ext {
+	struct page_pool pool;
+	struct page_pool_return_cache __percpu *return_cache;
+	/* Return caches holding pages, only changes when one fills from or
+	 * drains to empty, so that recycling doesn't bounce it.
+	 */
+	atomic_t return_caches_used;
+};
+
+static struct page_pool_ext *page_pool_ext(struct page_pool *pool)
+{
+	return container_of(pool, struct page_pool_ext, pool);
+}
+
 #ifdef CONFIG_PAGE_POOL_STATS
 static DEFINE_PER_CPU(struct page_pool_recycle_stats, pp_system_recycle_stats);
 
@@ -235,12 +265,20 @@ static int page_pool_init(struct page_pool *pool,
 	}
 #endif
 
-	if (ptr_ring_init(&pool->ring, ring_qsize, GFP_KERNEL) < 0) {
-#ifdef CONFIG_PAGE_POOL_STATS
-		if (!(pool->p.flags & PP_FLAG_SYSTEM_POOL))
-			free_percpu(pool->recycle_stats);
-#endif
-		return -ENOMEM;
+	if (ptr_ring_init(&pool->ring, ring_qsize, GFP_KERNEL) < 0)
+		goto err_free_stats;
+
+	/* System pools are per CPU already, and mostly see local returns. */
+	if (!(pool->p.flags & PP_FLAG_SYSTEM_POOL)) {
+		struct page_pool_ext *ext = page_pool_ext(pool);
+		int cpu;
+
+		ext->return_cache = alloc_percpu(struct page_pool_return_cache);
+		if (!ext->return_cache)
+			goto err_cleanup_ring;
+
+		for_each_possible_cpu(cpu)
+			spin_lock_init(&per_cpu_ptr(ext->return_cache, cpu)->lock);
 	}
 
 	atomic_set(&pool->pages_state_release_cnt, 0);
@@ -252,10 +290,20 @@ static int page_pool_init(struct page_pool *pool,
 		get_device(pool->p.dev);
 
 	return 0;
+
+err_cleanup_ring:
+	ptr_ring_cleanup(&pool->ring, NULL);
+err_free_stats:
+#ifdef CONFIG_PAGE_POOL_STATS
+	if (!(pool->p.flags & PP_FLAG_SYSTEM_POOL))
+		free_percpu(pool->recycle_stats);
+#endif
+	return -ENOMEM;
 }
 
 static void page_pool_uninit(struct page_pool *pool)
 {
+	free_percpu(page_pool_ext(pool)->return_cache);
 	ptr_ring_cleanup(&pool->ring, NULL);
 
 	if (pool->p.flags & PP_FLAG_DMA_MAP)
@@ -275,13 +323,16 @@ static void page_pool_uninit(struct page_pool *pool)
 struct page_pool *
 page_pool_create_percpu(const struct page_pool_params *params, int cpuid)
 {
+	struct page_pool_ext *ext;
 	struct page_pool *pool;
 	int err;
 
-	pool = kzalloc_node(sizeof(*pool), GFP_KERNEL, params->nid);
-	if (!pool)
+	ext = kzalloc_node(sizeof(*ext), GFP_KERNEL, params->nid);
+	if (!ext)
 		return ERR_PTR(-ENOMEM);
 
+	pool = &ext->pool;
+
 	err = page_pool_init(pool, params, cpuid);
 	if (err < 0)
 		goto err_free;
@@ -296,7 +347,7 @@ page_pool_create_percpu(const struct page_pool_params *params, int cpuid)
 	page_pool_uninit(pool);
 err_free:
 	pr_warn("%s() gave up with errno %d\n", __func__, err);
-	kfree(pool);
+	kfree(ext);
 	return ERR_PTR(err);
 }
 EXPORT_SYMBOL(page_pool_create_percpu);
@@ -313,6 +364,45 @@ EXPORT_SYMBOL(page_pool_create);
 
 static void page_pool_return_page(struct page_pool *pool, struct page *page);
 
+/* The ring is empty, but pages may be parked in the return caches of other
+ * CPUs until these fill up. Take them back rather than leaving them out of
+ * reach while the pool allocates new pages, which starves small pools.
+ */
+static void page_pool_steal_return_caches(struct page_pool *pool, int pref_nid)
+{
+	struct page_pool_ext *ext = page_pool_ext(pool);
+	struct page *page;
+	int cpu;
+
+	if (!ext->return_cache || !atomic_read(&ext->return_caches_used))
+		return;
+
+	for_each_possible_cpu(cpu) {
+		struct page_pool_return_cache *rc;
+
+		rc = per_cpu_ptr(ext->return_cache, cpu);
+		if (!READ_ONCE(rc->count))
+			continue;
+
+		spin_lock_bh(&rc->lock);
+		while (rc->count && pool->alloc.count < PP_ALLOC_CACHE_REFILL) {
+			page = rc->cache[--rc->count];
+			if (likely(page_to_nid(page) == pref_nid)) {
+				pool->alloc.cache[pool->alloc.count++] = page;
+			} else {
+				page_pool_return_page(pool, page);
+				alloc_stat_inc(pool, waive);
+			}
+		}
+		if (!rc->count)
+			atomic_dec(&ext->return_caches_used);
+		spin_unlock_bh(&rc->lock);
+
+		if (pool->alloc.count >= PP_ALLOC_CACHE_REFILL)
+			break;
+	}
+}
+
 noinline
 static struct page *page_pool_refill_alloc_cache(struct page_pool *pool)
 {
@@ -320,12 +410,6 @@ static struct page *page_pool_refill_alloc_cache(struct page_pool *pool)
 	struct page *page;
 	int pref_nid; /* preferred NUMA node */
 
-	/* Quicker fallback, avoid locks when ring is empty */
-	if (__ptr_ring_empty(r)) {
-		alloc_stat_inc(pool, empty);
-		return NULL;
-	}
-
 	/* Softirq guarantee CPU and thus NUMA node is stable. This,
 	 * assumes CPU refilling driver RX-ring will also run RX-NAPI.
 	 */
@@ -336,6 +420,17 @@ static struct page *page_pool_refill_alloc_cache(struct page_pool *pool)
 	pref_nid = numa_mem_id(); /* will be zero like page_to_nid() */
 #endif
 
+	/* Quicker fallback, avoid locks when ring is empty */
+	if (__ptr_ring_empty(r)) {
+		page_pool_steal_return_caches(pool, pref_nid);
+		if (!pool->alloc.count) {
+			alloc_stat_inc(pool, empty);
+			return NULL;
+		}
+		alloc_stat_inc(pool, refill);
+		return pool->alloc.cache[--pool->alloc.count];
+	}
+
 	/* Refill alloc array, but only if NUMA match */
 	do {
 		page = __ptr_ring_consume(r);
@@ -638,6 +733,57 @@ static bool page_pool_recycle_in_ring(struct page_pool *pool, struct page *page)
 	return false;
 }
 
+/* Returns false if @pool has no return cache, the page is then left to the
+ * caller.  Pages the ptr_ring has no room for are released to the page
+ * allocator.
+ */
+static bool page_pool_recycle_in_return_cache(struct page_pool *pool,
+					      struct page *page)
+{
+	struct page_pool_ext *ext = page_pool_ext(pool);
+	struct page *batch[PP_RETURN_CACHE_SIZE];
+	struct page_pool_return_cache *rc;
+	unsigned int i, count;
+
+	if (!ext->return_cache)
+		return false;
+
+	local_bh_disable();
+	rc = this_cpu_ptr(ext->return_cache);
+
+	spin_lock(&rc->lock);
+	if (!rc->count)
+		atomic_inc(&ext->return_caches_used);
+	rc->cache[rc->count++] = page;
+	if (likely(rc->count < PP_RETURN_CACHE_SIZE)) {
+		spin_unlock(&rc->lock);
+		local_bh_enable();
+		return true;
+	}
+
+	count = rc->count;
+	memcpy(batch, rc->cache, count * sizeof(*batch));
+	rc->count = 0;
+	atomic_dec(&ext->return_caches_used);
+	spin_unlock(&rc->lock);
+
+	spin_lock(&pool->ring.producer_lock);
+	for (i = 0; i < count; i++) {
+		if (__ptr_ring_produce(&pool->ring, batch[i]))
+			break;
+	}
+	recycle_stat_add(pool, ring, i);
+	recycle_stat_add(pool, ring_full, count - i);
+	spin_unlock(&pool->ring.producer_lock);
+	local_bh_enable();
+
+	/* Same as page_pool_put_page_bulk(), free outside of the lock */
+	for (; i < count; i++)
+		page_pool_return_page(pool, batch[i]);
+
+	return true;
+}
+
 /* Only allow direct recycling in special circumstances, into the
  * alloc side cache.  E.g. during RX-NAPI processing for XDP_DROP use-case.
  *
@@ -720,7 +866,10 @@ void page_pool_put_unrefed_page(struct page_pool *pool, struct page *page,
 				unsigned int dma_sync_size, bool allow_direct)
 {
 	page = __page_pool_put_page(pool, page, dma_sync_size, allow_direct);
-	if (page && !page_pool_recycle_in_ring(pool, page)) {
+	if (!page || page_pool_recycle_in_return_cache(pool, page))
+		return;
+
+	if (!page_pool_recycle_in_ring(pool, page)) {
 		/* Cache full, fallback to free pages */
 		recycle_stat_inc(pool, ring_full);
 		page_pool_return_page(pool, page);
@@ -889,7 +1038,7 @@ static void __page_pool_destroy(struct page_pool *pool)
 
 	page_pool_unlist(pool);
 	page_pool_uninit(pool);
-	kfree(pool);
+	kfree(page_pool_ext(pool));
 }
 
 static void page_pool_empty_alloc_cache_once(struct page_pool *pool)
@@ -909,11 +1058,37 @@ static void page_pool_empty_alloc_cache_once(struct page_pool *pool)
 	}
 }
 
+/* Producers could still be in-flight, so this is repeated along with
+ * page_pool_empty_ring() until no page is left.
+ */
+static void page_pool_empty_return_caches(struct page_pool *pool)
+{
+	struct page_pool_ext *ext = page_pool_ext(pool);
+	int cpu;
+
+	if (!ext->return_cache)
+		return;
+
+	for_each_possible_cpu(cpu) {
+		struct page_pool_return_cache *rc;
+
+		rc = per_cpu_ptr(ext->return_cache, cpu);
+		spin_lock_bh(&rc->lock);
+		if (rc->count)
+			atomic_dec(&ext->return_caches_used);
+		while (rc->count)
+			page_pool_return_page(pool, rc->cache[--rc->count]);
+		spin_unlock_bh(&rc->lock);
+	}
+}
+
 static void page_pool_scrub(struct page_pool *pool)
 {
 	page_pool_empty_alloc_cache_once(pool);
 	pool->destroy_cnt++;
 
+	page_pool_empty_return_caches(pool);
+
 	/* No more consumers should exist, but producers could still
 	 * be in-flight.
 	 */
@@ -57,6 +57,90 @@ static u32 sk_ehashfn(const struct sock *sk)
 			    sk->sk_daddr, sk->sk_dport);
 }
 
+/* Ports recently released by connect()ed sockets, per destination.
+ *
+ * Proxies connecting at a high rate to a few destinations end up with the
+ * ephemeral range mostly in use for each of them, and __inet_hash_connect()
+ * then probes many bind buckets before finding a free port. When the bind
+ * bucket of a port picked by connect() is destroyed, that is once its
+ * TIME_WAIT socket is gone too, remember the port for the (saddr, daddr,
+ * dport) of its last owner. A later connect() to the same destination tries
+ * it when the randomized start of its search is taken, which is also when
+ * upstream's randomization mostly gives way. Uncontended connect()s never
+ * look at the hints.
+ *
+ * Entries are only hints: the port goes through the usual bind bucket and
+ * established checks, which is what invalidates stale ones. Each entry is
+ * the port in the low 16 bits, tagged with the upper bits of the hash.
+ */
+#define INET_PORT_HINT_SIZE	4096
+#define INET_PORT_HINT_WAYS	4
+static u32 *port_hints;
+
+static u32 sk_port_hint_hash(const struct sock *sk)
+{
+#if IS_ENABLED(CONFIG_IPV6)
+	if (sk->sk_family == AF_INET6 &&
+	    !ipv6_addr_v4mapped(&sk->sk_v6_daddr))
+		return inet6_ehashfn(sock_net(sk), &sk->sk_v6_rcv_saddr, 0,
+				     &sk->sk_v6_daddr, sk->sk_dport);
+#endif
+	return inet_ehashfn(sock_net(sk), sk->sk_rcv_saddr, 0,
+			    sk->sk_daddr, sk->sk_dport);
+}
+
+static u32 *inet_port_hint_set(u32 hash)
+{
+	return &port_hints[(hash % INET_PORT_HINT_SIZE) * INET_PORT_HINT_WAYS];
+}
+
+static void inet_port_hint_add(const struct sock *sk, unsigned short port)
+{
+	u32 hash = sk_port_hint_hash(sk), *set;
+	int i;
+
+	if (unlikely(!port_hints))
+		return;
+
+	set = inet_port_hint_set(hash);
+	for (i = 0; i < INET_PORT_HINT_WAYS; i++) {
+		if (!READ_ONCE(set[i]))
+			break;
+	}
+	if (i == INET_PORT_HINT_WAYS)
+		i = port % INET_PORT_HINT_WAYS;
+	WRITE_ONCE(set[i], (hash & 0xffff0000) | port);
+}
+
+/* Claim a port remembered for @sk's destination, in [@low, @high[ and with
+ * the parity of @low unless @any_parity, or return 0.
+ */
+static int inet_port_hint_get(const struct sock *sk, int low, int high,
+			      bool any_parity)
+{
+	u32 hash, *set;
+	int i, port;
+
+	if (unlikely(!port_hints))
+		return 0;
+
+	hash = sk_port_hint_hash(sk);
+	set = inet_port_hint_set(hash);
+	for (i = 0; i < INET_PORT_HINT_WAYS; i++) {
+		u32 val = READ_ONCE(set[i]);
+
+		if (!val || (val & 0xffff0000) != (hash & 0xffff0000))
+			continue;
+		port = val & 0xffff;
+		if (port < low || port >= high ||
+		    (!any_parity && ((port - low) & 1)))
+			continue;
+		if (cmpxchg(&set[i], val, 0) == val)
+			return port;
+	}
+	return 0;
+}
+
 /*
  * Allocate and initialize a new local port bind bucket.
  * The bindhash mutex for snum's hash chain must be held here.
@@ -171,6 +255,16 @@ void inet_bind_hash(struct sock *sk, struct inet_bind_bucket *tb,
 	sk_add_bind_node(sk, &tb2->owners);
 }
 
+/* Called with the bind bucket lock held, before inet_bind_bucket_destroy() */
+void inet_bind_bucket_hint(const struct sock *sk,
+			   const struct inet_bind_bucket *tb)
+{
+	/* Last owner of a bucket created by __inet_hash_connect() */
+	if (hlist_empty(&tb->bhash2) && tb->fastreuse < 0 &&
+	    tb->fastreuseport < 0 && sk->sk_dport)
+		inet_port_hint_add(sk, tb->port);
+}
+
 /*
  * Get rid of any references to a local port held by the given sock.
  */
@@ -201,6 +295,7 @@ static void __inet_put_port(struct sock *sk)
 	}
 	spin_unlock(&head2->lock);
 
+	inet_bind_bucket_hint(sk, tb);
 	inet_bind_bucket_destroy(hashinfo->bind_bucket_cachep, tb);
 	spin_unlock(&head->lock);
 }
@@ -1005,7 +1100,8 @@ int __inet_hash_connect(struct inet_timewait_death_row *death_row,
 	bool tb_created = false;
 	u32 remaining, offset;
 	int ret, i, low, high;
-	bool local_ports;
+	bool local_ports, hinted = false;
+	int hint;
 	int step, l3mdev;
 	u32 index;
 
@@ -1038,6 +1134,7 @@ int __inet_hash_connect(struct inet_timewait_death_row *death_row,
 	 */
 	if (!local_ports)
 		offset &= ~1U;
+
 other_parity_scan:
 	port = low + offset;
 	for (i = 0; i < remaining; i += step, port += step) {
@@ -1078,6 +1175,19 @@ int __inet_hash_connect(struct inet_timewait_death_row *death_row,
 next_port:
 		spin_unlock_bh(&head->lock);
 		cond_resched();
+
+		/* The randomized start is taken, go on from a port this
+		 * destination released lately, if any.
+		 */
+		if (!hinted) {
+			hinted = true;
+			hint = inet_port_hint_get(sk, low, high, local_ports);
+			if (hint && (local_ports ||
+				     ((hint - low) & 1) == (offset & 1))) {
+				offset = hint - low;
+				goto other_parity_scan;
+			}
+		}
 	}
 
 	if (!local_ports) {
@@ -1208,6 +1318,14 @@ void __init inet_hashinfo2_init(struct inet_hashinfo *h, const char *name,
 						0, 0, NULL, NULL,
 						INET_TABLE_PERTURB_SIZE,
 						INET_TABLE_PERTURB_SIZE);
+
+	port_hints = alloc_large_system_hash("Port-hints",
+					     sizeof(*port_hints) *
+					     INET_PORT_HINT_WAYS,
+					     INET_PORT_HINT_SIZE,
+					     0, HASH_ZERO, NULL, NULL,
+					     INET_PORT_HINT_SIZE,
+					     INET_PORT_HINT_SIZE);
 }
 
 int inet_hashinfo2_init_mod(struct inet_hashinfo *h)
@@ -32,6 +32,7 @@
 #include <linux/mm.h>
 #include <linux/nsproxy.h>
 #include <linux/rculist_nulls.h>
+#include <linux/seq_file.h>
 
 #include <net/netfilter/nf_conntrack.h>
 #include <net/netfilter/nf_conntrack_bpf.h>
@@ -63,15 +64,26 @@ EXPORT_SYMBOL_GPL(nf_conntrack_expect_lock);
 struct hlist_nulls_head *nf_conntrack_hash __read_mostly;
 EXPORT_SYMBOL_GPL(nf_conntrack_hash);
 
+/* The hash table is split in contiguous bucket ranges, one per shard, and
+ * each shard is scanned by its own work item at its own pace.
+ */
 struct conntrack_gc_work {
 	struct delayed_work	dwork;
-	u32			next_bucket;
+	u32			next_bucket;	/* relative to shard start */
 	u32			avg_timeout;
 	u32			count;
 	u32			start_time;
+	u16			shard;
 	bool			exiting;
 	bool			early_drop;
-};
+
+	/* statistics, see conntrack_gc_seq_show() */
+	u32			pass_linger;
+	u32			last_linger;
+	u32			last_scan_time;
+	u64			expired;
+	u64			passes;
+} ____cacheline_aligned_in_smp;
 
 static __read_mostly struct kmem_cache *nf_conntrack_cachep;
 static DEFINE_SPINLOCK(nf_conntrack_locks_all_lock);
@@ -96,10 +108,17 @@ static DEFINE_MUTEX(nf_conntrack_mutex);
 #define GC_SCAN_MAX_DURATION	msecs_to_jiffies(10)
 #define GC_SCAN_EXPIRED_MAX	(64000u / HZ)
 
+/* don't split the table in shards smaller than this */
+#define GC_SHARD_MIN_BUCKETS	16384u
+#define GC_SHARDS_MAX		64u
+
 #define MIN_CHAINLEN	50u
 #define MAX_CHAINLEN	(80u - MIN_CHAINLEN)
 
-static struct conntrack_gc_work conntrack_gc_work;
+static struct conntrack_gc_work *conntrack_gc_work;
+/* shards in use for the current table size, out of conntrack_gc_shards_max */
+static unsigned int conntrack_gc_shards __read_mostly;
+static unsigned int conntrack_gc_shards_max __read_mostly;
 
 void nf_conntrack_lock(spinlock_t *lock) __acquires(lock)
 {
@@ -1452,9 +1471,29 @@ static bool gc_worker_can_early_drop(const struct nf_conn *ct)
 	return false;
 }
 
+static struct workqueue_struct *gc_workqueue(void)
+{
+	/* shards are only worth having if they can run in parallel */
+	return READ_ONCE(conntrack_gc_shards) > 1 ? system_unbound_wq :
+						    system_power_efficient_wq;
+}
+
+/* Number of shards to split a table of @hashsz buckets in */
+static unsigned int gc_shards_for(unsigned int hashsz)
+{
+	return clamp(min(num_possible_cpus(), hashsz / GC_SHARD_MIN_BUCKETS),
+		     1u, conntrack_gc_shards_max);
+}
+
+/* First bucket of @shard, for a table of @hashsz buckets */
+static unsigned int gc_shard_bucket(unsigned int hashsz, unsigned int shard)
+{
+	return div_u64((u64)hashsz * shard, READ_ONCE(conntrack_gc_shards));
+}
+
 static void gc_worker(struct work_struct *work)
 {
-	unsigned int i, hashsz, nf_conntrack_max95 = 0;
+	unsigned int i, first, end, hashsz, nf_conntrack_max95 = 0;
 	u32 end_time, start_time = nfct_time_stamp;
 	struct conntrack_gc_work *gc_work;
 	unsigned int expired_count = 0;
@@ -1464,16 +1503,23 @@ static void gc_worker(struct work_struct *work)
 
 	gc_work = container_of(work, struct conntrack_gc_work, dwork.work);
 
-	i = gc_work->next_bucket;
 	if (gc_work->early_drop)
 		nf_conntrack_max95 = nf_conntrack_max / 100u * 95u;
 
-	if (i == 0) {
+	if (gc_work->next_bucket == 0) {
 		gc_work->avg_timeout = GC_SCAN_INTERVAL_INIT;
 		gc_work->count = GC_SCAN_INITIAL_COUNT;
 		gc_work->start_time = start_time;
+		gc_work->pass_linger = 0;
 	}
 
+	/* The table might be resized between runs, the relative position
+	 * in the shard is kept: gc is best-effort anyway.
+	 */
+	first = gc_shard_bucket(READ_ONCE(nf_conntrack_htable_size),
+				gc_work->shard);
+	i = first + gc_work->next_bucket;
+
 	next_run = gc_work->avg_timeout;
 	count = gc_work->count;
 
@@ -1488,7 +1534,8 @@ static void gc_worker(struct work_struct *work)
 		rcu_read_lock();
 
 		nf_conntrack_get_ht(&ct_hash, &hashsz);
-		if (i >= hashsz) {
+		end = gc_shard_bucket(hashsz, gc_work->shard + 1);
+		if (i >= end) {
 			rcu_read_unlock();
 			break;
 		}
@@ -1509,7 +1556,7 @@ static void gc_worker(struct work_struct *work)
 			if (expired_count > GC_SCAN_EXPIRED_MAX) {
 				rcu_read_unlock();
 
-				gc_work->next_bucket = i;
+				gc_work->next_bucket = i - first;
 				gc_work->avg_timeout = next_run;
 				gc_work->count = count;
 
@@ -1521,7 +1568,12 @@ static void gc_worker(struct work_struct *work)
 			}
 
 			if (nf_ct_is_expired(tmp)) {
+				/* how long it stayed in the table once expired */
+				gc_work->pass_linger =
+					max_t(u32, gc_work->pass_linger,
+					      nfct_time_stamp - READ_ONCE(tmp->timeout));
 				nf_ct_gc_expired(tmp);
+				gc_work->expired++;
 				expired_count++;
 				continue;
 			}
@@ -1567,16 +1619,19 @@ static void gc_worker(struct work_struct *work)
 		i++;
 
 		delta_time = nfct_time_stamp - end_time;
-		if (delta_time > 0 && i < hashsz) {
+		if (delta_time > 0 && i < end) {
 			gc_work->avg_timeout = next_run;
 			gc_work->count = count;
-			gc_work->next_bucket = i;
+			gc_work->next_bucket = i - first;
 			next_run = 0;
 			goto early_exit;
 		}
-	} while (i < hashsz);
+	} while (i < end);
 
 	gc_work->next_bucket = 0;
+	gc_work->last_linger = gc_work->pass_linger;
+	gc_work->last_scan_time = nfct_time_stamp - gc_work->start_time;
+	gc_work->passes++;
 
 	next_run = clamp(next_run, GC_SCAN_INTERVAL_MIN, GC_SCAN_INTERVAL_MAX);
 
@@ -1593,15 +1648,101 @@ static void gc_worker(struct work_struct *work)
 	if (next_run)
 		gc_work->early_drop = false;
 
-	queue_delayed_work(system_power_efficient_wq, &gc_work->dwork, next_run);
+	queue_delayed_work(gc_workqueue(), &gc_work->dwork, next_run);
 }
 
-static void conntrack_gc_work_init(struct conntrack_gc_work *gc_work)
+static void conntrack_gc_set_early_drop(void)
 {
-	INIT_DELAYED_WORK(&gc_work->dwork, gc_worker);
-	gc_work->exiting = false;
+	unsigned int i;
+
+	for (i = 0; i < conntrack_gc_shards; i++) {
+		if (!conntrack_gc_work[i].early_drop)
+			conntrack_gc_work[i].early_drop = true;
+	}
 }
 
+static int conntrack_gc_work_init(void)
+{
+	unsigned int i;
+
+	/* enough for any table size, nf_conntrack_hash_resize() picks */
+	conntrack_gc_shards_max = clamp(num_possible_cpus(), 1u, GC_SHARDS_MAX);
+	conntrack_gc_work = kcalloc(conntrack_gc_shards_max,
+				    sizeof(*conntrack_gc_work), GFP_KERNEL);
+	if (!conntrack_gc_work)
+		return -ENOMEM;
+
+	conntrack_gc_shards = gc_shards_for(nf_conntrack_htable_size);
+	for (i = 0; i < conntrack_gc_shards_max; i++) {
+		struct conntrack_gc_work *gc_work = &conntrack_gc_work[i];
+
+		INIT_DELAYED_WORK(&gc_work->dwork, gc_worker);
+		gc_work->shard = i;
+		/* spread the first runs over a second */
+		if (i < conntrack_gc_shards)
+			queue_delayed_work(gc_workqueue(), &gc_work->dwork,
+					   HZ + i * HZ / conntrack_gc_shards);
+	}
+	return 0;
+}
+
+/* Split the table again after a resize to @hashsz buckets, with
+ * nf_conntrack_mutex held.  The shards restart from their first bucket.
+ */
+static void conntrack_gc_work_reshard(unsigned int hashsz)
+{
+	unsigned int i, shards = gc_shards_for(hashsz);
+
+	if (shards == conntrack_gc_shards)
+		return;
+
+	for (i = 0; i < conntrack_gc_shards; i++)
+		cancel_delayed_work_sync(&conntrack_gc_work[i].dwork);
+
+	WRITE_ONCE(conntrack_gc_shards, shards);
+	for (i = 0; i < shards; i++) {
+		struct conntrack_gc_work *gc_work = &conntrack_gc_work[i];
+
+		gc_work->next_bucket = 0;
+		if (!gc_work->exiting)
+			queue_delayed_work(gc_workqueue(), &gc_work->dwork,
+					   i * HZ / shards);
+	}
+}
+
+static void conntrack_gc_work_fini(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < conntrack_gc_shards_max; i++)
+		cancel_delayed_work_sync(&conntrack_gc_work[i].dwork);
+	kfree(conntrack_gc_work);
+}
+
+#ifdef CONFIG_NF_CONNTRACK_PROCFS
+/* /proc/net/stat/nf_conntrack_gc: one line per shard. Entries found expired
+ * but still in the table, for how long the worst of them lingered during the
+ * last full pass over the shard, and how long that pass took (both in ms).
+ */
+static int conntrack_gc_seq_show(struct seq_file *seq, void *v)
+{
+	unsigned int i;
+
+	seq_puts(seq, "shard first_bucket passes expired linger_ms scan_ms\n");
+	for (i = 0; i < conntrack_gc_shards; i++) {
+		const struct conntrack_gc_work *gc_work = &conntrack_gc_work[i];
+
+		seq_printf(seq, "%5u %12u %6llu %7llu %9u %7u\n", i,
+			   gc_shard_bucket(READ_ONCE(nf_conntrack_htable_size), i),
+			   READ_ONCE(gc_work->passes),
+			   READ_ONCE(gc_work->expired),
+			   jiffies_to_msecs(READ_ONCE(gc_work->last_linger)),
+			   jiffies_to_msecs(READ_ONCE(gc_work->last_scan_time)));
+	}
+	return 0;
+}
+#endif
+
 static struct nf_conn *
 __nf_conntrack_alloc(struct net *net,
 		     const struct nf_conntrack_zone *zone,
@@ -1618,8 +1759,7 @@ __nf_conntrack_alloc(struct net *net,
 
 	if (nf_conntrack_max && unlikely(ct_count > nf_conntrack_max)) {
 		if (!early_drop(net, hash)) {
-			if (!conntrack_gc_work.early_drop)
-				conntrack_gc_work.early_drop = true;
+			conntrack_gc_set_early_drop();
 			atomic_dec(&cnet->count);
 			net_warn_ratelimited("nf_conntrack: table full, dropping packet\n");
 			return ERR_PTR(-ENOMEM);
@@ -2490,14 +2630,20 @@ static int kill_all(struct nf_conn *i, void *data)
 
 void nf_conntrack_cleanup_start(void)
 {
+	unsigned int i;
+
 	cleanup_nf_conntrack_bpf();
-	conntrack_gc_work.exiting = true;
+	for (i = 0; i < conntrack_gc_shards_max; i++)
+		conntrack_gc_work[i].exiting = true;
 }
 
 void nf_conntrack_cleanup_end(void)
 {
 	RCU_INIT_POINTER(nf_ct_hook, NULL);
-	cancel_delayed_work_sync(&conntrack_gc_work.dwork);
+#ifdef CONFIG_NF_CONNTRACK_PROCFS
+	remove_proc_entry("nf_conntrack_gc", init_net.proc_net_stat);
+#endif
+	conntrack_gc_work_fini();
 	kvfree(nf_conntrack_hash);
 
 	nf_conntrack_proto_fini();
@@ -2631,6 +2777,7 @@ int nf_conntrack_hash_resize(unsigned int hashsize)
 	nf_conntrack_all_unlock();
 	local_bh_enable();
 
+	conntrack_gc_work_reshard(hashsize);
 	mutex_unlock(&nf_conntrack_mutex);
 
 	synchronize_net();
@@ -2716,17 +2863,24 @@ int nf_conntrack_init_start(void)
 	if (ret < 0)
 		goto err_proto;
 
-	conntrack_gc_work_init(&conntrack_gc_work);
-	queue_delayed_work(system_power_efficient_wq, &conntrack_gc_work.dwork, HZ);
+	ret = conntrack_gc_work_init();
+	if (ret < 0)
+		goto err_gc;
 
 	ret = register_nf_conntrack_bpf();
 	if (ret < 0)
 		goto err_kfunc;
 
+#ifdef CONFIG_NF_CONNTRACK_PROCFS
+	/* gc is global, so are its statistics */
+	proc_create_single("nf_conntrack_gc", 0444, init_net.proc_net_stat,
+			   conntrack_gc_seq_show);
+#endif
 	return 0;
 
 err_kfunc:
-	cancel_delayed_work_sync(&conntrack_gc_work.dwork);
+	conntrack_gc_work_fini();
+err_gc:
 	nf_conntrack_proto_fini();
 err_proto:
 	nf_conntrack_helper_fini();
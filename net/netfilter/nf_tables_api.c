@@ -20,9 +20,13 @@
 #include <net/netfilter/nf_tables_core.h>
 #include <net/netfilter/nf_tables.h>
 #include <net/netfilter/nf_tables_offload.h>
+#include <net/netfilter/nf_tables_jit.h>
 #include <net/net_namespace.h>
 #include <net/sock.h>
 
+#include "nft_set_pipapo_avx512.h"
+#include "nft_set_pipapo_neon.h"
+
 #define NFT_MODULE_AUTOLOAD_LIMIT (MODULE_NAME_LEN - sizeof("nft-expr-255-"))
 #define NFT_SET_MAX_ANONLEN 16
 
@@ -2055,18 +2059,24 @@ static void nft_chain_stats_replace(struct nft_trans *trans)
 		static_branch_inc(&nft_counters_enabled);
 }
 
+static void nf_tables_chain_free_blob(struct nft_rule_blob *blob)
+{
+	nft_jit_release(blob);
+	kvfree(blob);
+}
+
 static void nf_tables_chain_free_chain_rules(struct nft_chain *chain)
 {
 	struct nft_rule_blob *g0 = rcu_dereference_raw(chain->blob_gen_0);
 	struct nft_rule_blob *g1 = rcu_dereference_raw(chain->blob_gen_1);
 
 	if (g0 != g1)
-		kvfree(g1);
-	kvfree(g0);
+		nf_tables_chain_free_blob(g1);
+	nf_tables_chain_free_blob(g0);
 
 	/* should be NULL either via abort or via successful commit */
 	WARN_ON_ONCE(chain->blob_next);
-	kvfree(chain->blob_next);
+	nf_tables_chain_free_blob(chain->blob_next);
 }
 
 void nf_tables_chain_destroy(struct nft_ctx *ctx)
@@ -4262,6 +4272,13 @@ static const struct nft_set_type *nft_set_types[] = {
 	&nft_set_rbtree_type,
 #if defined(CONFIG_X86_64) && !defined(CONFIG_UML)
 	&nft_set_pipapo_avx2_type,
+#endif
+	/* CPUs with AVX-512 have AVX2: not picked until shown to be faster */
+#ifdef NFT_PIPAPO_HAVE_AVX512
+	&nft_set_pipapo_avx512_type,
+#endif
+#ifdef NFT_PIPAPO_HAVE_NEON
+	&nft_set_pipapo_neon_type,
 #endif
 	&nft_set_pipapo_type,
 };
@@ -9495,9 +9512,9 @@ static int nf_tables_commit_chain_prepare(struct net *net, struct nft_chain *cha
 {
 	const struct nft_expr *expr, *last;
 	struct nft_regs_track track = {};
-	unsigned int size, data_size;
-	void *data, *data_boundary;
-	struct nft_rule_dp *prule;
+	unsigned int size, data_size, run;
+	struct nft_rule_dp *prule, *jrule;
+	void *data, *data_boundary, *seg;
 	struct nft_rule *rule;
 
 	/* already handled or inactive chain? */
@@ -9505,9 +9522,17 @@ static int nf_tables_commit_chain_prepare(struct net *net, struct nft_chain *cha
 		return 0;
 
 	data_size = 0;
+	run = 0;
 	list_for_each_entry(rule, &chain->rules, list) {
 		if (nft_is_active_next(net, rule)) {
 			data_size += sizeof(*prule) + rule->dlen;
+
+			/* room for the rule heading a compiled segment */
+			if (!nft_jit_rule_supported(rule))
+				run = 0;
+			else if (++run == NFT_JIT_MIN_RULES)
+				data_size += NFT_JIT_RULE_SIZE;
+
 			if (data_size > INT_MAX)
 				return -ENOMEM;
 		}
@@ -9520,11 +9545,23 @@ static int nf_tables_commit_chain_prepare(struct net *net, struct nft_chain *cha
 	data = (void *)chain->blob_next->data;
 	data_boundary = data + data_size;
 	size = 0;
+	jrule = NULL;
+	seg = NULL;
+	run = 0;
 
 	list_for_each_entry(rule, &chain->rules, list) {
 		if (!nft_is_active_next(net, rule))
 			continue;
 
+		if (!nft_jit_rule_supported(rule)) {
+			if (jrule)
+				nft_jit_compile(jrule, data);
+			jrule = NULL;
+			run = 0;
+		} else if (run++ == 0) {
+			seg = data;
+		}
+
 		prule = (struct nft_rule_dp *)data;
 		data += offsetof(struct nft_rule_dp, data);
 		if (WARN_ON_ONCE(data > data_boundary))
@@ -9556,8 +9593,23 @@ static int nf_tables_commit_chain_prepare(struct net *net, struct nft_chain *cha
 		data += size;
 		size = 0;
 		chain->blob_next->size += (unsigned long)(data - (void *)prule);
+
+		/* long enough run, insert its segment rule in front of it */
+		if (run == NFT_JIT_MIN_RULES) {
+			if (WARN_ON_ONCE(data + NFT_JIT_RULE_SIZE > data_boundary))
+				return -ENOMEM;
+
+			memmove(seg + NFT_JIT_RULE_SIZE, seg, data - seg);
+			jrule = seg;
+			nft_jit_rule_init(jrule);
+			data += NFT_JIT_RULE_SIZE;
+			chain->blob_next->size += NFT_JIT_RULE_SIZE;
+		}
 	}
 
+	if (jrule)
+		nft_jit_compile(jrule, data);
+
 	if (WARN_ON_ONCE(data > data_boundary))
 		return -ENOMEM;
 
@@ -9577,7 +9629,7 @@ static void nf_tables_commit_chain_prepare_cancel(struct net *net)
 
 		if (trans->msg_type == NFT_MSG_NEWRULE ||
 		    trans->msg_type == NFT_MSG_DELRULE) {
-			kvfree(chain->blob_next);
+			nf_tables_chain_free_blob(chain->blob_next);
 			chain->blob_next = NULL;
 		}
 	}
@@ -9587,7 +9639,7 @@ static void __nf_tables_commit_chain_free_rules(struct rcu_head *h)
 {
 	struct nft_rule_dp_last *l = container_of(h, struct nft_rule_dp_last, h);
 
-	kvfree(l->blob);
+	nf_tables_chain_free_blob(l->blob);
 }
 
 static void nf_tables_commit_chain_free_rules_old(struct nft_rule_blob *blob)
@@ -14,12 +14,14 @@
 #include <linux/netlink.h>
 #include <linux/netfilter.h>
 #include <linux/static_key.h>
+#include <linux/filter.h>
 #include <linux/netfilter/nfnetlink.h>
 #include <linux/netfilter/nf_tables.h>
 #include <net/netfilter/nf_tables_core.h>
 #include <net/netfilter/nf_tables.h>
 #include <net/netfilter/nf_log.h>
 #include <net/netfilter/nft_meta.h>
+#include <net/netfilter/nf_tables_jit.h>
 
 #if defined(CONFIG_MITIGATION_RETPOLINE) && defined(CONFIG_X86)
 
@@ -249,6 +251,616 @@ static void expr_call_ops_eval(const struct nft_expr *expr,
              (expr) != (last); \
              (expr) = nft_rule_expr_next(expr))
 
+#ifdef CONFIG_NF_TABLES_JIT
+/*
+ * Runs of rules made of loads and fast comparisons that end in a verdict
+ * are translated into a BPF program. The program evaluates the matches of
+ * each rule in turn and returns where the statements of the first rule
+ * that matches start, from which the interpreter applies them and the
+ * verdict: the matches are never evaluated twice. nft registers live on
+ * the BPF stack. Fast payload loads and the simplest meta keys are
+ * translated too, other loads are delegated to nft_jit_load(). Only loads
+ * without side effects and with deterministic results are accepted.
+ */
+#define NFT_JIT_STACK_SIZE	sizeof_field(struct nft_regs, data)
+
+/* Programs return the blob offset of the matching rule from the segment
+ * rule, shifted by this, ORed with the offset of its first statement in
+ * its data, which fits as dlen is 12 bits.
+ */
+#define NFT_JIT_EXPR_SHIFT	12
+
+static s16 nft_jit_reg_off(u8 reg)
+{
+	return reg * NFT_REG32_SIZE - (int)NFT_JIT_STACK_SIZE;
+}
+
+static u32 nft_jit_reg_mask(u8 reg, unsigned int len)
+{
+	return GENMASK(reg + DIV_ROUND_UP(len, NFT_REG32_SIZE) - 1, reg);
+}
+
+static void nft_jit_expr_eval(const struct nft_expr *expr,
+			      struct nft_regs *regs,
+			      const struct nft_pktinfo *pkt)
+{
+	/* nothing to do, the rules of the segment follow */
+}
+
+static const struct nft_expr_ops nft_jit_ops = {
+	.size		= NFT_EXPR_SIZE(sizeof(struct nft_jit_expr)),
+	.eval		= nft_jit_expr_eval,
+};
+
+BPF_CALL_5(nft_jit_load, struct nft_pktinfo *, pkt,
+	   const struct nft_expr *, expr, u32 *, dst, u32, dreg, u32, len)
+{
+	struct nft_regs regs;
+
+	regs.verdict.code = NFT_CONTINUE;
+	if (expr->ops != &nft_payload_fast_ops ||
+	    !nft_payload_fast_eval(expr, &regs, pkt))
+		expr_call_ops_eval(expr, &regs, pkt);
+
+	if (regs.verdict.code != NFT_CONTINUE)
+		return -1;
+
+	memcpy(dst, &regs.data[dreg], round_up(len, NFT_REG32_SIZE));
+	return 0;
+}
+
+/* Meta keys which are cheap, deterministic and free of side effects */
+static bool nft_jit_meta_key_supported(enum nft_meta_keys key)
+{
+	switch (key) {
+	case NFT_META_LEN:
+	case NFT_META_PROTOCOL:
+	case NFT_META_NFPROTO:
+	case NFT_META_L4PROTO:
+	case NFT_META_MARK:
+	case NFT_META_PRIORITY:
+	case NFT_META_IIF:
+	case NFT_META_OIF:
+	case NFT_META_IIFNAME:
+	case NFT_META_OIFNAME:
+	case NFT_META_IIFTYPE:
+	case NFT_META_OIFTYPE:
+		return true;
+	default:
+		return false;
+	}
+}
+
+static bool nft_jit_expr_load(const struct nft_expr *expr, u8 *dreg, u8 *len)
+{
+	if (expr->ops->eval == nft_payload_eval) {
+		const struct nft_payload *priv = nft_expr_priv(expr);
+
+		*dreg = priv->dreg;
+		*len = priv->len;
+	} else if (expr->ops->eval == nft_meta_get_eval) {
+		const struct nft_meta *priv = nft_expr_priv(expr);
+
+		if (!nft_jit_meta_key_supported(priv->key))
+			return false;
+
+		*dreg = priv->dreg;
+		*len = priv->len;
+	} else {
+		return false;
+	}
+
+	return *len && *len <= NFT_REG_SIZE;
+}
+
+bool nft_jit_rule_supported(const struct nft_rule *rule)
+{
+	const struct nft_expr *expr, *last;
+	bool statement = false;
+	u32 written = 0;
+	u8 reg, len;
+
+	nft_rule_for_each_expr(expr, last, rule) {
+		if (expr->ops->type == &nft_imm_type) {
+			const struct nft_immediate_expr *priv = nft_expr_priv(expr);
+
+			return priv->dreg == NFT_REG_VERDICT &&
+			       nft_expr_next(expr) == last;
+		}
+
+		if (expr->ops->type == &nft_counter_type) {
+			statement = true;
+			continue;
+		}
+
+		/* statements only run once the rule is known to match */
+		if (statement)
+			return false;
+
+		/* registers must be set up by the rule itself, the program
+		 * does not see values left behind by the interpreter.
+		 */
+		if (nft_jit_expr_load(expr, &reg, &len)) {
+			written |= nft_jit_reg_mask(reg, len);
+		} else if (expr->ops == &nft_cmp_fast_ops) {
+			const struct nft_cmp_fast_expr *priv = nft_expr_priv(expr);
+
+			if (!(written & BIT(priv->sreg)))
+				return false;
+		} else if (expr->ops == &nft_cmp16_fast_ops) {
+			const struct nft_cmp16_fast_expr *priv = nft_expr_priv(expr);
+			u32 mask = nft_jit_reg_mask(priv->sreg, priv->len);
+
+			if ((written & mask) != mask)
+				return false;
+		} else if (expr->ops == &nft_bitwise_fast_ops) {
+			const struct nft_bitwise_fast_expr *priv = nft_expr_priv(expr);
+
+			if (!(written & BIT(priv->sreg)))
+				return false;
+			written |= BIT(priv->dreg);
+		} else {
+			return false;
+		}
+	}
+
+	/* no verdict */
+	return false;
+}
+
+struct nft_jit_ctx {
+	struct bpf_insn		*insn;
+	unsigned int		len;
+	unsigned int		fail;
+};
+
+static void nft_jit_emit(struct nft_jit_ctx *ctx, struct bpf_insn insn)
+{
+	if (ctx->insn)
+		ctx->insn[ctx->len] = insn;
+	ctx->len++;
+}
+
+/* offset of a jump to @target emitted at the current position */
+static s16 nft_jit_off(const struct nft_jit_ctx *ctx, unsigned int target)
+{
+	return target - ctx->len - 1;
+}
+
+/* point the jump emitted at @at to @target */
+static void nft_jit_patch(struct nft_jit_ctx *ctx, unsigned int at,
+			  unsigned int target)
+{
+	if (ctx->insn)
+		ctx->insn[at].off = target - at - 1;
+}
+
+static void nft_jit_emit_call(struct nft_jit_ctx *ctx,
+			      const struct nft_expr *expr, u8 dreg, u8 len)
+{
+	u64 addr = (unsigned long)expr;
+
+	nft_jit_emit(ctx, BPF_MOV64_REG(BPF_REG_1, BPF_REG_6));
+	nft_jit_emit(ctx, ((struct bpf_insn) {
+		.code	 = BPF_LD | BPF_DW | BPF_IMM,
+		.dst_reg = BPF_REG_2,
+		.imm	 = (u32)addr,
+	}));
+	nft_jit_emit(ctx, ((struct bpf_insn) {
+		.imm	 = addr >> 32,
+	}));
+	nft_jit_emit(ctx, BPF_MOV64_REG(BPF_REG_3, BPF_REG_FP));
+	nft_jit_emit(ctx, BPF_ALU64_IMM(BPF_ADD, BPF_REG_3,
+					nft_jit_reg_off(dreg)));
+	nft_jit_emit(ctx, BPF_MOV64_IMM(BPF_REG_4, dreg));
+	nft_jit_emit(ctx, BPF_MOV64_IMM(BPF_REG_5, len));
+	nft_jit_emit(ctx, BPF_EMIT_CALL(nft_jit_load));
+	nft_jit_emit(ctx, BPF_JMP_IMM(BPF_JNE, BPF_REG_0, 0,
+				      nft_jit_off(ctx, ctx->fail)));
+}
+
+/* store the low @size bytes of R0 into register @dreg, zeroing the rest */
+static void nft_jit_emit_store(struct nft_jit_ctx *ctx, u8 dreg, int size)
+{
+	if (size != BPF_W)
+		nft_jit_emit(ctx, BPF_ST_MEM(BPF_W, BPF_REG_FP,
+					     nft_jit_reg_off(dreg), 0));
+	nft_jit_emit(ctx, BPF_STX_MEM(size, BPF_REG_FP, BPF_REG_0,
+				      nft_jit_reg_off(dreg)));
+}
+
+/* R1 = pkt->skb */
+static void nft_jit_emit_skb(struct nft_jit_ctx *ctx)
+{
+	nft_jit_emit(ctx, BPF_LDX_MEM(BPF_FIELD_SIZEOF(struct nft_pktinfo, skb),
+				      BPF_REG_1, BPF_REG_6,
+				      offsetof(struct nft_pktinfo, skb)));
+}
+
+/* jump to @target unless pkt has a transport protocol, clobbers R0 */
+static void nft_jit_emit_l4proto_check(struct nft_jit_ctx *ctx,
+				       unsigned int target)
+{
+	nft_jit_emit(ctx, BPF_LDX_MEM(BPF_FIELD_SIZEOF(struct nft_pktinfo, flags),
+				      BPF_REG_0, BPF_REG_6,
+				      offsetof(struct nft_pktinfo, flags)));
+	nft_jit_emit(ctx, BPF_ALU32_IMM(BPF_AND, BPF_REG_0,
+					NFT_PKTINFO_L4PROTO));
+	nft_jit_emit(ctx, BPF_JMP_IMM(BPF_JEQ, BPF_REG_0, 0,
+				      nft_jit_off(ctx, target)));
+}
+
+/* Same as nft_payload_fast_eval(), which falls back to nft_jit_load() */
+static void nft_jit_emit_payload(struct nft_jit_ctx *ctx,
+				 const struct nft_expr *expr)
+{
+	const struct nft_payload *priv = nft_expr_priv(expr);
+	unsigned int l4_check = 0, tail_check, done;
+
+	nft_jit_emit_skb(ctx);
+	if (priv->base == NFT_PAYLOAD_NETWORK_HEADER) {
+		nft_jit_emit(ctx, BPF_LDX_MEM(BPF_FIELD_SIZEOF(struct sk_buff, head),
+					      BPF_REG_2, BPF_REG_1,
+					      offsetof(struct sk_buff, head)));
+		nft_jit_emit(ctx, BPF_LDX_MEM(BPF_FIELD_SIZEOF(struct sk_buff,
+							       network_header),
+					      BPF_REG_3, BPF_REG_1,
+					      offsetof(struct sk_buff,
+						       network_header)));
+	} else {
+		l4_check = ctx->len + 2;
+		nft_jit_emit_l4proto_check(ctx, 0);
+		nft_jit_emit(ctx, BPF_LDX_MEM(BPF_FIELD_SIZEOF(struct sk_buff, data),
+					      BPF_REG_2, BPF_REG_1,
+					      offsetof(struct sk_buff, data)));
+		nft_jit_emit(ctx, BPF_LDX_MEM(BPF_FIELD_SIZEOF(struct nft_pktinfo,
+							       thoff),
+					      BPF_REG_3, BPF_REG_6,
+					      offsetof(struct nft_pktinfo, thoff)));
+	}
+	nft_jit_emit(ctx, BPF_ALU64_REG(BPF_ADD, BPF_REG_2, BPF_REG_3));
+	nft_jit_emit(ctx, BPF_ALU64_IMM(BPF_ADD, BPF_REG_2, priv->offset));
+
+	/* ptr + len against skb_tail_pointer() */
+	nft_jit_emit(ctx, BPF_MOV64_REG(BPF_REG_3, BPF_REG_2));
+	nft_jit_emit(ctx, BPF_ALU64_IMM(BPF_ADD, BPF_REG_3, priv->len));
+	nft_jit_emit(ctx, BPF_LDX_MEM(BPF_FIELD_SIZEOF(struct sk_buff, tail),
+				      BPF_REG_4, BPF_REG_1,
+				      offsetof(struct sk_buff, tail)));
+#ifdef NET_SKBUFF_DATA_USES_OFFSET
+	nft_jit_emit(ctx, BPF_LDX_MEM(BPF_FIELD_SIZEOF(struct sk_buff, head),
+				      BPF_REG_5, BPF_REG_1,
+				      offsetof(struct sk_buff, head)));
+	nft_jit_emit(ctx, BPF_ALU64_REG(BPF_ADD, BPF_REG_4, BPF_REG_5));
+#endif
+	tail_check = ctx->len;
+	nft_jit_emit(ctx, BPF_JMP_REG(BPF_JGT, BPF_REG_3, BPF_REG_4, 0));
+
+	nft_jit_emit(ctx, BPF_LDX_MEM(bytes_to_bpf_size(priv->len),
+				      BPF_REG_0, BPF_REG_2, 0));
+	nft_jit_emit_store(ctx, priv->dreg, bytes_to_bpf_size(priv->len));
+	done = ctx->len;
+	nft_jit_emit(ctx, BPF_JMP_A(0));
+
+	if (priv->base != NFT_PAYLOAD_NETWORK_HEADER)
+		nft_jit_patch(ctx, l4_check, ctx->len);
+	nft_jit_patch(ctx, tail_check, ctx->len);
+	nft_jit_emit_call(ctx, expr, priv->dreg, priv->len);
+	nft_jit_patch(ctx, done, ctx->len);
+}
+
+/* Same as nft_meta_get_eval() for the keys it is cheaper to translate */
+static bool nft_jit_emit_meta(struct nft_jit_ctx *ctx,
+			      const struct nft_expr *expr)
+{
+	const struct nft_meta *priv = nft_expr_priv(expr);
+
+	switch (priv->key) {
+	case NFT_META_LEN:
+		nft_jit_emit_skb(ctx);
+		nft_jit_emit(ctx, BPF_LDX_MEM(BPF_FIELD_SIZEOF(struct sk_buff, len),
+					      BPF_REG_0, BPF_REG_1,
+					      offsetof(struct sk_buff, len)));
+		nft_jit_emit_store(ctx, priv->dreg, BPF_W);
+		return true;
+	case NFT_META_MARK:
+		nft_jit_emit_skb(ctx);
+		nft_jit_emit(ctx, BPF_LDX_MEM(BPF_FIELD_SIZEOF(struct sk_buff, mark),
+					      BPF_REG_0, BPF_REG_1,
+					      offsetof(struct sk_buff, mark)));
+		nft_jit_emit_store(ctx, priv->dreg, BPF_W);
+		return true;
+	case NFT_META_PROTOCOL:
+		nft_jit_emit_skb(ctx);
+		nft_jit_emit(ctx, BPF_LDX_MEM(BPF_FIELD_SIZEOF(struct sk_buff,
+							       protocol),
+					      BPF_REG_0, BPF_REG_1,
+					      offsetof(struct sk_buff, protocol)));
+		nft_jit_emit_store(ctx, priv->dreg, BPF_H);
+		return true;
+	case NFT_META_NFPROTO:
+		nft_jit_emit(ctx, BPF_LDX_MEM(BPF_FIELD_SIZEOF(struct nft_pktinfo,
+							       state),
+					      BPF_REG_1, BPF_REG_6,
+					      offsetof(struct nft_pktinfo, state)));
+		nft_jit_emit(ctx, BPF_LDX_MEM(BPF_FIELD_SIZEOF(struct nf_hook_state,
+							       pf),
+					      BPF_REG_0, BPF_REG_1,
+					      offsetof(struct nf_hook_state, pf)));
+		nft_jit_emit_store(ctx, priv->dreg, BPF_B);
+		return true;
+	case NFT_META_L4PROTO:
+		/* no transport protocol breaks out of the rule */
+		nft_jit_emit_l4proto_check(ctx, ctx->fail);
+		nft_jit_emit(ctx, BPF_LDX_MEM(BPF_FIELD_SIZEOF(struct nft_pktinfo,
+							       tprot),
+					      BPF_REG_0, BPF_REG_6,
+					      offsetof(struct nft_pktinfo, tprot)));
+		nft_jit_emit_store(ctx, priv->dreg, BPF_B);
+		return true;
+	default:
+		return false;
+	}
+}
+
+static void nft_jit_emit_load(struct nft_jit_ctx *ctx,
+			      const struct nft_expr *expr, u8 dreg, u8 len)
+{
+	if (expr->ops == &nft_payload_fast_ops) {
+		nft_jit_emit_payload(ctx, expr);
+		return;
+	}
+
+	if (expr->ops->eval == nft_meta_get_eval &&
+	    nft_jit_emit_meta(ctx, expr))
+		return;
+
+	nft_jit_emit_call(ctx, expr, dreg, len);
+}
+
+static void nft_jit_emit_cmp(struct nft_jit_ctx *ctx, u8 reg, u32 mask,
+			     u32 data, u8 op, unsigned int target)
+{
+	nft_jit_emit(ctx, BPF_LDX_MEM(BPF_W, BPF_REG_0, BPF_REG_FP,
+				      nft_jit_reg_off(reg)));
+	if (mask != U32_MAX)
+		nft_jit_emit(ctx, BPF_ALU32_IMM(BPF_AND, BPF_REG_0, mask));
+	nft_jit_emit(ctx, BPF_JMP32_IMM(op, BPF_REG_0, data,
+					nft_jit_off(ctx, target)));
+}
+
+static void nft_jit_emit_cmp16(struct nft_jit_ctx *ctx,
+			       const struct nft_cmp16_fast_expr *priv,
+			       unsigned int target)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(priv->mask.data); i++) {
+		if (!priv->mask.data[i])
+			continue;
+
+		nft_jit_emit_cmp(ctx, priv->sreg + i, priv->mask.data[i],
+				 priv->data.data[i], BPF_JNE, target);
+	}
+}
+
+static void nft_jit_emit_rule(struct nft_jit_ctx *ctx,
+			      const struct nft_rule_dp *rule, u32 off)
+{
+	const struct nft_expr *expr, *last, *stmt = NULL;
+	u8 reg, len;
+
+	nft_rule_dp_for_each_expr(expr, last, rule) {
+		if (nft_jit_expr_load(expr, &reg, &len)) {
+			nft_jit_emit_load(ctx, expr, reg, len);
+		} else if (expr->ops == &nft_cmp_fast_ops) {
+			const struct nft_cmp_fast_expr *priv = nft_expr_priv(expr);
+
+			nft_jit_emit_cmp(ctx, priv->sreg, priv->mask, priv->data,
+					 priv->inv ? BPF_JEQ : BPF_JNE, ctx->fail);
+		} else if (expr->ops == &nft_cmp16_fast_ops) {
+			const struct nft_cmp16_fast_expr *priv = nft_expr_priv(expr);
+			struct nft_jit_ctx dry = {};
+
+			if (!priv->inv) {
+				nft_jit_emit_cmp16(ctx, priv, ctx->fail);
+				continue;
+			}
+
+			/* any differing word makes the inverted match succeed */
+			nft_jit_emit_cmp16(&dry, priv, 0);
+			nft_jit_emit_cmp16(ctx, priv, ctx->len + dry.len + 1);
+			nft_jit_emit(ctx, BPF_JMP_A(nft_jit_off(ctx, ctx->fail)));
+		} else if (expr->ops == &nft_bitwise_fast_ops) {
+			const struct nft_bitwise_fast_expr *priv = nft_expr_priv(expr);
+
+			nft_jit_emit(ctx, BPF_LDX_MEM(BPF_W, BPF_REG_0, BPF_REG_FP,
+						      nft_jit_reg_off(priv->sreg)));
+			nft_jit_emit(ctx, BPF_ALU32_IMM(BPF_AND, BPF_REG_0,
+							priv->mask));
+			nft_jit_emit(ctx, BPF_ALU32_IMM(BPF_XOR, BPF_REG_0,
+							priv->xor));
+			nft_jit_emit(ctx, BPF_STX_MEM(BPF_W, BPF_REG_FP, BPF_REG_0,
+						      nft_jit_reg_off(priv->dreg)));
+		} else if (!stmt) {
+			/* statements and the verdict are left to the
+			 * interpreter
+			 */
+			stmt = expr;
+		}
+	}
+
+	nft_jit_emit(ctx, BPF_MOV32_IMM(BPF_REG_0,
+					off << NFT_JIT_EXPR_SHIFT |
+					((void *)stmt - (void *)rule->data)));
+	nft_jit_emit(ctx, BPF_EXIT_INSN());
+}
+
+static int nft_jit_emit_segment(struct nft_jit_ctx *ctx,
+				const struct nft_rule_dp *jrule,
+				const void *end)
+{
+	const struct nft_rule_dp *rule = nft_rule_next(jrule);
+
+	nft_jit_emit(ctx, BPF_MOV64_REG(BPF_REG_6, BPF_REG_1));
+
+	for (; (void *)rule < end; rule = nft_rule_next(rule)) {
+		struct nft_jit_ctx dry = {};
+
+		if ((void *)rule - (void *)jrule > U32_MAX >> NFT_JIT_EXPR_SHIFT)
+			return -E2BIG;
+
+		/* size the rule first to learn where a mismatch jumps to */
+		nft_jit_emit_rule(&dry, rule, 0);
+		if (dry.len > S16_MAX)
+			return -E2BIG;
+
+		ctx->fail = ctx->len + dry.len;
+		nft_jit_emit_rule(ctx, rule, (void *)rule - (void *)jrule);
+	}
+
+	/* no rule matched */
+	nft_jit_emit(ctx, BPF_MOV64_IMM(BPF_REG_0, 0));
+	nft_jit_emit(ctx, BPF_EXIT_INSN());
+
+	return 0;
+}
+
+static struct bpf_prog *nft_jit_build(const struct nft_rule_dp *jrule,
+				      const void *end)
+{
+	struct nft_jit_ctx ctx = {};
+	long call = BPF_CALL_IMM(nft_jit_load);
+	struct bpf_prog *prog;
+	int err;
+
+	/* nf_tables can be a module, out of reach of a BPF call */
+	if (call != (s32)call)
+		return NULL;
+
+	if (nft_jit_emit_segment(&ctx, jrule, end) < 0)
+		return NULL;
+
+	prog = bpf_prog_alloc(bpf_prog_size(ctx.len), 0);
+	if (!prog)
+		return NULL;
+
+	ctx.insn = prog->insnsi;
+	ctx.len = 0;
+	nft_jit_emit_segment(&ctx, jrule, end);
+
+	prog->len = ctx.len;
+	prog->aux->stack_depth = NFT_JIT_STACK_SIZE;
+
+	prog = bpf_prog_select_runtime(prog, &err);
+	/* interpreted BPF would not beat the nf_tables interpreter */
+	if (err || !prog->jited) {
+		bpf_prog_free(prog);
+		return NULL;
+	}
+
+	return prog;
+}
+
+void nft_jit_rule_init(struct nft_rule_dp *jrule)
+{
+	struct nft_expr *expr = nft_rule_expr_first(jrule);
+	struct nft_jit_expr *priv = nft_expr_priv(expr);
+
+	jrule->is_last = 0;
+	jrule->dlen = nft_jit_ops.size;
+	jrule->handle = 0;
+	expr->ops = &nft_jit_ops;
+	priv->prog = NULL;
+	priv->len = 0;
+}
+
+void nft_jit_compile(struct nft_rule_dp *jrule, const void *end)
+{
+	struct nft_jit_expr *priv = nft_expr_priv(nft_rule_expr_first(jrule));
+
+	/* tracing reports the handle of the first rule in the segment */
+	jrule->handle = nft_rule_next(jrule)->handle;
+	priv->len = end - (void *)jrule;
+	priv->prog = nft_jit_build(jrule, end);
+}
+
+static bool nft_rule_dp_is_jit(const struct nft_rule_dp *rule)
+{
+	return !rule->is_last && rule->dlen &&
+	       nft_rule_expr_first(rule)->ops == &nft_jit_ops;
+}
+
+void nft_jit_release(const struct nft_rule_blob *blob)
+{
+	const struct nft_rule_dp *rule;
+	const void *end;
+
+	if (!blob)
+		return;
+
+	rule = (const struct nft_rule_dp *)blob->data;
+	end = blob->data + blob->size;
+	for (; (void *)rule < end; rule = nft_rule_next(rule)) {
+		const struct nft_jit_expr *priv;
+
+		if (!nft_rule_dp_is_jit(rule))
+			continue;
+
+		priv = nft_expr_priv(nft_rule_expr_first(rule));
+		if (priv->prog)
+			bpf_prog_free(priv->prog);
+	}
+}
+
+/* Returns the next rule for the interpreter to evaluate, and in @expr the
+ * expression to start from: the first statement of a rule the program
+ * matched, the first expression otherwise.
+ */
+static const struct nft_rule_dp *nft_jit_run(const struct nft_rule_dp *jrule,
+					     const struct nft_pktinfo *pkt,
+					     const struct nft_traceinfo *info,
+					     const struct nft_expr **expr)
+{
+	const struct nft_jit_expr *priv;
+	const struct nft_rule_dp *rule;
+	u32 ret;
+
+	priv = nft_expr_priv(nft_rule_expr_first(jrule));
+
+	/* traced packets are evaluated rule by rule */
+	if (!priv->prog || info->trace) {
+		rule = nft_rule_next(jrule);
+		*expr = nft_rule_expr_first(rule);
+		return rule;
+	}
+
+	ret = bpf_prog_run_pin_on_cpu(priv->prog, pkt);
+	if (!ret) {
+		rule = (const void *)jrule + priv->len;
+		*expr = nft_rule_expr_first(rule);
+		return rule;
+	}
+
+	rule = (const void *)jrule + (ret >> NFT_JIT_EXPR_SHIFT);
+	*expr = (const void *)rule->data +
+		(ret & (BIT(NFT_JIT_EXPR_SHIFT) - 1));
+	return rule;
+}
+#else
+static inline bool nft_rule_dp_is_jit(const struct nft_rule_dp *rule)
+{
+	return false;
+}
+
+static inline const struct nft_rule_dp *
+nft_jit_run(const struct nft_rule_dp *jrule, const struct nft_pktinfo *pkt,
+	    const struct nft_traceinfo *info, const struct nft_expr **expr)
+{
+	return jrule;
+}
+#endif /* CONFIG_NF_TABLES_JIT */
+
 unsigned int
 nft_do_chain(struct nft_pktinfo *pkt, void *priv)
 {
@@ -276,7 +888,14 @@ nft_do_chain(struct nft_pktinfo *pkt, void *priv)
 next_rule:
 	regs.verdict.code = NFT_CONTINUE;
 	for (; !rule->is_last ; rule = nft_rule_next(rule)) {
-		nft_rule_dp_for_each_expr(expr, last, rule) {
+		expr = nft_rule_expr_first(rule);
+		while (nft_rule_dp_is_jit(rule))
+			rule = nft_jit_run(rule, pkt, &info, &expr);
+		if (rule->is_last)
+			break;
+
+		for (last = nft_rule_expr_last(rule); expr != last;
+		     expr = nft_rule_expr_next(expr)) {
 			if (expr->ops == &nft_cmp_fast_ops)
 				nft_cmp_fast_eval(expr, &regs);
 			else if (expr->ops == &nft_cmp16_fast_ops)
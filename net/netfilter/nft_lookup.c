@@ -15,6 +15,9 @@
 #include <net/netfilter/nf_tables.h>
 #include <net/netfilter/nf_tables_core.h>
 
+#include "nft_set_pipapo_avx512.h"
+#include "nft_set_pipapo_neon.h"
+
 struct nft_lookup {
 	struct nft_set			*set;
 	u8				sreg;
@@ -45,6 +48,14 @@ bool nft_set_do_lookup(const struct net *net, const struct nft_set *set,
 	if (set->ops == &nft_set_pipapo_avx2_type.ops)
 		return nft_pipapo_avx2_lookup(net, set, key, ext);
 #endif
+#ifdef NFT_PIPAPO_HAVE_AVX512
+	if (set->ops == &nft_set_pipapo_avx512_type.ops)
+		return nft_pipapo_avx512_lookup(net, set, key, ext);
+#endif
+#ifdef NFT_PIPAPO_HAVE_NEON
+	if (set->ops == &nft_set_pipapo_neon_type.ops)
+		return nft_pipapo_neon_lookup(net, set, key, ext);
+#endif
 
 	if (set->ops == &nft_set_rbtree_type.ops)
 		return nft_rbtree_lookup(net, set, key, ext);
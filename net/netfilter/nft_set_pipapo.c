@@ -340,6 +340,8 @@
 #include <linux/bitops.h>
 
 #include "nft_set_pipapo_avx2.h"
+#include "nft_set_pipapo_avx512.h"
+#include "nft_set_pipapo_neon.h"
 #include "nft_set_pipapo.h"
 
 /**
@@ -410,94 +412,14 @@ int pipapo_refill(unsigned long *map, unsigned int len, unsigned int rules,
 bool nft_pipapo_lookup(const struct net *net, const struct nft_set *set,
 		       const u32 *key, const struct nft_set_ext **ext)
 {
-	struct nft_pipapo *priv = nft_set_priv(set);
-	struct nft_pipapo_scratch *scratch;
-	unsigned long *res_map, *fill_map;
-	u8 genmask = nft_genmask_cur(net);
-	const struct nft_pipapo_match *m;
-	const struct nft_pipapo_field *f;
-	const u8 *rp = (const u8 *)key;
-	bool map_index;
-	int i;
+	bool ret;
 
 	local_bh_disable();
-
-	m = rcu_dereference(priv->match);
-
-	if (unlikely(!m || !*raw_cpu_ptr(m->scratch)))
-		goto out;
-
-	scratch = *raw_cpu_ptr(m->scratch);
-
-	map_index = scratch->map_index;
-
-	res_map  = scratch->map + (map_index ? m->bsize_max : 0);
-	fill_map = scratch->map + (map_index ? 0 : m->bsize_max);
-
-	memset(res_map, 0xff, m->bsize_max * sizeof(*res_map));
-
-	nft_pipapo_for_each_field(f, i, m) {
-		bool last = i == m->field_count - 1;
-		int b;
-
-		/* For each bit group: select lookup table bucket depending on
-		 * packet bytes value, then AND bucket value
-		 */
-		if (likely(f->bb == 8))
-			pipapo_and_field_buckets_8bit(f, res_map, rp);
-		else
-			pipapo_and_field_buckets_4bit(f, res_map, rp);
-		NFT_PIPAPO_GROUP_BITS_ARE_8_OR_4;
-
-		rp += f->groups / NFT_PIPAPO_GROUPS_PER_BYTE(f);
-
-		/* Now populate the bitmap for the next field, unless this is
-		 * the last field, in which case return the matched 'ext'
-		 * pointer if any.
-		 *
-		 * Now res_map contains the matching bitmap, and fill_map is the
-		 * bitmap for the next field.
-		 */
-next_match:
-		b = pipapo_refill(res_map, f->bsize, f->rules, fill_map, f->mt,
-				  last);
-		if (b < 0) {
-			scratch->map_index = map_index;
-			local_bh_enable();
-
-			return false;
-		}
-
-		if (last) {
-			*ext = &f->mt[b].e->ext;
-			if (unlikely(nft_set_elem_expired(*ext) ||
-				     !nft_set_elem_active(*ext, genmask)))
-				goto next_match;
-
-			/* Last field: we're just returning the key without
-			 * filling the initial bitmap for the next field, so the
-			 * current inactive bitmap is clean and can be reused as
-			 * *next* bitmap (not initial) for the next packet.
-			 */
-			scratch->map_index = map_index;
-			local_bh_enable();
-
-			return true;
-		}
-
-		/* Swap bitmap indices: res_map is the initial bitmap for the
-		 * next field, and fill_map is guaranteed to be all-zeroes at
-		 * this point.
-		 */
-		map_index = !map_index;
-		swap(res_map, fill_map);
-
-		rp += NFT_PIPAPO_GROUPS_PADDING(f);
-	}
-
-out:
+	ret = pipapo_lookup_fields(net, set, key, ext,
+				   pipapo_and_field_buckets);
 	local_bh_enable();
-	return false;
+
+	return ret;
 }
 
 /**
@@ -2415,3 +2337,57 @@ const struct nft_set_type nft_set_pipapo_avx2_type = {
 	},
 };
 #endif
+
+#ifdef NFT_PIPAPO_HAVE_AVX512
+const struct nft_set_type nft_set_pipapo_avx512_type = {
+	.features	= NFT_SET_INTERVAL | NFT_SET_MAP | NFT_SET_OBJECT |
+			  NFT_SET_TIMEOUT,
+	.ops		= {
+		.lookup		= nft_pipapo_avx512_lookup,
+		.insert		= nft_pipapo_insert,
+		.activate	= nft_pipapo_activate,
+		.deactivate	= nft_pipapo_deactivate,
+		.flush		= nft_pipapo_flush,
+		.remove		= nft_pipapo_remove,
+		.walk		= nft_pipapo_walk,
+		.get		= nft_pipapo_get,
+		.privsize	= nft_pipapo_privsize,
+		.estimate	= nft_pipapo_avx512_estimate,
+		.init		= nft_pipapo_init,
+		.destroy	= nft_pipapo_destroy,
+		.gc_init	= nft_pipapo_gc_init,
+		.commit		= nft_pipapo_commit,
+		.abort		= nft_pipapo_abort,
+		.elemsize	= offsetof(struct nft_pipapo_elem, ext),
+	},
+};
+#endif
+
+#ifdef NFT_PIPAPO_HAVE_NEON
+const struct nft_set_type nft_set_pipapo_neon_type = {
+	.features	= NFT_SET_INTERVAL | NFT_SET_MAP | NFT_SET_OBJECT |
+			  NFT_SET_TIMEOUT,
+	.ops		= {
+		.lookup		= nft_pipapo_neon_lookup,
+		.insert		= nft_pipapo_insert,
+		.activate	= nft_pipapo_activate,
+		.deactivate	= nft_pipapo_deactivate,
+		.flush		= nft_pipapo_flush,
+		.remove		= nft_pipapo_remove,
+		.walk		= nft_pipapo_walk,
+		.get		= nft_pipapo_get,
+		.privsize	= nft_pipapo_privsize,
+		.estimate	= nft_pipapo_neon_estimate,
+		.init		= nft_pipapo_init,
+		.destroy	= nft_pipapo_destroy,
+		.gc_init	= nft_pipapo_gc_init,
+		.commit		= nft_pipapo_commit,
+		.abort		= nft_pipapo_abort,
+		.elemsize	= offsetof(struct nft_pipapo_elem, ext),
+	},
+};
+#endif
+
+#ifdef CONFIG_NFT_SET_PIPAPO_KUNIT_TEST
+#include "nft_set_pipapo_test.c"
+#endif
@@ -15,6 +15,10 @@
 #define NFT_PIPAPO_MAX_BYTES		(sizeof(struct in6_addr))
 #define NFT_PIPAPO_MAX_BITS		(NFT_PIPAPO_MAX_BYTES * BITS_PER_BYTE)
 
+/* Largest amount of bit groups in a field, with the small group width */
+#define NFT_PIPAPO_MAX_GROUPS		(NFT_PIPAPO_MAX_BITS /		\
+					 NFT_PIPAPO_GROUP_BITS_LARGE_SET)
+
 /* Bits to be grouped together in table buckets depending on set size */
 #define NFT_PIPAPO_GROUP_BITS_INIT	NFT_PIPAPO_GROUP_BITS_SMALL_SET
 #define NFT_PIPAPO_GROUP_BITS_SMALL_SET	8
@@ -230,6 +234,151 @@ static inline void pipapo_and_field_buckets_8bit(const struct nft_pipapo_field *
 	}
 }
 
+/**
+ * pipapo_and_field_buckets() - Intersect buckets for a field
+ * @f:		Field including lookup table
+ * @dst:	Area to store result
+ * @data:	Input data selecting table buckets
+ */
+static inline void pipapo_and_field_buckets(const struct nft_pipapo_field *f,
+					    unsigned long *dst,
+					    const u8 *data)
+{
+	if (likely(f->bb == 8))
+		pipapo_and_field_buckets_8bit(f, dst, data);
+	else
+		pipapo_and_field_buckets_4bit(f, dst, data);
+	NFT_PIPAPO_GROUP_BITS_ARE_8_OR_4;
+}
+
+/**
+ * pipapo_field_buckets() - Find buckets selected by input data for a field
+ * @f:		Field including lookup table
+ * @off:	Offsets of selected buckets in lookup table, in longs, by group
+ * @data:	Input data selecting table buckets
+ *
+ * Used by vectorised implementations intersecting all the groups of a field
+ * one chunk of bitmap at a time, instead of one group at a time.
+ */
+static inline void pipapo_field_buckets(const struct nft_pipapo_field *f,
+					unsigned long *off, const u8 *data)
+{
+	int group;
+
+	for (group = 0; group < f->groups; group++) {
+		u8 v;
+
+		if (f->bb == 8)
+			v = data[group];
+		else if (group % 2)
+			v = data[group / 2] & 0x0f;
+		else
+			v = data[group / 2] >> 4;
+
+		off[group] = (group * NFT_PIPAPO_BUCKETS(f->bb) + v) * f->bsize;
+	}
+	NFT_PIPAPO_GROUP_BITS_ARE_8_OR_4;
+}
+
+/**
+ * pipapo_lookup_fields() - Match key data against all fields of a set
+ * @net:	Network namespace
+ * @set:	nftables API set representation
+ * @key:	nftables API element representation containing key data
+ * @ext:	nftables API extension pointer, filled with matching reference
+ * @and_buckets: Intersect buckets selected by the input data for a field
+ *
+ * Body of nft_pipapo_lookup(), shared with vectorised implementations that
+ * only replace bucket intersection, so that they return the same element as
+ * the generic lookup by construction. Callers need to disable BHs, or to hold
+ * an equivalent SIMD context, to protect scratch maps.
+ *
+ * Return: true on match, false otherwise.
+ */
+static __always_inline bool
+pipapo_lookup_fields(const struct net *net, const struct nft_set *set,
+		     const u32 *key, const struct nft_set_ext **ext,
+		     void (*and_buckets)(const struct nft_pipapo_field *f,
+					 unsigned long *dst, const u8 *data))
+{
+	struct nft_pipapo *priv = nft_set_priv(set);
+	struct nft_pipapo_scratch *scratch;
+	unsigned long *res_map, *fill_map;
+	u8 genmask = nft_genmask_cur(net);
+	const struct nft_pipapo_match *m;
+	const struct nft_pipapo_field *f;
+	const u8 *rp = (const u8 *)key;
+	bool map_index;
+	int i;
+
+	m = rcu_dereference(priv->match);
+
+	if (unlikely(!m || !*raw_cpu_ptr(m->scratch)))
+		return false;
+
+	scratch = *raw_cpu_ptr(m->scratch);
+
+	map_index = scratch->map_index;
+
+	res_map  = scratch->map + (map_index ? m->bsize_max : 0);
+	fill_map = scratch->map + (map_index ? 0 : m->bsize_max);
+
+	memset(res_map, 0xff, m->bsize_max * sizeof(*res_map));
+
+	nft_pipapo_for_each_field(f, i, m) {
+		bool last = i == m->field_count - 1;
+		int b;
+
+		/* For each bit group: select lookup table bucket depending on
+		 * packet bytes value, then AND bucket value
+		 */
+		and_buckets(f, res_map, rp);
+
+		rp += f->groups / NFT_PIPAPO_GROUPS_PER_BYTE(f);
+
+		/* Now populate the bitmap for the next field, unless this is
+		 * the last field, in which case return the matched 'ext'
+		 * pointer if any.
+		 *
+		 * Now res_map contains the matching bitmap, and fill_map is the
+		 * bitmap for the next field.
+		 */
+next_match:
+		b = pipapo_refill(res_map, f->bsize, f->rules, fill_map, f->mt,
+				  last);
+		if (b < 0) {
+			scratch->map_index = map_index;
+			return false;
+		}
+
+		if (last) {
+			*ext = &f->mt[b].e->ext;
+			if (unlikely(nft_set_elem_expired(*ext) ||
+				     !nft_set_elem_active(*ext, genmask)))
+				goto next_match;
+
+			/* Last field: we're just returning the key without
+			 * filling the initial bitmap for the next field, so the
+			 * current inactive bitmap is clean and can be reused as
+			 * *next* bitmap (not initial) for the next packet.
+			 */
+			scratch->map_index = map_index;
+			return true;
+		}
+
+		/* Swap bitmap indices: res_map is the initial bitmap for the
+		 * next field, and fill_map is guaranteed to be all-zeroes at
+		 * this point.
+		 */
+		map_index = !map_index;
+		swap(res_map, fill_map);
+
+		rp += NFT_PIPAPO_GROUPS_PADDING(f);
+	}
+
+	return false;
+}
+
 /**
  * pipapo_estimate_size() - Estimate worst-case for set size
  * @desc:	Set description, element count and field description used here
@@ -0,0 +1,158 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+/* PIPAPO: PIle PAcket POlicies: AVX-512 packet lookup routines
+ *
+ * The AVX2 implementation unrolls lookups for common field sizes, and works on
+ * 256 bits of bitmap at a time. Here, the generic lookup body is reused as it
+ * is, and only the intersection of lookup table buckets is vectorised: for
+ * each 512-bit chunk of the result bitmap, the buckets selected by all the
+ * groups of a field are intersected in a single register, so that the result
+ * bitmap is loaded and stored once per field instead of once per group.
+ */
+
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/netlink.h>
+#include <linux/netfilter.h>
+#include <linux/netfilter/nf_tables.h>
+#include <net/netfilter/nf_tables_core.h>
+#include <uapi/linux/netfilter/nf_tables.h>
+#include <linux/bitmap.h>
+#include <linux/bitops.h>
+
+#include <linux/compiler.h>
+#include <asm/fpu/api.h>
+#include <asm/fpu/xstate.h>
+
+#include "nft_set_pipapo_avx2.h"
+#include "nft_set_pipapo_avx512.h"
+#include "nft_set_pipapo.h"
+
+#define NFT_PIPAPO_LONGS_PER_M512	(512 / BITS_PER_LONG)
+
+/* Select the longs of the next chunk to operate on: buckets are aligned to
+ * 256 bits, so the last chunk of a bitmap might only be half a register.
+ */
+#define NFT_PIPAPO_AVX512_MASK(mask)					\
+	asm volatile("kmovw %0, %%k1" : : "r" (mask))
+
+/* Load result bitmap chunk into zmm0, zeroing longs outside the mask */
+#define NFT_PIPAPO_AVX512_LOAD(loc)					\
+	asm volatile("vmovdqu64 %0, %%zmm0%{%%k1%}%{z%}"		\
+		     : : "m" (loc) : "memory")
+
+/* Bitwise AND of zmm0 with a lookup table bucket chunk */
+#define NFT_PIPAPO_AVX512_AND(loc)					\
+	asm volatile("vpandq %0, %%zmm0, %%zmm0%{%%k1%}%{z%}"		\
+		     : : "m" (loc))
+
+/* Jump to label if zmm0 is zero */
+#define NFT_PIPAPO_AVX512_NOMATCH_GOTO(label)				\
+	asm goto("vptestmq %%zmm0, %%zmm0, %%k2;"			\
+		 "kortestw %%k2, %%k2;"					\
+		 "je %l[" #label "]" : : : : label)
+
+/* Store zmm0 back into the result bitmap chunk */
+#define NFT_PIPAPO_AVX512_STORE(loc)					\
+	asm volatile("vmovdqu64 %%zmm0, %0%{%%k1%}"			\
+		     : "=m" (loc) : : "memory")
+
+/**
+ * nft_pipapo_avx512_and_buckets() - Intersect buckets for a field
+ * @f:		Field including lookup table
+ * @dst:	Area to store result
+ * @data:	Input data selecting table buckets
+ *
+ * Chunks of @dst which are already empty are skipped: no rule can match there
+ * anymore, whatever the content of lookup table buckets is.
+ */
+static void nft_pipapo_avx512_and_buckets(const struct nft_pipapo_field *f,
+					  unsigned long *dst, const u8 *data)
+{
+	const unsigned long *lt = NFT_PIPAPO_LT_ALIGN(f->lt);
+	unsigned long off[NFT_PIPAPO_MAX_GROUPS];
+	unsigned int i, mask = 0xff;
+	int group;
+
+	pipapo_field_buckets(f, off, data);
+
+	NFT_PIPAPO_AVX512_MASK(mask);
+	for (i = 0; i < f->bsize; i += NFT_PIPAPO_LONGS_PER_M512) {
+		if (unlikely(f->bsize - i < NFT_PIPAPO_LONGS_PER_M512)) {
+			mask = GENMASK(f->bsize - i - 1, 0);
+			NFT_PIPAPO_AVX512_MASK(mask);
+		}
+
+		NFT_PIPAPO_AVX512_LOAD(dst[i]);
+		NFT_PIPAPO_AVX512_NOMATCH_GOTO(nothing);
+
+		for (group = 0; group < f->groups; group++)
+			NFT_PIPAPO_AVX512_AND(lt[off[group] + i]);
+
+		NFT_PIPAPO_AVX512_STORE(dst[i]);
+nothing:
+		;
+	}
+}
+
+/**
+ * nft_pipapo_avx512_estimate() - Set size, space and lookup complexity
+ * @desc:	Set description, element count and field description used
+ * @features:	Flags: NFT_SET_INTERVAL needs to be there
+ * @est:	Storage for estimation data
+ *
+ * Return: true if set is compatible and AVX-512 available, false otherwise.
+ */
+bool nft_pipapo_avx512_estimate(const struct nft_set_desc *desc, u32 features,
+				struct nft_set_estimate *est)
+{
+	if (!(features & NFT_SET_INTERVAL) ||
+	    desc->field_count < NFT_PIPAPO_MIN_FIELDS)
+		return false;
+
+	if (!boot_cpu_has(X86_FEATURE_AVX512F) ||
+	    !cpu_has_xfeatures(XFEATURE_MASK_SSE | XFEATURE_MASK_YMM |
+			       XFEATURE_MASK_AVX512, NULL))
+		return false;
+
+	est->size = pipapo_estimate_size(desc);
+	if (!est->size)
+		return false;
+
+	est->lookup = NFT_SET_CLASS_O_LOG_N;
+
+	est->space = NFT_SET_CLASS_O_N;
+
+	return true;
+}
+
+/**
+ * nft_pipapo_avx512_lookup() - Lookup function for AVX-512 implementation
+ * @net:	Network namespace
+ * @set:	nftables API set representation
+ * @key:	nftables API element representation containing key data
+ * @ext:	nftables API extension pointer, filled with matching reference
+ *
+ * For more details, see DOC: Theory of Operation in nft_set_pipapo.c.
+ *
+ * Return: true on match, false otherwise.
+ */
+bool nft_pipapo_avx512_lookup(const struct net *net, const struct nft_set *set,
+			      const u32 *key, const struct nft_set_ext **ext)
+{
+	bool ret;
+
+	if (unlikely(!irq_fpu_usable()))
+		return nft_pipapo_lookup(net, set, key, ext);
+
+	/* This also protects access to all data related to scratch maps, and
+	 * no valid MXCSR state is needed for integer operations.
+	 */
+	kernel_fpu_begin_mask(0);
+	ret = pipapo_lookup_fields(net, set, key, ext,
+				   nft_pipapo_avx512_and_buckets);
+	kernel_fpu_end();
+
+	return ret;
+}
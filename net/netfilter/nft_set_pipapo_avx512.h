@@ -0,0 +1,16 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+#ifndef _NFT_SET_PIPAPO_AVX512_H
+#define _NFT_SET_PIPAPO_AVX512_H
+
+#if defined(CONFIG_X86_64) && !defined(CONFIG_UML) && defined(CONFIG_AS_AVX512)
+#define NFT_PIPAPO_HAVE_AVX512
+
+extern const struct nft_set_type nft_set_pipapo_avx512_type;
+
+bool nft_pipapo_avx512_lookup(const struct net *net, const struct nft_set *set,
+			      const u32 *key, const struct nft_set_ext **ext);
+bool nft_pipapo_avx512_estimate(const struct nft_set_desc *desc, u32 features,
+				struct nft_set_estimate *est);
+#endif /* defined(CONFIG_X86_64) && !defined(CONFIG_UML) && ... */
+
+#endif /* _NFT_SET_PIPAPO_AVX512_H */
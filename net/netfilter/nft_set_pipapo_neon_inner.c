@@ -0,0 +1,49 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+/* PIPAPO: PIle PAcket POlicies: NEON bucket intersection
+ *
+ * Built with NEON code generation enabled, and only called between
+ * kernel_neon_begin() and kernel_neon_end(), see nft_set_pipapo_neon.c.
+ */
+
+#include <asm/neon-intrinsics.h>
+
+#include <linux/types.h>
+
+void pipapo_neon_and(unsigned long *dst, const unsigned long *lt,
+		     const unsigned long *off, unsigned int groups,
+		     unsigned int bsize);
+
+/**
+ * pipapo_neon_and() - Intersect lookup table buckets, 128 bits at a time
+ * @dst:	Result bitmap, also used as initial bitmap
+ * @lt:		Lookup table of the field
+ * @off:	Offsets of selected buckets in lookup table, in longs, by group
+ * @groups:	Number of groups in the field
+ * @bsize:	Size of each bucket, in longs
+ */
+void pipapo_neon_and(unsigned long *dst, const unsigned long *lt,
+		     const unsigned long *off, unsigned int groups,
+		     unsigned int bsize)
+{
+	unsigned int i, group;
+
+	for (i = 0; i + 2 <= bsize; i += 2) {
+		uint64x2_t r = vld1q_u64((const u64 *)&dst[i]);
+
+		/* nothing can match in these 128 bits anymore */
+		if (!vmaxvq_u32(vreinterpretq_u32_u64(r)))
+			continue;
+
+		for (group = 0; group < groups; group++)
+			r = vandq_u64(r, vld1q_u64((const u64 *)
+						   &lt[off[group] + i]));
+
+		vst1q_u64((u64 *)&dst[i], r);
+	}
+
+	if (i < bsize) {
+		for (group = 0; group < groups && dst[i]; group++)
+			dst[i] &= lt[off[group] + i];
+	}
+}
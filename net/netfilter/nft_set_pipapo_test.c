@@ -0,0 +1,311 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * KUnit tests and lookup benchmark for nft_set_pipapo.c: check that every
+ * lookup implementation usable on this CPU returns the same element as the
+ * generic one, and report lookup times across set sizes and field layouts.
+ */
+#include <kunit/test.h>
+#include <linux/random.h>
+#include <linux/timekeeping.h>
+
+#define PIPAPO_TEST_PROBES		4096
+#define PIPAPO_TEST_BENCH_ROUNDS	64
+
+struct pipapo_test_impl {
+	const char *name;
+	const struct nft_set_type *type;
+};
+
+static const struct pipapo_test_impl pipapo_test_impls[] = {
+	{ "generic",	&nft_set_pipapo_type },
+#if defined(CONFIG_X86_64) && !defined(CONFIG_UML)
+	{ "avx2",	&nft_set_pipapo_avx2_type },
+#endif
+#ifdef NFT_PIPAPO_HAVE_AVX512
+	{ "avx512",	&nft_set_pipapo_avx512_type },
+#endif
+#ifdef NFT_PIPAPO_HAVE_NEON
+	{ "neon",	&nft_set_pipapo_neon_type },
+#endif
+};
+
+struct pipapo_test_param {
+	const char *layout;
+	unsigned int field_count;
+	u8 field_len[NFT_PIPAPO_MAX_FIELDS];
+	unsigned int rules;
+	bool large_groups;	/* first field switches to 4-bit groups */
+};
+
+#define PIPAPO_TEST_LAYOUT(_name, _rules, ...)				\
+	{								\
+		.layout = _name,					\
+		.field_count = ARRAY_SIZE(((u8 []){ __VA_ARGS__ })),	\
+		.field_len = { __VA_ARGS__ },				\
+		.rules = _rules,					\
+	}
+
+#define PIPAPO_TEST_LAYOUT_4BIT(_name, _rules, ...)			\
+	{								\
+		.layout = _name,					\
+		.field_count = ARRAY_SIZE(((u8 []){ __VA_ARGS__ })),	\
+		.field_len = { __VA_ARGS__ },				\
+		.rules = _rules,					\
+		.large_groups = true,					\
+	}
+
+static const struct pipapo_test_param pipapo_test_params[] = {
+	PIPAPO_TEST_LAYOUT("ipv4 . port", 16, 4, 2),
+	PIPAPO_TEST_LAYOUT("ipv4 . port", 256, 4, 2),
+	PIPAPO_TEST_LAYOUT("ipv4 . port", 4096, 4, 2),
+	PIPAPO_TEST_LAYOUT("ipv4 . ipv4 . port", 16, 4, 4, 2),
+	PIPAPO_TEST_LAYOUT("ipv4 . ipv4 . port", 256, 4, 4, 2),
+	PIPAPO_TEST_LAYOUT("ipv4 . ipv4 . port", 4096, 4, 4, 2),
+	PIPAPO_TEST_LAYOUT("ipv6 . port", 16, 16, 2),
+	PIPAPO_TEST_LAYOUT("ipv6 . port", 256, 16, 2),
+	PIPAPO_TEST_LAYOUT("ipv6 . port", 4096, 16, 2),
+	PIPAPO_TEST_LAYOUT("mac . ipv4 . proto", 256, 6, 4, 1),
+	/* ipv6 lookup table over NFT_PIPAPO_LT_SIZE_HIGH, port one below */
+	PIPAPO_TEST_LAYOUT_4BIT("ipv6 . port", 8192, 16, 2),
+};
+
+static void pipapo_test_param_desc(const struct pipapo_test_param *p,
+				   char *desc)
+{
+	snprintf(desc, KUNIT_PARAM_DESC_SIZE, "%s, %u rules%s", p->layout,
+		 p->rules, p->large_groups ? ", 4-bit groups" : "");
+}
+
+KUNIT_ARRAY_PARAM(pipapo_test, pipapo_test_params, pipapo_test_param_desc);
+
+struct pipapo_test_set {
+	struct nft_set *set;
+	struct nft_pipapo_elem *elems;
+	u32 *probes;
+	unsigned int width;
+};
+
+static int pipapo_test_insert(struct nft_set *set, const u8 *key,
+			      struct nft_pipapo_elem *e)
+{
+	union nft_pipapo_map_bucket rulemap[NFT_PIPAPO_MAX_FIELDS];
+	struct nft_pipapo *priv = nft_set_priv(set);
+	struct nft_pipapo_match *m = priv->clone;
+	int i, ret, bsize_max = m->bsize_max;
+	struct nft_pipapo_field *f;
+
+	nft_pipapo_for_each_field(f, i, m) {
+		rulemap[i].to = f->rules;
+
+		ret = pipapo_insert(f, key, f->groups * f->bb);
+		if (ret < 0)
+			return ret;
+
+		rulemap[i].n = ret;
+		bsize_max = max_t(int, bsize_max, f->bsize);
+		key += NFT_PIPAPO_GROUPS_PADDED_SIZE(f);
+	}
+
+	if (bsize_max > m->bsize_max) {
+		ret = pipapo_realloc_scratch(m, bsize_max);
+		if (ret)
+			return ret;
+
+		m->bsize_max = bsize_max;
+	}
+
+	pipapo_map(m, rulemap, e);
+
+	return 0;
+}
+
+/* Build a set with one exact entry per rule, and probe keys: half of them
+ * match an entry, the other half are random.
+ */
+static void pipapo_test_set_init(struct kunit *test,
+				 const struct pipapo_test_param *p,
+				 struct pipapo_test_set *ts)
+{
+	struct nft_set_desc desc = { .field_count = p->field_count };
+	struct nft_pipapo *priv;
+	unsigned int r, words;
+	u32 *keys;
+
+	memcpy(desc.field_len, p->field_len, sizeof(desc.field_len));
+
+	ts->set = kunit_kzalloc(test, sizeof(*ts->set) + sizeof(*priv),
+				GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, ts->set);
+	KUNIT_ASSERT_EQ(test, nft_pipapo_init(ts->set, &desc, NULL), 0);
+
+	priv = nft_set_priv(ts->set);
+	ts->width = priv->width;
+	words = ts->width / sizeof(u32);
+
+	ts->elems = kunit_kcalloc(test, p->rules, sizeof(*ts->elems),
+				  GFP_KERNEL);
+	keys = kunit_kcalloc(test, p->rules, ts->width, GFP_KERNEL);
+	ts->probes = kunit_kcalloc(test, PIPAPO_TEST_PROBES, ts->width,
+				   GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, ts->elems);
+	KUNIT_ASSERT_NOT_NULL(test, keys);
+	KUNIT_ASSERT_NOT_NULL(test, ts->probes);
+
+	get_random_bytes(keys, p->rules * ts->width);
+	for (r = 0; r < p->rules; r++) {
+		u8 *key = (u8 *)&keys[r * words];
+
+		/* keep entries distinct */
+		key[0] = r >> 8;
+		key[1] = r;
+
+		KUNIT_ASSERT_EQ(test, pipapo_test_insert(ts->set, key,
+							 &ts->elems[r]), 0);
+	}
+
+	if (p->large_groups)
+		KUNIT_ASSERT_EQ(test, priv->clone->f[0].bb,
+				NFT_PIPAPO_GROUP_BITS_LARGE_SET);
+
+	get_random_bytes(ts->probes, PIPAPO_TEST_PROBES * ts->width);
+	for (r = 0; r < PIPAPO_TEST_PROBES; r += 2) {
+		memcpy(&ts->probes[r * words],
+		       &keys[get_random_u32_below(p->rules) * words],
+		       ts->width);
+	}
+
+	/* No lookups yet, no need to wait for readers */
+	pipapo_free_match(rcu_dereference_protected(priv->match, true));
+	rcu_assign_pointer(priv->match, priv->clone);
+	priv->clone = NULL;
+}
+
+static void pipapo_test_set_exit(struct pipapo_test_set *ts)
+{
+	struct nft_pipapo *priv = nft_set_priv(ts->set);
+
+	pipapo_free_match(rcu_dereference_protected(priv->match, true));
+}
+
+static bool pipapo_test_impl_usable(const struct pipapo_test_impl *impl,
+				    const struct pipapo_test_param *p)
+{
+	struct nft_set_desc desc = { .field_count = p->field_count };
+	struct nft_set_estimate est;
+
+	memcpy(desc.field_len, p->field_len, sizeof(desc.field_len));
+
+	return impl->type->ops.estimate(&desc, NFT_SET_INTERVAL, &est);
+}
+
+static bool pipapo_test_lookup(const struct pipapo_test_impl *impl,
+			       const struct pipapo_test_set *ts,
+			       unsigned int probe,
+			       const struct nft_set_ext **ext)
+{
+	const u32 *key = &ts->probes[probe * ts->width / sizeof(u32)];
+	bool ret;
+
+	*ext = NULL;
+
+	rcu_read_lock();
+	local_bh_disable();
+	ret = impl->type->ops.lookup(&init_net, ts->set, key, ext);
+	local_bh_enable();
+	rcu_read_unlock();
+
+	return ret;
+}
+
+static void pipapo_test_lookup_match(struct kunit *test)
+{
+	const struct pipapo_test_param *p = test->param_value;
+	const struct nft_set_ext *ext, *ref_ext;
+	struct pipapo_test_set ts;
+	unsigned int i, probe;
+	bool ret, ref;
+
+	pipapo_test_set_init(test, p, &ts);
+
+	for (i = 1; i < ARRAY_SIZE(pipapo_test_impls); i++) {
+		const struct pipapo_test_impl *impl = &pipapo_test_impls[i];
+
+		if (!pipapo_test_impl_usable(impl, p))
+			continue;
+
+		for (probe = 0; probe < PIPAPO_TEST_PROBES; probe++) {
+			ref = pipapo_test_lookup(&pipapo_test_impls[0], &ts,
+						 probe, &ref_ext);
+			ret = pipapo_test_lookup(impl, &ts, probe, &ext);
+
+			KUNIT_EXPECT_EQ_MSG(test, ret, ref, "%s, probe %u",
+					    impl->name, probe);
+			if (ret && ref)
+				KUNIT_EXPECT_PTR_EQ_MSG(test, ext, ref_ext,
+							"%s, probe %u",
+							impl->name, probe);
+		}
+	}
+
+	/* even, probes copied from entries, must match */
+	for (probe = 0; probe < PIPAPO_TEST_PROBES; probe += 2)
+		KUNIT_EXPECT_TRUE(test, pipapo_test_lookup(&pipapo_test_impls[0],
+							   &ts, probe, &ext));
+
+	pipapo_test_set_exit(&ts);
+}
+
+static void pipapo_test_lookup_bench(struct kunit *test)
+{
+	const struct pipapo_test_param *p = test->param_value;
+	const struct nft_set_ext *ext;
+	struct pipapo_test_set ts;
+	unsigned int i, probe, round;
+
+	pipapo_test_set_init(test, p, &ts);
+
+	for (i = 0; i < ARRAY_SIZE(pipapo_test_impls); i++) {
+		const struct pipapo_test_impl *impl = &pipapo_test_impls[i];
+		u64 start, ns = 0;
+
+		if (!pipapo_test_impl_usable(impl, p))
+			continue;
+
+		for (round = 0; round < PIPAPO_TEST_BENCH_ROUNDS; round++) {
+			rcu_read_lock();
+			local_bh_disable();
+			start = ktime_get_ns();
+			for (probe = 0; probe < PIPAPO_TEST_PROBES; probe++) {
+				impl->type->ops.lookup(&init_net, ts.set,
+						       &ts.probes[probe * ts.width / sizeof(u32)],
+						       &ext);
+			}
+			ns += ktime_get_ns() - start;
+			local_bh_enable();
+			rcu_read_unlock();
+
+			cond_resched();
+		}
+
+		kunit_info(test, "%s . %u rules: %s: %llu ns/lookup\n",
+			   p->layout, p->rules, impl->name,
+			   div_u64(ns, PIPAPO_TEST_BENCH_ROUNDS *
+				       PIPAPO_TEST_PROBES));
+	}
+
+	pipapo_test_set_exit(&ts);
+}
+
+static struct kunit_case pipapo_test_cases[] = {
+	KUNIT_CASE_PARAM(pipapo_test_lookup_match, pipapo_test_gen_params),
+	KUNIT_CASE_PARAM_ATTR(pipapo_test_lookup_bench, pipapo_test_gen_params,
+			      { .speed = KUNIT_SPEED_SLOW }),
+	{}
+};
+
+static struct kunit_suite pipapo_test_suite = {
+	.name = "nft_set_pipapo",
+	.test_cases = pipapo_test_cases,
+};
+
+kunit_test_suite(pipapo_test_suite);
@@ -12,6 +12,8 @@
 #include <linux/workqueue.h>
 #include <linux/refcount.h>
 #include <linux/bitfield.h>
+#include <linux/jhash.h>
+#include <linux/sort.h>
 
 #include <linux/if_ether.h>
 #include <linux/in6.h>
@@ -40,6 +42,19 @@
 #define TCA_FLOWER_KEY_CT_FLAGS_MASK \
 		(TCA_FLOWER_KEY_CT_FLAGS_MAX - 1)
 
+#define FL_MASK_REORDER_INTERVAL	HZ
+#define FL_FLOW_CACHE_SIZE		16
+
+static bool mask_reorder;
+module_param(mask_reorder, bool, 0644);
+MODULE_PARM_DESC(mask_reorder,
+		 "Try masks in order of hit rate. Packets matching filters under several masks go to the one tried first");
+
+static bool flow_cache;
+module_param(flow_cache, bool, 0644);
+MODULE_PARM_DESC(flow_cache,
+		 "Cache classification results per CPU, by exact packet key");
+
 struct fl_flow_key {
 	struct flow_dissector_key_meta meta;
 	struct flow_dissector_key_control control;
@@ -93,6 +108,30 @@ struct fl_flow_mask {
 	struct rcu_work rwork;
 	struct list_head list;
 	refcount_t refcnt;
+	unsigned long __percpu *hits;
+	unsigned long last_hits;
+	unsigned long rate;
+	unsigned int pos;
+};
+
+/* Masks in the order fl_classify() tries them. Removed masks leave a NULL
+ * slot behind until the array is rebuilt.
+ */
+struct fl_mask_array {
+	struct rcu_head rcu;
+	unsigned int count;
+	struct fl_flow_mask *masks[];
+};
+
+struct fl_flow_cache_entry {
+	struct cls_fl_filter *filter;
+	unsigned int gen;
+	u32 hash;
+	struct fl_flow_key key;
+};
+
+struct fl_flow_cache {
+	struct fl_flow_cache_entry ent[FL_FLOW_CACHE_SIZE];
 };
 
 struct fl_flow_tmplt {
@@ -109,6 +148,18 @@ struct cls_fl_head {
 	struct list_head hw_filters;
 	struct rcu_work rwork;
 	struct idr handle_idr;
+	struct mutex order_lock; /* Protect mask_order and cache_mask */
+	struct fl_mask_array __rcu *mask_order;
+	struct delayed_work reorder_work;
+	bool mask_reorder;
+	/* Exact match cache in front of mask lookups, keyed by packet fields
+	 * used by any mask, as dissected with cache_mask. Entries are only
+	 * valid for the cache_gen they were added with, which is bumped on
+	 * every filter insertion and removal.
+	 */
+	struct fl_flow_cache __percpu *cache;
+	struct fl_flow_mask __rcu *cache_mask;
+	atomic_t cache_gen;
 };
 
 struct cls_fl_filter {
@@ -310,42 +361,186 @@ static u16 fl_ct_info_to_flower_map[] = {
 					TCA_FLOWER_KEY_CT_FLAGS_NEW,
 };
 
+static void fl_dissect(struct sk_buff *skb, struct fl_flow_mask *mask,
+		       struct fl_flow_key *skb_key, bool post_ct, u16 zone)
+{
+	flow_dissector_init_keys(&skb_key->control, &skb_key->basic);
+	fl_clear_masked_range(skb_key, mask);
+
+	skb_flow_dissect_meta(skb, &mask->dissector, skb_key);
+	/* skb_flow_dissect() does not set n_proto in case an unknown
+	 * protocol, so do it rather here.
+	 */
+	skb_key->basic.n_proto = skb_protocol(skb, false);
+	skb_flow_dissect_tunnel_info(skb, &mask->dissector, skb_key);
+	skb_flow_dissect_ct(skb, &mask->dissector, skb_key,
+			    fl_ct_info_to_flower_map,
+			    ARRAY_SIZE(fl_ct_info_to_flower_map),
+			    post_ct, zone);
+	skb_flow_dissect_hash(skb, &mask->dissector, skb_key);
+	skb_flow_dissect(skb, &mask->dissector, skb_key,
+			 FLOW_DISSECTOR_F_STOP_BEFORE_ENCAP);
+}
+
+/* Look up the exact packet key in the flow cache. On a miss, the entry the
+ * key maps to is claimed and returned in @slot, for fl_classify() to store
+ * the result of mask lookups there.
+ */
+static struct cls_fl_filter *
+fl_flow_cache_lookup(struct sk_buff *skb, struct cls_fl_head *head,
+		     struct fl_flow_key *skb_key, bool post_ct, u16 zone,
+		     struct fl_flow_cache_entry **slot)
+{
+	struct fl_flow_mask *cmask = rcu_dereference_bh(head->cache_mask);
+	struct fl_flow_cache_entry *e;
+	unsigned int gen;
+	u32 hash;
+
+	if (!cmask)
+		return NULL;
+
+	gen = atomic_read_acquire(&head->cache_gen);
+
+	fl_dissect(skb, cmask, skb_key, post_ct, zone);
+	hash = jhash2(fl_key_get_start(skb_key, cmask),
+		      fl_mask_range(cmask) / sizeof(u32), 0);
+
+	e = &this_cpu_ptr(head->cache)->ent[hash % FL_FLOW_CACHE_SIZE];
+	if (e->filter && e->gen == gen && e->hash == hash &&
+	    !memcmp(fl_key_get_start(&e->key, cmask),
+		    fl_key_get_start(skb_key, cmask), fl_mask_range(cmask)))
+		return e->filter;
+
+	e->filter = NULL;
+	e->gen = gen;
+	e->hash = hash;
+	memcpy(fl_key_get_start(&e->key, cmask),
+	       fl_key_get_start(skb_key, cmask), fl_mask_range(cmask));
+	*slot = e;
+
+	return NULL;
+}
+
 TC_INDIRECT_SCOPE int fl_classify(struct sk_buff *skb,
 				  const struct tcf_proto *tp,
 				  struct tcf_result *res)
 {
 	struct cls_fl_head *head = rcu_dereference_bh(tp->root);
+	struct fl_flow_cache_entry *slot = NULL;
 	bool post_ct = tc_skb_cb(skb)->post_ct;
 	u16 zone = tc_skb_cb(skb)->zone;
+	struct fl_mask_array *order;
 	struct fl_flow_key skb_key;
 	struct fl_flow_mask *mask;
 	struct cls_fl_filter *f;
+	unsigned int i;
+
+	if (head->cache) {
+		f = fl_flow_cache_lookup(skb, head, &skb_key, post_ct, zone,
+					 &slot);
+		if (f)
+			goto found;
+	}
 
-	list_for_each_entry_rcu(mask, &head->masks, list) {
-		flow_dissector_init_keys(&skb_key.control, &skb_key.basic);
-		fl_clear_masked_range(&skb_key, mask);
+	order = rcu_dereference_bh(head->mask_order);
+	if (!order)
+		return -1;
 
-		skb_flow_dissect_meta(skb, &mask->dissector, &skb_key);
-		/* skb_flow_dissect() does not set n_proto in case an unknown
-		 * protocol, so do it rather here.
-		 */
-		skb_key.basic.n_proto = skb_protocol(skb, false);
-		skb_flow_dissect_tunnel_info(skb, &mask->dissector, &skb_key);
-		skb_flow_dissect_ct(skb, &mask->dissector, &skb_key,
-				    fl_ct_info_to_flower_map,
-				    ARRAY_SIZE(fl_ct_info_to_flower_map),
-				    post_ct, zone);
-		skb_flow_dissect_hash(skb, &mask->dissector, &skb_key);
-		skb_flow_dissect(skb, &mask->dissector, &skb_key,
-				 FLOW_DISSECTOR_F_STOP_BEFORE_ENCAP);
+	for (i = 0; i < order->count; i++) {
+		mask = READ_ONCE(order->masks[i]);
+		if (!mask)
+			continue;
+
+		fl_dissect(skb, mask, &skb_key, post_ct, zone);
 
 		f = fl_mask_lookup(mask, &skb_key);
 		if (f && !tc_skip_sw(f->flags)) {
-			*res = f->res;
-			return tcf_exts_exec(skb, &f->exts, res);
+			if (mask->hits)
+				this_cpu_inc(*mask->hits);
+			/* Before running actions, which might classify
+			 * packets again on this CPU and reuse the slot.
+			 */
+			if (slot)
+				slot->filter = f;
+			goto found;
 		}
 	}
 	return -1;
+
+found:
+	*res = f->res;
+	return tcf_exts_exec(skb, &f->exts, res);
+}
+
+static int fl_mask_rate_cmp(const void *a, const void *b)
+{
+	const struct fl_flow_mask *ma = *(const struct fl_flow_mask **)a;
+	const struct fl_flow_mask *mb = *(const struct fl_flow_mask **)b;
+
+	if (ma->rate != mb->rate)
+		return ma->rate > mb->rate ? -1 : 1;
+
+	/* sort() is not stable, keep the current order among equals */
+	return ma->pos < mb->pos ? -1 : 1;
+}
+
+static void fl_mask_reorder_work(struct work_struct *work)
+{
+	struct cls_fl_head *head = container_of(to_delayed_work(work),
+						struct cls_fl_head,
+						reorder_work);
+	struct fl_mask_array *order, *old;
+	unsigned long hits, rate = ULONG_MAX;
+	bool sorted = true;
+	unsigned int i;
+	int cpu;
+
+	mutex_lock(&head->order_lock);
+
+	old = rcu_dereference_protected(head->mask_order,
+					lockdep_is_held(&head->order_lock));
+	if (!old)
+		goto out;
+
+	for (i = 0; i < old->count; i++) {
+		struct fl_flow_mask *mask = old->masks[i];
+
+		if (!mask)
+			continue;
+
+		hits = 0;
+		for_each_possible_cpu(cpu)
+			hits += *per_cpu_ptr(mask->hits, cpu);
+
+		mask->rate = hits - mask->last_hits;
+		mask->last_hits = hits;
+		mask->pos = i;
+
+		if (mask->rate > rate)
+			sorted = false;
+		rate = mask->rate;
+	}
+
+	if (sorted)
+		goto out;
+
+	order = kzalloc(struct_size(order, masks, old->count), GFP_KERNEL);
+	if (!order)
+		goto out;
+
+	for (i = 0; i < old->count; i++) {
+		if (old->masks[i])
+			order->masks[order->count++] = old->masks[i];
+	}
+	sort(order->masks, order->count, sizeof(order->masks[0]),
+	     fl_mask_rate_cmp, NULL);
+
+	rcu_assign_pointer(head->mask_order, order);
+	kfree_rcu(old, rcu);
+out:
+	mutex_unlock(&head->order_lock);
+
+	schedule_delayed_work(&head->reorder_work, FL_MASK_REORDER_INTERVAL);
 }
 
 static int fl_init(struct tcf_proto *tp)
@@ -356,9 +551,23 @@ static int fl_init(struct tcf_proto *tp)
 	if (!head)
 		return -ENOBUFS;
 
+	if (READ_ONCE(flow_cache)) {
+		head->cache = alloc_percpu(struct fl_flow_cache);
+		if (!head->cache) {
+			kfree(head);
+			return -ENOBUFS;
+		}
+	}
+
 	spin_lock_init(&head->masks_lock);
 	INIT_LIST_HEAD_RCU(&head->masks);
 	INIT_LIST_HEAD(&head->hw_filters);
+	mutex_init(&head->order_lock);
+	INIT_DELAYED_WORK(&head->reorder_work, fl_mask_reorder_work);
+	head->mask_reorder = READ_ONCE(mask_reorder);
+	if (head->mask_reorder)
+		schedule_delayed_work(&head->reorder_work,
+				      FL_MASK_REORDER_INTERVAL);
 	rcu_assign_pointer(tp->root, head);
 	idr_init(&head->handle_idr);
 
@@ -372,6 +581,7 @@ static void fl_mask_free(struct fl_flow_mask *mask, bool mask_init_done)
 		WARN_ON(!list_empty(&mask->filters));
 		rhashtable_destroy(&mask->ht);
 	}
+	free_percpu(mask->hits);
 	kfree(mask);
 }
 
@@ -391,6 +601,36 @@ static void fl_uninit_mask_free_work(struct work_struct *work)
 	fl_mask_free(mask, false);
 }
 
+static void fl_mask_order_del(struct cls_fl_head *head,
+			      struct fl_flow_mask *mask)
+{
+	struct fl_mask_array *order;
+	unsigned int i;
+
+	mutex_lock(&head->order_lock);
+	order = rcu_dereference_protected(head->mask_order,
+					  lockdep_is_held(&head->order_lock));
+	for (i = 0; i < order->count; i++) {
+		if (order->masks[i] == mask) {
+			WRITE_ONCE(order->masks[i], NULL);
+			break;
+		}
+	}
+	mutex_unlock(&head->order_lock);
+}
+
+/* Invalidate flow cache entries. Called once filters become visible to, or
+ * are hidden from mask lookups, and before removed filters can be released.
+ */
+static void fl_flow_cache_flush(struct cls_fl_head *head)
+{
+	if (!head->cache)
+		return;
+
+	smp_mb__before_atomic();
+	atomic_inc(&head->cache_gen);
+}
+
 static bool fl_mask_put(struct cls_fl_head *head, struct fl_flow_mask *mask)
 {
 	if (!refcount_dec_and_test(&mask->refcnt))
@@ -402,6 +642,8 @@ static bool fl_mask_put(struct cls_fl_head *head, struct fl_flow_mask *mask)
 	list_del_rcu(&mask->list);
 	spin_unlock(&head->masks_lock);
 
+	fl_mask_order_del(head, mask);
+
 	tcf_queue_work(&mask->rwork, fl_mask_free_work);
 
 	return true;
@@ -565,6 +807,8 @@ static int __fl_delete(struct tcf_proto *tp, struct cls_fl_filter *f,
 	list_del_rcu(&f->list);
 	spin_unlock(&tp->lock);
 
+	fl_flow_cache_flush(head);
+
 	*last = fl_mask_put(head, f->mask);
 	if (!tc_skip_hw(f->flags))
 		fl_hw_destroy_filter(tp, f, rtnl_held, extack);
@@ -579,7 +823,13 @@ static void fl_destroy_sleepable(struct work_struct *work)
 	struct cls_fl_head *head = container_of(to_rcu_work(work),
 						struct cls_fl_head,
 						rwork);
+	struct fl_flow_mask *cmask = rcu_dereference_raw(head->cache_mask);
 
+	if (cmask)
+		fl_mask_free(cmask, false);
+	free_percpu(head->cache);
+	kfree(rcu_dereference_raw(head->mask_order));
+	mutex_destroy(&head->order_lock);
 	rhashtable_destroy(&head->ht);
 	kfree(head);
 	module_put(THIS_MODULE);
@@ -593,6 +843,8 @@ static void fl_destroy(struct tcf_proto *tp, bool rtnl_held,
 	struct cls_fl_filter *f, *next;
 	bool last;
 
+	cancel_delayed_work_sync(&head->reorder_work);
+
 	list_for_each_entry_safe(mask, next_mask, &head->masks, list) {
 		list_for_each_entry_safe(f, next, &mask->filters, list) {
 			__fl_delete(tp, f, &last, rtnl_held, extack);
@@ -2102,10 +2354,62 @@ static void fl_init_dissector(struct flow_dissector *dissector,
 	skb_flow_dissector_init(dissector, keys, cnt);
 }
 
+/* Grow the mask of packet fields the flow cache is keyed by */
+static struct fl_flow_mask *fl_cache_mask_alloc(struct cls_fl_head *head,
+						struct fl_flow_mask *mask)
+{
+	struct fl_flow_mask *old, *cmask;
+	const long *lmask;
+	long *lcmask;
+	int i;
+
+	cmask = kzalloc(sizeof(*cmask), GFP_KERNEL);
+	if (!cmask)
+		return NULL;
+
+	old = rcu_dereference_protected(head->cache_mask,
+					lockdep_is_held(&head->order_lock));
+	if (old)
+		fl_mask_copy(cmask, old);
+
+	lmask = fl_key_get_start(&mask->key, mask);
+	lcmask = fl_key_get_start(&cmask->key, mask);
+	for (i = 0; i < fl_mask_range(mask); i += sizeof(long))
+		*lcmask++ |= *lmask++;
+
+	fl_mask_update_range(cmask);
+	fl_init_dissector(&cmask->dissector, &cmask->key);
+
+	return cmask;
+}
+
+static struct fl_mask_array *fl_mask_order_alloc(struct cls_fl_head *head)
+{
+	struct fl_mask_array *old, *order;
+	unsigned int i, count = 1;
+
+	old = rcu_dereference_protected(head->mask_order,
+					lockdep_is_held(&head->order_lock));
+	if (old)
+		count += old->count;
+
+	order = kzalloc(struct_size(order, masks, count), GFP_KERNEL);
+	if (!order)
+		return NULL;
+
+	for (i = 0; old && i < old->count; i++) {
+		if (old->masks[i])
+			order->masks[order->count++] = old->masks[i];
+	}
+
+	return order;
+}
+
 static struct fl_flow_mask *fl_create_new_mask(struct cls_fl_head *head,
 					       struct fl_flow_mask *mask)
 {
-	struct fl_flow_mask *newmask;
+	struct fl_flow_mask *newmask, *cmask = NULL, *old_cmask;
+	struct fl_mask_array *order, *old_order;
 	int err;
 
 	newmask = kzalloc(sizeof(*newmask), GFP_KERNEL);
@@ -2128,18 +2432,66 @@ static struct fl_flow_mask *fl_create_new_mask(struct cls_fl_head *head,
 
 	INIT_LIST_HEAD_RCU(&newmask->filters);
 
+	if (head->mask_reorder) {
+		newmask->hits = alloc_percpu(unsigned long);
+		if (!newmask->hits) {
+			err = -ENOMEM;
+			goto errout_destroy;
+		}
+	}
+
+	mutex_lock(&head->order_lock);
+
+	order = fl_mask_order_alloc(head);
+	if (!order) {
+		err = -ENOMEM;
+		goto errout_unlock;
+	}
+
+	if (head->cache) {
+		cmask = fl_cache_mask_alloc(head, newmask);
+		if (!cmask) {
+			err = -ENOMEM;
+			goto errout_order;
+		}
+	}
+
 	refcount_set(&newmask->refcnt, 1);
 	err = rhashtable_replace_fast(&head->ht, &mask->ht_node,
 				      &newmask->ht_node, mask_ht_params);
 	if (err)
-		goto errout_destroy;
+		goto errout_cmask;
 
 	spin_lock(&head->masks_lock);
 	list_add_tail_rcu(&newmask->list, &head->masks);
 	spin_unlock(&head->masks_lock);
 
+	order->masks[order->count++] = newmask;
+	old_order = rcu_replace_pointer(head->mask_order, order,
+					lockdep_is_held(&head->order_lock));
+	if (old_order)
+		kfree_rcu(old_order, rcu);
+
+	if (cmask) {
+		old_cmask = rcu_replace_pointer(head->cache_mask, cmask,
+						lockdep_is_held(&head->order_lock));
+		fl_flow_cache_flush(head);
+		if (old_cmask)
+			tcf_queue_work(&old_cmask->rwork,
+				       fl_uninit_mask_free_work);
+	}
+
+	mutex_unlock(&head->order_lock);
+
 	return newmask;
 
+errout_cmask:
+	kfree(cmask);
+errout_order:
+	kfree(order);
+errout_unlock:
+	mutex_unlock(&head->order_lock);
+	free_percpu(newmask->hits);
 errout_destroy:
 	rhashtable_destroy(&newmask->ht);
 errout_free:
@@ -2363,6 +2715,8 @@ static int fl_change(struct net *net, struct sk_buff *in_skb,
 	err = fl_ht_insert_unique(fnew, fold, &in_ht);
 	if (err)
 		goto errout_mask;
+	if (in_ht)
+		fl_flow_cache_flush(head);
 
 	if (!tc_skip_hw(fnew->flags)) {
 		err = fl_hw_replace_filter(tp, fnew, rtnl_held, extack);
@@ -2414,6 +2768,8 @@ static int fl_change(struct net *net, struct sk_buff *in_skb,
 
 		spin_unlock(&tp->lock);
 
+		fl_flow_cache_flush(head);
+
 		fl_mask_put(head, fold->mask);
 		if (!tc_skip_hw(fold->flags))
 			fl_hw_destroy_filter(tp, fold, rtnl_held, NULL);
@@ -2444,9 +2800,11 @@ static int fl_change(struct net *net, struct sk_buff *in_skb,
 	spin_unlock(&tp->lock);
 	if (!tc_skip_hw(fnew->flags))
 		fl_hw_destroy_filter(tp, fnew, rtnl_held, NULL);
-	if (in_ht)
+	if (in_ht) {
 		rhashtable_remove_fast(&fnew->mask->ht, &fnew->ht_node,
 				       fnew->mask->filter_ht_params);
+		fl_flow_cache_flush(head);
+	}
 errout_mask:
 	fl_mask_put(head, fnew->mask);
 
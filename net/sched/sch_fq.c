@@ -90,7 +90,10 @@ struct fq_flow {
 	int		band;
 	struct fq_flow *next;		/* next pointer in RR lists */
 
-	struct rb_node  rate_node;	/* anchor in q->delayed tree */
+	union {
+		struct rb_node	  rate_node;	/* anchor in q->delayed tree */
+		struct hlist_node wheel_node;	/* or in a q->wheel slot */
+	};
 	u64		time_next_packet;
 };
 
@@ -106,6 +109,31 @@ struct fq_perband_flows {
 	int		    quantum; /* based on band nr : 576KB, 192KB, 64KB */
 };
 
+/*
+ * Optional hierarchical timing wheel replacing the q->delayed rbtree, for
+ * hosts pacing many flows where the rbtree insert and rb_first() walk show up.
+ * Level 0 slots are as wide as the hrtimer slack (rounded down to a power of
+ * two, see fq_wheel_alloc()), each upper level slot covers a full lower level.
+ * Slots only order flows coarsely: flows are released on their exact
+ * time_next_packet, so pacing is unchanged.
+ */
+#define FQ_WHEEL_LEVELS		4
+#define FQ_WHEEL_BITS		6
+#define FQ_WHEEL_SLOTS		(1U << FQ_WHEEL_BITS)
+#define FQ_WHEEL_MASK		(FQ_WHEEL_SLOTS - 1)
+
+struct fq_wheel {
+	u64		clk;		/* current level 0 slot, in slot units */
+	u8		shift;		/* log2 of level 0 slot width in ns */
+	DECLARE_BITMAP(pending[FQ_WHEEL_LEVELS], FQ_WHEEL_SLOTS);
+	struct hlist_head slots[FQ_WHEEL_LEVELS][FQ_WHEEL_SLOTS];
+};
+
+static bool fq_timer_wheel __read_mostly;
+module_param(fq_timer_wheel, bool, 0644);
+MODULE_PARM_DESC(fq_timer_wheel,
+		 "Keep throttled flows in a timing wheel instead of an rbtree (new qdiscs only)");
+
 struct fq_sched_data {
 /* Read mostly cache line */
 
@@ -133,6 +161,7 @@ struct fq_sched_data {
 
 	struct fq_flow	internal;	/* fastpath queue. */
 	struct rb_root	delayed;	/* for rate limited flows */
+	struct fq_wheel	*wheel;		/* replaces delayed if fq_timer_wheel */
 	u64		time_next_delayed_flow;
 	unsigned long	unthrottle_latency_ns;
 
@@ -207,17 +236,133 @@ static void fq_flow_add_tail(struct fq_sched_data *q, struct fq_flow *flow,
 	flow->next = NULL;
 }
 
+static u64 fq_wheel_slot_time(const struct fq_wheel *w, u64 clk)
+{
+	return clk << w->shift;
+}
+
+static void fq_wheel_insert(struct fq_wheel *w, struct fq_flow *f)
+{
+	u64 t = max(f->time_next_packet >> w->shift, w->clk);
+	unsigned int lvl, shift, idx;
+
+	/* Lowest level still able to tell apart the slot of @t from the
+	 * current one. This never picks the current slot of an upper level,
+	 * which would only be looked at again after a full wrap.
+	 */
+	for (lvl = 0; lvl < FQ_WHEEL_LEVELS - 1; lvl++) {
+		shift = lvl * FQ_WHEEL_BITS;
+		if ((t >> shift) - (w->clk >> shift) < FQ_WHEEL_SLOTS)
+			break;
+	}
+	shift = lvl * FQ_WHEEL_BITS;
+	/* Beyond the last level: park in its farthest slot, the flow
+	 * is put back in place when that slot cascades.
+	 */
+	if ((t >> shift) - (w->clk >> shift) >= FQ_WHEEL_SLOTS)
+		t = w->clk + ((u64)FQ_WHEEL_MASK << shift);
+
+	idx = (t >> shift) & FQ_WHEEL_MASK;
+	hlist_add_head(&f->wheel_node, &w->slots[lvl][idx]);
+	__set_bit(idx, w->pending[lvl]);
+}
+
+/* Move flows of upper level slots starting at w->clk down the wheel. */
+static void fq_wheel_cascade(struct fq_wheel *w)
+{
+	struct hlist_node *tmp;
+	struct hlist_head head;
+	struct fq_flow *f;
+	unsigned int lvl, shift, idx;
+
+	for (lvl = FQ_WHEEL_LEVELS - 1; lvl > 0; lvl--) {
+		shift = lvl * FQ_WHEEL_BITS;
+		if (w->clk & ((1ULL << shift) - 1))
+			continue;
+
+		idx = (w->clk >> shift) & FQ_WHEEL_MASK;
+		if (!__test_and_clear_bit(idx, w->pending[lvl]))
+			continue;
+
+		hlist_move_list(&w->slots[lvl][idx], &head);
+		hlist_for_each_entry_safe(f, tmp, &head, wheel_node)
+			fq_wheel_insert(w, f);
+	}
+}
+
+/* Earliest w->clk value after the current one where a slot needs work. */
+static u64 fq_wheel_next_clk(const struct fq_wheel *w)
+{
+	u64 next = ~0ULL;
+	unsigned int lvl;
+
+	for (lvl = 0; lvl < FQ_WHEEL_LEVELS; lvl++) {
+		unsigned int shift = lvl * FQ_WHEEL_BITS;
+		u64 pos = w->clk >> shift;
+		unsigned long idx;
+
+		idx = find_next_bit(w->pending[lvl], FQ_WHEEL_SLOTS,
+				    (pos & FQ_WHEEL_MASK) + 1);
+		if (idx == FQ_WHEEL_SLOTS) {
+			/* Wrapped: bits left of pos are for the next round */
+			idx = find_first_bit(w->pending[lvl], FQ_WHEEL_SLOTS);
+			if (idx == FQ_WHEEL_SLOTS)
+				continue;
+			idx += FQ_WHEEL_SLOTS;
+		}
+		next = min(next, ((pos & ~(u64)FQ_WHEEL_MASK) + idx) << shift);
+	}
+	return next;
+}
+
+static void fq_wheel_reset(struct fq_wheel *w)
+{
+	unsigned int lvl, idx;
+
+	for (lvl = 0; lvl < FQ_WHEEL_LEVELS; lvl++) {
+		bitmap_zero(w->pending[lvl], FQ_WHEEL_SLOTS);
+		for (idx = 0; idx < FQ_WHEEL_SLOTS; idx++)
+			INIT_HLIST_HEAD(&w->slots[lvl][idx]);
+	}
+	w->clk = 0;
+}
+
+static struct fq_wheel *fq_wheel_alloc(u32 timer_slack)
+{
+	struct fq_wheel *w = kmalloc(sizeof(*w), GFP_KERNEL);
+
+	if (!w)
+		return NULL;
+
+	fq_wheel_reset(w);
+	/* No point in slots finer than the watchdog can honour */
+	w->shift = ilog2(max_t(u32, timer_slack, NSEC_PER_USEC));
+	return w;
+}
+
 static void fq_flow_unset_throttled(struct fq_sched_data *q, struct fq_flow *f)
 {
-	rb_erase(&f->rate_node, &q->delayed);
+	if (q->wheel)
+		hlist_del(&f->wheel_node);
+	else
+		rb_erase(&f->rate_node, &q->delayed);
 	q->throttled_flows--;
 	fq_flow_add_tail(q, f, OLD_FLOW);
 }
 
-static void fq_flow_set_throttled(struct fq_sched_data *q, struct fq_flow *f)
+static void fq_flow_set_throttled(struct fq_sched_data *q, struct fq_flow *f,
+				  u64 now)
 {
 	struct rb_node **p = &q->delayed.rb_node, *parent = NULL;
 
+	if (q->wheel) {
+		/* Empty wheel: jump its clock to now, skipping idle slots */
+		if (!q->throttled_flows)
+			q->wheel->clk = now >> q->wheel->shift;
+		fq_wheel_insert(q->wheel, f);
+		goto throttled;
+	}
+
 	while (*p) {
 		struct fq_flow *aux;
 
@@ -230,6 +375,7 @@ static void fq_flow_set_throttled(struct fq_sched_data *q, struct fq_flow *f)
 	}
 	rb_link_node(&f->rate_node, parent, p);
 	rb_insert_color(&f->rate_node, &q->delayed);
+throttled:
 	q->throttled_flows++;
 	q->stat_throttled++;
 
@@ -238,7 +384,6 @@ static void fq_flow_set_throttled(struct fq_sched_data *q, struct fq_flow *f)
 		q->time_next_delayed_flow = f->time_next_packet;
 }
 
-
 static struct kmem_cache *fq_flow_cachep __read_mostly;
 
 
@@ -588,6 +733,48 @@ static int fq_enqueue(struct sk_buff *skb, struct Qdisc *sch,
 	return NET_XMIT_SUCCESS;
 }
 
+/* Release all flows due at @now, walking level 0 slots up to the one
+ * of @now and cascading upper levels on the way. Flows of the last slot
+ * that are not due yet stay there, and set the next wakeup exactly.
+ * Other pending slots only give a lower bound of their flows' times.
+ */
+static void fq_wheel_expire(struct fq_sched_data *q, u64 now)
+{
+	struct fq_wheel *w = q->wheel;
+	u64 target = now >> w->shift;
+	u64 next_kept = ~0ULL;
+	struct hlist_node *tmp;
+	struct hlist_head head;
+	struct fq_flow *f;
+	unsigned int idx;
+
+	while (w->clk <= target) {
+		fq_wheel_cascade(w);
+
+		idx = w->clk & FQ_WHEEL_MASK;
+		if (__test_and_clear_bit(idx, w->pending[0])) {
+			hlist_move_list(&w->slots[0][idx], &head);
+			hlist_for_each_entry_safe(f, tmp, &head, wheel_node) {
+				if (f->time_next_packet <= now) {
+					fq_flow_unset_throttled(q, f);
+					continue;
+				}
+				hlist_del(&f->wheel_node);
+				fq_wheel_insert(w, f);
+				next_kept = min(next_kept, f->time_next_packet);
+			}
+		}
+		if (w->clk == target)
+			break;
+		w->clk = min(fq_wheel_next_clk(w), target);
+	}
+
+	if (q->throttled_flows)
+		q->time_next_delayed_flow =
+			min(next_kept,
+			    fq_wheel_slot_time(w, fq_wheel_next_clk(w)));
+}
+
 static void fq_check_throttled(struct fq_sched_data *q, u64 now)
 {
 	unsigned long sample;
@@ -604,6 +791,10 @@ static void fq_check_throttled(struct fq_sched_data *q, u64 now)
 	q->unthrottle_latency_ns += sample >> 3;
 
 	q->time_next_delayed_flow = ~0ULL;
+	if (q->wheel) {
+		fq_wheel_expire(q, now);
+		return;
+	}
 	while ((p = rb_first(&q->delayed)) != NULL) {
 		struct fq_flow *f = rb_entry(p, struct fq_flow, rate_node);
 
@@ -686,7 +877,7 @@ static struct sk_buff *fq_dequeue(struct Qdisc *sch)
 		if (now < time_next_packet) {
 			head->first = f->next;
 			f->time_next_packet = time_next_packet;
-			fq_flow_set_throttled(q, f);
+			fq_flow_set_throttled(q, f, now);
 			goto begin;
 		}
 		prefetch(&skb->end);
@@ -807,6 +998,8 @@ static void fq_reset(struct Qdisc *sch)
 		q->band_flows[idx].old_flows.first = NULL;
 	}
 	q->delayed		= RB_ROOT;
+	if (q->wheel)
+		fq_wheel_reset(q->wheel);
 	q->flows		= 0;
 	q->inactive_flows	= 0;
 	q->throttled_flows	= 0;
@@ -1108,6 +1301,7 @@ static void fq_destroy(struct Qdisc *sch)
 
 	fq_reset(sch);
 	fq_free(q->fq_root);
+	kfree(q->wheel);
 	qdisc_watchdog_cancel(&q->watchdog);
 }
 
@@ -1154,6 +1348,15 @@ static int fq_init(struct Qdisc *sch, struct nlattr *opt,
 	else
 		err = fq_resize(sch, q->fq_trees_log);
 
+	/* Slot width follows the slack given at creation time: the wheel
+	 * stays correct if it changes later, only less tightly sized.
+	 */
+	if (!err && READ_ONCE(fq_timer_wheel)) {
+		q->wheel = fq_wheel_alloc(q->timer_slack);
+		if (!q->wheel)
+			err = -ENOMEM;
+	}
+
 	return err;
 }
 
@@ -66,6 +66,16 @@ static int htb_rate_est = 0; /* htb classes have a default rate estimator */
 module_param(htb_rate_est, int, 0640);
 MODULE_PARM_DESC(htb_rate_est, "setup a default rate estimator (4sec 16sec) for htb classes");
 
+static int htb_mq = 0; /* shard root htb per tx queue on multiqueue devices */
+module_param(htb_mq, int, 0640);
+MODULE_PARM_DESC(htb_mq, "shard root htb per tx queue on multiqueue devices, rebalancing rates between shards");
+
+/* mq mode: how often shares of class rates are rebalanced between shards,
+ * and fixed point shift of shares
+ */
+#define HTB_MQ_REBALANCE_INTERVAL	msecs_to_jiffies(10)
+#define HTB_MQ_SHARE_SHIFT		16
+
 /* used internaly to keep status of single class */
 enum htb_cmode {
 	HTB_CANT_SEND,		/* class can't send and can't borrow */
@@ -139,6 +149,18 @@ struct htb_class {
 
 	unsigned int drops ____cacheline_aligned_in_smp;
 	unsigned int		overlimits;
+
+	/* mq mode: classes of shards mirror a class of the root and get
+	 * mq_share of its rate and ceil, following the demand seen by each
+	 * shard. Demands are summed in mq_demand of the root class, and
+	 * shards with some demand are counted in mq_active.
+	 */
+	struct htb_class	*mq_root_cl;
+	u32			mq_share;
+	u64			mq_bytes;	/* charged since last rebalance */
+	u64			mq_last_demand;
+	atomic64_t		mq_demand;
+	atomic_t		mq_active;
 };
 
 struct htb_level {
@@ -180,6 +202,14 @@ struct htb_sched {
 	unsigned int            num_direct_qdiscs;
 
 	bool			offload;
+
+	/* mq mode: root with one shard per tx queue, or shard of mq_root */
+	struct Qdisc		**mq_shards;
+	unsigned int		num_mq_shards;
+	unsigned int		num_mq_real;	/* shards of real tx queues */
+	struct Qdisc		*mq_root;
+	struct delayed_work	mq_work;
+	int			mq_idle;	/* mq_work stopped, see htb_mq_kick() */
 };
 
 /* find class in global hash table using given handle */
@@ -201,6 +231,28 @@ static unsigned long htb_search(struct Qdisc *sch, u32 handle)
 
 #define HTB_DIRECT ((struct htb_class *)-1L)
 
+/* Shards of an mq root classify with the filters attached to the root */
+static struct htb_sched *htb_filter_sched(struct htb_sched *q)
+{
+	return q->mq_root ? qdisc_priv(q->mq_root) : q;
+}
+
+static struct htb_class *htb_filter_class(struct htb_class *cl)
+{
+	return cl->mq_root_cl ? : cl;
+}
+
+/* Rebalancing stops while the qdisc is idle, the first enqueue to a shard
+ * restarts it.
+ */
+static void htb_mq_kick(struct Qdisc *root)
+{
+	struct htb_sched *q = qdisc_priv(root);
+
+	if (unlikely(READ_ONCE(q->mq_idle)) && xchg(&q->mq_idle, 0))
+		schedule_delayed_work(&q->mq_work, 0);
+}
+
 /**
  * htb_classify - classify a packet into class
  * @skb: the socket buffer
@@ -236,9 +288,9 @@ static struct htb_class *htb_classify(struct sk_buff *skb, struct Qdisc *sch,
 		if (cl->level == 0)
 			return cl;
 		/* Start with inner filter chain if a non-leaf class is selected */
-		tcf = rcu_dereference_bh(cl->filter_list);
+		tcf = rcu_dereference_bh(htb_filter_class(cl)->filter_list);
 	} else {
-		tcf = rcu_dereference_bh(q->filter_list);
+		tcf = rcu_dereference_bh(htb_filter_sched(q)->filter_list);
 	}
 
 	*qerr = NET_XMIT_SUCCESS | __NET_XMIT_BYPASS;
@@ -255,6 +307,12 @@ static struct htb_class *htb_classify(struct sk_buff *skb, struct Qdisc *sch,
 		}
 #endif
 		cl = (void *)res.class;
+		if (cl && q->mq_root) {
+			/* filters are bound to classes of the root */
+			cl = htb_find(cl->common.classid, sch);
+			if (!cl)
+				break;
+		}
 		if (!cl) {
 			if (res.classid == sch->handle)
 				return HTB_DIRECT;	/* X:0 (direct flow) */
@@ -266,7 +324,7 @@ static struct htb_class *htb_classify(struct sk_buff *skb, struct Qdisc *sch,
 			return cl;	/* we hit leaf; return it */
 
 		/* we have got inner class; apply inner filter chain */
-		tcf = rcu_dereference_bh(cl->filter_list);
+		tcf = rcu_dereference_bh(htb_filter_class(cl)->filter_list);
 	}
 	/* classification failed; try to use default class */
 	cl = htb_find(TC_H_MAKE(TC_H_MAJ(sch->handle), q->defcls), sch);
@@ -651,6 +709,8 @@ static int htb_enqueue(struct sk_buff *skb, struct Qdisc *sch,
 
 	sch->qstats.backlog += len;
 	sch->q.qlen++;
+	if (q->mq_root)
+		htb_mq_kick(q->mq_root);
 	return NET_XMIT_SUCCESS;
 }
 
@@ -714,6 +774,7 @@ static void htb_charge_class(struct htb_sched *q, struct htb_class *cl,
 		}
 		htb_accnt_ctokens(cl, bytes, diff);
 		cl->t_c = q->now;
+		cl->mq_bytes += bytes;
 
 		old_mode = cl->cmode;
 		diff = 0;
@@ -1051,6 +1112,235 @@ static int htb_offload(struct net_device *dev, struct tc_htb_qopt_offload *opt)
 	return dev->netdev_ops->ndo_setup_tc(dev, TC_SETUP_QDISC_HTB, opt);
 }
 
+static struct Qdisc_ops htb_mq_shard_qdisc_ops __read_mostly;
+
+/* Tokens and ctokens are in time at the current rate. Debts are carried over
+ * in bytes when the share changes, so that a shard which was charged while its
+ * share was tiny doesn't stall for as long at its new rate.
+ */
+static void htb_mq_set_share(struct htb_class *cl, u32 share)
+{
+	if (cl->mq_share && share != cl->mq_share) {
+		if (cl->tokens < 0)
+			cl->tokens = -(s64)div_u64((u64)-cl->tokens *
+						   cl->mq_share, share);
+		if (cl->ctokens < 0)
+			cl->ctokens = -(s64)div_u64((u64)-cl->ctokens *
+						    cl->mq_share, share);
+	}
+	cl->mq_share = share;
+}
+
+/* Rate and ceil of a shard class are its share of the ones of the root class.
+ * Token buckets keep the depth (in time) of the root class, so that bursts of
+ * all shards add up to the configured ones too.
+ */
+static void htb_mq_apply_share(struct htb_class *cl)
+{
+	struct htb_class *root_cl = cl->mq_root_cl;
+	struct tc_ratespec spec;
+	u64 rate;
+
+	psched_ratecfg_getrate(&spec, &root_cl->rate);
+	rate = mul_u64_u32_shr(root_cl->rate.rate_bytes_ps, cl->mq_share,
+			       HTB_MQ_SHARE_SHIFT);
+	spec.rate = 0;
+	psched_ratecfg_precompute(&cl->rate, &spec, max_t(u64, rate, 1));
+
+	psched_ratecfg_getrate(&spec, &root_cl->ceil);
+	rate = mul_u64_u32_shr(root_cl->ceil.rate_bytes_ps, cl->mq_share,
+			       HTB_MQ_SHARE_SHIFT);
+	spec.rate = 0;
+	psched_ratecfg_precompute(&cl->ceil, &spec, max_t(u64, rate, 1));
+}
+
+/* Publish the demand of each class of a shard, bytes sent since the last
+ * rebalance and backlog, into the budget shared with other shards. Returns
+ * whether the shard had any demand.
+ */
+static bool htb_mq_shard_demand(struct Qdisc *shard)
+{
+	struct htb_sched *q = qdisc_priv(shard);
+	struct htb_class *cl;
+	bool active = false;
+	unsigned int i;
+
+	spin_lock_bh(qdisc_lock(shard));
+	for (i = 0; i < q->clhash.hashsize; i++) {
+		hlist_for_each_entry(cl, &q->clhash.hash[i], common.hnode) {
+			if (!cl->mq_root_cl)
+				continue;
+
+			cl->mq_last_demand = cl->mq_bytes;
+			if (!cl->level)
+				cl->mq_last_demand += cl->leaf.q->qstats.backlog;
+			cl->mq_bytes = 0;
+
+			atomic64_add(cl->mq_last_demand,
+				     &cl->mq_root_cl->mq_demand);
+			if (cl->mq_last_demand) {
+				atomic_inc(&cl->mq_root_cl->mq_active);
+				active = true;
+			}
+		}
+	}
+	spin_unlock_bh(qdisc_lock(shard));
+
+	return active;
+}
+
+/* Give each shard with some demand a share of class rates proportional to
+ * it. An eighth of the rates is split evenly between those shards, so that
+ * demand which is limited by the current share can still grow. Shards without
+ * demand only keep a minimal share: the whole rate goes to the shards that
+ * use it, and a shard which just got traffic waits at most one rebalance for
+ * its share. Without demand at all, rates are split evenly between the shards
+ * of real tx queues. Apart from the minimal shares, shares add up to the whole
+ * rate, so that shards together don't exceed it.
+ */
+static void htb_mq_shard_rebalance(struct Qdisc *shard, unsigned int ntx,
+				   unsigned int nreal, bool last)
+{
+	struct htb_sched *q = qdisc_priv(shard);
+	struct htb_class *cl;
+	unsigned int i, nactive;
+	u32 share;
+	u64 total, w;
+
+	spin_lock_bh(qdisc_lock(shard));
+	for (i = 0; i < q->clhash.hashsize; i++) {
+		hlist_for_each_entry(cl, &q->clhash.hash[i], common.hnode) {
+			if (!cl->mq_root_cl)
+				continue;
+
+			total = atomic64_read(&cl->mq_root_cl->mq_demand);
+			nactive = atomic_read(&cl->mq_root_cl->mq_active);
+			if (!total) {
+				share = ntx < nreal ?
+					(1 << HTB_MQ_SHARE_SHIFT) / nreal : 0;
+			} else if (!cl->mq_last_demand) {
+				share = 0;
+			} else {
+				w = 7 * cl->mq_last_demand +
+				    div_u64(total, nactive);
+				share = div64_u64(w << HTB_MQ_SHARE_SHIFT,
+						  8 * total);
+			}
+			htb_mq_set_share(cl, share ? : 1);
+			htb_mq_apply_share(cl);
+
+			if (last) {
+				atomic64_set(&cl->mq_root_cl->mq_demand, 0);
+				atomic_set(&cl->mq_root_cl->mq_active, 0);
+			}
+		}
+	}
+	spin_unlock_bh(qdisc_lock(shard));
+}
+
+static void htb_mq_rebalance_work(struct work_struct *work)
+{
+	struct htb_sched *q = container_of(to_delayed_work(work),
+					   struct htb_sched, mq_work);
+	unsigned int ntx, nreal = READ_ONCE(q->num_mq_real);
+	bool active = false;
+
+	/* Enqueues that come after the demand of their shard was taken
+	 * restart the work, see htb_mq_kick().
+	 */
+	WRITE_ONCE(q->mq_idle, 1);
+	smp_mb();
+
+	for (ntx = 0; ntx < q->num_mq_shards; ntx++)
+		active |= htb_mq_shard_demand(q->mq_shards[ntx]);
+
+	for (ntx = 0; ntx < q->num_mq_shards; ntx++)
+		htb_mq_shard_rebalance(q->mq_shards[ntx], ntx, nreal,
+				       ntx == q->num_mq_shards - 1);
+
+	if (active) {
+		WRITE_ONCE(q->mq_idle, 0);
+		schedule_delayed_work(&q->mq_work, HTB_MQ_REBALANCE_INTERVAL);
+	}
+}
+
+/* Shards exist for all tx queues, like the qdiscs of mq. When the number of
+ * real tx queues changes, rates are split again over the new ones right away.
+ */
+static void htb_mq_change_real_num_tx(struct Qdisc *sch,
+				      unsigned int new_real_tx)
+{
+	struct htb_sched *q = qdisc_priv(sch);
+
+	WRITE_ONCE(q->num_mq_real, min(new_real_tx, q->num_mq_shards));
+	WRITE_ONCE(q->mq_idle, 0);
+	mod_delayed_work(system_wq, &q->mq_work, 0);
+}
+
+static void htb_change_real_num_tx(struct Qdisc *sch, unsigned int new_real_tx)
+{
+	struct htb_sched *q = qdisc_priv(sch);
+
+	if (q->mq_shards)
+		htb_mq_change_real_num_tx(sch, new_real_tx);
+}
+
+/* In mq mode, the root only holds configuration and filters: each tx queue
+ * gets a shard, a complete htb with its own lock and a copy of the class
+ * tree, see htb_mq_change_class().
+ */
+static int htb_mq_init(struct Qdisc *sch, struct netlink_ext_ack *extack)
+{
+	struct net_device *dev = qdisc_dev(sch);
+	struct htb_sched *q = qdisc_priv(sch);
+	unsigned int ntx;
+
+	q->num_mq_shards = dev->num_tx_queues;
+	q->num_mq_real = dev->real_num_tx_queues;
+	q->mq_shards = kcalloc(q->num_mq_shards, sizeof(*q->mq_shards),
+			       GFP_KERNEL);
+	if (!q->mq_shards)
+		return -ENOMEM;
+
+	for (ntx = 0; ntx < q->num_mq_shards; ntx++) {
+		struct netdev_queue *dev_queue = netdev_get_tx_queue(dev, ntx);
+		struct htb_sched *shard_q;
+		struct Qdisc *shard;
+
+		shard = qdisc_create_dflt(dev_queue, &htb_mq_shard_qdisc_ops,
+					  TC_H_MAKE(sch->handle, 0), extack);
+		if (!shard)
+			return -ENOMEM;
+
+		htb_set_lockdep_class_child(shard);
+		shard->flags |= TCQ_F_ONETXQUEUE | TCQ_F_NOPARENT;
+
+		shard_q = qdisc_priv(shard);
+		shard_q->mq_root = sch;
+		shard_q->defcls = q->defcls;
+		shard_q->rate2quantum = q->rate2quantum;
+		shard_q->direct_qlen = q->direct_qlen;
+
+		q->mq_shards[ntx] = shard;
+	}
+
+	sch->flags |= TCQ_F_MQROOT;
+
+	return 0;
+}
+
+static int htb_mq_shard_init(struct Qdisc *sch, struct nlattr *opt,
+			     struct netlink_ext_ack *extack)
+{
+	struct htb_sched *q = qdisc_priv(sch);
+
+	qdisc_watchdog_init(&q->watchdog, sch);
+	INIT_WORK(&q->work, htb_work_func);
+	INIT_DELAYED_WORK(&q->mq_work, htb_mq_rebalance_work);
+
+	return qdisc_class_hash_init(&q->clhash);
+}
+
 static int htb_init(struct Qdisc *sch, struct nlattr *opt,
 		    struct netlink_ext_ack *extack)
 {
@@ -1065,6 +1355,7 @@ static int htb_init(struct Qdisc *sch, struct nlattr *opt,
 
 	qdisc_watchdog_init(&q->watchdog, sch);
 	INIT_WORK(&q->work, htb_work_func);
+	INIT_DELAYED_WORK(&q->mq_work, htb_mq_rebalance_work);
 
 	if (!opt)
 		return -EINVAL;
@@ -1119,8 +1410,12 @@ static int htb_init(struct Qdisc *sch, struct nlattr *opt,
 		q->rate2quantum = 1;
 	q->defcls = gopt->defcls;
 
-	if (!offload)
+	if (!offload) {
+		if (htb_mq && sch->parent == TC_H_ROOT &&
+		    netif_is_multiqueue(dev))
+			return htb_mq_init(sch, extack);
 		return 0;
+	}
 
 	for (ntx = 0; ntx < q->num_direct_qdiscs; ntx++) {
 		struct netdev_queue *dev_queue = netdev_get_tx_queue(dev, ntx);
@@ -1197,16 +1492,69 @@ static void htb_attach_software(struct Qdisc *sch)
 	}
 }
 
+static void htb_attach_mq(struct Qdisc *sch)
+{
+	struct net_device *dev = qdisc_dev(sch);
+	struct htb_sched *q = qdisc_priv(sch);
+	unsigned int ntx;
+
+	for (ntx = 0; ntx < q->num_mq_shards; ntx++) {
+		struct Qdisc *old, *shard = q->mq_shards[ntx];
+
+		/* One ref for q->mq_shards, the other for dev_queue->qdisc. */
+		qdisc_refcount_inc(shard);
+		old = dev_graft_qdisc(shard->dev_queue, shard);
+		qdisc_put(old);
+	}
+	for (ntx = q->num_mq_shards; ntx < dev->num_tx_queues; ntx++) {
+		struct netdev_queue *dev_queue = netdev_get_tx_queue(dev, ntx);
+		struct Qdisc *old = dev_graft_qdisc(dev_queue, NULL);
+
+		qdisc_put(old);
+	}
+
+	schedule_delayed_work(&q->mq_work, HTB_MQ_REBALANCE_INTERVAL);
+}
+
 static void htb_attach(struct Qdisc *sch)
 {
 	struct htb_sched *q = qdisc_priv(sch);
 
 	if (q->offload)
 		htb_attach_offload(sch);
+	else if (q->mq_shards)
+		htb_attach_mq(sch);
 	else
 		htb_attach_software(sch);
 }
 
+static void htb_mq_dump_stats(struct Qdisc *sch)
+{
+	struct htb_sched *q = qdisc_priv(sch);
+	unsigned int ntx;
+
+	sch->q.qlen = 0;
+	gnet_stats_basic_sync_init(&sch->bstats);
+	memset(&sch->qstats, 0, sizeof(sch->qstats));
+	q->direct_pkts = 0;
+	q->overlimits = 0;
+
+	for (ntx = 0; ntx < q->num_mq_shards; ntx++) {
+		struct Qdisc *shard = q->mq_shards[ntx];
+		struct htb_sched *shard_q = qdisc_priv(shard);
+
+		spin_lock_bh(qdisc_lock(shard));
+
+		gnet_stats_add_basic(&sch->bstats, NULL, &shard->bstats, false);
+		gnet_stats_add_queue(&sch->qstats, NULL, &shard->qstats);
+		sch->q.qlen += qdisc_qlen(shard);
+		q->direct_pkts += shard_q->direct_pkts;
+		q->overlimits += shard_q->overlimits;
+
+		spin_unlock_bh(qdisc_lock(shard));
+	}
+}
+
 static int htb_dump(struct Qdisc *sch, struct sk_buff *skb)
 {
 	struct htb_sched *q = qdisc_priv(sch);
@@ -1218,6 +1566,9 @@ static int htb_dump(struct Qdisc *sch, struct sk_buff *skb)
 	else
 		sch->flags &= ~TCQ_F_OFFLOADED;
 
+	if (q->mq_shards)
+		htb_mq_dump_stats(sch);
+
 	sch->qstats.overlimits = q->overlimits;
 	/* Its safe to not acquire qdisc lock. As we hold RTNL,
 	 * no change can happen on the qdisc parameters.
@@ -1324,6 +1675,43 @@ static void htb_offload_aggregate_stats(struct htb_sched *q,
 	_bstats_update(&cl->bstats, bytes, packets);
 }
 
+static void htb_mq_aggregate_stats(struct htb_sched *q, struct htb_class *cl,
+				   struct gnet_stats_queue *qs, __u32 *qlen)
+{
+	u64 bytes = 0, packets = 0;
+	unsigned int ntx;
+
+	memset(&cl->xstats, 0, sizeof(cl->xstats));
+
+	for (ntx = 0; ntx < q->num_mq_shards; ntx++) {
+		struct Qdisc *shard = q->mq_shards[ntx];
+		struct htb_class *c = htb_find(cl->common.classid, shard);
+		__u32 c_qlen = 0, c_backlog = 0;
+
+		if (!c)
+			continue;
+
+		spin_lock_bh(qdisc_lock(shard));
+
+		bytes += u64_stats_read(&c->bstats.bytes);
+		packets += u64_stats_read(&c->bstats.packets);
+		qs->drops += c->drops;
+		qs->overlimits += c->overlimits;
+		cl->xstats.lends += c->xstats.lends;
+		cl->xstats.borrows += c->xstats.borrows;
+		cl->xstats.giants += c->xstats.giants;
+		if (!c->level && c->leaf.q)
+			qdisc_qstats_qlen_backlog(c->leaf.q, &c_qlen, &c_backlog);
+		*qlen += c_qlen;
+		qs->backlog += c_backlog;
+
+		spin_unlock_bh(qdisc_lock(shard));
+	}
+
+	gnet_stats_basic_sync_init(&cl->bstats);
+	_bstats_update(&cl->bstats, bytes, packets);
+}
+
 static int
 htb_dump_class_stats(struct Qdisc *sch, unsigned long arg, struct gnet_dump *d)
 {
@@ -1343,6 +1731,9 @@ htb_dump_class_stats(struct Qdisc *sch, unsigned long arg, struct gnet_dump *d)
 	cl->xstats.ctokens = clamp_t(s64, PSCHED_NS2TICKS(cl->ctokens),
 				     INT_MIN, INT_MAX);
 
+	if (q->mq_shards)
+		htb_mq_aggregate_stats(q, cl, &qs, &qlen);
+
 	if (q->offload) {
 		if (!cl->level) {
 			if (cl->leaf.q)
@@ -1457,6 +1848,11 @@ static int htb_graft(struct Qdisc *sch, unsigned long arg, struct Qdisc *new,
 	if (cl->level)
 		return -EINVAL;
 
+	if (q->mq_shards) {
+		NL_SET_ERR_MSG(extack, "HTB mq mode doesn't support grafting leaf qdiscs");
+		return -EOPNOTSUPP;
+	}
+
 	if (q->offload)
 		dev_queue = htb_offload_get_queue(cl);
 
@@ -1497,6 +1893,38 @@ static void htb_qlen_notify(struct Qdisc *sch, unsigned long arg)
 	htb_deactivate(qdisc_priv(sch), cl);
 }
 
+/* Leaves of mq shards are not linked to them by handle, as they share it with
+ * the leaves of the root: account for purged packets here instead of through
+ * qdisc_tree_reduce_backlog().
+ */
+static void htb_purge_leaf(struct Qdisc *sch, struct Qdisc *leaf)
+{
+	struct htb_sched *q = qdisc_priv(sch);
+
+	if (!q->mq_root) {
+		qdisc_purge_queue(leaf);
+		return;
+	}
+
+	sch->q.qlen -= leaf->q.qlen;
+	sch->qstats.backlog -= leaf->qstats.backlog;
+	qdisc_reset(leaf);
+}
+
+static struct Qdisc *htb_leaf_create(struct Qdisc *sch,
+				     struct netdev_queue *dev_queue,
+				     u32 classid)
+{
+	struct htb_sched *q = qdisc_priv(sch);
+	struct Qdisc *leaf;
+
+	leaf = qdisc_create_dflt(dev_queue, &pfifo_qdisc_ops, classid, NULL);
+	if (leaf && q->mq_root)
+		leaf->flags |= TCQ_F_NOPARENT;
+
+	return leaf;
+}
+
 static inline int htb_parent_last_child(struct htb_class *cl)
 {
 	if (!cl->parent)
@@ -1629,6 +2057,9 @@ static void htb_destroy(struct Qdisc *sch)
 	unsigned int i;
 
 	cancel_work_sync(&q->work);
+	/* Keep enqueues to shards from restarting it, see htb_mq_kick() */
+	WRITE_ONCE(q->mq_idle, 0);
+	cancel_delayed_work_sync(&q->mq_work);
 	qdisc_watchdog_cancel(&q->watchdog);
 	/* This line used to be after htb_destroy_class call below
 	 * and surprisingly it worked in 2.4. But it must precede it
@@ -1689,6 +2120,12 @@ static void htb_destroy(struct Qdisc *sch)
 		htb_offload(dev, &offload_opt);
 	}
 
+	if (q->mq_shards) {
+		for (i = 0; i < q->num_mq_shards && q->mq_shards[i]; i++)
+			qdisc_put(q->mq_shards[i]);
+		kfree(q->mq_shards);
+	}
+
 	if (!q->direct_qdiscs)
 		return;
 	for (i = 0; i < q->num_direct_qdiscs && q->direct_qdiscs[i]; i++)
@@ -1703,6 +2140,7 @@ static int htb_delete(struct Qdisc *sch, unsigned long arg,
 	struct htb_class *cl = (struct htb_class *)arg;
 	struct Qdisc *new_q = NULL;
 	int last_child = 0;
+	unsigned int ntx;
 	int err;
 
 	/* TODO: why don't allow to delete subtree ? references ? does
@@ -1714,6 +2152,15 @@ static int htb_delete(struct Qdisc *sch, unsigned long arg,
 		return -EBUSY;
 	}
 
+	/* Copies of the class in shards go first, see htb_mq_change_class() */
+	for (ntx = 0; ntx < q->num_mq_shards; ntx++) {
+		struct Qdisc *shard = q->mq_shards[ntx];
+		struct htb_class *shard_cl = htb_find(cl->common.classid, shard);
+
+		if (shard_cl)
+			htb_delete(shard, (unsigned long)shard_cl, NULL);
+	}
+
 	if (!cl->level && htb_parent_last_child(cl))
 		last_child = 1;
 
@@ -1730,9 +2177,8 @@ static int htb_delete(struct Qdisc *sch, unsigned long arg,
 		if (q->offload)
 			dev_queue = htb_offload_get_queue(cl);
 
-		new_q = qdisc_create_dflt(dev_queue, &pfifo_qdisc_ops,
-					  cl->parent->common.classid,
-					  NULL);
+		new_q = htb_leaf_create(sch, dev_queue,
+					cl->parent->common.classid);
 		if (q->offload) {
 			if (new_q)
 				htb_set_lockdep_class_child(new_q);
@@ -1743,7 +2189,7 @@ static int htb_delete(struct Qdisc *sch, unsigned long arg,
 	sch_tree_lock(sch);
 
 	if (!cl->level)
-		qdisc_purge_queue(cl->leaf.q);
+		htb_purge_leaf(sch, cl->leaf.q);
 
 	/* delete from hash and active; remainder in destroy_class */
 	qdisc_class_hash_remove(&q->clhash, &cl->common);
@@ -1766,9 +2212,9 @@ static int htb_delete(struct Qdisc *sch, unsigned long arg,
 	return 0;
 }
 
-static int htb_change_class(struct Qdisc *sch, u32 classid,
-			    u32 parentid, struct nlattr **tca,
-			    unsigned long *arg, struct netlink_ext_ack *extack)
+static int __htb_change_class(struct Qdisc *sch, u32 classid,
+			      u32 parentid, struct nlattr **tca,
+			      unsigned long *arg, struct netlink_ext_ack *extack)
 {
 	int err = -EINVAL;
 	struct htb_sched *q = qdisc_priv(sch);
@@ -1944,8 +2390,7 @@ static int htb_change_class(struct Qdisc *sch, u32 classid,
 				       u64_stats_read(&old_q->bstats.packets));
 			qdisc_put(old_q);
 		}
-		new_q = qdisc_create_dflt(dev_queue, &pfifo_qdisc_ops,
-					  classid, NULL);
+		new_q = htb_leaf_create(sch, dev_queue, classid);
 		if (q->offload) {
 			if (new_q) {
 				htb_set_lockdep_class_child(new_q);
@@ -1961,7 +2406,7 @@ static int htb_change_class(struct Qdisc *sch, u32 classid,
 		sch_tree_lock(sch);
 		if (parent && !parent->level) {
 			/* turn parent into inner node */
-			qdisc_purge_queue(parent->leaf.q);
+			htb_purge_leaf(sch, parent->leaf.q);
 			parent_qdisc = parent->leaf.q;
 			if (parent->prio_activity)
 				htb_deactivate(q, parent);
@@ -1994,7 +2439,7 @@ static int htb_change_class(struct Qdisc *sch, u32 classid,
 		qdisc_class_hash_insert(&q->clhash, &cl->common);
 		if (parent)
 			parent->children++;
-		if (cl->leaf.q != &noop_qdisc)
+		if (cl->leaf.q != &noop_qdisc && !q->mq_root)
 			qdisc_hash_add(cl->leaf.q, true);
 	} else {
 		if (tca[TCA_RATE]) {
@@ -2084,6 +2529,63 @@ static int htb_change_class(struct Qdisc *sch, u32 classid,
 	return err;
 }
 
+/* Create or change the copy of class cl of the root in each shard */
+static int htb_mq_change_class(struct Qdisc *sch, struct htb_class *cl,
+			       u32 parentid, struct nlattr **tca)
+{
+	struct htb_sched *q = qdisc_priv(sch);
+	unsigned int ntx;
+	int err;
+
+	for (ntx = 0; ntx < q->num_mq_shards; ntx++) {
+		struct Qdisc *shard = q->mq_shards[ntx];
+		struct htb_class *shard_cl;
+		unsigned long arg;
+
+		arg = (unsigned long)htb_find(cl->common.classid, shard);
+		err = __htb_change_class(shard, cl->common.classid, parentid,
+					 tca, &arg, NULL);
+		if (err)
+			return err;
+
+		shard_cl = (struct htb_class *)arg;
+
+		sch_tree_lock(shard);
+		if (!shard_cl->mq_root_cl) {
+			shard_cl->mq_root_cl = cl;
+			shard_cl->mq_share = ntx < q->num_mq_real ?
+				(1 << HTB_MQ_SHARE_SHIFT) / q->num_mq_real : 1;
+		}
+		htb_mq_apply_share(shard_cl);
+		sch_tree_unlock(shard);
+	}
+
+	return 0;
+}
+
+static int htb_change_class(struct Qdisc *sch, u32 classid,
+			    u32 parentid, struct nlattr **tca,
+			    unsigned long *arg, struct netlink_ext_ack *extack)
+{
+	struct htb_sched *q = qdisc_priv(sch);
+	bool create = !*arg;
+	int err;
+
+	err = __htb_change_class(sch, classid, parentid, tca, arg, extack);
+	if (err || !q->mq_shards)
+		return err;
+
+	err = htb_mq_change_class(sch, (struct htb_class *)*arg, parentid,
+				  tca);
+	if (err) {
+		NL_SET_ERR_MSG(extack, "Failed to update HTB class in all shards");
+		if (create)
+			htb_delete(sch, *arg, NULL);
+	}
+
+	return err;
+}
+
 static struct tcf_block *htb_tcf_block(struct Qdisc *sch, unsigned long arg,
 				       struct netlink_ext_ack *extack)
 {
@@ -2152,6 +2654,19 @@ static const struct Qdisc_class_ops htb_class_ops = {
 	.dump_stats	=	htb_dump_class_stats,
 };
 
+/* Shards are only created by an mq root, see htb_mq_init() */
+static struct Qdisc_ops htb_mq_shard_qdisc_ops __read_mostly = {
+	.id		=	"htb_shard",
+	.priv_size	=	sizeof(struct htb_sched),
+	.enqueue	=	htb_enqueue,
+	.dequeue	=	htb_dequeue,
+	.peek		=	qdisc_peek_dequeued,
+	.init		=	htb_mq_shard_init,
+	.reset		=	htb_reset,
+	.destroy	=	htb_destroy,
+	.owner		=	THIS_MODULE,
+};
+
 static struct Qdisc_ops htb_qdisc_ops __read_mostly = {
 	.cl_ops		=	&htb_class_ops,
 	.id		=	"htb",
@@ -2161,6 +2676,7 @@ static struct Qdisc_ops htb_qdisc_ops __read_mostly = {
 	.peek		=	qdisc_peek_dequeued,
 	.init		=	htb_init,
 	.attach		=	htb_attach,
+	.change_real_num_tx =	htb_change_real_num_tx,
 	.reset		=	htb_reset,
 	.destroy	=	htb_destroy,
 	.dump		=	htb_dump,
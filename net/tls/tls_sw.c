@@ -48,6 +48,11 @@
 
 #include "tls.h"
 
+static unsigned int tls_sw_async_depth __read_mostly = 32;
+module_param_named(async_depth, tls_sw_async_depth, uint, 0644);
+MODULE_PARM_DESC(async_depth,
+		 "Records in flight to async crypto before sendmsg/recvmsg reap them (0: no limit)");
+
 struct tls_decrypt_arg {
 	struct_group(inargs,
 	bool zc;
@@ -530,6 +535,26 @@ static int tls_encrypt_async_wait(struct tls_sw_context_tx *ctx)
 	return ctx->async_wait.err;
 }
 
+/* Wait for the records in flight and transmit them right away, rather
+ * than leaving that to tx_work.
+ */
+static int tls_encrypt_async_reap(struct sock *sk,
+				  struct tls_sw_context_tx *ctx, int flags)
+{
+	int err;
+
+	err = tls_encrypt_async_wait(ctx);
+	if (err)
+		return err;
+
+	if (test_and_clear_bit(BIT_TX_SCHEDULED, &ctx->tx_bitmask)) {
+		cancel_delayed_work(&ctx->tx_work.work);
+		tls_tx_records(sk, flags);
+	}
+
+	return 0;
+}
+
 static int tls_do_encryption(struct sock *sk,
 			     struct tls_context *tls_ctx,
 			     struct tls_sw_context_tx *ctx,
@@ -1018,6 +1043,7 @@ static int tls_sw_sendmsg_locked(struct sock *sk, struct msghdr *msg,
 	struct sk_msg *msg_pl, *msg_en;
 	struct tls_rec *rec;
 	int required_size;
+	unsigned int async_depth;
 	int num_async = 0;
 	bool full_record;
 	int record_room;
@@ -1038,12 +1064,24 @@ static int tls_sw_sendmsg_locked(struct sock *sk, struct msghdr *msg,
 		}
 	}
 
+	async_depth = READ_ONCE(tls_sw_async_depth);
+
 	while (msg_data_left(msg)) {
 		if (sk->sk_err) {
 			ret = -sk->sk_err;
 			goto send_end;
 		}
 
+		if (async_depth && num_async >= async_depth) {
+			ret = tls_encrypt_async_reap(sk, ctx, msg->msg_flags);
+			if (ret) {
+				if (num_zc)
+					copied = 0;
+				goto send_end;
+			}
+			num_async = 0;
+		}
+
 		if (ctx->open_rec)
 			rec = ctx->open_rec;
 		else
@@ -1964,7 +2002,9 @@ int tls_sw_recvmsg(struct sock *sk,
 	struct tls_msg *tlm;
 	ssize_t copied = 0;
 	ssize_t peeked = 0;
+	unsigned int async_depth;
 	bool async = false;
+	int num_async = 0;
 	int target, err;
 	bool is_kvec = iov_iter_is_kvec(&msg->msg_iter);
 	bool is_peek = flags & MSG_PEEK;
@@ -2001,11 +2041,34 @@ int tls_sw_recvmsg(struct sock *sk,
 
 	zc_capable = !bpf_strp_enabled && !is_kvec && !is_peek &&
 		ctx->zc_capable;
+	/* Peeked records have to stay on rx_list until the end */
+	async_depth = is_peek ? 0 : READ_ONCE(tls_sw_async_depth);
 	decrypted = 0;
 	while (len && (decrypted + copied < target || tls_strp_msg_ready(ctx))) {
 		struct tls_decrypt_arg darg;
 		int to_decrypt, chunk;
 
+		/* Reap the records in flight, and copy them out while they
+		 * are still cache hot.
+		 */
+		if (async_depth && num_async >= async_depth) {
+			err = tls_decrypt_async_wait(ctx);
+			__skb_queue_purge(&ctx->async_hold);
+			if (err)
+				goto recv_end;
+
+			err = process_rx_list(ctx, msg, &control, 0,
+					      async_copy_bytes, false, NULL);
+			decrypted += max(err, 0) - async_copy_bytes;
+			if (err < async_copy_bytes) {
+				copied += decrypted;
+				goto end;
+			}
+
+			async_copy_bytes = 0;
+			num_async = 0;
+		}
+
 		err = tls_rx_rec_wait(sk, psock, flags & MSG_DONTWAIT,
 				      released);
 		if (err <= 0) {
@@ -2045,6 +2108,7 @@ int tls_sw_recvmsg(struct sock *sk,
 		}
 
 		async |= darg.async;
+		num_async += darg.async;
 
 		/* If the type of records being processed is not known yet,
 		 * set it to record type just dequeued. If it is already known,
@@ -103,265 +103,522 @@ struct unix_sock *unix_get_socket(struct file *filp)
 
 DEFINE_SPINLOCK(unix_gc_lock);
 unsigned int unix_tot_inflight;
-static LIST_HEAD(gc_candidates);
-static LIST_HEAD(gc_inflight_list);
 
-/* Keep the number of times in flight count for the file
- * descriptor if it is for an AF_UNIX socket.
+/* In-flight AF_UNIX sockets form a directed graph: each socket with at
+ * least one file reference queued in some receive queue is a vertex, and
+ * each such reference is an edge from that socket to the receiver (or to
+ * the listener, for a not yet accepted embryo).  A group of sockets can
+ * only leak if it is a strongly connected component (SCC) of that graph
+ * none of whose members is referenced from anywhere else.
+ *
+ * SCCs found by a run are cached as rings through unix_vertex.scc_entry.
+ * Between runs, a vertex whose edges may have changed the SCC layout is
+ * moved to unix_dirty_vertices: the predecessor of an edge added towards a
+ * vertex, and the whole SCC when an edge inside it is removed.  A run only
+ * walks the vertices reachable from the dirty ones, every other ring is
+ * still exact and just checked for dead members.
  */
-void unix_inflight(struct user_struct *user, struct file *filp)
+static LIST_HEAD(unix_dirty_vertices);
+static LIST_HEAD(unix_cyclic_vertices);
+static LIST_HEAD(unix_acyclic_vertices);
+static unsigned long unix_vertex_next_index = 1;
+static unsigned long unix_walk_start;
+static bool unix_graph_maybe_cyclic;
+
+static struct unix_vertex *unix_edge_successor(struct unix_edge *edge)
 {
-	struct unix_sock *u = unix_get_socket(filp);
+	struct unix_sock *receiver = edge->successor;
+	struct unix_vertex *vertex;
+	struct sock *listener;
 
-	spin_lock(&unix_gc_lock);
+	/* The receiver was collected along with a dead SCC. */
+	if (!receiver)
+		return NULL;
 
-	if (u) {
-		if (!u->inflight) {
-			WARN_ON_ONCE(!list_empty(&u->link));
-			list_add_tail(&u->link, &gc_inflight_list);
-		} else {
-			WARN_ON_ONCE(list_empty(&u->link));
-		}
-		u->inflight++;
+	listener = READ_ONCE(receiver->listener);
+	if (listener)
+		receiver = unix_sk(listener);
+
+	vertex = READ_ONCE(receiver->vertex);
+	if (!vertex || !vertex->out_degree)
+		return NULL;
+
+	return vertex;
+}
+
+static struct unix_sock *unix_vertex_sock(struct unix_vertex *vertex)
+{
+	struct unix_edge *edge;
 
-		/* Paired with READ_ONCE() in wait_for_unix_gc() */
-		WRITE_ONCE(unix_tot_inflight, unix_tot_inflight + 1);
+	edge = list_first_entry(&vertex->edges, typeof(*edge), vertex_entry);
+
+	return edge->predecessor;
+}
+
+static void unix_dirty_scc(struct unix_vertex *vertex)
+{
+	struct unix_vertex *v = vertex;
+
+	do {
+		list_move_tail(&v->entry, &unix_dirty_vertices);
+		v = list_next_entry(v, scc_entry);
+	} while (v != vertex);
+}
+
+/* Allocate a vertex for each AF_UNIX socket in @fpl which has none yet,
+ * and the edges @fpl will need once queued.
+ */
+int unix_prepare_fpl(struct scm_fp_list *fpl, struct unix_edge **edges)
+{
+	struct unix_vertex *vertex;
+	struct unix_sock *u;
+	int i;
+
+	*edges = NULL;
+
+	if (!fpl->count_unix)
+		return 0;
+
+	for (i = 0; i < fpl->count; i++) {
+		u = unix_get_socket(fpl->fp[i]);
+		if (!u || READ_ONCE(u->vertex))
+			continue;
+
+		vertex = kmalloc(sizeof(*vertex), GFP_KERNEL_ACCOUNT);
+		if (!vertex)
+			return -ENOMEM;
+
+		INIT_LIST_HEAD(&vertex->edges);
+		INIT_LIST_HEAD(&vertex->entry);
+		INIT_LIST_HEAD(&vertex->scc_entry);
+		vertex->out_degree = 0;
+		vertex->index = 0;
+		vertex->scc_index = 0;
+		vertex->on_stack = false;
+
+		if (cmpxchg(&u->vertex, NULL, vertex))
+			kfree(vertex);
 	}
 
-	WRITE_ONCE(user->unix_inflight, user->unix_inflight + 1);
+	*edges = kvcalloc(fpl->count_unix, sizeof(**edges), GFP_KERNEL_ACCOUNT);
+	if (!*edges)
+		return -ENOMEM;
 
-	spin_unlock(&unix_gc_lock);
+	return 0;
 }
 
-void unix_notinflight(struct user_struct *user, struct file *filp)
+/* Called once the skb carrying @fpl is queued to @receiver. */
+void unix_add_edges(struct scm_fp_list *fpl, struct unix_edge *edges,
+		    struct unix_sock *receiver)
 {
-	struct unix_sock *u = unix_get_socket(filp);
+	struct unix_vertex *vertex;
+	struct unix_edge *edge;
+	int i, j = 0;
+
+	if (!edges)
+		return;
 
 	spin_lock(&unix_gc_lock);
 
-	if (u) {
-		WARN_ON_ONCE(!u->inflight);
-		WARN_ON_ONCE(list_empty(&u->link));
+	for (i = 0; i < fpl->count; i++) {
+		struct unix_sock *u = unix_get_socket(fpl->fp[i]);
+
+		if (!u)
+			continue;
 
-		u->inflight--;
-		if (!u->inflight)
-			list_del_init(&u->link);
+		edge = &edges[j++];
+		edge->predecessor = u;
+		edge->successor = receiver;
+
+		vertex = u->vertex;
+		if (!vertex->out_degree++) {
+			vertex->index = unix_vertex_next_index++;
+			vertex->scc_index = vertex->index;
+			list_add_tail(&vertex->entry, &unix_acyclic_vertices);
+		}
 
-		/* Paired with READ_ONCE() in wait_for_unix_gc() */
-		WRITE_ONCE(unix_tot_inflight, unix_tot_inflight - 1);
+		list_add_tail(&edge->vertex_entry, &vertex->edges);
 	}
 
-	WRITE_ONCE(user->unix_inflight, user->unix_inflight - 1);
+	/* An edge towards a socket which is not in flight cannot close a
+	 * cycle: if that socket is sent later, it becomes dirty itself.
+	 */
+	for (i = 0; i < j; i++) {
+		edge = &edges[i];
+
+		if (!unix_edge_successor(edge))
+			continue;
+
+		list_move_tail(&edge->predecessor->vertex->entry,
+			       &unix_dirty_vertices);
+		WRITE_ONCE(unix_graph_maybe_cyclic, true);
+	}
 
 	spin_unlock(&unix_gc_lock);
 }
 
-static void scan_inflight(struct sock *x, void (*func)(struct unix_sock *),
-			  struct sk_buff_head *hitlist)
+static void unix_del_edges(struct scm_fp_list *fpl, struct unix_edge *edges)
 {
-	struct sk_buff *skb;
-	struct sk_buff *next;
-
-	spin_lock(&x->sk_receive_queue.lock);
-	skb_queue_walk_safe(&x->sk_receive_queue, skb, next) {
-		/* Do we have file descriptors ? */
-		if (UNIXCB(skb).fp) {
-			bool hit = false;
-			/* Process the descriptors of this socket */
-			int nfd = UNIXCB(skb).fp->count;
-			struct file **fp = UNIXCB(skb).fp->fp;
-
-			while (nfd--) {
-				/* Get the socket the fd matches if it indeed does so */
-				struct unix_sock *u = unix_get_socket(*fp++);
-
-				/* Ignore non-candidates, they could have been added
-				 * to the queues after starting the garbage collection
-				 */
-				if (u && test_bit(UNIX_GC_CANDIDATE, &u->gc_flags)) {
-					hit = true;
-
-					func(u);
-				}
-			}
-			if (hit && hitlist != NULL) {
-				__skb_unlink(skb, &x->sk_receive_queue);
-				__skb_queue_tail(hitlist, skb);
-			}
+	struct unix_vertex *vertex, *next;
+	struct unix_edge *edge;
+	int i;
+
+	for (i = 0; i < fpl->count_unix; i++) {
+		edge = &edges[i];
+		vertex = edge->predecessor->vertex;
+
+		/* Removing an edge can only split the SCC it is part of. */
+		next = unix_edge_successor(edge);
+		if (next && next->scc_index == vertex->scc_index)
+			unix_dirty_scc(vertex);
+
+		list_del(&edge->vertex_entry);
+
+		if (!--vertex->out_degree) {
+			list_del_init(&vertex->entry);
+			list_del_init(&vertex->scc_entry);
 		}
 	}
-	spin_unlock(&x->sk_receive_queue.lock);
 }
 
-static void scan_children(struct sock *x, void (*func)(struct unix_sock *),
-			  struct sk_buff_head *hitlist)
+/* @receiver is being accepted or its listener is going away: edges
+ * towards it no longer lead to the listener.
+ */
+void unix_update_edges(struct unix_sock *receiver)
 {
-	if (x->sk_state != TCP_LISTEN) {
-		scan_inflight(x, func, hitlist);
-	} else {
-		struct sk_buff *skb;
-		struct sk_buff *next;
-		struct unix_sock *u;
-		LIST_HEAD(embryos);
-
-		/* For a listening socket collect the queued embryos
-		 * and perform a scan on them as well.
-		 */
-		spin_lock(&x->sk_receive_queue.lock);
-		skb_queue_walk_safe(&x->sk_receive_queue, skb, next) {
-			u = unix_sk(skb->sk);
-
-			/* An embryo cannot be in-flight, so it's safe
-			 * to use the list link.
-			 */
-			WARN_ON_ONCE(!list_empty(&u->link));
-			list_add_tail(&u->link, &embryos);
-		}
-		spin_unlock(&x->sk_receive_queue.lock);
+	struct unix_vertex *vertex;
 
-		while (!list_empty(&embryos)) {
-			u = list_entry(embryos.next, struct unix_sock, link);
-			scan_inflight(&u->sk, func, hitlist);
-			list_del_init(&u->link);
-		}
+	/* nr_fds is updated before edges are added, and an embryo cannot be
+	 * read from, so no edge can lead to it if this is zero.
+	 */
+	if (!atomic_read(&receiver->scm_stat.nr_fds)) {
+		WRITE_ONCE(receiver->listener, NULL);
+		return;
 	}
+
+	spin_lock(&unix_gc_lock);
+
+	vertex = READ_ONCE(unix_sk(receiver->listener)->vertex);
+	if (vertex && vertex->out_degree)
+		unix_dirty_scc(vertex);
+
+	WRITE_ONCE(receiver->listener, NULL);
+
+	spin_unlock(&unix_gc_lock);
 }
 
-static void dec_inflight(struct unix_sock *usk)
+/* Keep the number of times in flight count for the file
+ * descriptors, and the number of AF_UNIX sockets among them.
+ */
+void unix_inflight(struct scm_fp_list *fpl)
 {
-	usk->inflight--;
+	spin_lock(&unix_gc_lock);
+
+	/* Paired with READ_ONCE() in wait_for_unix_gc() */
+	WRITE_ONCE(unix_tot_inflight, unix_tot_inflight + fpl->count_unix);
+	WRITE_ONCE(fpl->user->unix_inflight,
+		   fpl->user->unix_inflight + fpl->count);
+
+	spin_unlock(&unix_gc_lock);
 }
 
-static void inc_inflight(struct unix_sock *usk)
+void unix_notinflight(struct scm_fp_list *fpl, struct unix_edge *edges)
 {
-	usk->inflight++;
+	spin_lock(&unix_gc_lock);
+
+	/* Edges are only added once the skb is queued. */
+	if (edges && edges[0].predecessor)
+		unix_del_edges(fpl, edges);
+
+	/* Paired with READ_ONCE() in wait_for_unix_gc() */
+	WRITE_ONCE(unix_tot_inflight, unix_tot_inflight - fpl->count_unix);
+	WRITE_ONCE(fpl->user->unix_inflight,
+		   fpl->user->unix_inflight - fpl->count);
+
+	spin_unlock(&unix_gc_lock);
+
+	kvfree(edges);
 }
 
-static void inc_inflight_move_tail(struct unix_sock *u)
+/* A vertex is dead if all its references come from in-flight skbs queued
+ * to members of its own SCC.
+ */
+static bool unix_vertex_dead(struct unix_vertex *vertex)
 {
-	u->inflight++;
+	struct unix_vertex *next;
+	struct unix_edge *edge;
+	struct unix_sock *u;
+
+	list_for_each_entry(edge, &vertex->edges, vertex_entry) {
+		next = unix_edge_successor(edge);
+		if (!next || next->scc_index != vertex->scc_index)
+			return false;
+	}
 
-	/* If this still might be part of a cycle, move it to the end
-	 * of the list, so that it's checked even if it was already
-	 * passed over
-	 */
-	if (test_bit(UNIX_GC_MAYBE_CYCLE, &u->gc_flags))
-		list_move_tail(&u->link, &gc_candidates);
+	u = unix_vertex_sock(vertex);
+
+	return file_count(u->sk.sk_socket->file) == vertex->out_degree;
 }
 
-static bool gc_in_progress;
+static bool unix_scc_dead(struct list_head *scc)
+{
+	struct unix_vertex *vertex;
 
-static void __unix_gc(struct work_struct *work)
+	list_for_each_entry(vertex, scc, scc_entry) {
+		if (!unix_vertex_dead(vertex))
+			return false;
+	}
+
+	return true;
+}
+
+static bool unix_scc_cyclic(struct list_head *scc)
 {
-	struct sk_buff_head hitlist;
-	struct unix_sock *u, *next;
-	LIST_HEAD(not_cycle_list);
-	struct list_head cursor;
+	struct unix_vertex *vertex;
+	struct unix_edge *edge;
 
-	spin_lock(&unix_gc_lock);
+	if (!list_is_singular(scc))
+		return true;
 
-	/* First, select candidates for garbage collection.  Only
-	 * in-flight sockets are considered, and from those only ones
-	 * which don't have any external reference.
-	 *
-	 * Holding unix_gc_lock will protect these candidates from
-	 * being detached, and hence from gaining an external
-	 * reference.  Since there are no possible receivers, all
-	 * buffers currently on the candidates' queues stay there
-	 * during the garbage collection.
-	 *
-	 * We also know that no new candidate can be added onto the
-	 * receive queues.  Other, non candidate sockets _can_ be
-	 * added to queue, so we must make sure only to touch
-	 * candidates.
-	 */
-	list_for_each_entry_safe(u, next, &gc_inflight_list, link) {
-		long total_refs;
+	vertex = list_first_entry(scc, typeof(*vertex), scc_entry);
 
-		total_refs = file_count(u->sk.sk_socket->file);
+	list_for_each_entry(edge, &vertex->edges, vertex_entry) {
+		if (unix_edge_successor(edge) == vertex)
+			return true;
+	}
 
-		WARN_ON_ONCE(!u->inflight);
-		WARN_ON_ONCE(total_refs < u->inflight);
-		if (total_refs == u->inflight) {
-			list_move_tail(&u->link, &gc_candidates);
-			__set_bit(UNIX_GC_CANDIDATE, &u->gc_flags);
-			__set_bit(UNIX_GC_MAYBE_CYCLE, &u->gc_flags);
-		}
+	return false;
+}
+
+static void unix_collect_oob(struct unix_sock *u)
+{
+#if IS_ENABLED(CONFIG_AF_UNIX_OOB)
+	if (u->oob_skb) {
+		kfree_skb(u->oob_skb);
+		u->oob_skb = NULL;
 	}
+#endif
+}
 
-	/* Now remove all internal in-flight reference to children of
-	 * the candidates.
-	 */
-	list_for_each_entry(u, &gc_candidates, link)
-		scan_children(&u->sk, dec_inflight, NULL);
+/* Nobody can receive from a dead SCC anymore, so its queues are stable. */
+static void unix_collect_skb(struct list_head *scc, struct sk_buff_head *hitlist)
+{
+	struct unix_vertex *vertex;
 
-	/* Restore the references for children of all candidates,
-	 * which have remaining references.  Do this recursively, so
-	 * only those remain, which form cyclic references.
-	 *
-	 * Use a "cursor" link, to make the list traversal safe, even
-	 * though elements might be moved about.
-	 */
-	list_add(&cursor, &gc_candidates);
-	while (cursor.next != &gc_candidates) {
-		u = list_entry(cursor.next, struct unix_sock, link);
+	list_for_each_entry(vertex, scc, scc_entry) {
+		struct unix_sock *u = unix_vertex_sock(vertex);
+		struct sk_buff_head *queue = &u->sk.sk_receive_queue;
 
-		/* Move cursor to after the current position. */
-		list_move(&cursor, &u->link);
+		spin_lock(&queue->lock);
 
-		if (u->inflight) {
-			list_move_tail(&u->link, &not_cycle_list);
-			__clear_bit(UNIX_GC_MAYBE_CYCLE, &u->gc_flags);
-			scan_children(&u->sk, inc_inflight_move_tail, NULL);
+		if (u->sk.sk_state == TCP_LISTEN) {
+			struct sk_buff *skb;
+
+			skb_queue_walk(queue, skb) {
+				struct sk_buff_head *embryo_queue = &skb->sk->sk_receive_queue;
+
+				spin_lock_nested(&embryo_queue->lock,
+						 SINGLE_DEPTH_NESTING);
+				skb_queue_splice_init(embryo_queue, hitlist);
+				unix_collect_oob(unix_sk(skb->sk));
+				spin_unlock(&embryo_queue->lock);
+			}
+		} else {
+			skb_queue_splice_init(queue, hitlist);
+			unix_collect_oob(u);
 		}
+
+		spin_unlock(&queue->lock);
 	}
-	list_del(&cursor);
+}
 
-	/* Now gc_candidates contains only garbage.  Restore original
-	 * inflight counters for these as well, and remove the skbuffs
-	 * which are creating the cycle(s).
-	 */
-	skb_queue_head_init(&hitlist);
-	list_for_each_entry(u, &gc_candidates, link) {
-		scan_children(&u->sk, inc_inflight, &hitlist);
+/* Pop the SCC rooted at @vertex off @vertex_stack and leave it as a ring. */
+static void unix_group_scc(struct unix_vertex *vertex,
+			   struct list_head *vertex_stack,
+			   struct list_head *cyclic,
+			   struct sk_buff_head *hitlist)
+{
+	struct unix_vertex *v;
+	LIST_HEAD(scc);
 
-#if IS_ENABLED(CONFIG_AF_UNIX_OOB)
-		if (u->oob_skb) {
-			kfree_skb(u->oob_skb);
-			u->oob_skb = NULL;
+	list_cut_position(&scc, vertex_stack, &vertex->scc_entry);
+
+	list_for_each_entry(v, &scc, scc_entry) {
+		v->on_stack = false;
+		v->scc_index = vertex->index;
+	}
+
+	if (unix_scc_cyclic(&scc)) {
+		list_for_each_entry(v, &scc, scc_entry)
+			list_move_tail(&v->entry, cyclic);
+
+		if (unix_scc_dead(&scc))
+			unix_collect_skb(&scc, hitlist);
+	} else {
+		list_move_tail(&vertex->entry, &unix_acyclic_vertices);
+	}
+
+	list_del(&scc);
+}
+
+/* Tarjan's algorithm over the vertices not yet visited by this run. */
+static void __unix_walk_scc(struct unix_vertex *vertex,
+			    struct list_head *cyclic,
+			    struct sk_buff_head *hitlist)
+{
+	LIST_HEAD(vertex_stack);
+	struct unix_edge *edge;
+	LIST_HEAD(edge_stack);
+
+next_vertex:
+	vertex->index = unix_vertex_next_index++;
+	vertex->scc_index = vertex->index;
+
+	/* Leave the ring of the SCC found by an earlier run. */
+	list_del(&vertex->scc_entry);
+	list_add(&vertex->scc_entry, &vertex_stack);
+	vertex->on_stack = true;
+
+	list_for_each_entry(edge, &vertex->edges, vertex_entry) {
+		struct unix_vertex *next_vertex = unix_edge_successor(edge);
+
+		if (!next_vertex)
+			continue;
+
+		if (next_vertex->index < unix_walk_start) {
+			/* Iterative deepening depth first search */
+			list_add(&edge->stack_entry, &edge_stack);
+
+			vertex = next_vertex;
+			goto next_vertex;
+prev_vertex:
+			edge = list_first_entry(&edge_stack, typeof(*edge),
+						stack_entry);
+			list_del_init(&edge->stack_entry);
+
+			next_vertex = vertex;
+			vertex = edge->predecessor->vertex;
+
+			vertex->scc_index = min(vertex->scc_index,
+						next_vertex->scc_index);
+		} else if (next_vertex->on_stack) {
+			vertex->scc_index = min(vertex->scc_index,
+						next_vertex->index);
 		}
-#endif
 	}
 
-	/* not_cycle_list contains those sockets which do not make up a
-	 * cycle.  Restore these to the inflight list.
-	 */
-	while (!list_empty(&not_cycle_list)) {
-		u = list_entry(not_cycle_list.next, struct unix_sock, link);
-		__clear_bit(UNIX_GC_CANDIDATE, &u->gc_flags);
-		list_move_tail(&u->link, &gc_inflight_list);
+	if (vertex->index == vertex->scc_index)
+		unix_group_scc(vertex, &vertex_stack, cyclic, hitlist);
+
+	if (!list_empty(&edge_stack))
+		goto prev_vertex;
+}
+
+/* Check the cyclic SCCs this run did not have to walk again. */
+static void unix_walk_scc_fast(struct list_head *cyclic,
+			       struct sk_buff_head *hitlist)
+{
+	while (!list_empty(&unix_cyclic_vertices)) {
+		struct unix_vertex *vertex, *v;
+		LIST_HEAD(scc);
+
+		vertex = list_first_entry(&unix_cyclic_vertices,
+					  typeof(*vertex), entry);
+		list_add(&scc, &vertex->scc_entry);
+
+		list_for_each_entry(v, &scc, scc_entry)
+			list_move_tail(&v->entry, cyclic);
+
+		if (unix_scc_dead(&scc))
+			unix_collect_skb(&scc, hitlist);
+
+		list_del(&scc);
 	}
+}
 
-	spin_unlock(&unix_gc_lock);
+/* Indices only grow, start over before they could wrap around. */
+static void unix_reset_index(void)
+{
+	struct unix_vertex *vertex;
 
-	/* Here we are. Hitlist is filled. Die. */
-	__skb_queue_purge(&hitlist);
+	list_splice_init(&unix_cyclic_vertices, &unix_dirty_vertices);
+	list_splice_init(&unix_acyclic_vertices, &unix_dirty_vertices);
+
+	list_for_each_entry(vertex, &unix_dirty_vertices, entry) {
+		vertex->index = 0;
+		vertex->scc_index = 0;
+	}
+
+	unix_vertex_next_index = 1;
+}
+
+static void unix_walk_scc(struct sk_buff_head *hitlist)
+{
+	struct unix_vertex *vertex;
+	LIST_HEAD(cyclic);
+	struct sk_buff *skb;
+
+	if (unlikely(unix_vertex_next_index > ULONG_MAX / 2))
+		unix_reset_index();
+
+	unix_walk_start = unix_vertex_next_index;
+
+	while (!list_empty(&unix_dirty_vertices)) {
+		vertex = list_first_entry(&unix_dirty_vertices,
+					  typeof(*vertex), entry);
+		__unix_walk_scc(vertex, &cyclic, hitlist);
+	}
+
+	unix_walk_scc_fast(&cyclic, hitlist);
+	list_splice(&cyclic, &unix_cyclic_vertices);
+
+	/* Receivers of collected skbs may be freed before the skbs are. */
+	skb_queue_walk(hitlist, skb) {
+		struct unix_edge *edges = UNIXCB(skb).edges;
+		int i;
+
+		for (i = 0; edges && i < UNIXCB(skb).fp->count_unix; i++)
+			edges[i].successor = NULL;
+	}
+
+	WRITE_ONCE(unix_graph_maybe_cyclic,
+		   !list_empty(&unix_cyclic_vertices));
+}
+
+static bool gc_in_progress;
+
+static void __unix_gc(struct work_struct *work)
+{
+	struct sk_buff_head hitlist;
 
 	spin_lock(&unix_gc_lock);
 
-	/* All candidates should have been detached by now. */
-	WARN_ON_ONCE(!list_empty(&gc_candidates));
+	if (!unix_graph_maybe_cyclic) {
+		spin_unlock(&unix_gc_lock);
+		goto skip_gc;
+	}
 
-	/* Paired with READ_ONCE() in wait_for_unix_gc(). */
-	WRITE_ONCE(gc_in_progress, false);
+	__skb_queue_head_init(&hitlist);
+	unix_walk_scc(&hitlist);
 
 	spin_unlock(&unix_gc_lock);
+
+	/* Here we are. Hitlist is filled. Die. */
+	__skb_queue_purge(&hitlist);
+
+skip_gc:
+	/* Paired with READ_ONCE() in wait_for_unix_gc(). */
+	WRITE_ONCE(gc_in_progress, false);
 }
 
 static DECLARE_WORK(unix_gc_work, __unix_gc);
 
 void unix_gc(void)
 {
+	/* Without a cycle, every in-flight socket is still reachable. */
+	if (!READ_ONCE(unix_graph_maybe_cyclic))
+		return;
+
 	WRITE_ONCE(gc_in_progress, true);
 	queue_work(system_unbound_wq, &unix_gc_work);
 }
@@ -0,0 +1,102 @@
+#!/bin/bash
+# SPDX-License-Identifier: GPL-2.0
+#
+# Check that with sch_htb's htb_mq mode, a class whose traffic all goes
+# through a single tx queue of a multiqueue device still gets its whole
+# rate: the shards of idle tx queues must not keep a part of it.
+
+ksft_skip=4
+
+RATE_MBIT=100
+DURATION=4
+MIN_PERCENT=95
+
+NS="htb-mq-$(mktemp -u XXXXXX)"
+PG=/proc/net/pktgen
+
+cleanup()
+{
+	[ -w "$PG/pgctrl" ] && echo reset > "$PG/pgctrl"
+	ip netns del "$NS" 2>/dev/null
+	ip link del htbmq0 2>/dev/null
+}
+
+skip()
+{
+	echo "SKIP: $1"
+	exit $ksft_skip
+}
+
+[ "$(id -u)" -eq 0 ] || skip "need root"
+for tool in ip tc; do
+	command -v $tool >/dev/null || skip "$tool not found"
+done
+
+modprobe pktgen 2>/dev/null
+[ -d "$PG" ] || skip "pktgen not available"
+
+if [ -e /sys/module/sch_htb/parameters/htb_mq ]; then
+	old_htb_mq=$(cat /sys/module/sch_htb/parameters/htb_mq)
+else
+	modprobe sch_htb 2>/dev/null
+	[ -e /sys/module/sch_htb/parameters/htb_mq ] ||
+		skip "sch_htb has no htb_mq parameter"
+	old_htb_mq=0
+fi
+
+trap 'cleanup; echo $old_htb_mq > /sys/module/sch_htb/parameters/htb_mq' EXIT
+echo 1 > /sys/module/sch_htb/parameters/htb_mq
+
+ip netns add "$NS"
+ip link add htbmq0 numtxqueues 4 numrxqueues 4 type veth \
+	peer name htbmq1 numtxqueues 4 numrxqueues 4 netns "$NS"
+ip addr add 192.0.2.1/24 dev htbmq0
+ip link set htbmq0 up
+ip -n "$NS" addr add 192.0.2.2/24 dev htbmq1
+ip -n "$NS" link set htbmq1 up
+
+tc qdisc add dev htbmq0 root handle 1: htb default 10 ||
+	skip "cannot add htb root"
+tc class add dev htbmq0 parent 1: classid 1:10 htb \
+	rate ${RATE_MBIT}mbit ceil ${RATE_MBIT}mbit
+
+# A single flow, so that all packets hash to the same tx queue.
+echo "rem_device_all" > "$PG/kpktgend_0"
+echo "add_device htbmq0" > "$PG/kpktgend_0"
+{
+	echo "count 0"
+	echo "pkt_size 1000"
+	echo "delay 0"
+	echo "xmit_mode queue_xmit"
+	echo "dst 192.0.2.2"
+	echo "dst_mac $(ip -n "$NS" -br link show htbmq1 | awk '{ print $3 }')"
+	echo "udp_src_min 9"
+	echo "udp_src_max 9"
+	echo "udp_dst_min 9"
+	echo "udp_dst_max 9"
+} | while read -r cmd; do
+	echo "$cmd" > "$PG/htbmq0"
+done
+
+echo start > "$PG/pgctrl" &
+pgpid=$!
+
+# Skip the ramp up, shares start out split evenly between the tx queues.
+sleep 1
+rx_start=$(ip netns exec "$NS" cat /sys/class/net/htbmq1/statistics/rx_bytes)
+sleep $DURATION
+rx_end=$(ip netns exec "$NS" cat /sys/class/net/htbmq1/statistics/rx_bytes)
+
+echo stop > "$PG/pgctrl"
+wait $pgpid 2>/dev/null
+
+rate=$(( (rx_end - rx_start) * 8 / DURATION ))
+min=$(( RATE_MBIT * 1000000 * MIN_PERCENT / 100 ))
+
+if [ "$rate" -lt "$min" ]; then
+	echo "FAIL: single tx queue got $rate bit/s, expected at least $min"
+	exit 1
+fi
+
+echo "PASS: single tx queue got $rate bit/s of ${RATE_MBIT}mbit"
+exit 0